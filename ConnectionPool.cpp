@@ -0,0 +1,246 @@
+#include "ConnectionPool.h"
+
+ConnectionPool::ConnectionPool(SocketManager &manager, const Options &o) : client(manager), options(o), critSec{}, nextPick(0), timer(nullptr),
+                                                                          routed(0), refused(0), ejections(0), connects(0) {
+    InitializeCriticalSection(&critSec);
+    if (options.connectionsPerBackend < 1)
+        options.connectionsPerBackend = 1;
+    if (options.maintenancePeriod == 0)
+        options.maintenancePeriod = 1;
+    if (!CreateTimerQueueTimer(&timer,                      //phNewTimer : A pointer to a buffer that receives a handle to the timer-queue timer on return.
+                               nullptr,                     //TimerQueue : A handle to the timer queue. If this parameter is NULL, the timer is associated with the default timer queue.
+                               MaintainCallback,            //Callback : A pointer to the application-defined function of type WAITORTIMERCALLBACK to be executed when the timer expires.
+                               this,                        //Parameter : A single parameter value that will be passed to the callback function.
+                               options.maintenancePeriod,   //DueTime : The amount of time in milliseconds relative to the current time that must elapse before the timer is signaled for the first time.
+                               options.maintenancePeriod,   //Period : The period of the timer, in milliseconds. If this parameter is not zero, the timer is periodic.
+                               WT_EXECUTEDEFAULT)) {        //Flags : By default, the callback function is queued to a non-I/O worker thread.
+        LOG_ERROR("CreateTimerQueueTimer failed / error %lu\n", GetLastError());   //connections are then only checked when picked, and never replaced
+        timer = nullptr;
+    }
+}
+
+ConnectionPool::~ConnectionPool() {
+    if (timer != nullptr)
+        DeleteTimerQueueTimer(nullptr, timer, INVALID_HANDLE_VALUE);    //waits for a Maintain in progress
+    DeleteCriticalSection(&critSec);
+}
+
+size_t ConnectionPool::AddBackend(const char *address, u_short port) {
+    size_t index;
+
+    EnterCriticalSection(&critSec);
+    {
+        index = backends.size();
+        backends.push_back(Backend{address, port, options.minRetryDelay, GetTickCount(), 0, 0, 0});
+        for (int i = 0 ; i < options.connectionsPerBackend ; i++)
+            slots.push_back(Slot{Misc::CreateNilUUID(), index, SlotState::WAITING, 0});
+    }
+    LeaveCriticalSection(&critSec);
+    Maintain();                                             //warm connections started now rather than one period later
+    return index;
+}
+
+VOID CALLBACK ConnectionPool::MaintainCallback(PVOID lpParam, BOOLEAN timerFired) {
+    static_cast<ConnectionPool*>(lpParam)->Maintain();
+}
+
+void ConnectionPool::Maintain() {
+    std::vector<std::pair<size_t, Backend*>> due;           //slot and its backend, connected outside of the lock
+    DWORD now = GetTickCount();
+    RPC_STATUS status;
+
+    EnterCriticalSection(&critSec);
+    {
+        for (size_t i = 0 ; i < slots.size() ; i++) {
+            Slot &slot = slots[i];
+            Backend &backend = backends[slot.backend];
+            switch (slot.state) {
+                case SlotState::CONNECTING :{
+                    if (UuidIsNil(&slot.id, &status))               //ConnectToNewSocket still running in another Maintain
+                        break;
+                    if (client.isClientSocketReady(slot.id)) {
+                        slot.state = SlotState::READY;
+                        backend.retryDelay = options.minRetryDelay;
+                    } else if (!client.isSocketInitialising(slot.id))
+                        Eject(slot, true);
+                    break;
+                }
+                case SlotState::READY :{                            //closed by the backend or failed, also found by Pick when it samples loads
+                    if (!client.isClientSocketReady(slot.id))
+                        Eject(slot, false);
+                    break;
+                }
+                case SlotState::WAITING :{
+                    if (static_cast<LONG>(now - backend.nextAttempt) < 0)
+                        break;
+                    slot.state = SlotState::CONNECTING;
+                    due.emplace_back(i, &backend);
+                    connects++;
+                    break;
+                }
+            }
+        }
+    }
+    LeaveCriticalSection(&critSec);
+    for (auto &entry : due) {
+        UUID id = client.ConnectToNewSocket(entry.second->address.c_str(), entry.second->port);     //resolves host names on the thread pool, never blocks on the connect itself
+        EnterCriticalSection(&critSec);
+        {
+            Slot &slot = slots[entry.first];                        //slots may have moved if a backend was added meanwhile
+            if (UuidIsNil(&id, &status))
+                Eject(slot, true);
+            else {
+                slot.id = id;
+                slotOf[id] = entry.first;
+            }
+        }
+        LeaveCriticalSection(&critSec);
+    }
+}
+
+void ConnectionPool::Eject(Slot &slot, bool connectFailed) {
+    Backend &backend = backends[slot.backend];
+
+    slotOf.erase(slot.id);
+    slot.id = Misc::CreateNilUUID();
+    slot.state = SlotState::WAITING;
+    slot.outstanding = 0;                                   //requests sent on it won't be completed
+    if (connectFailed) {                                    //backend down or refusing : back off before the next connect to it
+        backend.connectFailures++;
+        backend.nextAttempt = GetTickCount() + backend.retryDelay;
+        backend.retryDelay = backend.retryDelay * 2 < options.maxRetryDelay ? backend.retryDelay * 2 : options.maxRetryDelay;
+    } else {
+        backend.ejections++;
+        ejections++;
+    }
+}
+
+UUID ConnectionPool::Pick() {
+    UUID    id          = Misc::CreateNilUUID();
+    size_t  best;
+    LONG64  bestLoad    = 0;
+
+    EnterCriticalSection(&critSec);
+    {
+        best = slots.size();                                //none
+        // ----------------------------- ready connections under their request limit, loads of all of them sampled at once
+        readyIds.clear();
+        readySlots.clear();
+        for (size_t i = 0 ; i < slots.size() ; i++) {
+            if (slots[i].state == SlotState::READY && (options.maxOutstanding == 0 || slots[i].outstanding < options.maxOutstanding)) {
+                readyIds.push_back(slots[i].id);
+                readySlots.push_back(i);
+            }
+        }
+        size_t count = readySlots.size();
+        if (count > 0 && options.balancing == Balancing::LEAST_LOADED) {
+            loads.resize(count);
+            client.GetPendingBytes(readyIds.data(), count, loads.data());      //only takes the socket map lock
+        }
+        // ----------------------------- least loaded, scanned from a rotating start so ties are spread
+        for (size_t k = 0 ; k < count ; k++) {
+            size_t j = (nextPick + k) % count;
+            Slot &slot = slots[readySlots[j]];
+            if (options.balancing == Balancing::ROUND_ROBIN) {
+                best = readySlots[j];
+                break;
+            }
+            if (loads[j] < 0) {                             //failed or closed since the last Maintain
+                Eject(slot, false);
+                continue;
+            }
+            LONG64 load = slot.outstanding * options.requestWeight + loads[j];
+            if (best == slots.size() || load < bestLoad) {
+                best = readySlots[j];
+                bestLoad = load;
+            }
+        }
+        nextPick++;
+        if (best < slots.size()) {
+            Slot &slot = slots[best];
+            slot.outstanding++;
+            backends[slot.backend].routed++;
+            routed++;
+            id = slot.id;
+        } else
+            refused++;
+    }
+    LeaveCriticalSection(&critSec);
+    return id;
+}
+
+void ConnectionPool::Release(UUID socketId, bool sendRefused) {
+    EnterCriticalSection(&critSec);
+    {
+        auto it = slotOf.find(socketId);
+        if (it != slotOf.end()) {
+            Slot &slot = slots[it->second];
+            if (slot.outstanding > 0)
+                slot.outstanding--;
+            if (sendRefused)
+                backends[slot.backend].routed--;
+        }
+        if (sendRefused) {
+            routed--;
+            refused++;
+        }
+    }
+    LeaveCriticalSection(&critSec);
+}
+
+UUID ConnectionPool::Send(const char *data, u_long length, SocketManager::SendClass sendClass) {
+    WSABUF piece;
+
+    piece.buf = const_cast<char*>(data);
+    piece.len = length;
+    return Send(&piece, 1, sendClass);
+}
+
+UUID ConnectionPool::Send(const WSABUF *pieces, DWORD count, SocketManager::SendClass sendClass) {
+    RPC_STATUS status;
+    UUID id = Pick();
+
+    if (UuidIsNil(&id, &status))
+        return id;
+    if (!client.SendData(pieces, count, id, sendClass)) {   //backpressure, or closed since it was picked : outside of the pool lock, the send takes the socket one
+        Release(id, true);
+        return Misc::CreateNilUUID();
+    }
+    return id;
+}
+
+ConnectionPool::BackendStats ConnectionPool::GetBackendStats(size_t backend) {
+    BackendStats stats{};
+
+    EnterCriticalSection(&critSec);
+    {
+        if (backend < backends.size()) {
+            for (Slot &slot : slots) {
+                if (slot.backend != backend)
+                    continue;
+                if (slot.state == SlotState::READY)
+                    stats.healthy++;
+                stats.outstanding += slot.outstanding;
+            }
+            stats.routed = backends[backend].routed;
+            stats.ejections = backends[backend].ejections;
+            stats.connectFailures = backends[backend].connectFailures;
+        }
+    }
+    LeaveCriticalSection(&critSec);
+    return stats;
+}
+
+ConnectionPool::PoolStats ConnectionPool::GetPoolStats() {
+    PoolStats stats;
+
+    EnterCriticalSection(&critSec);
+    {
+        stats.routed = routed;
+        stats.refused = refused;
+        stats.ejections = ejections;
+        stats.connects = connects;
+    }
+    LeaveCriticalSection(&critSec);
+    return stats;
+}
@@ -0,0 +1,105 @@
+#ifndef SOCKETMANAGER_CONNECTIONPOOL_H
+#define SOCKETMANAGER_CONNECTIONPOOL_H
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SocketManager.h"
+
+/************* ConnectionPool ***********/
+class ConnectionPool {                      // Client side : warm connections of a client manager to a set of backends, each send routed to the least loaded healthy one
+public:
+    enum Balancing {
+        LEAST_LOADED,                                           // Lowest outstanding requests * requestWeight + pending send bytes (default)
+        ROUND_ROBIN                                             // Next healthy connection, whatever its load (to compare against)
+    };
+
+    struct Options {
+        int             connectionsPerBackend;                  // Warm connections kept to each backend
+        Balancing       balancing;
+        LONG64          requestWeight;                          // Bytes of pending send an outstanding request weighs when comparing loads
+        LONG            maxOutstanding;                         // Requests in flight above which a connection isn't picked, 0 for no limit
+        DWORD           maintenancePeriod;                      // ms between two health checks, ejected connections are replaced then
+        DWORD           minRetryDelay;                          // ms before reconnecting to a backend after a failed connect, doubled on each failure in a row
+        DWORD           maxRetryDelay;
+
+        Options() : connectionsPerBackend(4), balancing(LEAST_LOADED), requestWeight(4096), maxOutstanding(0), maintenancePeriod(100), minRetryDelay(100), maxRetryDelay(10000) {}
+    };
+
+    struct BackendStats {                                       // One backend, since it was added
+        int             healthy;                                // Connections ready to be picked now
+        LONG            outstanding;                            // Requests in flight now
+        LONG64          routed;                                 // Sends routed to it
+        LONG64          ejections;                              // Connections found failed or closed and taken out
+        LONG64          connectFailures;                        // Connects which never got ready
+    };
+
+    struct PoolStats {                                          // All backends, since the start
+        LONG64          routed;                                 // Sends taken by a connection
+        LONG64          refused;                                // Sends with no healthy connection to take them, or refused by the one picked
+        LONG64          ejections;
+        LONG64          connects;                               // Connects started, the first ones of each backend included
+    };
+
+private:
+    enum SlotState {
+        WAITING,                                                // No connection, one is started once the retry delay of its backend is over
+        CONNECTING,                                             // Connect started, nil id while ConnectToNewSocket runs
+        READY                                                   // Can be picked
+    };
+
+    struct Backend {
+        std::string     address;                                // Numeric address or host name, resolved by the client manager on each connect, sockets keep a pointer to it
+        u_short         port;
+        DWORD           retryDelay;                             // ms, back to minRetryDelay once a connection gets ready
+        DWORD           nextAttempt;                            // Tick count before which no connect is started
+        LONG64          routed;
+        LONG64          ejections;
+        LONG64          connectFailures;
+    };
+
+    struct Slot {                                               // One warm connection of a backend, kept across reconnects
+        UUID            id;
+        size_t          backend;
+        SlotState       state;
+        LONG            outstanding;                            // Requests sent on it and not completed, 0 again when it is ejected
+    };
+
+    SocketManager &                     client;
+    Options                             options;
+    CRITICAL_SECTION                    critSec;                // Guards backends, slots and slotOf, never held while calling into the manager a socket lock could be taken in
+    std::deque<Backend>                 backends;               // Never moved once added, their addresses are given to ConnectToNewSocket
+    std::vector<Slot>                   slots;
+    std::unordered_map<UUID, size_t>    slotOf;                 // Slot of each connection, so Complete finds it
+    std::vector<UUID>                   readyIds;               // Pick : ids of the ready slots, loads sampled for all of them at once
+    std::vector<size_t>                 readySlots;
+    std::vector<LONG64>                 loads;
+    size_t                              nextPick;               // Round robin start, so equal loads are spread
+    HANDLE                              timer;                  // Runs Maintain every maintenancePeriod
+    LONG64                              routed;                 // Stats, see PoolStats
+    LONG64                              refused;
+    LONG64                              ejections;
+    LONG64                              connects;
+
+    static VOID CALLBACK MaintainCallback   (PVOID lpParam, BOOLEAN timerFired);
+    void                Maintain            ();                                                 // Promote connects which got ready, eject failed connections and start the connects due
+    void                Eject               (Slot &slot, bool connectFailed);                   // Lock held : take the connection out, its backend backs off if it never got ready
+    UUID                Pick                ();                                                 // Reserve a request on the best ready connection, nil if none
+    void                Release             (UUID socketId, bool sendRefused);                  // Give back the request reserved by Pick, on completion or because its send was refused
+public:
+    explicit            ConnectionPool      (SocketManager &manager, const Options &o = Options());     // manager must be a CLIENT one and outlive the pool
+                        ~ConnectionPool     ();                                                 // Connections are left to the manager, none of them may still be connecting (their address is the pool's)
+
+    size_t              AddBackend          (const char *address, u_short port);                // Start its warm connections, returns its index for GetBackendStats
+    // Send a request to the least loaded healthy connection, returns the id of the connection that took it (nil if none could).
+    // The request counts as outstanding on it until Complete is called with that id, from ReceiveData or ReceiveMessage of the client.
+    UUID                Send                (const char *data, u_long length, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK);
+    UUID                Send                (const WSABUF *pieces, DWORD count, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK);
+    inline void         Complete            (UUID socketId)                                     { Release(socketId, false); }     // Response received, ignored for a connection ejected since
+    BackendStats        GetBackendStats     (size_t backend);
+    PoolStats           GetPoolStats        ();
+};
+////////////// ConnectionPool ////////////
+
+#endif //SOCKETMANAGER_CONNECTIONPOOL_H
@@ -0,0 +1,135 @@
+#include <cstring>
+#include "DelimiterScanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DELIMITER_SCANNER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // Candidates are positions where both the first and the last delimiter bytes match, the middle is then checked with memcmp.
+    // nextAllowed prevents overlapping matches ("aa" in "aaa" is found once).
+    inline void CheckCandidate(const char *data, size_t pos, const char *delimiter, size_t delimiterLength,
+                               size_t &nextAllowed, std::vector<u_long> &positions) {
+        if (pos >= nextAllowed && (delimiterLength <= 2 || memcmp(data + pos + 1, delimiter + 1, delimiterLength - 2) == 0)) {
+            positions.push_back(static_cast<u_long>(pos));
+            nextAllowed = pos + delimiterLength;
+        }
+    }
+
+    void ScanTail(const char *data, size_t from, size_t limit, const char *delimiter, size_t delimiterLength,
+                  size_t &nextAllowed, std::vector<u_long> &positions) {
+        const char first = delimiter[0], last = delimiter[delimiterLength - 1];
+        for (size_t pos = from ; pos < limit ; pos++) {
+            if (data[pos] == first && data[pos + delimiterLength - 1] == last)
+                CheckCandidate(data, pos, delimiter, delimiterLength, nextAllowed, positions);
+        }
+    }
+
+    void FindAllScalar(const char *data, size_t length, const char *delimiter, size_t delimiterLength, std::vector<u_long> &positions) {
+        if (delimiterLength == 0 || length < delimiterLength)
+            return;
+        size_t      limit       = length - delimiterLength + 1;        // candidates start in [0, limit)
+        size_t      pos         = 0;
+        size_t      nextAllowed = 0;
+        while (pos < limit) {
+            auto found = static_cast<const char*>(memchr(data + pos, delimiter[0], limit - pos));
+            if (found == nullptr)
+                break;
+            pos = static_cast<size_t>(found - data);
+            if (data[pos + delimiterLength - 1] == delimiter[delimiterLength - 1])
+                CheckCandidate(data, pos, delimiter, delimiterLength, nextAllowed, positions);
+            pos = pos + 1 > nextAllowed ? pos + 1 : nextAllowed;
+        }
+    }
+
+#ifdef DELIMITER_SCANNER_X86
+    __attribute__((target("sse2")))
+    void FindAllSse2(const char *data, size_t length, const char *delimiter, size_t delimiterLength, std::vector<u_long> &positions) {
+        if (delimiterLength == 0 || length < delimiterLength)
+            return;
+        const __m128i   first       = _mm_set1_epi8(delimiter[0]);
+        const __m128i   last        = _mm_set1_epi8(delimiter[delimiterLength - 1]);
+        size_t          limit       = length - delimiterLength + 1;
+        size_t          nextAllowed = 0;
+        size_t          i           = 0;
+        for (; i + 16 <= limit ; i += 16) {
+            __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i blockLast  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + delimiterLength - 1));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last))));
+            while (mask) {
+                CheckCandidate(data, i + __builtin_ctz(mask), delimiter, delimiterLength, nextAllowed, positions);
+                mask &= mask - 1;
+            }
+        }
+        ScanTail(data, i, limit, delimiter, delimiterLength, nextAllowed, positions);
+    }
+
+    __attribute__((target("avx2")))
+    void FindAllAvx2(const char *data, size_t length, const char *delimiter, size_t delimiterLength, std::vector<u_long> &positions) {
+        if (delimiterLength == 0 || length < delimiterLength)
+            return;
+        const __m256i   first       = _mm256_set1_epi8(delimiter[0]);
+        const __m256i   last        = _mm256_set1_epi8(delimiter[delimiterLength - 1]);
+        size_t          limit       = length - delimiterLength + 1;
+        size_t          nextAllowed = 0;
+        size_t          i           = 0;
+        for (; i + 32 <= limit ; i += 32) {
+            __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i blockLast  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + delimiterLength - 1));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last))));
+            while (mask) {
+                CheckCandidate(data, i + __builtin_ctz(mask), delimiter, delimiterLength, nextAllowed, positions);
+                mask &= mask - 1;
+            }
+        }
+        ScanTail(data, i, limit, delimiter, delimiterLength, nextAllowed, positions);
+    }
+#endif //DELIMITER_SCANNER_X86
+
+}
+
+DelimiterScanner::Level         DelimiterScanner::level     = DelimiterScanner::DetectLevel();
+DelimiterScanner::ScanFunction  DelimiterScanner::scan      = DelimiterScanner::FunctionOf(DelimiterScanner::level);
+
+DelimiterScanner::Level DelimiterScanner::DetectLevel() {
+#ifdef DELIMITER_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))             // also checks the OS saves ymm registers
+        return AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SSE2;
+#endif
+    return SCALAR;
+}
+
+DelimiterScanner::ScanFunction DelimiterScanner::FunctionOf(Level l) {
+    switch (l) {
+#ifdef DELIMITER_SCANNER_X86
+        case AVX2 : return FindAllAvx2;
+        case SSE2 : return FindAllSse2;
+#endif
+        default :   return FindAllScalar;
+    }
+}
+
+bool DelimiterScanner::IsSupported(Level l) {
+    return l <= DetectLevel();
+}
+
+bool DelimiterScanner::SetLevel(Level l) {
+    if (!IsSupported(l))
+        return false;
+    level = l;
+    scan = FunctionOf(l);
+    return true;
+}
+
+const char *DelimiterScanner::LevelName(Level l) {
+    switch (l) {
+        case AVX2 : return "avx2";
+        case SSE2 : return "sse2";
+        default :   return "scalar";
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef SOCKETMANAGER_DELIMITERSCANNER_H
+#define SOCKETMANAGER_DELIMITERSCANNER_H
+
+#include <cstddef>
+#include <vector>
+#include "socket_headers.h"
+
+/************* DelimiterScanner ***********/
+class DelimiterScanner {                    // Vectorized search of every occurrence of a delimiter (one or more bytes) in a buffer
+public:
+    enum Level {                            // Instruction set used, the best one supported by the cpu is selected at startup
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    typedef void (*ScanFunction)(const char *data, size_t length, const char *delimiter, size_t delimiterLength, std::vector<u_long> &positions);
+
+private:
+    static ScanFunction     scan;           // Implementation selected for the current level
+    static Level            level;
+
+    static Level            DetectLevel     ();
+    static ScanFunction     FunctionOf      (Level l);
+
+public:
+    // Append to positions the offset of each non overlapping occurrence of delimiter in data, in one pass over data
+    static inline void      FindAll         (const char *data, size_t length, const char *delimiter, size_t delimiterLength, std::vector<u_long> &positions)
+                                                                                    { scan(data, length, delimiter, delimiterLength, positions); }
+    static inline Level     GetLevel        ()                                      { return level; }
+    static const char *     LevelName       (Level l);
+    static bool             IsSupported     (Level l);
+    static bool             SetLevel        (Level l);                              // Force an implementation (benchmarks), false if not supported by the cpu
+};
+////////////// DelimiterScanner ////////////
+
+#endif //SOCKETMANAGER_DELIMITERSCANNER_H
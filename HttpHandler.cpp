@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstring>
+#include "HttpHandler.h"
+
+namespace {
+
+    const char      OK_STATUS_LINE[]        = "HTTP/1.1 200 OK\r\n";
+    const char      SEPARATOR[]             = ": ";
+    const char      CRLF[]                  = "\r\n";
+    const char      CLOSE_END_OF_HEAD[]     = "Connection: close\r\n\r\n";
+
+}
+
+HttpResponse::HttpResponse() : count(1), close(false) {
+    pieces[0].buf = const_cast<char*>(OK_STATUS_LINE);
+    pieces[0].len = sizeof(OK_STATUS_LINE) - 1;
+}
+
+const char *HttpResponse::ReasonOf(u_short code) {
+    switch (code) {
+        case 200 : return "OK";
+        case 201 : return "Created";
+        case 204 : return "No Content";
+        case 301 : return "Moved Permanently";
+        case 302 : return "Found";
+        case 304 : return "Not Modified";
+        case 400 : return "Bad Request";
+        case 403 : return "Forbidden";
+        case 404 : return "Not Found";
+        case 405 : return "Method Not Allowed";
+        case 413 : return "Content Too Large";
+        case 426 : return "Upgrade Required";
+        case 431 : return "Request Header Fields Too Large";
+        case 500 : return "Internal Server Error";
+        case 501 : return "Not Implemented";
+        case 503 : return "Service Unavailable";
+        case 505 : return "HTTP Version Not Supported";
+        default :  return "";
+    }
+}
+
+void HttpResponse::Status(u_short code, const char *reason) {
+    int length;
+
+    if (code == 200 && reason == nullptr) {
+        pieces[0].buf = const_cast<char*>(OK_STATUS_LINE);
+        pieces[0].len = sizeof(OK_STATUS_LINE) - 1;
+        return;
+    }
+    length = snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %03u %s\r\n", code, reason != nullptr ? reason : ReasonOf(code));
+    if (length < 0 || length >= static_cast<int>(sizeof(statusLine)))       // reason cut, the line must still end
+        length = snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %03u \r\n", code);
+    pieces[0].buf = statusLine;
+    pieces[0].len = static_cast<u_long>(length);
+}
+
+bool HttpResponse::Header(std::string_view name, std::string_view value) {
+    if (count + 4 > 1 + 4 * MAX_HEADERS)
+        return false;
+    Piece(name.data(), name.size());
+    Piece(SEPARATOR, sizeof(SEPARATOR) - 1);
+    Piece(value.data(), value.size());
+    Piece(CRLF, sizeof(CRLF) - 1);
+    return true;
+}
+
+DWORD HttpResponse::Assemble(bool keepAlive, bool withBody) {
+    char    digits[16];
+    int     size        = 0;
+    auto    value       = static_cast<u_long>(body.size());
+
+    do {                                                        // no printf on the path of every response
+        digits[size++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    memcpy(contentLength, "Content-Length: ", 16);
+    for (int i = 0 ; i < size ; i++)
+        contentLength[16 + i] = digits[size - 1 - i];
+    memcpy(contentLength + 16 + size, CRLF, 2);
+    Piece(contentLength, 16 + size + 2);
+    if (keepAlive)
+        Piece(CRLF, sizeof(CRLF) - 1);
+    else
+        Piece(CLOSE_END_OF_HEAD, sizeof(CLOSE_END_OF_HEAD) - 1);
+    if (withBody && !body.empty())
+        Piece(body.data(), body.size());
+    return count;
+}
+
+int HttpHandler::ReceiveData(SocketManager &manager, const char *data, u_long length, Socket *socket) {
+    auto   *connection  = static_cast<Connection*>(socket->GetContext());
+    bool    open;
+
+    if (connection == nullptr) {                                // first read of the connection
+        connection = new Connection(limits);
+        socket->SetContext(connection);
+    }
+    EnterCriticalSection(&connection->lock);
+    {
+        if (!connection->blocked.empty()) {                     // read before the reads were held back, parsed after the blocked response
+            open = connection->held.size() + length <= limits.maxHeaderSize + limits.maxBodySize;     // not buffered without end for a client that never reads
+            if (open)
+                connection->held.insert(connection->held.end(), data, data + length);
+        }
+        else
+            open = Parse(manager, *connection, data, length, socket) && (connection->blocked.empty() || Unblock(manager, *connection, socket));
+    }
+    LeaveCriticalSection(&connection->lock);
+    if (!open)
+        CloseSocket(manager, socket);
+    return 1;
+}
+
+void HttpHandler::SendsDrained(SocketManager &manager, Socket *socket) {
+    auto   *connection  = static_cast<Connection*>(socket->GetContext());
+    bool    open;
+
+    if (connection == nullptr)
+        return;
+    EnterCriticalSection(&connection->lock);
+    {
+        open = Unblock(manager, *connection, socket);
+    }
+    LeaveCriticalSection(&connection->lock);
+    if (!open)
+        CloseSocket(manager, socket);
+}
+
+bool HttpHandler::Parse(SocketManager &manager, Connection &connection, const char *data, u_long length, Socket *socket) {
+    bool open = true;
+
+    bool valid = connection.parser.Feed(data, length, [&](const HttpRequest &request) {
+        HttpResponse response;
+        HandleRequest(manager, request, response, socket);
+        open = request.keepAlive && !response.close;
+        if (!Respond(manager, response, open, request.method != "HEAD", socket)) {
+            for (DWORD i = 0 ; i < response.count ; i++)        // over the max pending send : the client pipelines more than it reads, the rest waits
+                connection.blocked.append(response.pieces[i].buf, response.pieces[i].len);
+            connection.closeAfter = !open;
+            open = true;
+            return false;
+        }
+        return open;
+    });
+    if (!connection.blocked.empty()) {                          // the requests behind the blocked response are parsed once it is sent
+        connection.held.assign(data, data + length);
+        return true;
+    }
+    if (!valid) {                                               // what follows a refused request can't be parsed, answer it and close
+        HttpResponse response;
+        response.Status(connection.parser.GetError());
+        Respond(manager, response, false, true, socket);
+        open = false;
+    }
+    return open;
+}
+
+bool HttpHandler::Unblock(SocketManager &manager, Connection &connection, Socket *socket) {
+    std::vector<char> held;
+
+    while (!connection.blocked.empty()) {
+        if (PauseReads(manager, socket))                        // sends still pending, the last one to complete calls SendsDrained
+            return true;
+        if (!SendData(manager, connection.blocked.data(), static_cast<u_long>(connection.blocked.size()), socket))
+            return false;                                       // refused with nothing pending : the socket failed, or the response is bigger than the max pending send
+        connection.blocked.clear();
+        if (connection.closeAfter)
+            return false;
+        held.clear();
+        held.swap(connection.held);
+        if (!Parse(manager, connection, held.data(), static_cast<u_long>(held.size()), socket))
+            return false;
+    }
+    return ResumeReads(manager, socket);
+}
+
+bool HttpHandler::Respond(SocketManager &manager, HttpResponse &response, bool keepAlive, bool withBody, Socket *socket) {
+    DWORD count = response.Assemble(keepAlive, withBody);
+
+    return SendData(manager, response.pieces, count, socket);  // copied once, straight into the pool buffers
+}
+
+void HttpHandler::ReleaseContext(SocketManager &manager, void *context, Socket *socket) {
+    delete static_cast<Connection*>(context);
+}
@@ -0,0 +1,67 @@
+#ifndef SOCKETMANAGER_HTTPHANDLER_H
+#define SOCKETMANAGER_HTTPHANDLER_H
+
+#include "SocketManager.h"
+#include "HttpParser.h"
+
+/************* HttpResponse ***********/
+class HttpResponse {                        // Status, headers and body of one response, sent as the pieces of a single gather write without being concatenated first
+    friend class HttpHandler;
+public:
+    static const DWORD          MAX_HEADERS                     = 32;
+private:
+    static const DWORD          MAX_PIECES                      = 1 + 4 * MAX_HEADERS + 3;      // Status line, name / ": " / value / CRLF per header, Content-Length, end of head and body
+
+    WSABUF                      pieces[MAX_PIECES];
+    DWORD                       count;                          // Pieces of the status line and headers given so far
+    char                        statusLine[64];                 // Status other than 200, formatted
+    char                        contentLength[32];              // "Content-Length: N\r\n"
+    std::string_view            body;
+    bool                        close;                          // Connection closed once the response is sent
+
+    void                Piece               (const char *data, size_t length)       { pieces[count].buf = const_cast<char*>(data); pieces[count].len = static_cast<u_long>(length); count++; }
+    DWORD               Assemble            (bool keepAlive, bool withBody);        // Add Content-Length, Connection and the end of the head, then the body, return the number of pieces
+public:
+                        HttpResponse        ();
+
+    void                Status              (u_short code, const char *reason = nullptr);                   // 200 OK if never called, reason of the standard codes when nullptr
+    bool                Header              (std::string_view name, std::string_view value);                // Not copied, must stay valid until the handler returns, false over MAX_HEADERS
+    inline void         Body                (std::string_view b)                    { body = b; }           // Not copied either, a view of the request works (echo)
+    inline void         Close               ()                                      { close = true; }       // Answer with "Connection: close" and close the connection
+    static const char * ReasonOf            (u_short code);
+};
+////////////// HttpResponse ////////////
+
+/************* HttpHandler ***********/
+class HttpHandler : public SocketHandler {  // Listener handler speaking HTTP/1.1 : keep-alive connections, pipelined requests answered in order
+public:
+    explicit            HttpHandler         (const HttpParser::Limits &l = HttpParser::Limits()) : limits(l) {}
+
+    int                 ReceiveData         (SocketManager &manager, const char *data, u_long length, Socket *socket) final;
+    void                SendsDrained        (SocketManager &manager, Socket *socket) final;                    // Send the response held back and parse the requests behind it
+    void                ReleaseContext      (SocketManager &manager, void *context, Socket *socket) final;     // Connection state
+protected:
+    // Fill the response of a request, called on a worker thread for each request of a connection in the order they came.
+    // The request, and the views it holds, are only valid until it returns, as is everything the response points to.
+    virtual void        HandleRequest       (SocketManager &manager, const HttpRequest &request, HttpResponse &response, Socket *socket) = 0;
+private:
+    struct Connection {                     // Context of a connection
+        CRITICAL_SECTION        lock;       // Records decrypted from one read, or ring doorbells, may be delivered while SendsDrained runs
+        HttpParser              parser;
+        std::string             blocked;    // Response refused over the max pending send, copied as the request it points to is gone, sent before anything else
+        bool                    closeAfter; // blocked is the last response of the connection
+        std::vector<char>       held;       // Read behind blocked, parsed once it is sent
+
+        explicit    Connection  (const HttpParser::Limits &l) : lock{}, parser(l), closeAfter(false) { InitializeCriticalSection(&lock); }
+                    ~Connection ()                                                                  { DeleteCriticalSection(&lock); }
+    };
+
+    HttpParser::Limits          limits;
+
+    bool                Parse               (SocketManager &manager, Connection &connection, const char *data, u_long length, Socket *socket);    // false to close, stops at a blocked response
+    bool                Unblock             (SocketManager &manager, Connection &connection, Socket *socket);  // Send blocked then parse held until reads can resume or are paused again, false to close
+    bool                Respond             (SocketManager &manager, HttpResponse &response, bool keepAlive, bool withBody, Socket *socket);
+};
+////////////// HttpHandler ////////////
+
+#endif //SOCKETMANAGER_HTTPHANDLER_H
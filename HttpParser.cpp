@@ -0,0 +1,148 @@
+#include <cstring>
+#include "HttpParser.h"
+
+namespace {
+
+    bool EqualsNoCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0 ; i < a.size() ; i++) {
+            if ((a[i] | 0x20) != (b[i] | 0x20))                 // ASCII letters only, the names compared are tokens
+                return false;
+        }
+        return true;
+    }
+
+    bool IsTokenChar(char c) {                                  // RFC 9110 5.6.2
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+    }
+
+    bool HasToken(std::string_view list, std::string_view token) {      // Comma separated list (Connection), case insensitive
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            std::string_view item = list.substr(0, comma);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                item.remove_prefix(1);
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+                item.remove_suffix(1);
+            if (EqualsNoCase(item, token))
+                return true;
+            if (comma == std::string_view::npos)
+                break;
+            list.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+
+}
+
+std::string_view HttpRequest::Header(std::string_view name) const {
+    for (u_long i = 0 ; i < headerCount ; i++) {
+        if (EqualsNoCase(headers[i].name, name))
+            return headers[i].value;
+    }
+    return std::string_view();
+}
+
+bool HttpRequest::HasToken(std::string_view name, std::string_view token) const {
+    for (u_long i = 0 ; i < headerCount ; i++) {
+        if (EqualsNoCase(headers[i].name, name) && ::HasToken(headers[i].value, token))      // the header may be repeated
+            return true;
+    }
+    return false;
+}
+
+bool HttpParser::ParseHead(const char *head, const u_long *ends, size_t count) {
+    const char *line    = head;
+    u_long      length  = ends[0];
+    bool        close   = false;
+    bool        keep    = false;
+
+    // ----------------------------- request line : method SP target SP HTTP/1.x
+    auto space = static_cast<const char*>(memchr(line, ' ', length));
+    if (space == nullptr || space == line)
+        return Fail(400);
+    request.method = std::string_view(line, space - line);
+    for (char c : request.method) {
+        if (!IsTokenChar(c))
+            return Fail(400);
+    }
+    const char *target = space + 1;
+    space = static_cast<const char*>(memchr(target, ' ', line + length - target));
+    if (space == nullptr || space == target)
+        return Fail(400);
+    request.target = std::string_view(target, space - target);
+    std::string_view version(space + 1, line + length - space - 1);
+    if (version.size() != 8 || version.compare(0, 5, "HTTP/") != 0 || version[6] != '.' || version[5] < '0' || version[5] > '9' || version[7] < '0' || version[7] > '9')
+        return Fail(400);
+    if (version[5] != '1')
+        return Fail(505);
+    request.minorVersion = version[7] - '0';
+
+    // ----------------------------- header fields, the last line end is the one of the empty line
+    request.headerCount = 0;
+    request.contentLength = 0;
+    for (size_t i = 1 ; i + 1 < count ; i++) {
+        line = head + ends[i - 1] + 2;
+        length = ends[i] - ends[i - 1] - 2;
+        if (!ParseHeader(line, length))
+            return false;
+        const HttpHeader &header = request.headers[request.headerCount - 1];
+        if (EqualsNoCase(header.name, "connection")) {
+            close = close || HasToken(header.value, "close");
+            keep = keep || HasToken(header.value, "keep-alive");
+        }
+    }
+    request.keepAlive = !close && (request.minorVersion >= 1 || keep);
+    return true;
+}
+
+bool HttpParser::ParseHeader(const char *line, u_long length) {
+    if (request.headerCount == HttpRequest::MAX_HEADERS)
+        return Fail(431);
+    auto colon = static_cast<const char*>(memchr(line, ':', length));
+    if (colon == nullptr || colon == line)                      // obsolete line folding included (RFC 9112 5.2)
+        return Fail(400);
+    HttpHeader &header = request.headers[request.headerCount++];
+    header.name = std::string_view(line, colon - line);
+    for (char c : header.name) {
+        if (!IsTokenChar(c))                                    // no whitespace before the colon (RFC 9112 5.1)
+            return Fail(400);
+    }
+    const char *value = colon + 1;
+    const char *end = line + length;
+    while (value < end && (*value == ' ' || *value == '\t'))
+        value++;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    header.value = std::string_view(value, end - value);
+
+    if (EqualsNoCase(header.name, "transfer-encoding"))         // chunked request bodies are not supported
+        return Fail(501);
+    if (EqualsNoCase(header.name, "content-length")) {
+        ULONG64 contentLength = 0;
+        if (header.value.empty())
+            return Fail(400);
+        for (char c : header.value) {
+            if (c < '0' || c > '9')
+                return Fail(400);
+            contentLength = contentLength * 10 + (c - '0');
+            if (contentLength > limits.maxBodySize)
+                return Fail(413);
+        }
+        if (request.contentLength != 0 && request.contentLength != contentLength)   // request smuggling (RFC 9112 6.3)
+            return Fail(400);
+        request.contentLength = static_cast<u_long>(contentLength);
+    }
+    return true;
+}
+
+void HttpParser::ResetSpill() {
+    if (spill.capacity() > SPILL_SHRINK_THRESHOLD)
+        std::vector<char>().swap(spill);            // a big body went through, don't keep its memory for the life of the connection
+    else
+        spill.clear();
+    headSize = 0;
+    expectedSize = 0;
+    spillScanned = 0;
+}
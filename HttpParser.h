@@ -0,0 +1,197 @@
+#ifndef SOCKETMANAGER_HTTPPARSER_H
+#define SOCKETMANAGER_HTTPPARSER_H
+
+#include <string_view>
+#include <vector>
+#include "socket_headers.h"
+#include "DelimiterScanner.h"
+
+/************* HttpRequest ***********/
+struct HttpHeader {
+    std::string_view            name;
+    std::string_view            value;                          // Without the whitespace around it
+};
+
+struct HttpRequest {                        // Views into the read the request came in (or the parser's spill when it straddles reads), valid during the callback only
+    static const u_long         MAX_HEADERS                     = 64;           // More headers are answered 431
+
+    std::string_view            method;
+    std::string_view            target;
+    int                         minorVersion;                   // HTTP/1.x
+    bool                        keepAlive;                      // HTTP/1.1 unless "Connection: close", HTTP/1.0 with "Connection: keep-alive" only
+    u_long                      contentLength;
+    u_long                      headerCount;
+    HttpHeader                  headers[MAX_HEADERS];
+    std::string_view            body;
+
+    std::string_view            Header          (std::string_view name) const;          // Value of the first header of that name (case insensitive), empty if none
+    bool                        HasToken        (std::string_view name, std::string_view token) const;  // A comma separated header of that name (Connection, Upgrade...) lists token, case insensitive
+};
+////////////// HttpRequest ////////////
+
+/************* HttpParser ***********/
+class HttpParser {                          // Cut the byte stream of one connection into HTTP/1.1 requests, delivered in place when they fit in a single read
+public:
+    struct Limits {
+        u_long                  maxHeaderSize;                      // Request line and headers, bigger ones are answered 431
+        u_long                  maxBodySize;                        // A bigger Content-Length is answered 413
+
+        Limits() : maxHeaderSize(16384), maxBodySize(1048576) {}
+    };
+
+private:
+    static const size_t         SPILL_SHRINK_THRESHOLD      = 65536;        // Spill buffer capacity kept between requests
+
+    Limits                      limits;
+    HttpRequest                 request;            // Filled again for each request, views only
+    std::vector<char>           spill;              // Start of a request that straddles reads
+    u_long                      headSize;           // Request line, headers and empty line of the spilled request, 0 while not fully received
+    u_long                      expectedSize;       // Head and body of the spilled request, once its head is received
+    std::vector<u_long>         lineEnds;           // Every CRLF of the current read (or of the spill), found in one vectorized scan
+    const char *                scanBase;           // Start of the scanned read, lineEnds are relative to it (nullptr for none yet)
+    size_t                      nextLineEnd;        // First line end of the request being parsed
+    u_long                      spillScanned;       // Bytes of spill already searched for the end of the head
+    u_short                     error;              // HTTP status the refused request must be answered with
+
+    bool                ParseHead           (const char *head, const u_long *ends, size_t count);      // Fill request from the line ends of its head (the last one ends the empty line), error set on failure
+    bool                ParseHeader         (const char *line, u_long length);
+    bool                Fail                (u_short status)        { error = status; return false; }
+    void                ResetSpill          ();
+
+    template<typename F>
+    bool                FeedInPlace         (const char *&data, u_long &length, F &onRequest, bool &stop);
+    template<typename F>
+    bool                FeedSpill           (const char *&data, u_long &length, F &onRequest, bool &stop);
+
+public:
+    explicit            HttpParser          (const Limits &l = Limits()) : limits(l), request(), headSize(0), expectedSize(0), scanBase(nullptr), nextLineEnd(0), spillScanned(0), error(0) {}
+
+    inline u_short      GetError            () const                { return error; }                       // 400, 413, 431, 501 or 505 after Feed failed
+
+    // Call onRequest(const HttpRequest &request) -> bool for each complete request of data, which is consumed.
+    // onRequest returns false to stop (connection closed), data and length are then left on the first unread byte.
+    // Returns false on protocol error, GetError gives the status to answer with : the rest of the stream can't be parsed.
+    template<typename F>
+    bool                Feed                (const char *&data, u_long &length, F onRequest) {
+        bool stop = false;
+        scanBase = nullptr;                         // new read, previous line ends are stale
+        while (length > 0 && !stop) {
+            if (!(spill.empty() ? FeedInPlace(data, length, onRequest, stop) : FeedSpill(data, length, onRequest, stop)))
+                return false;
+        }
+        return true;
+    }
+};
+
+template<typename F>
+bool HttpParser::FeedInPlace(const char *&data, u_long &length, F &onRequest, bool &stop) {     // Deliver at most one request
+    if (scanBase == nullptr) {                                          // first request of this read, find all its line ends at once
+        lineEnds.clear();
+        DelimiterScanner::FindAll(data, length, "\r\n", 2, lineEnds);
+        scanBase = data;
+        nextLineEnd = 0;
+    }
+    auto offset = static_cast<u_long>(data - scanBase);
+    while (nextLineEnd < lineEnds.size() && lineEnds[nextLineEnd] < offset)
+        nextLineEnd++;                                                  // inside the body of the previous request
+    while (nextLineEnd < lineEnds.size() && lineEnds[nextLineEnd] == offset) {     // empty lines before a request are ignored (RFC 9112 2.2)
+        data += 2;
+        length -= 2;
+        offset += 2;
+        nextLineEnd++;
+    }
+    size_t last = nextLineEnd;
+    while (last + 1 < lineEnds.size() && lineEnds[last + 1] != lineEnds[last] + 2)
+        last++;
+    if (last + 1 >= lineEnds.size()) {                                  // head not complete in this read
+        if (length > limits.maxHeaderSize)
+            return Fail(431);
+        spill.assign(data, data + length);
+        spillScanned = 0;
+        data += length;
+        length = 0;
+        return true;
+    }
+    u_long size = lineEnds[last + 1] + 2 - offset;
+    if (size > limits.maxHeaderSize)
+        return Fail(431);
+    for (size_t i = nextLineEnd ; i <= last + 1 ; i++)
+        lineEnds[i] -= offset;                                          // relative to the request, they are not looked at again
+    if (!ParseHead(data, lineEnds.data() + nextLineEnd, last + 2 - nextLineEnd))
+        return false;
+    nextLineEnd = last + 2;
+    if (length - size >= request.contentLength) {                       // whole request in this read, deliver in place
+        request.body = std::string_view(data + size, request.contentLength);
+        data += size + request.contentLength;
+        length -= size + request.contentLength;
+        stop = !onRequest(static_cast<const HttpRequest&>(request));
+        return true;
+    }
+    headSize = size;
+    expectedSize = size + request.contentLength;
+    spill.reserve(expectedSize);
+    spill.assign(data, data + length);
+    data += length;
+    length = 0;
+    return true;
+}
+
+template<typename F>
+bool HttpParser::FeedSpill(const char *&data, u_long &length, F &onRequest, bool &stop) {       // Deliver at most one request
+    if (headSize == 0) {                                                // head itself straddles reads, search its end in what was added
+        auto before = static_cast<u_long>(spill.size());
+        u_long take = limits.maxHeaderSize - before < length ? limits.maxHeaderSize - before : length;
+        spill.insert(spill.end(), data, data + take);
+        u_long blank = 0;                                               // empty lines before the request whose CRLF straddled reads, ignored like in place
+        while (blank + 1 < spill.size() && spill[blank] == '\r' && spill[blank + 1] == '\n')
+            blank += 2;
+        if (blank > 0) {
+            spill.erase(spill.begin(), spill.begin() + blank);
+            spillScanned = 0;                                           // line ends moved
+        }
+        u_long from = spillScanned > 0 ? spillScanned - 1 : 0;         // a CRLF may straddle the previous end
+        if (from == 0)
+            lineEnds.clear();
+        std::vector<u_long> found;
+        DelimiterScanner::FindAll(spill.data() + from, spill.size() - from, "\r\n", 2, found);
+        for (u_long end : found)
+            lineEnds.push_back(end + from);
+        spillScanned = static_cast<u_long>(spill.size());
+        size_t last = 0;
+        while (last + 1 < lineEnds.size() && lineEnds[last + 1] != lineEnds[last] + 2)
+            last++;
+        if (last + 1 >= lineEnds.size()) {
+            data += take;
+            length -= take;
+            return spill.size() < limits.maxHeaderSize || Fail(431);
+        }
+        headSize = lineEnds[last + 1] + 2;
+        u_long used = headSize + blank - before;                        // what follows the head in data is read again as body
+        spill.resize(headSize);
+        data += used;
+        length -= used;
+        if (!ParseHead(spill.data(), lineEnds.data(), last + 2))
+            return false;
+        expectedSize = headSize + request.contentLength;
+        spill.reserve(expectedSize);
+    }
+    u_long missing = expectedSize - static_cast<u_long>(spill.size());
+    u_long take = missing < length ? missing : length;
+    spill.insert(spill.end(), data, data + take);
+    data += take;
+    length -= take;
+    if (spill.size() < expectedSize)
+        return true;
+    lineEnds.clear();                                                   // spill may have moved since the head was parsed
+    DelimiterScanner::FindAll(spill.data(), headSize, "\r\n", 2, lineEnds);
+    scanBase = nullptr;                                                 // what follows in data is scanned again
+    if (!ParseHead(spill.data(), lineEnds.data(), lineEnds.size()))
+        return false;
+    request.body = std::string_view(spill.data() + headSize, request.contentLength);
+    stop = !onRequest(static_cast<const HttpRequest&>(request));
+    ResetSpill();
+    return true;
+}
+////////////// HttpParser ////////////
+
+#endif //SOCKETMANAGER_HTTPPARSER_H
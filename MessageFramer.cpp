@@ -0,0 +1,135 @@
+#include <cstring>
+#include "MessageFramer.h"
+
+MessageFramer::Options MessageFramer::LengthPrefixed(u_short prefixSize, u_long maxMessageSize) {
+    Options o;
+    o.mode = FIXED_LENGTH_PREFIX;
+    o.prefixSize = prefixSize;
+    o.maxMessageSize = maxMessageSize;
+    return o;
+}
+
+MessageFramer::Options MessageFramer::VarintPrefixed(u_long maxMessageSize) {
+    Options o;
+    o.mode = VARINT_LENGTH_PREFIX;
+    o.maxMessageSize = maxMessageSize;
+    return o;
+}
+
+MessageFramer::Options MessageFramer::Delimited(const char *delimiter, u_long delimiterLength, u_long maxMessageSize) {
+    Options o;
+    o.mode = DELIMITER;
+    o.delimiter.assign(delimiter, delimiterLength);
+    o.maxMessageSize = maxMessageSize;
+    return o;
+}
+
+void MessageFramer::Configure(const Options &o) {
+    options = o;
+    if ((options.mode == FIXED_LENGTH_PREFIX && options.prefixSize != 1 && options.prefixSize != 2 && options.prefixSize != 4) ||
+        (options.mode == DELIMITER && options.delimiter.empty())) {
+        options.mode = NONE;                        // invalid configuration, better deliver raw data than garbage
+    }
+    spill.clear();                                  // no deallocation, a message of spill may still be used by the caller
+    headerSize = 0;
+    expectedSize = 0;
+    scanNext = nullptr;
+}
+
+bool MessageFramer::CanFrame(u_long length) const {
+    if (length > options.maxMessageSize)
+        return false;
+    if (options.mode == FIXED_LENGTH_PREFIX && options.prefixSize < 4)
+        return length < (1ul << (8 * options.prefixSize));
+    return true;
+}
+
+u_long MessageFramer::EncodeHeader(u_long length, char *header) const {
+    switch (options.mode) {
+        case FIXED_LENGTH_PREFIX :{
+            for (u_short i = 0 ; i < options.prefixSize ; i++)
+                header[i] = static_cast<char>((length >> (8 * (options.prefixSize - 1 - i))) & 0xFF);
+            return options.prefixSize;
+        }
+        case VARINT_LENGTH_PREFIX :{
+            u_long size = 0;
+            do {
+                auto byte = static_cast<unsigned char>(length & 0x7F);
+                length >>= 7;
+                header[size++] = static_cast<char>(length ? byte | 0x80 : byte);
+            } while (length);
+            return size;
+        }
+        default:
+            return 0;
+    }
+}
+
+int MessageFramer::ParseHeader(const char *data, u_long length, u_long &messageSize) const {
+    messageSize = 0;
+    if (options.mode == FIXED_LENGTH_PREFIX) {
+        if (length < options.prefixSize)
+            return 0;
+        for (u_short i = 0 ; i < options.prefixSize ; i++)
+            messageSize = (messageSize << 8) | static_cast<unsigned char>(data[i]);
+    } else {
+        u_long i = 0;
+        for (;; i++) {
+            if (i >= MAX_HEADER_SIZE)
+                return -1;
+            if (i >= length)
+                return 0;
+            auto byte = static_cast<unsigned char>(data[i]);
+            if (i == MAX_HEADER_SIZE - 1 && (byte & 0x70))  // the last byte only has room for the 4 high bits of a 32 bits length
+                return -1;
+            messageSize |= static_cast<u_long>(byte & 0x7F) << (7 * i);
+            if (!(byte & 0x80))
+                break;
+        }
+        if (messageSize > options.maxMessageSize)
+            return -1;
+        return static_cast<int>(i + 1);
+    }
+    return messageSize > options.maxMessageSize ? -1 : options.prefixSize;
+}
+
+const char *MessageFramer::FindDelimiter(const char *data, u_long length) {
+    size_t size = options.delimiter.size();
+
+    if (data != scanNext) {                         // first search in this read (or data skipped by a straddling delimiter), scan it all at once
+        boundaries.clear();
+        DelimiterScanner::FindAll(data, length, options.delimiter.data(), size, boundaries);
+        scanBase = data;
+        nextBoundary = 0;
+    }
+    if (nextBoundary == boundaries.size()) {
+        scanNext = nullptr;
+        return nullptr;
+    }
+    const char *found = scanBase + boundaries[nextBoundary++];
+    scanNext = found + size;
+    return found;
+}
+
+u_long MessageFramer::StraddlingDelimiter(const char *data, u_long length) const {
+    size_t size = options.delimiter.size();
+    size_t maxInSpill = size - 1 < spill.size() ? size - 1 : spill.size();
+
+    for (size_t inSpill = maxInSpill ; inSpill > 0 ; inSpill--) {   // earliest possible delimiter start first
+        size_t inData = size - inSpill;
+        if (inData <= length &&
+            memcmp(spill.data() + spill.size() - inSpill, options.delimiter.data(), inSpill) == 0 &&
+            memcmp(data, options.delimiter.data() + inSpill, inData) == 0)
+            return static_cast<u_long>(inData);
+    }
+    return 0;
+}
+
+void MessageFramer::ResetSpill() {
+    if (spill.capacity() > SPILL_SHRINK_THRESHOLD)
+        std::vector<char>().swap(spill);            // a huge message went through, don't keep its memory for the life of the socket
+    else
+        spill.clear();
+    headerSize = 0;
+    expectedSize = 0;
+}
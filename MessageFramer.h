@@ -0,0 +1,188 @@
+#ifndef SOCKETMANAGER_MESSAGEFRAMER_H
+#define SOCKETMANAGER_MESSAGEFRAMER_H
+
+#include <string>
+#include <vector>
+#include "socket_headers.h"
+#include "DelimiterScanner.h"
+
+/************* MessageFramer ***********/
+class MessageFramer {                       // Cut the byte stream of one socket into messages, delivered in place when they fit in a single read
+public:
+    enum Mode {
+        NONE,                               // No framing, reads are given as is to ReceiveData
+        FIXED_LENGTH_PREFIX,                // Each message is preceded by its length on 1, 2 or 4 big endian bytes
+        VARINT_LENGTH_PREFIX,               // Each message is preceded by its length as a LEB128 varint (7 bits per byte, at most 5 bytes)
+        DELIMITER                           // Each message is followed by a delimiter of one or more bytes, the delimiter is not delivered
+    };
+
+    static const u_long         DEFAULT_MAX_MESSAGE_SIZE    = 16777216;     // 16MB, protect against bogus or malicious length
+    static const u_long         MAX_HEADER_SIZE             = 5;            // Longest varint for a 32 bits length
+
+    struct Options {
+        Mode                    mode            = NONE;
+        u_short                 prefixSize      = 4;                        // FIXED_LENGTH_PREFIX only : 1, 2 or 4
+        std::string             delimiter;                                  // DELIMITER only
+        u_long                  maxMessageSize  = DEFAULT_MAX_MESSAGE_SIZE; // Bigger messages are a protocol error and fail the socket
+    };
+
+    static Options      LengthPrefixed      (u_short prefixSize = 4, u_long maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE);
+    static Options      VarintPrefixed      (u_long maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE);
+    static Options      Delimited           (const char *delimiter, u_long delimiterLength, u_long maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE);
+
+private:
+    static const size_t         SPILL_SHRINK_THRESHOLD      = 65536;        // Spill buffer capacity kept between messages
+
+    Options                     options;
+    std::vector<char>           spill;              // Start of a message that straddles reads
+    u_long                      headerSize;         // Length prefix size of the spilled message, 0 while not fully received
+    u_long                      expectedSize;       // Header + payload size of the spilled message, when known
+    std::vector<u_long>         boundaries;         // DELIMITER only : every delimiter of the current read, found in one scan
+    const char *                scanBase;           // Start of the scanned read, boundaries are relative to it
+    const char *                scanNext;           // Where the next message is expected to start for boundaries to still be valid
+    size_t                      nextBoundary;
+
+    int                 ParseHeader         (const char *data, u_long length, u_long &messageSize) const;   // Header size, 0 if incomplete, -1 if invalid
+    const char *        FindDelimiter       (const char *data, u_long length);                              // Start of first delimiter, nullptr if none
+    u_long              StraddlingDelimiter (const char *data, u_long length) const;                        // Bytes of data ending a delimiter started in spill, 0 if none
+    void                ResetSpill          ();
+
+    template<typename F>
+    bool                FeedLengthPrefixed  (const char *&data, u_long &length, F &onMessage, bool &stop);
+    template<typename F>
+    bool                FeedDelimited       (const char *&data, u_long &length, F &onMessage, bool &stop);
+
+public:
+                        MessageFramer       () : headerSize(0), expectedSize(0), scanBase(nullptr), scanNext(nullptr), nextBoundary(0) {}
+
+    void                Configure           (const Options &o);                                             // Change framing, drop any partial message
+    inline bool         IsEnabled           () const                { return options.mode != NONE; }
+    inline Mode         GetMode             () const                { return options.mode; }
+    bool                CanFrame            (u_long length) const;                                          // Check a message of this size can be sent
+    u_long              EncodeHeader        (u_long length, char *header) const;                            // Write length prefix in header (MAX_HEADER_SIZE bytes), return its size
+    inline const std::string & Trailer      () const                { return options.delimiter; }          // Bytes to send after each message
+
+    // Call onMessage(const char *message, u_long length) -> bool for each complete message of data, which is consumed.
+    // onMessage returns false to stop (socket closed), data and length are then left on the first unread byte.
+    // If onMessage disables framing, feeding stops too and the rest of data is left to the caller as raw data.
+    // Returns false on protocol error (invalid or too big message).
+    template<typename F>
+    bool                Feed                (const char *&data, u_long &length, F onMessage) {
+        bool stop = false;
+        scanNext = nullptr;                         // new read, previous boundaries are stale
+        while (length > 0 && !stop) {
+            bool ok;
+            switch (options.mode) {
+                case FIXED_LENGTH_PREFIX :
+                    /** NOBREAK **/
+                case VARINT_LENGTH_PREFIX : ok = FeedLengthPrefixed(data, length, onMessage, stop); break;
+                case DELIMITER :            ok = FeedDelimited(data, length, onMessage, stop); break;
+                default :                   return true;
+            }
+            if (!ok)
+                return false;
+        }
+        return true;
+    }
+};
+
+template<typename F>
+bool MessageFramer::FeedLengthPrefixed(const char *&data, u_long &length, F &onMessage, bool &stop) {     // Deliver at most one message
+    u_long  messageSize;
+    int     hdr;
+
+    if (spill.empty()) {
+        hdr = ParseHeader(data, length, messageSize);
+        if (hdr < 0)
+            return false;
+        if (hdr > 0 && length - hdr >= messageSize) {                   // whole message in this read, deliver in place
+            const char *message = data + hdr;
+            data += hdr + messageSize;
+            length -= hdr + messageSize;
+            stop = !onMessage(message, messageSize);
+            return true;
+        }
+        headerSize = static_cast<u_long>(hdr);
+        expectedSize = hdr > 0 ? hdr + messageSize : 0;
+        if (expectedSize > 0)
+            spill.reserve(expectedSize);
+        spill.assign(data, data + length);
+        data += length;
+        length = 0;
+        return true;
+    }
+    if (headerSize == 0) {                                              // header itself straddles reads, complete it byte by byte
+        spill.push_back(*data++);
+        length--;
+        hdr = ParseHeader(spill.data(), static_cast<u_long>(spill.size()), messageSize);
+        if (hdr < 0)
+            return false;
+        if (hdr == 0)
+            return true;
+        headerSize = static_cast<u_long>(hdr);
+        expectedSize = hdr + messageSize;
+        spill.reserve(expectedSize);
+    }
+    u_long missing = expectedSize - static_cast<u_long>(spill.size());
+    u_long take = missing < length ? missing : length;
+    spill.insert(spill.end(), data, data + take);
+    data += take;
+    length -= take;
+    if (spill.size() == expectedSize) {
+        stop = !onMessage(spill.data() + headerSize, expectedSize - headerSize);
+        ResetSpill();
+    }
+    return true;
+}
+
+template<typename F>
+bool MessageFramer::FeedDelimited(const char *&data, u_long &length, F &onMessage, bool &stop) {          // Deliver at most one message
+    auto delimiterSize = static_cast<u_long>(options.delimiter.size());
+
+    if (spill.empty()) {
+        const char *end = FindDelimiter(data, length);
+        if (end != nullptr) {                                           // whole message in this read, deliver in place
+            const char *message = data;
+            auto messageSize = static_cast<u_long>(end - data);
+            data = end + delimiterSize;
+            length -= messageSize + delimiterSize;
+            if (messageSize > options.maxMessageSize)
+                return false;
+            stop = !onMessage(message, messageSize);
+            return true;
+        }
+        if (length > options.maxMessageSize + delimiterSize)
+            return false;
+        spill.assign(data, data + length);
+        data += length;
+        length = 0;
+        return true;
+    }
+    u_long straddle = StraddlingDelimiter(data, length);
+    u_long messageSize;
+    if (straddle > 0) {
+        messageSize = static_cast<u_long>(spill.size()) - (delimiterSize - straddle);
+        data += straddle;
+        length -= straddle;
+    } else {
+        const char *end = FindDelimiter(data, length);
+        if (end == nullptr) {
+            spill.insert(spill.end(), data, data + length);
+            data += length;
+            length = 0;
+            return spill.size() <= options.maxMessageSize + delimiterSize;
+        }
+        spill.insert(spill.end(), data, end);
+        messageSize = static_cast<u_long>(spill.size());
+        length -= static_cast<u_long>(end - data) + delimiterSize;
+        data = end + delimiterSize;
+    }
+    if (messageSize > options.maxMessageSize)
+        return false;
+    stop = !onMessage(spill.data(), messageSize);
+    ResetSpill();
+    return true;
+}
+////////////// MessageFramer ////////////
+
+#endif //SOCKETMANAGER_MESSAGEFRAMER_H
@@ -4,14 +4,18 @@
 #include <string>
 #include <windows.h>
 
+#ifndef NO_DEBUG_LOG        // can be set from the build system, for benchmarks for example
 #define DEBUG
+#endif
 #ifndef DEBUG
 #define LOG(...) if(false);
 #else
 #define LOG(text...) setbuf(stdout, 0); printf("%s : ", __func__); printf(text);
 #endif
 
+#ifndef NO_DEBUG_ERROR_LOG
 #define DEBUG_ERROR
+#endif
 #ifndef DEBUG_ERROR
 #define LOG_ERROR(...) if(false);
 #else
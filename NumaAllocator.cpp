@@ -0,0 +1,148 @@
+#include "NumaAllocator.h"
+#include "Misc.h"
+
+DWORD Numa::NodeCount() {
+    ULONG highestNode;
+    if (!GetNumaHighestNodeNumber(&highestNode))
+        return 1;
+    return highestNode + 1;
+}
+
+std::vector<PROCESSOR_NUMBER> Numa::Processors(DWORD node) {
+    std::vector<PROCESSOR_NUMBER>   processors;
+    DWORD                           first   = node == ANY_NODE ? 0 : node;
+    DWORD                           last    = node == ANY_NODE ? NodeCount() - 1 : node;
+    GROUP_AFFINITY                  affinity;
+
+    for (DWORD n = first ; n <= last ; n++) {
+        if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(n),    //Node : The number of the node.
+                                        &affinity)) {               //ProcessorMask : A pointer to a GROUP_AFFINITY structure that receives the processor mask for the specified node. A processor mask is a bit vector in which each bit represents a processor and whether it is in the node.
+            LOG_ERROR("GetNumaNodeProcessorMaskEx failed for node %lu / error %lu\n", n, GetLastError());
+            continue;
+        }
+        for (BYTE bit = 0 ; bit < sizeof(KAFFINITY) * 8 ; bit++) {
+            if (affinity.Mask & (static_cast<KAFFINITY>(1) << bit)) {
+                PROCESSOR_NUMBER processor{};
+                processor.Group = affinity.Group;
+                processor.Number = bit;
+                processors.push_back(processor);
+            }
+        }
+    }
+    return processors;
+}
+
+bool Numa::PinThread(HANDLE thread, DWORD node, int processorIndex) {
+    GROUP_AFFINITY affinity{};
+
+    if (processorIndex < 0) {
+        if (node == ANY_NODE)
+            return true;                                                // whole machine, nothing to restrict
+        if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity)) {
+            LOG_ERROR("GetNumaNodeProcessorMaskEx failed for node %lu / error %lu\n", node, GetLastError());
+            return false;
+        }
+    } else {
+        std::vector<PROCESSOR_NUMBER> processors = Processors(node);
+        if (processors.empty())
+            return false;
+        const PROCESSOR_NUMBER &processor = processors[processorIndex % processors.size()];
+        affinity.Group = processor.Group;
+        affinity.Mask = static_cast<KAFFINITY>(1) << processor.Number;
+    }
+    if (!SetThreadGroupAffinity(thread,                                 //hThread : A handle to the thread. The handle must have the THREAD_SET_INFORMATION access right.
+                                &affinity,                              //GroupAffinity : A GROUP_AFFINITY structure that specifies the processor group affinity to be used for the specified thread.
+                                nullptr)) {                             //PreviousGroupAffinity : A pointer to a GROUP_AFFINITY structure to receive the thread's previous group affinity. This parameter can be NULL.
+        LOG_ERROR("SetThreadGroupAffinity failed / error %lu\n", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+NumaHeap::NumaHeap(DWORD n, size_t size) : node(n), critSec{}, chunks(), partial(), currentChunk(nullptr), current(nullptr), remaining(0) {
+    const size_t alignment = alignof(std::max_align_t);
+    blockSize = ((size < sizeof(void*) ? sizeof(void*) : size) + alignment - 1) / alignment * alignment;   // a free block stores a pointer
+    InitializeCriticalSection(&critSec);
+}
+
+NumaHeap &NumaHeap::Of(DWORD node, size_t blockSize) {
+    static struct Registry {
+        CRITICAL_SECTION                                    critSec{};
+        std::map<std::pair<DWORD, size_t>, NumaHeap*>       heaps;
+        Registry    ()  { InitializeCriticalSection(&critSec); }
+    } registry;
+    NumaHeap *heap;
+
+    EnterCriticalSection(&registry.critSec);
+    {
+        NumaHeap *&slot = registry.heaps[std::make_pair(node, blockSize)];
+        if (slot == nullptr)
+            slot = new NumaHeap(node, blockSize);
+        heap = slot;
+    }
+    LeaveCriticalSection(&registry.critSec);
+    return *heap;
+}
+
+void *NumaHeap::Allocate() {
+    void *block = nullptr;
+
+    EnterCriticalSection(&critSec);
+    {
+        if (!partial.empty()) {
+            Chunk &chunk = chunks[*partial.begin()];
+            block = chunk.freeList;
+            chunk.freeList = *static_cast<void**>(block);
+            chunk.used++;
+            if (chunk.freeList == nullptr)
+                partial.erase(partial.begin());
+        } else {
+            if (remaining < blockSize) {
+                size_t chunkSize = blockSize > CHUNK_SIZE ? blockSize : CHUNK_SIZE;
+                void *chunk = VirtualAllocExNuma(GetCurrentProcess(),           //hProcess : The handle to a process. The function allocates memory within the virtual address space of this process.
+                                                 nullptr,                       //lpAddress : The pointer that specifies a desired starting address for the region of pages that you want to allocate. If lpAddress is NULL, the function determines where to allocate the region.
+                                                 chunkSize,                     //dwSize : The size of the region of memory to be allocated, in bytes.
+                                                 MEM_RESERVE | MEM_COMMIT,      //flAllocationType : The type of memory allocation.
+                                                 PAGE_READWRITE,                //flProtect : The memory protection for the region of pages to be allocated.
+                                                 node);                         //nndPreferred : The NUMA node where the physical memory should reside.
+                if (chunk == nullptr) {
+                    LOG_ERROR("VirtualAllocExNuma failed for node %lu / error %lu\n", node, GetLastError());
+                    LeaveCriticalSection(&critSec);
+                    throw std::bad_alloc();
+                }
+                currentChunk = static_cast<char*>(chunk);
+                chunks[currentChunk] = Chunk{0, nullptr};
+                current = currentChunk;
+                remaining = chunkSize;
+            }
+            chunks[currentChunk].used++;
+            block = current;
+            current += blockSize;
+            remaining -= blockSize;
+        }
+    }
+    LeaveCriticalSection(&critSec);
+    return block;
+}
+
+void NumaHeap::Free(void *block) {
+    EnterCriticalSection(&critSec);
+    {
+        auto it = --chunks.upper_bound(static_cast<char*>(block));     // last chunk starting at or before the block
+        Chunk &chunk = it->second;
+        if (--chunk.used == 0 && it->first != currentChunk) {          // memory budgets see the pools shrink, so must the process
+            if (!VirtualFree(it->first,                                 //lpAddress : A pointer to the base address of the region of pages to be freed.
+                             0,                                         //dwSize : The size of the region of memory to be freed, 0 with MEM_RELEASE for the whole region reserved by VirtualAllocExNuma.
+                             MEM_RELEASE)) {                            //dwFreeType : The type of free operation.
+                LOG_ERROR("VirtualFree failed / error %lu\n", GetLastError());
+            }
+            partial.erase(it->first);
+            chunks.erase(it);
+        } else {
+            *static_cast<void**>(block) = chunk.freeList;
+            chunk.freeList = block;
+            partial.insert(it->first);
+        }
+    }
+    LeaveCriticalSection(&critSec);
+}
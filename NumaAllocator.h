@@ -0,0 +1,89 @@
+#ifndef SOCKETMANAGER_NUMAALLOCATOR_H
+#define SOCKETMANAGER_NUMAALLOCATOR_H
+
+#include <cstddef>
+#include <map>
+#include <new>
+#include <set>
+#include <vector>
+#include "socket_headers.h"
+
+/************* Numa ***********/
+namespace Numa {
+    const DWORD                     ANY_NODE    = 0xFFFFFFFF;   // No placement : default heap, threads free to run anywhere
+
+    DWORD                           NodeCount       ();                                                 // 1 on a non NUMA system
+    std::vector<PROCESSOR_NUMBER>   Processors      (DWORD node);                                       // Processors of a node, of every node for ANY_NODE
+    bool                            PinThread       (HANDLE thread, DWORD node, int processorIndex);    // Pin to the processorIndex-th processor of node (modulo their count), or to the whole node if processorIndex < 0
+}
+////////////// Numa ////////////
+
+/************* NumaHeap ***********/
+class NumaHeap {                            // Fixed size blocks carved from chunks committed on one NUMA node, freed blocks are kept for reuse until their whole chunk is free
+private:
+    static const size_t         CHUNK_SIZE      = 262144;       // 256kB, about 60 Buffers
+
+    struct Chunk {
+        size_t                  used;                           // Blocks given out and not freed
+        void *                  freeList;                       // Freed blocks of this chunk, each one storing the next one
+    };
+
+    DWORD                       node;
+    size_t                      blockSize;
+    CRITICAL_SECTION            critSec;
+    std::map<char*, Chunk>      chunks;                         // By start address, to find the chunk of a freed block
+    std::set<char*>             partial;                        // Chunks with freed blocks, the lowest first so the others get a chance to empty
+    char *                      currentChunk;                   // Last chunk, kept even once empty as its end is still carved
+    char *                      current;                        // Unused end of the last chunk
+    size_t                      remaining;
+
+                        NumaHeap        (DWORD n, size_t size);
+public:
+                        NumaHeap        (const NumaHeap&) = delete;
+    NumaHeap &          operator=       (const NumaHeap&) = delete;
+
+    static NumaHeap &   Of              (DWORD node, size_t blockSize);     // Heap shared by every allocator of this node and block size, never destroyed
+    void *              Allocate        ();                                 // Throw std::bad_alloc if the node has no memory left
+    void                Free            (void *block);                      // The chunk goes back to the system once all its blocks are freed (but the last one)
+};
+////////////// NumaHeap ////////////
+
+/************* NumaAllocator ***********/
+template<typename T>
+class NumaAllocator {                       // Allocate single objects (std::list nodes) in the memory of one NUMA node, anything else from the default heap
+public:
+    typedef T                   value_type;
+
+    DWORD                       node;
+    NumaHeap *                  heap;                           // Cached NumaHeap::Of(node, sizeof(T))
+
+                        NumaAllocator   (DWORD n = Numa::ANY_NODE) noexcept                 : node(n), heap(nullptr) {}
+    template<typename U>
+                        NumaAllocator   (const NumaAllocator<U> &other) noexcept            : node(other.node), heap(nullptr) {}
+
+    T *                 allocate        (size_t n) {
+        if (node == Numa::ANY_NODE || n != 1)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        if (heap == nullptr)
+            heap = &NumaHeap::Of(node, sizeof(T));
+        return static_cast<T*>(heap->Allocate());
+    }
+
+    void                deallocate      (T *p, size_t n) noexcept {
+        if (node == Numa::ANY_NODE || n != 1)
+            ::operator delete(p);
+        else {
+            if (heap == nullptr)
+                heap = &NumaHeap::Of(node, sizeof(T));
+            heap->Free(p);
+        }
+    }
+
+    template<typename U>
+    inline bool         operator==      (const NumaAllocator<U> &other) const noexcept     { return node == other.node; }
+    template<typename U>
+    inline bool         operator!=      (const NumaAllocator<U> &other) const noexcept     { return node != other.node; }
+};
+////////////// NumaAllocator ////////////
+
+#endif //SOCKETMANAGER_NUMAALLOCATOR_H
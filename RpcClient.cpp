@@ -0,0 +1,187 @@
+#include "RpcClient.h"
+
+RpcClient::RpcClient(SocketManager &manager, const Options &o) : client(manager), options(o), slots(nullptr), freeHead(0), used(0), timer(nullptr),
+                                                               calls(0), completed(0), timeouts(0), abandoned(0), refused(0), late(0), inFlight(0) {
+    if (options.capacity < 1)
+        options.capacity = 1;
+    if (options.deadlinePeriod == 0)
+        options.deadlinePeriod = 1;
+    slots = new Slot[options.capacity];
+    for (DWORD i = 0 ; i < options.capacity ; i++) {
+        slots[i].id = 0;
+        slots[i].generation = 0;
+        slots[i].next = 0;
+        slots[i].deadline = 0;
+        slots[i].socket = Misc::CreateNilUUID();
+    }
+    if (!CreateTimerQueueTimer(&timer,                      //phNewTimer : A pointer to a buffer that receives a handle to the timer-queue timer on return.
+                               nullptr,                     //TimerQueue : A handle to the timer queue. If this parameter is NULL, the timer is associated with the default timer queue.
+                               DeadlineCallback,            //Callback : A pointer to the application-defined function of type WAITORTIMERCALLBACK to be executed when the timer expires.
+                               this,                        //Parameter : A single parameter value that will be passed to the callback function.
+                               options.deadlinePeriod,      //DueTime : The amount of time in milliseconds relative to the current time that must elapse before the timer is signaled for the first time.
+                               options.deadlinePeriod,      //Period : The period of the timer, in milliseconds. If this parameter is not zero, the timer is periodic.
+                               WT_EXECUTEDEFAULT)) {        //Flags : By default, the callback function is queued to a non-I/O worker thread.
+        LOG_ERROR("CreateTimerQueueTimer failed / error %lu\n", GetLastError());   //calls without a response then never time out
+        timer = nullptr;
+    }
+}
+
+RpcClient::~RpcClient() {
+    if (timer != nullptr)
+        DeleteTimerQueueTimer(nullptr, timer, INVALID_HANDLE_VALUE);    //waits for a CheckDeadlines in progress
+    for (LONG i = 0 ; i < used ; i++) {                     //futures waited on must not hang
+        LONG64 id = slots[i].id;
+        if (id != 0 && Finish(slots[i], id, RpcFrame::DISCONNECTED, nullptr, 0))
+            abandoned++;
+    }
+    delete[] slots;
+}
+
+VOID CALLBACK RpcClient::DeadlineCallback(PVOID lpParam, BOOLEAN timerFired) {
+    static_cast<RpcClient*>(lpParam)->CheckDeadlines();
+}
+
+void RpcClient::CheckDeadlines() {
+    DWORD   now     = GetTickCount();
+    LONG    count   = used;
+
+    for (LONG i = 0 ; i < count ; i++) {
+        Slot &slot = slots[i];
+        LONG64 id = slot.id;                                //read before the deadline : a deadline of a later call fails Finish on the id
+        if (id == 0 || static_cast<LONG>(now - slot.deadline) < 0)
+            continue;
+        if (Finish(slot, id, RpcFrame::TIMEOUT, nullptr, 0))
+            InterlockedIncrement64(&timeouts);
+    }
+}
+
+LONG RpcClient::Take() {
+    LONG64 head;
+    LONG   count;
+
+    // ----------------------------- slots given back first, the pop count in the head makes a head popped and pushed again meanwhile fail the swap
+    while (((head = freeHead) & 0xFFFFFFFF) != 0) {
+        auto top = static_cast<LONG>(head & 0xFFFFFFFF) - 1;
+        LONG64 next = static_cast<LONG64>(((static_cast<ULONG64>(head) >> 32) + 1) << 32 | static_cast<ULONG>(slots[top].next));
+        if (InterlockedCompareExchange64(&freeHead, next, head) == head)
+            return top;
+    }
+    // ----------------------------- then the ones never used, so a small load only ever scans the start of the table
+    while ((count = used) < static_cast<LONG>(options.capacity)) {
+        if (InterlockedCompareExchange(&used, count + 1, count) == count)
+            return count;
+    }
+    return -1;
+}
+
+void RpcClient::Give(LONG index) {
+    LONG64 head;
+    LONG64 top;
+
+    do {
+        head = freeHead;
+        slots[index].next = static_cast<LONG>(head & 0xFFFFFFFF);
+        top = static_cast<LONG64>((static_cast<ULONG64>(head) >> 32) << 32 | static_cast<ULONG>(index + 1));
+    } while (InterlockedCompareExchange64(&freeHead, top, head) != head);
+}
+
+bool RpcClient::Finish(Slot &slot, LONG64 id, Status status, const char *payload, u_long length) {
+    if (InterlockedCompareExchange64(&slot.id, 0, id) != id)
+        return false;                                       //completed by the response, its deadline or Abandon meanwhile
+    Callback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    InterlockedDecrement(&inFlight);
+    Give(static_cast<LONG>(id & 0xFFFFFFFF));               //before the callback, which may well make the next call
+    callback(status, payload, length);
+    return true;
+}
+
+bool RpcClient::Call(UUID socketId, u_short method, const char *data, u_long length, Callback callback, DWORD timeoutMs) {
+    char                header[RpcFrame::HEADER_SIZE];
+    WSABUF              pieces[2];
+    LONG                index;
+
+    if (length > RpcFrame::MAX_PAYLOAD_SIZE || (index = Take()) < 0) {
+        InterlockedIncrement64(&refused);
+        return false;
+    }
+    // ----------------------------- fill the slot, then publish its id : the response may come before SendData returns
+    Slot &slot = slots[index];
+    if (++slot.generation == 0)
+        slot.generation = 1;                                //0 is a free slot
+    auto id = static_cast<LONG64>(static_cast<ULONG64>(slot.generation) << 32 | static_cast<ULONG>(index));
+    slot.deadline = GetTickCount() + (timeoutMs > 0 ? timeoutMs : options.defaultTimeout);
+    slot.socket = socketId;
+    slot.callback = std::move(callback);
+    InterlockedIncrement(&inFlight);
+    InterlockedExchange64(&slot.id, id);
+
+    RpcFrame::Encode(RpcFrame::Header{RpcFrame::REQUEST, RpcFrame::OK, method, static_cast<ULONG64>(id)}, length, header);
+    pieces[0].buf = header;
+    pieces[0].len = RpcFrame::HEADER_SIZE;
+    pieces[1].buf = const_cast<char*>(data);
+    pieces[1].len = length;
+    if (!client.SendData(pieces, 2, socketId)) {            //backpressure or closed
+        if (InterlockedCompareExchange64(&slot.id, 0, id) != id)
+            return true;                                    //timed out or abandoned already, its callback was called
+        slot.callback = nullptr;
+        InterlockedDecrement(&inFlight);
+        Give(index);
+        InterlockedIncrement64(&refused);
+        return false;
+    }
+    InterlockedIncrement64(&calls);
+    return true;
+}
+
+std::future<RpcClient::Response> RpcClient::Call(UUID socketId, u_short method, const char *data, u_long length, DWORD timeoutMs) {
+    auto promise = std::make_shared<std::promise<Response>>();
+    std::future<Response> future = promise->get_future();
+
+    if (!Call(socketId, method, data, length, [promise](Status status, const char *payload, u_long size) {
+            promise->set_value(Response{status, payload != nullptr ? std::string(payload, size) : std::string()});
+        }, timeoutMs))
+        promise->set_value(Response{RpcFrame::REFUSED, std::string()});
+    return future;
+}
+
+bool RpcClient::Dispatch(const char *message, u_long length) {
+    RpcFrame::Header header;
+
+    if (!RpcFrame::Decode(message, length, header) || header.kind != RpcFrame::RESPONSE)
+        return false;
+    auto index = static_cast<ULONG>(header.id & 0xFFFFFFFF);
+    if (index < static_cast<ULONG>(used) && Finish(slots[index], static_cast<LONG64>(header.id), header.status,
+                                                   message + RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE, length - (RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE)))
+        InterlockedIncrement64(&completed);
+    else
+        InterlockedIncrement64(&late);
+    return true;
+}
+
+void RpcClient::Abandon(UUID socketId) {
+    LONG        count   = used;
+    RPC_STATUS  status;
+
+    for (LONG i = 0 ; i < count ; i++) {
+        Slot &slot = slots[i];
+        LONG64 id = slot.id;                                //read before the socket, like CheckDeadlines
+        if (id == 0 || !UuidEqual(&slot.socket, &socketId, &status))
+            continue;
+        if (Finish(slot, id, RpcFrame::DISCONNECTED, nullptr, 0))
+            InterlockedIncrement64(&abandoned);
+    }
+}
+
+RpcClient::Stats RpcClient::GetStats() {
+    Stats stats;
+
+    stats.calls = calls;
+    stats.completed = completed;
+    stats.timeouts = timeouts;
+    stats.abandoned = abandoned;
+    stats.refused = refused;
+    stats.late = late;
+    stats.inFlight = inFlight;
+    return stats;
+}
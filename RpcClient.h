@@ -0,0 +1,86 @@
+#ifndef SOCKETMANAGER_RPCCLIENT_H
+#define SOCKETMANAGER_RPCCLIENT_H
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include "SocketManager.h"
+#include "RpcFrame.h"
+
+/************* RpcClient ***********/
+class RpcClient {                           // Client side : calls multiplexed over connections of a client manager, each completed by the response carrying its id or by its deadline
+public:
+    typedef RpcFrame::Status Status;
+    typedef std::function<void(Status status, const char *payload, u_long length)> Callback;    // Called once per call, payload only valid until it returns
+
+    struct Response {                                           // What a future gets, the payload copied
+        Status          status;
+        std::string     payload;
+    };
+
+    struct Options {
+        DWORD           capacity;                               // Calls in flight over all connections, calls above it are refused
+        DWORD           defaultTimeout;                         // ms given to calls made with timeout 0
+        DWORD           deadlinePeriod;                         // ms between two checks of the deadlines, calls time out up to this late
+
+        Options() : capacity(4096), defaultTimeout(5000), deadlinePeriod(10) {}
+    };
+
+    struct Stats {                                              // Since the start
+        LONG64          calls;                                  // Calls sent
+        LONG64          completed;                              // Responses matched to their call
+        LONG64          timeouts;
+        LONG64          abandoned;                              // Failed by Abandon or the destructor
+        LONG64          refused;                                // Not sent : table full, payload too big or send refused
+        LONG64          late;                                   // Responses of calls already timed out or abandoned, or with an unknown id
+        LONG            inFlight;                               // Now
+    };
+
+private:
+    struct alignas(64) Slot {                                   // One call in flight, a cache line of its own so completions of neighbours don't contend
+        volatile LONG64 id;                                     // Id of the call while in flight, 0 when free : whoever swaps it to 0 completes the call
+        ULONG           generation;                             // Upper half of the id, bumped each time the slot is taken so a late response can't complete the next call
+        volatile LONG   next;                                   // Free stack : index + 1 of the next free slot, 0 for none
+        DWORD           deadline;                               // Tick count
+        UUID            socket;
+        Callback        callback;
+    };
+
+    SocketManager &                     client;
+    Options                             options;
+    Slot *                              slots;                  // options.capacity of them, never moved
+    volatile LONG64                     freeHead;               // Free stack of slots given back : pop count in the upper half against ABA, index + 1 of the top in the lower one
+    volatile LONG                       used;                   // Slots taken at least once, the others are taken in order before the free stack is empty
+    HANDLE                              timer;                  // Runs CheckDeadlines every deadlinePeriod
+    volatile LONG64                     calls;                  // Stats, see Stats
+    volatile LONG64                     completed;
+    volatile LONG64                     timeouts;
+    volatile LONG64                     abandoned;
+    volatile LONG64                     refused;
+    volatile LONG64                     late;
+    volatile LONG                       inFlight;
+
+    static VOID CALLBACK DeadlineCallback   (PVOID lpParam, BOOLEAN timerFired);
+    void                CheckDeadlines      ();                                                 // Time out the calls past their deadline
+    LONG                Take                ();                                                 // Index of a free slot, -1 if all of them are in flight
+    void                Give                (LONG index);                                       // Back on the free stack
+    bool                Finish              (Slot &slot, LONG64 id, Status status, const char *payload, u_long length);    // Complete the call if it is still id, false if someone else did
+public:
+    explicit            RpcClient           (SocketManager &manager, const Options &o = Options());    // manager must be a CLIENT one with RpcFrame::Framing, and outlive the client
+                        ~RpcClient          ();                                                 // Calls still in flight are completed with DISCONNECTED, Dispatch must not be called anymore
+
+    // Send a request on a connection and return at once, callback gets its response, or TIMEOUT after timeoutMs (0 for the default) if none came.
+    // Returns false, and callback is not called, if it could not be sent. Any thread, any number of calls in flight per connection.
+    bool                Call                (UUID socketId, u_short method, const char *data, u_long length, Callback callback, DWORD timeoutMs = 0);
+    // Same, completing a future instead, REFUSED right away if it could not be sent
+    std::future<Response> Call              (UUID socketId, u_short method, const char *data, u_long length, DWORD timeoutMs = 0);
+    // Give each message of ReceiveMessage of the client : completes the call the response is for, on that worker thread.
+    // Returns false if the message isn't a response, for the caller to handle.
+    bool                Dispatch            (const char *message, u_long length);
+    void                Abandon             (UUID socketId);                                    // Complete the calls in flight on a connection with DISCONNECTED, once it is closed or failed
+    Stats               GetStats            ();
+};
+////////////// RpcClient ////////////
+
+#endif //SOCKETMANAGER_RPCCLIENT_H
@@ -0,0 +1,70 @@
+#ifndef SOCKETMANAGER_RPCFRAME_H
+#define SOCKETMANAGER_RPCFRAME_H
+
+#include "socket_headers.h"
+#include "MessageFramer.h"
+
+/************* RpcFrame ***********/
+class RpcFrame {                            // Wire format of RpcClient and RpcHandler : a 4 bytes length prefix, then a 12 bytes header and the payload
+public:
+    enum Kind : u_char {
+        REQUEST         = 0,
+        RESPONSE        = 1
+    };
+
+    enum Status : u_char {
+        OK              = 0,
+        UNKNOWN_METHOD  = 1,                                    // Sent by the server, no handler for the method
+        FAILED          = 2,                                    // Sent by the server, the payload may tell why
+        TIMEOUT         = 0x80,                                 // Local : no response before the deadline of the call
+        DISCONNECTED    = 0x81,                                 // Local : connection abandoned (RpcClient::Abandon) or client destroyed
+        REFUSED         = 0x82                                  // Local, futures only : not sent, too many calls in flight or send refused
+    };
+
+    struct Header {                                             // Big endian on the wire, after the length prefix
+        Kind            kind;
+        Status          status;                                 // OK in requests
+        u_short         method;
+        ULONG64         id;                                     // Given by the client, sent back as is in the response
+    };
+
+    static const u_long         PREFIX_SIZE         = 4;
+    static const u_long         HEADER_SIZE         = PREFIX_SIZE + 12;                                     // What precedes each payload on the wire
+    static const u_long         MAX_PAYLOAD_SIZE    = MessageFramer::DEFAULT_MAX_MESSAGE_SIZE - (HEADER_SIZE - PREFIX_SIZE);
+
+    // Framing both ends must give the sockets RPCs go on (SetDefaultFraming), responses and requests are then given whole to ReceiveMessage
+    static inline MessageFramer::Options Framing    ()          { return MessageFramer::LengthPrefixed(PREFIX_SIZE, MessageFramer::DEFAULT_MAX_MESSAGE_SIZE); }
+
+    // Length prefix and header of a payload of length bytes in out (HEADER_SIZE bytes), sent with the payload as one gather write
+    static inline void  Encode              (const Header &header, u_long length, char *out) {
+        auto   *bytes   = reinterpret_cast<u_char*>(out);
+        u_long  size    = length + HEADER_SIZE - PREFIX_SIZE;
+
+        for (int i = 0 ; i < 4 ; i++)
+            bytes[i] = static_cast<u_char>(size >> (24 - 8 * i));
+        bytes[4] = header.kind;
+        bytes[5] = header.status;
+        bytes[6] = static_cast<u_char>(header.method >> 8);
+        bytes[7] = static_cast<u_char>(header.method);
+        for (int i = 0 ; i < 8 ; i++)
+            bytes[8 + i] = static_cast<u_char>(header.id >> (56 - 8 * i));
+    }
+
+    // Header of a message given by ReceiveMessage (length prefix already taken out), false if it is too short or of an unknown kind
+    static inline bool  Decode              (const char *message, u_long length, Header &header) {
+        auto *bytes = reinterpret_cast<const u_char*>(message);
+
+        if (length < HEADER_SIZE - PREFIX_SIZE || bytes[0] > RESPONSE)
+            return false;
+        header.kind = static_cast<Kind>(bytes[0]);
+        header.status = static_cast<Status>(bytes[1]);
+        header.method = static_cast<u_short>((bytes[2] << 8) | bytes[3]);
+        header.id = 0;
+        for (int i = 4 ; i < 12 ; i++)
+            header.id = (header.id << 8) | bytes[i];
+        return true;
+    }
+};
+////////////// RpcFrame ////////////
+
+#endif //SOCKETMANAGER_RPCFRAME_H
@@ -0,0 +1,33 @@
+#include "RpcHandler.h"
+
+int RpcHandler::ReceiveData(SocketManager &manager, const char *data, u_long length, Socket *socket) {
+    LOG_ERROR("RPC request on a socket without RpcFrame::Framing\n");
+    CloseSocket(manager, socket);
+    return 1;
+}
+
+int RpcHandler::ReceiveMessage(SocketManager &manager, const char *data, u_long length, Socket *socket) {
+    RpcFrame::Header header;
+
+    if (!RpcFrame::Decode(data, length, header) || header.kind != RpcFrame::REQUEST) {
+        CloseSocket(manager, socket);                           // the rest of the stream can't be trusted
+        return 1;
+    }
+    Call call{&manager, socket->GetId(), header.id, header.method};
+    HandleCall(call, data + RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE, length - (RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE), socket);
+    return 1;
+}
+
+bool RpcHandler::Reply(const Call &call, const char *data, u_long length, RpcFrame::Status status) {
+    char    header[RpcFrame::HEADER_SIZE];
+    WSABUF  pieces[2];
+
+    if (length > RpcFrame::MAX_PAYLOAD_SIZE)
+        return false;
+    RpcFrame::Encode(RpcFrame::Header{RpcFrame::RESPONSE, status, call.method, call.id}, length, header);
+    pieces[0].buf = header;
+    pieces[0].len = RpcFrame::HEADER_SIZE;
+    pieces[1].buf = const_cast<char*>(data);
+    pieces[1].len = length;
+    return call.manager->SendData(pieces, 2, call.socket);     // by id : the socket may have been closed and reused since the request
+}
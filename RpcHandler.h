@@ -0,0 +1,28 @@
+#ifndef SOCKETMANAGER_RPCHANDLER_H
+#define SOCKETMANAGER_RPCHANDLER_H
+
+#include "SocketManager.h"
+#include "RpcFrame.h"
+
+/************* RpcHandler ***********/
+class RpcHandler : public SocketHandler {   // Listener handler answering the requests of RpcClient, the manager must frame its sockets with RpcFrame::Framing
+public:
+    struct Call {                                               // What a response needs, copyable so it can be answered later from any thread
+        SocketManager * manager;                                // Owning the connection (shards)
+        UUID            socket;
+        ULONG64         id;
+        u_short         method;
+    };
+
+    int                 ReceiveData         (SocketManager &manager, const char *data, u_long length, Socket *socket) final;    // Socket not framed : closed
+    int                 ReceiveMessage      (SocketManager &manager, const char *data, u_long length, Socket *socket) final;
+protected:
+    // Handle one request, called on a worker thread for each request of a connection in the order they came. The payload is only valid until it returns.
+    // Answer it with Reply, before returning or later : responses of a connection go in any order, the client matches them by id.
+    virtual void        HandleCall          (const Call &call, const char *payload, u_long length, Socket *socket) = 0;
+
+    static bool         Reply               (const Call &call, const char *data, u_long length, RpcFrame::Status status = RpcFrame::OK);   // false if the connection is gone or refused it (backpressure)
+};
+////////////// RpcHandler ////////////
+
+#endif //SOCKETMANAGER_RPCHANDLER_H
@@ -0,0 +1,181 @@
+#ifndef SOCKETMANAGER_SHARDEDSERVER_H
+#define SOCKETMANAGER_SHARDEDSERVER_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "SocketManager.h"
+
+/************* ShardedServer ***********/
+template<typename Manager>
+class ShardedServer {                       // One server manager per core (own IOCP, worker thread, buffer/socket pools and socket map), all accepting on the same listen socket
+public:
+    typedef std::function<Manager*(DWORD threadCount, const SocketManager::Placement &placement)> Factory;  // Create one shard, both must be given to the SocketManager constructor
+
+private:
+    std::vector<std::unique_ptr<Manager>>   shards;                         // shards[0] owns the listen socket and receives the accept completions of every shard
+    UUID                                    listenId;                       // Last listener added
+
+    inline Manager *    Owner               (UUID socketId) {               // Shard owning a socket, from the index it stamped in the id : no lock taken (sockets never move between shards)
+        u_short index = SocketManager::ShardOf(socketId);
+        return index < shards.size() ? shards[index].get() : nullptr;
+    }
+
+public:
+    // shardCount 0 for one shard per processor, each with threadsPerShard worker threads.
+    // If pin is true, the threads of each shard are pinned to their own processors and its pools are allocated on the NUMA node of these processors.
+    explicit            ShardedServer       (const Factory &factory, DWORD shardCount = 0, DWORD threadsPerShard = 1, bool pin = true) : listenId(Misc::CreateNilUUID()) {
+        std::vector<std::pair<DWORD, DWORD>> processors;                    // node and index inside the node of every processor, node by node
+        for (DWORD node = 0 ; node < Numa::NodeCount() ; node++) {
+            DWORD count = static_cast<DWORD>(Numa::Processors(node).size());
+            for (DWORD i = 0 ; i < count ; i++)
+                processors.emplace_back(node, i);
+        }
+        if (shardCount == 0) {
+            SYSTEM_INFO systemInfo;
+            GetSystemInfo(&systemInfo);
+            shardCount = systemInfo.dwNumberOfProcessors;
+        }
+        for (DWORD i = 0 ; i < shardCount ; i++) {
+            SocketManager::Placement placement;
+            if (pin && !processors.empty()) {
+                const std::pair<DWORD, DWORD> &first = processors[(i * threadsPerShard) % processors.size()];
+                placement.numaNode = first.first;
+                placement.affinity = SocketManager::ThreadAffinity::CORE_AFFINITY;
+                placement.firstProcessor = first.second;
+            }
+            shards.emplace_back(factory(threadsPerShard, placement));
+            shards.back()->SetShardIndex(static_cast<u_short>(i));
+        }
+    }
+
+                        ~ShardedServer      () {
+        for (auto &shard : shards)          // listen socket shard first, its threads are the only ones seeing other shards' accept sockets
+            shard.reset();
+    }
+
+    UUID                ListenToNewSocket   (u_short port, bool fewCLientsExpected = false) {
+        std::vector<SocketManager*> managers;
+        for (auto &shard : shards)
+            managers.push_back(shard.get());
+        listenId = shards[0]->ListenToNewSocket(port, fewCLientsExpected, managers);
+        return listenId;
+    }
+
+    UUID                ListenToNewSocket   (const SocketManager::Listener &listener) {    // Any number of listeners, each one accepted by every shard with its own pending accepts
+        std::vector<SocketManager*> managers;
+        for (auto &shard : shards)
+            managers.push_back(shard.get());
+        listenId = shards[0]->ListenToNewSocket(listener, managers);
+        return listenId;
+    }
+
+    inline size_t       ShardCount          () const                                            { return shards.size(); }
+    inline Manager &    Shard               (size_t index)                                      { return *shards[index]; }
+    inline bool         isReady             () const                                            { for (auto &shard : shards) if (!shard->isReady()) return false; return true; }
+    inline bool         isServerSocketReady (UUID socketId)                                     { return shards[0]->isServerSocketReady(socketId); }
+    inline bool         isSocketInitialising(UUID socketId)                                     { Manager *shard = Owner(socketId); return shard != nullptr && shard->isSocketInitialising(socketId); }
+    inline bool         SendData            (const char *data, u_long length, UUID socketId, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)     { Manager *shard = Owner(socketId); return shard != nullptr && shard->SendData(data, length, socketId, sendClass); }
+    inline bool         SendData            (const WSABUF *pieces, DWORD count, UUID socketId, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)    { Manager *shard = Owner(socketId); return shard != nullptr && shard->SendData(pieces, count, socketId, sendClass); }
+    inline bool         SendMessage         (const char *data, u_long length, UUID socketId, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)     { Manager *shard = Owner(socketId); return shard != nullptr && shard->SendMessage(data, length, socketId, sendClass); }
+    inline bool         SendDataNoCopy      (const char *data, u_long length, UUID socketId, void *context = nullptr)  { Manager *shard = Owner(socketId); return shard != nullptr && shard->SendDataNoCopy(data, length, socketId, context); }
+    inline bool         SendFile            (HANDLE file, ULONG64 offset, ULONG64 length, UUID socketId, void *context = nullptr)   { Manager *shard = Owner(socketId); return shard != nullptr && shard->SendFile(file, offset, length, socketId, context); }
+    inline bool         RelayData           (UUID sourceId, UUID destinationId)                 { Manager *source = Owner(sourceId), *destination = Owner(destinationId); return source != nullptr && destination != nullptr && source->RelayData(sourceId, *destination, destinationId); }
+    inline void         SetDefaultFraming   (const MessageFramer::Options &options)             { for (auto &shard : shards) shard->SetDefaultFraming(options); }
+    inline void         SetZeroCopyThreshold(u_long threshold)                                  { for (auto &shard : shards) shard->SetZeroCopyThreshold(threshold); }
+    inline void         SetSendScheduling   (const SocketManager::SendScheduling &options)      { for (auto &shard : shards) shard->SetSendScheduling(options); }   // limits apply to each shard
+    inline void         SetSharedMemoryRing (DWORD capacity)                                    { for (auto &shard : shards) shard->SetSharedMemoryRing(capacity); }
+    inline void         SetCompression      (SocketManager::Compression compression)            { for (auto &shard : shards) shard->SetCompression(compression); }
+    inline int          SendDataToAll       (const char *data, u_long length)                   { int nbSucc = 0; for (auto &shard : shards) nbSucc += shard->SendDataToAll(data, length); return nbSucc; }
+    inline bool         Subscribe           (const std::string &topic, UUID socketId, SocketManager::Backpressure policy = SocketManager::Backpressure::DROP_NEWEST)    { Manager *shard = Owner(socketId); return shard != nullptr && shard->Subscribe(topic, socketId, policy); }
+    inline bool         Unsubscribe         (const std::string &topic, UUID socketId)           { Manager *shard = Owner(socketId); return shard != nullptr && shard->Unsubscribe(topic, socketId); }
+    inline int          Publish             (const std::string &topic, const char *data, u_long length)     { int nbSucc = 0; for (auto &shard : shards) nbSucc += shard->Publish(topic, data, length); return nbSucc; }    // topics are per shard, each one serializes its own copy
+
+    void                SetMemoryBudget     (const SocketManager::MemoryBudget &budget) {   // Shared evenly between shards
+        SocketManager::MemoryBudget shardBudget;
+        shardBudget.soft = budget.soft / shards.size();
+        shardBudget.hard = budget.hard / shards.size();
+        for (auto &shard : shards)
+            shard->SetMemoryBudget(shardBudget);
+    }
+
+    bool                SetTls              (const SocketManager::TlsOptions &options) {    // Every shard gets its own credentials on the same certificate
+        bool set = true;
+        for (auto &shard : shards)
+            set = shard->SetTls(options) && set;
+        return set;
+    }
+
+    bool                Drain               (DWORD timeoutMs) {                             // Every shard stops accepting and sending first, then they flush one by one in what is left of timeoutMs
+        DWORD   start   = GetTickCount();
+        bool    flushed = true;
+        for (auto &shard : shards)
+            shard->StartDrain();
+        for (auto &shard : shards) {
+            DWORD spent = GetTickCount() - start;
+            flushed = shard->Drain(spent < timeoutMs ? timeoutMs - spent : 0) && flushed;
+        }
+        return flushed;
+    }
+
+    SocketManager::MemoryStats GetMemoryStats() {                                           // Sum of all shards, pressure of the most loaded one
+        SocketManager::MemoryStats total{};
+        for (auto &shard : shards) {
+            SocketManager::MemoryStats stats = shard->GetMemoryStats();
+            total.bufferBytes += stats.bufferBytes;
+            total.socketBytes += stats.socketBytes;
+            total.usedBytes += stats.usedBytes;
+            total.peakBytes += stats.peakBytes;
+            total.pressure = stats.pressure > total.pressure ? stats.pressure : total.pressure;
+            total.pausedAccepts += stats.pausedAccepts;
+            total.acceptPauses += stats.acceptPauses;
+            total.rejectedSends += stats.rejectedSends;
+            total.readProbes += stats.readProbes;
+        }
+        return total;
+    }
+
+    SocketManager::TlsStats GetTlsStats() {                                                 // Sum of all shards
+        SocketManager::TlsStats total{};
+        for (auto &shard : shards) {
+            SocketManager::TlsStats stats = shard->GetTlsStats();
+            total.handshakes += stats.handshakes;
+            total.failures += stats.failures;
+        }
+        return total;
+    }
+
+    SocketManager::CompressionStats GetCompressionStats() {                                 // Sum of all shards
+        SocketManager::CompressionStats total{};
+        for (auto &shard : shards) {
+            SocketManager::CompressionStats stats = shard->GetCompressionStats();
+            total.negotiated += stats.negotiated;
+            total.refused += stats.refused;
+            total.contextsCreated += stats.contextsCreated;
+            total.contextsReused += stats.contextsReused;
+            total.batches += stats.batches;
+            total.blocks += stats.blocks;
+            total.storedBlocks += stats.storedBlocks;
+            total.rawBytesSent += stats.rawBytesSent;
+            total.packedBytesSent += stats.packedBytesSent;
+            total.packedBytesReceived += stats.packedBytesReceived;
+            total.rawBytesReceived += stats.rawBytesReceived;
+        }
+        return total;
+    }
+
+    SocketManager::PubSubStats GetPubSubStats() {                                           // Sum of all shards, a publication counts once per shard with subscribers
+        SocketManager::PubSubStats total{};
+        for (auto &shard : shards) {
+            SocketManager::PubSubStats stats = shard->GetPubSubStats();
+            total.published += stats.published;
+            total.delivered += stats.delivered;
+            total.dropped += stats.dropped;
+            total.disconnected += stats.disconnected;
+        }
+        return total;
+    }
+};
+////////////// ShardedServer ////////////
+
+#endif //SOCKETMANAGER_SHARDEDSERVER_H
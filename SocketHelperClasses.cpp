@@ -9,6 +9,7 @@ void Socket::Delete(Socket *obj) {
             LOG("closing socket\n");
             obj->Close(obj->state == FAILURE);
         }
+        obj->ReleaseCompression();          // sockets deleted without being closed (disconnected for reuse) too
     }
     LeaveCriticalSection(&obj->SockCritSec);
     ListElt<Socket>::Delete(obj);
@@ -23,7 +24,7 @@ void Socket::DeleteOrDisconnect(Socket *obj, CriticalMap<UUID, Socket*> &critMap
         if (obj->state < DISCONNECTING) {
             switch (obj->state){
                 case CLOSING : {
-                    if (obj->client->ShouldReuseSocket()) {
+                    if (!obj->datagram && obj->af != AF_UNIX && obj->client->ShouldReuseSocket()) {     // DisconnectEx is TCP only
                         LOG("disconnecting socket\n");
                         obj->Disconnect(critMap);
                         return;
@@ -53,6 +54,8 @@ void Socket::DeleteOrDisconnect(Socket *obj, CriticalMap<UUID, Socket*> &critMap
             LeaveCriticalSection(&critMap.critSec);
         }
         needDelete = obj->state == CLOSED || obj->state == RETRY_CONNECTION;
+        if (needDelete)
+            obj->ReleaseCompression();
     }
     LeaveCriticalSection(&obj->SockCritSec);
     if (needDelete)
@@ -62,6 +65,17 @@ void Socket::DeleteOrDisconnect(Socket *obj, CriticalMap<UUID, Socket*> &critMap
 void Socket::Disconnect(CriticalMap<UUID, Socket*> &critMap) {
     int err;
 
+    ReleaseContext();                       // the next connection of the socket starts without it
+    LeaveTopics();
+    ReleasePausedFiles();
+    NotifyTlsClose();
+    delete tls;                             // the next connection of the socket gets its own
+    tls = nullptr;
+    if (compression != nullptr)             // but keeps the compression contexts
+        compression->Reset();
+    compressionPending = false;
+    compressed = false;
+
     // ----------------------------- enqueue disconnect operation
     Buffer *disconnectobj = Buffer::Create(client->inUseBufferList, Buffer::Operation::Disconnect);
     if (!SocketManager::DisconnectEx(s,                           // hSocket : A handle to a connected, connection-oriented socket.
@@ -81,10 +95,75 @@ void Socket::Disconnect(CriticalMap<UUID, Socket*> &critMap) {
     LOG("DisconnectEx ok\n");
 }
 
+void Socket::NotifyTlsClose() {
+    std::string alert;
+
+    if (tls == nullptr || !tls->Shutdown(alert))
+        return;
+    // ----------------------------- a few bytes after the sends already done, no buffer of the pool has to outlive the session for them
+    if (send(s,                                         //s : A descriptor identifying a connected socket.
+             alert.data(),                              //buf : A pointer to a buffer containing the data to be transmitted.
+             static_cast<int>(alert.size()),            //len : The length, in bytes, of the data in buffer pointed to by the buf parameter.
+             0                                          //flags : A set of flags that specify the way in which the call is made.
+    ) == SOCKET_ERROR) {
+        LOG_ERROR("send of TLS close_notify failed / error %d\n", WSAGetLastError());
+    }
+}
+
+void Socket::ReleaseContext() {
+    void *released = context;
+
+    if (released == nullptr)
+        return;
+    context = nullptr;
+    if (handler != nullptr)
+        handler->ReleaseContext(*client, released, this);
+    else
+        client->ReleaseContext(released, this);
+}
+
+void Socket::LeaveTopics() {
+    for (Topic *topic : topics)
+        topic->Remove(id);
+    topics.clear();
+    for (Publication *publication : publications)
+        Publication::Release(publication);
+    publications.clear();
+    publicationBytes = 0;
+}
+
+void Socket::ReleasePausedFiles() {
+    for (Buffer *fileObj : pausedFiles) {
+        client->ReleaseFile(fileObj->file, fileObj->context, false, this);
+        Buffer::Delete(fileObj);
+    }
+    pausedFiles.clear();
+}
+
+void Socket::ReleaseCompression() {
+    if (compression != nullptr)
+        client->ReturnCompression(compression);
+    compression = nullptr;
+    compressionPending = false;
+    compressed = false;
+}
+
 void Socket::Close(bool forceClose) {
     int err;
 
-    if (!forceClose) {
+    ReleaseContext();
+    LeaveTopics();
+    ReleasePausedFiles();
+    delete ring;                            // no read is posted anymore, and senders check it under the socket lock
+    ring = nullptr;
+    negotiating = false;
+    if (!forceClose)
+        NotifyTlsClose();
+    delete tls;
+    tls = nullptr;
+    ReleaseCompression();
+
+    if (!forceClose && !datagram) {
     // ----------------------------- shutdown connexion
         if (shutdown(s, SD_SEND) == SOCKET_ERROR) {
             err = WSAGetLastError();
@@ -95,7 +174,7 @@ void Socket::Close(bool forceClose) {
             forceClose = true;
         }
     }
-    if (forceClose) {
+    if (forceClose && !datagram) {        // no connection to abort on a datagram socket
         // ------------------------- change socket option to trigger abortive close
         linger sl = { 1,                                    //l_onoff : non-zero value enables linger option in kernel.
                       0 };                                  //l_linger : timeout interval in seconds.
@@ -119,4 +198,528 @@ void Socket::Close(bool forceClose) {
     }
     s = INVALID_SOCKET;
     state = CLOSED;
-}
\ No newline at end of file
+}
+const char SharedRing::HELLO_MAGIC[8]  = {'S', 'M', 'R', 'I', 'N', 'G', '0', '1'};
+const char SharedRing::ANSWER_OK[8]    = {'S', 'M', 'R', 'I', 'N', 'G', 'O', 'K'};
+const char SharedRing::ANSWER_NO[8]    = {'S', 'M', 'R', 'I', 'N', 'G', 'N', 'O'};
+
+SharedRing::SharedRing(HANDLE m, char *v, DWORD c, bool creator) : mapping(m), view(v), capacity(c), broken(false) {
+    auto *controls  = reinterpret_cast<Control*>(v);
+    char *data      = v + 2 * sizeof(Control);
+
+    tx = creator ? controls : controls + 1;         // client to server first, then server to client
+    rx = creator ? controls + 1 : controls;
+    txData = creator ? data : data + c;
+    rxData = creator ? data + c : data;
+}
+
+SharedRing::~SharedRing() {
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+}
+
+SharedRing *SharedRing::Create(DWORD capacity, Hello &hello) {
+    static volatile LONG    counter     = 0;
+    ULONG64                 size        = 2 * sizeof(Control) + 2 * static_cast<ULONG64>(capacity);
+    HANDLE                  mapping;
+    char                   *view;
+
+    memcpy(hello.magic, HELLO_MAGIC, sizeof(hello.magic));
+    hello.capacity = capacity;
+    snprintf(hello.name, sizeof(hello.name), "Local\\SocketManagerRing-%lu-%ld", GetCurrentProcessId(), InterlockedIncrement(&counter));
+    if ((mapping = CreateFileMappingA(INVALID_HANDLE_VALUE,                     //hFile : INVALID_HANDLE_VALUE -> the mapping is backed by the paging file, zero initialised.
+                                      nullptr,                                  //lpFileMappingAttributes : nullptr -> default security, processes of the same user can open it.
+                                      PAGE_READWRITE,                           //flProtect : Allows views to be mapped for read-only, copy-on-write, or read/write access.
+                                      static_cast<DWORD>(size >> 32),           //dwMaximumSizeHigh : The high-order DWORD of the maximum size of the file mapping object.
+                                      static_cast<DWORD>(size),                 //dwMaximumSizeLow : The low-order DWORD of the maximum size of the file mapping object.
+                                      hello.name                                //lpName : The name of the file mapping object.
+    )) == nullptr) {
+        LOG_ERROR("CreateFileMapping failed / error %lu\n", GetLastError());
+        return nullptr;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {   // someone else's, never share it
+        LOG_ERROR("file mapping %s already exists\n", hello.name);
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    if ((view = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0))) == nullptr) {
+        LOG_ERROR("MapViewOfFile failed / error %lu\n", GetLastError());
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    auto *ring = new SharedRing(mapping, view, capacity, true);
+    ring->tx->waiting = 1;                          // both consumers start waiting for a doorbell
+    ring->rx->waiting = 1;
+    return ring;
+}
+
+SharedRing *SharedRing::Open(const Hello &hello) {
+    HANDLE  mapping;
+    char   *view;
+    char    name[NAME_SIZE];
+
+    if (memcmp(hello.magic, HELLO_MAGIC, sizeof(hello.magic)) != 0 || hello.capacity == 0 || (hello.capacity & (hello.capacity - 1)) != 0)
+        return nullptr;
+    memcpy(name, hello.name, sizeof(name));
+    name[sizeof(name) - 1] = '\0';
+    if ((mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name)) == nullptr) {
+        LOG_ERROR("OpenFileMapping %s failed / error %lu\n", name, GetLastError());
+        return nullptr;
+    }
+    if ((view = static_cast<char*>(MapViewOfFile(mapping,                       //hFileMappingObject : A handle to a file mapping object.
+                                                 FILE_MAP_ALL_ACCESS,           //dwDesiredAccess : The type of access to a file mapping object, which determines the page protection of the pages.
+                                                 0, 0,                          //dwFileOffsetHigh, dwFileOffsetLow : Offset where the view begins.
+                                                 2 * sizeof(Control) + 2 * static_cast<SIZE_T>(hello.capacity)     //dwNumberOfBytesToMap : Fails if the mapping is smaller than the capacity announced.
+    ))) == nullptr) {
+        LOG_ERROR("MapViewOfFile failed / error %lu\n", GetLastError());
+        CloseHandle(mapping);
+        return nullptr;
+    }
+    return new SharedRing(mapping, view, hello.capacity, false);
+}
+
+bool SharedRing::Write(const WSABUF *pieces, DWORD count, u_long length, bool &wake) {
+    LONG64  head    = tx->head;
+    LONG64  tail    = tx->tail;                     // once : the peer moves it, and may write anything there
+    ULONG64 used    = static_cast<ULONG64>(head) - static_cast<ULONG64>(tail);
+
+    wake = false;
+    if (used > capacity) {                          // a tail past the head would let the copies below run out of the ring
+        broken = true;
+        return false;
+    }
+    if (length > capacity - used)
+        return false;
+    for (DWORD i = 0 ; i < count ; i++) {
+        u_long offset = static_cast<u_long>(head) & (capacity - 1);
+        u_long first = pieces[i].len < capacity - offset ? pieces[i].len : capacity - offset;  // up to the end of the ring, the rest from its start
+        memcpy(txData + offset, pieces[i].buf, first);
+        memcpy(txData, pieces[i].buf + first, pieces[i].len - first);
+        head += pieces[i].len;
+    }
+    InterlockedExchange64(&tx->head, head);         // full barrier : the data is visible before the head, and the head before waiting is read
+    wake = InterlockedExchange(&tx->waiting, 0) == 1;
+    return true;
+}
+
+u_long SharedRing::Peek(const char *&data) {
+    LONG64  tail    = rx->tail;
+    LONG64  head    = rx->head;
+
+    MemoryBarrier();                                // the data is read after the head it was published with
+    if (static_cast<ULONG64>(head) - static_cast<ULONG64>(tail) > capacity) {     // same for a head more than a ring ahead, or behind the tail
+        broken = true;
+        data = rxData;
+        return 0;
+    }
+    u_long offset = static_cast<u_long>(tail) & (capacity - 1);
+    u_long length = static_cast<u_long>(head - tail);
+    data = rxData + offset;
+    return length < capacity - offset ? length : capacity - offset;
+}
+
+void SharedRing::Consume(u_long length) {
+    InterlockedExchange64(&rx->tail, rx->tail + length);    // full barrier : the data is read before the producer may overwrite it
+}
+
+bool SharedRing::Sleep() {
+    InterlockedExchange(&rx->waiting, 1);           // full barrier : the producer sees it, or we see its head
+    if (rx->head == rx->tail)
+        return true;
+    InterlockedExchange(&rx->waiting, 0);           // a doorbell may still come, it finds the ring empty
+    return false;
+}
+
+TlsSession::TlsSession(CredHandle *c, bool s, const char *name) : credentials(c), context{}, hasContext(false), server(s), serverName(name != nullptr ? name : ""),
+                                                                    established(false), renegotiating(false), sizes{}, input(RECORD_SIZE), inputLength(0), pending(0) {}
+
+TlsSession::~TlsSession() {
+    if (hasContext)
+        DeleteSecurityContext(&context);
+}
+
+bool TlsSession::Grow() {
+    if (input.size() >= MAX_HANDSHAKE_SIZE)
+        return false;
+    input.resize(input.size() * 2 > MAX_HANDSHAKE_SIZE ? MAX_HANDSHAKE_SIZE : input.size() * 2);
+    return true;
+}
+
+void TlsSession::KeepExtra(const SecBuffer &extra) {
+    if (extra.BufferType == SECBUFFER_EXTRA && extra.cbBuffer > 0) {
+        memmove(input.data(), input.data() + inputLength - extra.cbBuffer, extra.cbBuffer);
+        inputLength = extra.cbBuffer;
+    } else {
+        inputLength = 0;
+    }
+}
+
+SECURITY_STATUS TlsSession::Handshake(std::string &output) {
+    SECURITY_STATUS status;
+
+    do {
+        SecBuffer       inBuffers[2]    = {{inputLength, SECBUFFER_TOKEN, input.data()}, {0, SECBUFFER_EMPTY, nullptr}};
+        SecBuffer       outBuffers[1]   = {{0, SECBUFFER_TOKEN, nullptr}};
+        SecBufferDesc   inDesc          = {SECBUFFER_VERSION, 2, inBuffers};
+        SecBufferDesc   outDesc         = {SECBUFFER_VERSION, 1, outBuffers};
+        ULONG           attributes      = 0;
+
+        if (server) {
+            status = AcceptSecurityContext(credentials,                     //phCredential : Credentials of the server.
+                                           hasContext ? &context : nullptr, //phContext : nullptr on the first call, the partial context after.
+                                           &inDesc,                         //pInput : Token sent by the client, and room for the extra bytes.
+                                           ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+                                           ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM,  //fContextReq : Stream context, output allocated by SChannel.
+                                           0,                               //TargetDataRep : Unused by SChannel.
+                                           &context,                        //phNewContext : Receives the context.
+                                           &outDesc,                        //pOutput : Token to send to the client.
+                                           &attributes,                     //pfContextAttr : Attributes of the established context.
+                                           nullptr                          //ptsTimeStamp : Optional expiration time.
+            );
+        } else {
+            status = InitializeSecurityContextA(credentials,                //phCredential : Credentials of the client.
+                                                hasContext ? &context : nullptr,    //phContext : nullptr on the first call, the partial context after.
+                                                const_cast<SEC_CHAR*>(serverName.c_str()),  //pszTargetName : Name checked against the certificate and sent as SNI.
+                                                ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+                                                ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM,  //fContextReq : Stream context, output allocated by SChannel.
+                                                0,                          //Reserved1 : Must be zero.
+                                                0,                          //TargetDataRep : Unused by SChannel.
+                                                hasContext ? &inDesc : nullptr,     //pInput : Token sent by the server, none on the first call.
+                                                0,                          //Reserved2 : Must be zero.
+                                                &context,                   //phNewContext : Receives the context.
+                                                &outDesc,                   //pOutput : Token to send to the server.
+                                                &attributes,                //pfContextAttr : Attributes of the established context.
+                                                nullptr                     //ptsExpiry : Optional expiration time.
+            );
+        }
+        if (outBuffers[0].pvBuffer != nullptr) {
+            output.append(static_cast<char*>(outBuffers[0].pvBuffer), outBuffers[0].cbBuffer);
+            FreeContextBuffer(outBuffers[0].pvBuffer);
+        }
+        if (status == SEC_E_INCOMPLETE_MESSAGE)         // input kept as is, read the rest of the message
+            return status;
+        if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED)
+            return status;
+        hasContext = true;
+        KeepExtra(inBuffers[1]);
+    } while (status == SEC_I_CONTINUE_NEEDED && inputLength > 0);
+
+    if (status == SEC_E_OK) {
+        if (!established && (status = QueryContextAttributesA(&context, SECPKG_ATTR_STREAM_SIZES, &sizes)) != SEC_E_OK)
+            return status;
+        established = true;
+        renegotiating = false;
+    }
+    return status;
+}
+
+SECURITY_STATUS TlsSession::Decrypt(const char *&data, u_long &length) {
+    SecBuffer       buffers[4]  = {{inputLength, SECBUFFER_DATA, input.data()}, {0, SECBUFFER_EMPTY, nullptr},
+                                   {0, SECBUFFER_EMPTY, nullptr}, {0, SECBUFFER_EMPTY, nullptr}};
+    SecBufferDesc   desc        = {SECBUFFER_VERSION, 4, buffers};
+    SECURITY_STATUS status;
+
+    data = nullptr;
+    length = 0;
+    pending = 0;
+    if (inputLength == 0)
+        return SEC_E_INCOMPLETE_MESSAGE;
+    status = DecryptMessage(&context, &desc, 0, nullptr);
+    if (status != SEC_E_OK && status != SEC_I_RENEGOTIATE)
+        return status;
+    for (SecBuffer &buffer : buffers) {                 // plaintext stays in the input, between header and trailer
+        if (buffer.BufferType == SECBUFFER_DATA) {
+            data = static_cast<const char*>(buffer.pvBuffer);
+            length = buffer.cbBuffer;
+        } else if (buffer.BufferType == SECBUFFER_EXTRA) {
+            pending = buffer.cbBuffer;
+        }
+    }
+    if (status == SEC_I_RENEGOTIATE)                    // the extra bytes are a handshake message, given to Handshake
+        renegotiating = true;
+    return status;
+}
+
+void TlsSession::Consume() {
+    memmove(input.data(), input.data() + inputLength - pending, pending);
+    inputLength = pending;
+    pending = 0;
+}
+
+u_long TlsSession::Seal(char *record, u_long length) {
+    SecBuffer       buffers[4]  = {{sizes.cbHeader, SECBUFFER_STREAM_HEADER, record},
+                                   {length, SECBUFFER_DATA, record + sizes.cbHeader},
+                                   {sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, record + sizes.cbHeader + length},
+                                   {0, SECBUFFER_EMPTY, nullptr}};
+    SecBufferDesc   desc        = {SECBUFFER_VERSION, 4, buffers};
+
+    if (EncryptMessage(&context, 0, &desc, 0) != SEC_E_OK)
+        return 0;
+    return buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer;
+}
+
+bool TlsSession::Shutdown(std::string &output) {
+    DWORD           token           = SCHANNEL_SHUTDOWN;
+    SecBuffer       inBuffers[1]    = {{sizeof(token), SECBUFFER_TOKEN, &token}};
+    SecBuffer       outBuffers[1]   = {{0, SECBUFFER_TOKEN, nullptr}};
+    SecBufferDesc   inDesc          = {SECBUFFER_VERSION, 1, inBuffers};
+    SecBufferDesc   outDesc         = {SECBUFFER_VERSION, 1, outBuffers};
+    ULONG           attributes      = 0;
+    SECURITY_STATUS status;
+
+    if (!established || ApplyControlToken(&context, &inDesc) != SEC_E_OK)
+        return false;
+    // ----------------------------- the next handshake call makes the alert record instead of a handshake message
+    if (server) {
+        status = AcceptSecurityContext(credentials,                         //phCredential : Credentials of the server.
+                                       &context,                            //phContext : The context the shutdown token was applied to.
+                                       nullptr,                             //pInput : No input for a shutdown.
+                                       ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+                                       ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM,  //fContextReq : Same as the handshake, output allocated by SChannel.
+                                       0,                                   //TargetDataRep : Unused by SChannel.
+                                       &context,                            //phNewContext : Same context.
+                                       &outDesc,                            //pOutput : Receives the close_notify alert.
+                                       &attributes,                         //pfContextAttr : Attributes of the context.
+                                       nullptr                              //ptsTimeStamp : Optional expiration time.
+        );
+    } else {
+        status = InitializeSecurityContextA(credentials,                    //phCredential : Credentials of the client.
+                                            &context,                       //phContext : The context the shutdown token was applied to.
+                                            const_cast<SEC_CHAR*>(serverName.c_str()),  //pszTargetName : Same name as the handshake.
+                                            ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+                                            ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM,  //fContextReq : Same as the handshake, output allocated by SChannel.
+                                            0,                              //Reserved1 : Must be zero.
+                                            0,                              //TargetDataRep : Unused by SChannel.
+                                            nullptr,                        //pInput : No input for a shutdown.
+                                            0,                              //Reserved2 : Must be zero.
+                                            &context,                       //phNewContext : Same context.
+                                            &outDesc,                       //pOutput : Receives the close_notify alert.
+                                            &attributes,                    //pfContextAttr : Attributes of the context.
+                                            nullptr                         //ptsExpiry : Optional expiration time.
+        );
+    }
+    if (outBuffers[0].pvBuffer != nullptr) {
+        output.append(static_cast<char*>(outBuffers[0].pvBuffer), outBuffers[0].cbBuffer);
+        FreeContextBuffer(outBuffers[0].pvBuffer);
+    }
+    established = false;                                // no record can be sealed after the alert
+    return (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED) && !output.empty();
+}
+
+const char CompressionSession::HELLO_MAGIC[8]  = {'S', 'M', 'Z', 'I', 'P', '0', '0', '1'};
+const char CompressionSession::ANSWER_OK[8]    = {'S', 'M', 'Z', 'I', 'P', '0', 'O', 'K'};
+const char CompressionSession::ANSWER_NO[8]    = {'S', 'M', 'Z', 'I', 'P', '0', 'N', 'O'};
+
+CompressionSession::CompressionSession(DWORD a, COMPRESSOR_HANDLE c, DECOMPRESSOR_HANDLE d) : algorithm(a), compressor(c), decompressor(d), ratio(32), staged(), posted(0),
+                                                                                            input(), inputLength(0), output(MAX_RAW_SIZE) {}
+
+CompressionSession::~CompressionSession() {
+    CloseCompressor(compressor);
+    CloseDecompressor(decompressor);
+}
+
+CompressionSession *CompressionSession::Create(DWORD algorithm) {
+    COMPRESSOR_HANDLE   compressor;
+    DECOMPRESSOR_HANDLE decompressor;
+
+    if (algorithm != COMPRESS_ALGORITHM_XPRESS && algorithm != COMPRESS_ALGORITHM_XPRESS_HUFF)
+        return nullptr;
+    if (!CreateCompressor(algorithm | COMPRESS_RAW,         //Algorithm : The type of compression algorithm and mode to be used by this compressor. Raw : no header of the API around the blocks, they get ours.
+                          nullptr,                          //AllocationRoutines : Optional memory allocation and deallocation routines, nullptr for the default ones.
+                          &compressor)) {                   //CompressorHandle : If the function succeeds, the handle to the specified compressor.
+        LOG_ERROR("CreateCompressor failed / error %lu\n", GetLastError());
+        return nullptr;
+    }
+    if (!CreateDecompressor(algorithm | COMPRESS_RAW,       //Algorithm : The type of compression algorithm and mode to be used by this decompressor, the same as the peer's compressor.
+                            nullptr,                        //AllocationRoutines : Optional memory allocation and deallocation routines, nullptr for the default ones.
+                            &decompressor)) {               //DecompressorHandle : If the function succeeds, the handle to the specified decompressor.
+        LOG_ERROR("CreateDecompressor failed / error %lu\n", GetLastError());
+        CloseCompressor(compressor);
+        return nullptr;
+    }
+    return new CompressionSession(algorithm, compressor, decompressor);
+}
+
+void CompressionSession::Stage(const WSABUF *pieces, DWORD count) {
+    for (DWORD i = 0 ; i < count ; i++)
+        staged.insert(staged.end(), pieces[i].buf, pieces[i].buf + pieces[i].len);
+}
+
+void CompressionSession::Reset() {
+    ratio = 32;
+    staged.clear();                                     // its capacity is kept, like the contexts
+    posted = 0;
+    inputLength = 0;
+}
+
+u_long CompressionSession::Pack(const char *raw, u_long length, char *block, u_long room, u_long &size, bool &stored) {
+    u_long  body    = room - HEADER_SIZE;
+    u_long  take    = length < MAX_RAW_SIZE ? length : MAX_RAW_SIZE;
+    SIZE_T  packed  = 0;
+
+    // ----------------------------- as many raw bytes as the ratio of the last block says fit in the body, half as many after each try that didn't
+    if (take > body * ratio / 16)
+        take = body * ratio / 16;
+    stored = true;
+    while (true) {
+        if (Compress(compressor,                        //CompressorHandle : Handle to a compressor returned by CreateCompressor.
+                     raw,                               //UncompressedData : Contains the block of information that is to be compressed.
+                     take,                              //UncompressedDataSize : The size in bytes of the uncompressed information.
+                     block + HEADER_SIZE,               //CompressedBuffer : The buffer that receives the compressed information, the send buffer itself after the block header.
+                     body,                              //CompressedBufferSize : The size in bytes of the CompressedBuffer buffer, fails with ERROR_INSUFFICIENT_BUFFER if the block doesn't fit.
+                     &packed) && packed < take) {       //CompressedDataSize : The actual size in bytes of the compressed information received.
+            stored = false;
+            break;
+        }
+        if (take <= body)                               // doesn't get smaller, sent as is
+            break;
+        take = take / 2 > body ? take / 2 : body;
+    }
+    if (stored) {
+        memcpy(block + HEADER_SIZE, raw, take);
+        packed = take;
+        ratio = 16;
+    } else {                                            // 7/8 of the ratio just seen, so the next block of the same data fits at the first try
+        ratio = static_cast<u_long>(take * 14 / packed);
+        if (ratio < 16)
+            ratio = 16;
+        if (ratio > MAX_RAW_SIZE * 16 / body)
+            ratio = MAX_RAW_SIZE * 16 / body;
+    }
+    Write32(block, static_cast<u_long>(packed) | (stored ? STORED_FLAG : 0));
+    Write32(block + 4, take);
+    size = HEADER_SIZE + static_cast<u_long>(packed);
+    return take;
+}
+
+bool CompressionSession::Inflate(const char *block, u_long packed, u_long raw) {
+    SIZE_T inflated = 0;
+
+    return Decompress(decompressor,                     //DecompressorHandle : Handle to a decompressor returned by CreateDecompressor.
+                      block,                            //CompressedData : Contains the block of information that is to be decompressed.
+                      packed,                           //CompressedDataSize : The size in bytes of the compressed information.
+                      output.data(),                    //UncompressedBuffer : The buffer that receives the uncompressed information.
+                      raw,                              //UncompressedBufferSize : Exactly the raw size of the block in raw mode, which has no header to take it from.
+                      &inflated) && inflated == raw;    //UncompressedDataSize : The actual size in bytes of the uncompressed information received.
+}
+
+bool DnsCache::Get(const std::string &name, std::vector<SOCKADDR_STORAGE> &addresses) {
+    CriticalMap<std::string, Entry> &shard = Shard(name);
+    bool found = false;
+
+    EnterCriticalSection(&shard.critSec);
+    {
+        auto it = shard.map.find(name);
+        if (it != shard.map.end()) {
+            if (static_cast<LONG>(GetTickCount() - it->second.expiry) < 0) {
+                addresses = it->second.addresses;
+                found = true;
+            } else {
+                shard.map.erase(it);
+            }
+        }
+    }
+    LeaveCriticalSection(&shard.critSec);
+    return found;
+}
+
+void DnsCache::Put(const std::string &name, const std::vector<SOCKADDR_STORAGE> &addresses, DWORD ttlMs) {
+    CriticalMap<std::string, Entry> &shard = Shard(name);
+    DWORD now = GetTickCount();
+
+    if (ttlMs == 0)                                     // must not be cached
+        return;
+    EnterCriticalSection(&shard.critSec);
+    {
+        if (shard.map.size() >= MAX_SHARD_ENTRIES && shard.map.find(name) == shard.map.end()) {
+            for (auto it = shard.map.begin() ; it != shard.map.end() ; ) {
+                if (static_cast<LONG>(now - it->second.expiry) >= 0)
+                    it = shard.map.erase(it);
+                else
+                    it++;
+            }
+            if (shard.map.size() >= MAX_SHARD_ENTRIES) {
+                auto first = shard.map.begin();
+                for (auto it = shard.map.begin() ; it != shard.map.end() ; it++) {
+                    if (static_cast<LONG>(it->second.expiry - first->second.expiry) < 0)
+                        first = it;
+                }
+                shard.map.erase(first);
+            }
+        }
+        Entry &entry = shard.map[name];
+        entry.addresses = addresses;
+        entry.expiry = now + ttlMs;
+    }
+    LeaveCriticalSection(&shard.critSec);
+}
+
+void DnsCache::Clear() {
+    for (auto &shard : shards) {
+        EnterCriticalSection(&shard.critSec);
+        {
+            shard.map.clear();
+        }
+        LeaveCriticalSection(&shard.critSec);
+    }
+}
+
+bool Topic::Add(UUID id, Backpressure policy) {
+    bool added;
+
+    EnterCriticalSection(&critSec);
+    {
+        auto it = subscribers.find(id);
+        added = it == subscribers.end();
+        if (added || it->second != policy) {
+            subscribers[id] = policy;
+            changed = 1;
+        }
+    }
+    LeaveCriticalSection(&critSec);
+    return added;
+}
+
+bool Topic::Remove(UUID id) {
+    bool removed;
+
+    EnterCriticalSection(&critSec);
+    {
+        removed = subscribers.erase(id) > 0;
+        if (removed)
+            changed = 1;
+    }
+    LeaveCriticalSection(&critSec);
+    return removed;
+}
+
+Topic::Snapshot *Topic::Acquire() {
+    Snapshot *snapshot;
+
+    if (changed) {
+        EnterCriticalSection(&critSec);
+        {
+            if (changed)
+                Rebuild();
+        }
+        LeaveCriticalSection(&critSec);
+    }
+    InterlockedIncrement(&readers);                     // current can't be released by a rebuild while counted here
+    snapshot = current;
+    InterlockedIncrement(&snapshot->refs);
+    InterlockedDecrement(&readers);
+    return snapshot;
+}
+
+void Topic::Rebuild() {
+    auto *snapshot = new Snapshot();
+
+    changed = 0;
+    snapshot->subscribers.reserve(subscribers.size());
+    for (auto &entry : subscribers)
+        snapshot->subscribers.push_back(Subscriber{entry.first, entry.second});
+    auto *previous = static_cast<Snapshot*>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&current), snapshot));
+    while (readers > 0)                                 // a publication may have read previous and not taken its reference yet, it is a few instructions away
+        YieldProcessor();
+    Release(previous);
+}
@@ -1,14 +1,23 @@
 #ifndef SOCKETMANAGER_SOCKETHELPERCLASSES_H
 #define SOCKETMANAGER_SOCKETHELPERCLASSES_H
 
+#include <cstring>
+#include <deque>
 #include <list>
 #include <queue>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include "socket_headers.h"
 #include "Misc.h"
+#include "MessageFramer.h"
+#include "NumaAllocator.h"
 #include "SocketManager.h"
 
 class SocketManager;
+class SocketHandler;
+class Socket;
+class Buffer;
 
 /*********** CriticalContainers *********/                        // Practical class to gather up a container and its critical section
 class CriticalContainerWrapper{
@@ -20,19 +29,26 @@ public:
 
 template<typename T>
 class CriticalRecyclableList : public CriticalContainerWrapper {    //prevent std::list malloc overhead by keeping a second list to store deleted element for later reuse
+public:
+    typedef std::list<T, NumaAllocator<T>>  List;                   //elements are allocated on a given NUMA node, or the default heap
+    typedef typename List::iterator         iterator;
+    static const size_t                     DEFAULT_MAX_RECYCLED_SIZE   = 250;
 private:
     size_t                      max_recycled_size;
-    std::list<T>                recycle_list;
+    List                        recycle_list;
 public:
-    std::list<T>                list;
+    List                        list;
+    volatile LONG64             allocated;                          //elements allocated, in use or kept for reuse
 
-    explicit                            CriticalRecyclableList<T>   (size_t s = 250) : CriticalContainerWrapper(), max_recycled_size(s) {}
+    explicit                            CriticalRecyclableList<T>   (size_t s = DEFAULT_MAX_RECYCLED_SIZE, DWORD numaNode = Numa::ANY_NODE) : CriticalContainerWrapper(), max_recycled_size(s),
+                                                                                                                                          recycle_list(NumaAllocator<T>(numaNode)), list(NumaAllocator<T>(numaNode)), allocated(0) {}
 
-    void                                erase                       (typename std::list<T>::iterator it){
+    void                                erase                       (iterator it){
         EnterCriticalSection(&critSec);
         {
             if (recycle_list.size() >= max_recycled_size) {
                 list.erase(it);
+                allocated--;
             } else {
                 recycle_list.splice(recycle_list.end(), list, it);
             }
@@ -41,11 +57,12 @@ public:
     }
 
     template<typename... Args>
-    typename std::list<T>::iterator     create                      (Args&&... args ){
+    iterator                            create                      (Args&&... args ){
         EnterCriticalSection(&critSec);
         //{
         if (recycle_list.empty()) {
             list.emplace_back(args...);
+            allocated++;
         } else {
             list.splice(list.end(), recycle_list, recycle_list.begin());
             list.back() = T(args...);
@@ -55,6 +72,15 @@ public:
         LeaveCriticalSection(&critSec);
         return newEltIt;
     }
+
+    void                                shrink                      (){     //free every element kept for reuse
+        EnterCriticalSection(&critSec);
+        {
+            allocated -= static_cast<LONG64>(recycle_list.size());
+            recycle_list.clear();
+        }
+        LeaveCriticalSection(&critSec);
+    }
 };
 
 template<typename T>
@@ -83,6 +109,297 @@ public:
 };
 //////////// CriticalContainers //////////
 
+/************* TokenBucket ***********/
+class TokenBucket {                         // Rate limit : bytes can be taken while tokens, refilled at rate bytes/s up to size, remain
+public:
+    double                      rate;                           // Bytes per second, 0 for no limit
+    double                      size;                           // Max burst in bytes
+    double                      tokens;                         // Can go negative when bytes are taken without checking
+    DWORD                       lastRefill;                     // Tick count of last refill
+
+                TokenBucket     ()                          : rate(0), size(0), tokens(0), lastRefill(0) {}
+
+    void        Configure       (double r, double s)        { rate = r; size = s; tokens = s; lastRefill = GetTickCount(); }
+    bool        CanTake         (u_long bytes) {            // a buffer bigger than the bucket can be taken once the bucket is full
+        if (rate <= 0)
+            return true;
+        DWORD now = GetTickCount();
+        tokens += rate * (now - lastRefill) / 1000.0;
+        if (tokens > size)
+            tokens = size;
+        lastRefill = now;
+        return tokens >= bytes || tokens >= size;
+    }
+    void        Take            (u_long bytes)              { if (rate > 0) tokens -= bytes; }
+};
+////////////// TokenBucket ////////////
+
+/************* ConnectRace ***********/
+class ConnectRace {                         // Happy Eyeballs (RFC 8305) : addresses of one connect tried by staggered parallel attempts, guarded by the manager's connectRaces lock
+public:
+    UUID                            id;                         // Id returned to the caller, in the socket map for one attempt at a time
+    SocketManager *                 client;                     // Manager connecting, the one the resolution completes on
+    const char *                    address;                    // As given by the caller, kept by the attempts
+    std::string                     host;                       // Copy of address resolved on a thread pool thread, after the caller returned
+    u_short                         port;
+    bool                            resolving;                  // Host name not resolved yet, no attempt can start
+    std::vector<SOCKADDR_STORAGE>   addresses;                  // Families interleaved, the first one resolved first
+    size_t                          next;                       // Index in addresses of the next attempt
+    std::vector<Socket*>            attempts;                   // Attempts whose connect is in flight
+    Socket *                        holder;                     // Attempt in the socket map under id
+    bool                            done;                       // An attempt connected or every one failed, the rest only waits for attempts in flight
+    DWORD                           nextAttemptTime;            // Tick count at which the next address is tried even if no attempt failed
+
+                ConnectRace     (UUID i, SocketManager *c, const char *a, u_short p) : id(i), client(c), address(a), host(a), port(p), resolving(false), addresses(), next(0), attempts(), holder(nullptr), done(false), nextAttemptTime(0) {}
+};
+////////////// ConnectRace ////////////
+
+/************* DnsCache ***********/
+class DnsCache {                            // Host names resolved, kept for the TTL of their records and failures too (negative caching), sharded by name so connects to different hosts seldom wait on the same lock
+public:
+    static const size_t         SHARD_COUNT                     = 16;
+    static const size_t         MAX_SHARD_ENTRIES               = 1024;         // Expired entries are dropped when a shard gets bigger, then the one expiring first
+
+    struct Entry {
+        std::vector<SOCKADDR_STORAGE>   addresses;                      // Port 0, families interleaved, empty for a name which failed to resolve
+        DWORD                           expiry;                         // Tick count from which the name must be resolved again
+    };
+private:
+    CriticalMap<std::string, Entry>     shards[SHARD_COUNT];
+
+    inline CriticalMap<std::string, Entry> &    Shard   (const std::string &name)   { return shards[std::hash<std::string>()(name) % SHARD_COUNT]; }
+public:
+    bool        Get             (const std::string &name, std::vector<SOCKADDR_STORAGE> &addresses);   // true if the name is cached and not expired, addresses empty for a cached failure
+    void        Put             (const std::string &name, const std::vector<SOCKADDR_STORAGE> &addresses, DWORD ttlMs);
+    void        Clear           ();
+};
+////////////// DnsCache ////////////
+
+/************* Topic ***********/
+class Topic : public CriticalContainerWrapper {     // Subscribers of one topic of a manager : changed under its lock, read by publications from an immutable snapshot without any lock
+public:
+    enum Backpressure {                                         // What a publication does to a subscriber whose pending send is full
+        DROP_NEWEST,                                            // It is dropped for this subscriber (default)
+        DROP_OLDEST,                                            // It is queued, the oldest queued publications are dropped to keep the queue within the max pending send
+        DISCONNECT                                              // The subscriber is too slow : it is closed abortively
+    };
+
+    struct Subscriber {
+        UUID                    id;
+        Backpressure            policy;
+    };
+
+    struct Snapshot {                                           // Subscribers at one time, never changed once current
+        volatile LONG           refs;                           // The topic's while it is current, and one per publication fanning out to it
+        std::vector<Subscriber> subscribers;
+
+                Snapshot        () : refs(1), subscribers() {}
+    };
+private:
+    std::unordered_map<UUID, Backpressure>  subscribers;        // Guarded by critSec, taken after the lock of a socket when both are
+    Snapshot * volatile         current;
+    volatile LONG               readers;                        // Publications between reading current and taking their reference on it
+    volatile LONG               changed;                        // subscribers changed since current was built
+
+    void        Rebuild         ();                             // New current from subscribers, lock held
+public:
+                Topic           () : CriticalContainerWrapper(), subscribers(), current(new Snapshot()), readers(0), changed(0) {}
+                ~Topic          ()                          { Release(current); }
+
+    bool        Add             (UUID id, Backpressure policy);     // false if it was subscribed already (its policy is changed)
+    bool        Remove          (UUID id);                          // false if it wasn't subscribed
+    Snapshot *  Acquire         ();                                 // Current subscribers, to give back to Release. The first publication after subscriptions changed rebuilds them, once for all the changes
+    static void Release         (Snapshot *snapshot)        { if (InterlockedDecrement(&snapshot->refs) == 0) delete snapshot; }
+};
+////////////// Topic ////////////
+
+/************* Publication ***********/
+class Publication {                         // One message published on a topic : copied once, sent to every subscriber from this memory, freed by the last send
+public:
+    volatile LONG               refs;                           // Fan-outs running, and sends posted or queued from it
+    std::vector<char>           data;
+    Topic::Snapshot *           snapshot;                       // Subscribers it goes to, released by the last fan-out
+    SocketManager *             manager;                        // Publishing manager, its worker threads fan out
+    volatile LONG               next;                           // Index in snapshot of the next batch of subscribers
+    volatile LONG               fanOuts;                        // Worker threads (and caller) still taking batches
+
+                Publication     (SocketManager *m, Topic::Snapshot *s) : refs(1), data(), snapshot(s), manager(m), next(0), fanOuts(1) {}
+
+    static void Release         (Publication *publication)  { if (InterlockedDecrement(&publication->refs) == 0) delete publication; }
+};
+////////////// Publication ////////////
+
+/************* SharedRing ***********/
+class SharedRing {                          // Two single producer single consumer byte rings in memory shared by the processes at both ends of a Unix domain socket, one per direction
+public:
+    static const size_t         NAME_SIZE                       = 52;
+    static const char           HELLO_MAGIC[8];                                 // First bytes of a client offering a ring
+    static const char           ANSWER_OK[8];                                   // Server answer, the ring is used from now on
+    static const char           ANSWER_NO[8];                                   // Server answer, the socket carries the data itself
+
+    struct Hello {                                                              // Sent by the client as the first bytes of the connection
+        char            magic[sizeof(HELLO_MAGIC)];
+        DWORD           capacity;                                               // Bytes of each ring, a power of 2
+        char            name[NAME_SIZE];                                        // Name of the file mapping
+    };
+private:
+    struct Control {                                                            // One direction, at the start of the mapping, each counter on its own cache line
+        alignas(64) volatile LONG64     head;                                   // Bytes written since the start, only moved by the producer
+        alignas(64) volatile LONG64     tail;                                   // Bytes read since the start, only moved by the consumer
+        alignas(64) volatile LONG       waiting;                                // Consumer found the ring empty and waits for a doorbell on the socket
+    };
+
+    HANDLE                      mapping;
+    char *                      view;
+    Control *                   tx;                                             // Ring written by this end
+    Control *                   rx;                                             // Ring read by this end
+    char *                      txData;
+    char *                      rxData;
+    DWORD                       capacity;
+    bool                        broken;                                         // The peer wrote counters no ring can have, the socket must be closed
+
+                SharedRing      (HANDLE m, char *v, DWORD c, bool creator);
+public:
+    static SharedRing * Create  (DWORD capacity, Hello &hello);                 // Client end, fills the hello to send, nullptr on failure
+    static SharedRing * Open    (const Hello &hello);                           // Server end of the ring a hello offers, nullptr on failure
+                ~SharedRing     ();
+
+    bool        Write           (const WSABUF *pieces, DWORD count, u_long length, bool &wake);    // Copy all pieces or nothing if they don't fit, wake is true if the consumer must get a doorbell
+    u_long      Peek            (const char *&data);                            // Bytes readable in one piece from data, 0 if the ring is empty
+    void        Consume         (u_long length);                                // Give bytes given by Peek back to the producer
+    bool        Sleep           ();                                             // Ask for a doorbell on the next write, false if data came meanwhile
+    inline bool IsBroken        () const        { return broken; }              // Write or Peek found the peer's counter out of the ring, nothing more can be trusted
+};
+////////////// SharedRing ////////////
+
+/************* TlsSession ***********/
+class TlsSession {                          // SChannel context of one socket : records are read straight into its input and decrypted there, sends are encrypted in place in their buffer
+public:
+    static const u_long         RECORD_SIZE                     = 16384 + 2048 + 5;     // Biggest TLS record (RFC 5246), plaintext + expansion + header
+    static const u_long         MAX_HANDSHAKE_SIZE              = 65536;                // The input grows up to this for handshake flights bigger than a record (certificate chains)
+private:
+    CredHandle *                credentials;                    // Manager's, outlives the session
+    CtxtHandle                  context;
+    bool                        hasContext;                     // context was created by the first handshake call
+    bool                        server;
+    std::string                 serverName;                     // Client : checked against the certificate and sent as SNI
+    bool                        established;                    // Handshake done, records can be sent
+    bool                        renegotiating;                  // A post-handshake message (TLS 1.3 session ticket, key update) waits in the input for the handshake
+    SecPkgContext_StreamSizes   sizes;
+    std::vector<char>           input;                          // Bytes read and not consumed yet, from its start
+    u_long                      inputLength;
+    u_long                      pending;                        // Bytes of input after the record being delivered, moved to its start by Consume
+
+    void        KeepExtra       (const SecBuffer &extra);                                   // Move the extra bytes at the end of the input to its start (or empty it)
+public:
+                TlsSession      (CredHandle *c, bool s, const char *name);
+                ~TlsSession     ();
+
+    inline bool         IsEstablished   () const        { return established; }
+    inline bool         IsHandshaking   () const        { return !established || renegotiating; }
+    inline u_long       Header          () const        { return sizes.cbHeader; }
+    inline u_long       Overhead        () const        { return sizes.cbHeader + sizes.cbTrailer; }
+    inline u_long       MaxMessage      () const        { return sizes.cbMaximumMessage; }
+    inline char *       ReadSpace       (u_long &length){ length = static_cast<u_long>(input.size()) - inputLength; return input.data() + inputLength; }  // Where the next recv goes
+    inline void         Received        (u_long length) { inputLength += length; }
+    bool                Grow            ();                                                 // Handshake with a full input : make room for more of its flight, false over MAX_HANDSHAKE_SIZE
+    SECURITY_STATUS     Handshake       (std::string &output);                              // Feed the input to the handshake, output gets what to send : SEC_E_OK once done, SEC_E_INCOMPLETE_MESSAGE or SEC_I_CONTINUE_NEEDED to wait for more, an error else
+    SECURITY_STATUS     Decrypt         (const char *&data, u_long &length);                // Decrypt the first record of the input in place, data is its plaintext (possibly empty) until Consume
+    void                Consume         ();                                                 // Drop the record Decrypt gave
+    u_long              Seal            (char *record, u_long length);                      // Encrypt length bytes at record + header in place, return the record length (0 on failure)
+    bool                Shutdown        (std::string &output);                              // Output gets the close_notify alert to send before a graceful close, false if there is none
+};
+////////////// TlsSession ////////////
+
+/************* CompressionSession ***********/
+class CompressionSession {                  // Compressor and decompressor of one algorithm, pooled by the manager and kept by a socket across its reuses : sends are packed by batches in blocks written straight into their buffers
+public:
+    static const u_long         HEADER_SIZE                     = 8;            // Before each block, big endian : packed length (high bit set for a block stored as is) and raw length
+    static const u_long         MAX_PACKED_SIZE                 = 4096;         // Header included, a block is sent in one buffer of the pool
+    static const u_long         MAX_RAW_SIZE                    = 65536;        // Raw bytes of one block, the more of them are packed together the better the ratio
+    static const u_long         STORED_FLAG                     = 0x80000000;
+    static const char           HELLO_MAGIC[8];                                 // First bytes of a client offering compression
+    static const char           ANSWER_OK[8];                                   // Server answer, blocks from now on in both directions
+    static const char           ANSWER_NO[8];                                   // Server answer, the socket carries raw data
+
+    struct Hello {                                                              // Sent by the client as the first bytes of the connection
+        char            magic[sizeof(HELLO_MAGIC)];
+        DWORD           algorithm;                                              // COMPRESS_ALGORITHM_XPRESS or COMPRESS_ALGORITHM_XPRESS_HUFF
+    };
+private:
+    DWORD                       algorithm;
+    COMPRESSOR_HANDLE           compressor;
+    DECOMPRESSOR_HANDLE         decompressor;
+    u_long                      ratio;                          // Raw bytes per packed byte of the last block, in 1/16, sizes the input of the next one
+    std::vector<char>           staged;                         // Raw bytes of the sends made while a batch is in flight, packed once it completes
+    LONG                        posted;                         // Blocks of the batch in flight, under the socket lock
+    char                        input[MAX_PACKED_SIZE];         // Block straddling reads, from its header
+    u_long                      inputLength;
+    std::vector<char>           output;                         // Raw bytes of the last block unpacked, MAX_RAW_SIZE
+
+                CompressionSession  (DWORD a, COMPRESSOR_HANDLE c, DECOMPRESSOR_HANDLE d);
+    bool        Inflate             (const char *block, u_long packed, u_long raw);     // Decompress a block body in output
+    static inline u_long    Read32  (const char *from)      { auto *bytes = reinterpret_cast<const u_char*>(from); return static_cast<u_long>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3]; }
+    static inline void      Write32 (char *to, u_long value){ for (int i = 0 ; i < 4 ; i++) to[i] = static_cast<char>(value >> (24 - 8 * i)); }
+public:
+    static CompressionSession * Create  (DWORD algorithm);                      // nullptr if the algorithm is unknown or its contexts can't be created
+                ~CompressionSession ();
+
+    inline DWORD        Algorithm       () const        { return algorithm; }
+    inline bool         IsBatchInFlight () const        { return posted > 0; }
+    inline void         Posted          ()              { posted++; }
+    inline bool         Completed       ()              { return --posted == 0; }  // A block of the batch was sent, true for the last one
+    inline std::vector<char> & Staged   ()              { return staged; }
+    void                Stage           (const WSABUF *pieces, DWORD count);    // Append the pieces to the staged bytes
+    void                Reset           ();                                     // Forget the connection, the contexts and the memory are kept for the next one
+    // Pack as many of length raw bytes as fit in one block at block (room bytes), size gets the block size and stored whether compression didn't help.
+    // Returns the raw bytes packed, fewer than length if the rest needs more blocks.
+    u_long              Pack            (const char *raw, u_long length, char *block, u_long room, u_long &size, bool &stored);
+
+    // Call onBlock(const char *raw, u_long length) -> bool for the raw bytes of each complete block of data, in place for a stored block read whole.
+    // onBlock returns false to stop (socket closed). Returns false on an invalid block.
+    template<typename F>
+    bool                Unpack          (const char *data, u_long length, F onBlock) {
+        while (length > 0) {
+            const char *block = data;
+            u_long      size;
+
+            if (inputLength == 0 && length >= HEADER_SIZE && length >= HEADER_SIZE + (Read32(data) & ~STORED_FLAG)) {
+                size = HEADER_SIZE + (Read32(data) & ~STORED_FLAG);     // whole block in this read
+                data += size;
+                length -= size;
+            } else {
+                // ----------------------------- block straddling reads : complete its header, then its body
+                u_long want = inputLength < HEADER_SIZE ? HEADER_SIZE : HEADER_SIZE + (Read32(input) & ~STORED_FLAG);
+                if (want > MAX_PACKED_SIZE)
+                    return false;
+                u_long take = want - inputLength < length ? want - inputLength : length;
+                memcpy(input + inputLength, data, take);
+                inputLength += take;
+                data += take;
+                length -= take;
+                if (inputLength < HEADER_SIZE || inputLength < HEADER_SIZE + (Read32(input) & ~STORED_FLAG))
+                    continue;
+                block = input;
+                size = inputLength;
+                inputLength = 0;
+            }
+            // ----------------------------- stored blocks are given where they are, packed ones once inflated
+            u_long packed = Read32(block);
+            u_long raw = Read32(block + 4);
+            bool stored = (packed & STORED_FLAG) != 0;
+            if (size == HEADER_SIZE || size > MAX_PACKED_SIZE || raw == 0 || raw > MAX_RAW_SIZE || (stored && raw != size - HEADER_SIZE))
+                return false;
+            if (!stored && !Inflate(block + HEADER_SIZE, size - HEADER_SIZE, raw))
+                return false;
+            if (!onBlock(stored ? block + HEADER_SIZE : output.data(), raw))
+                return true;
+        }
+        return true;
+    }
+};
+////////////// CompressionSession ////////////
+
 /************* ListElt ***********/
 template<typename T>
 class ListElt {                             // Object that manage itself inside its own container
@@ -91,7 +408,7 @@ protected:
     explicit        ListElt     (CriticalRecyclableList<T> &l)                    : critList(l) {}
 
     CriticalRecyclableList<T>       &critList;          // Reference to container of this element
-    typename std::list<T>::iterator it;                 // Iterator to itself to manipulate object in queue
+    typename CriticalRecyclableList<T>::iterator it;    // Iterator to itself to manipulate object in queue
 public:
     template<typename... Args>
     static T*       Create      (CriticalRecyclableList<T> &l, Args&&... args) {      // Factory function to return pointer to newly created element inside critList
@@ -146,11 +463,20 @@ public:
         CLOSED
     };
 
-    Socket(CriticalRecyclableList<Socket> &l, SocketManager *c, SOCKET s_, int af_) : ListElt(l), id(), address(""), port(0),
+    Socket(CriticalRecyclableList<Socket> &l, SocketManager *c, SOCKET s_, int af_) : ListElt(l), id(), address(""), host(), port(0),
                                                                             s(s_), af(af_), state(SocketState::INIT),
                                                                             OutstandingRecv(0), OutstandingSend(0),
                                                                             pendingByteSent(0), maxPendingByteSent(DEFAULT_MAX_PENDING_BYTE_SENT),
-                                                                            SockCritSec{}, client(c), timeWaitStartTime(0) {
+                                                                            SockCritSec{}, client(c), timeWaitStartTime(0),
+                                                                            relayTo(), relayManager(nullptr), relayPaused(false),
+                                                                            readsPaused(false), readHeld(false), drainNotify(false),
+                                                                            isbSampled(false), isbSampleTime(0), isbDelivered(0),
+                                                                            sendQueues(), deficit(0), inFlight(0), inBulkSend(false), inSendQueue(false), inControlQueue(false), sendBucket(),
+                                                                            readProbe{}, handler(nullptr), race(nullptr), raceAddress(0),
+                                                                            datagram(false), inlineCompletions(false), segmentOffload(false),
+                                                                            ring(nullptr), negotiating(false), tls(nullptr),
+                                                                            compression(nullptr), compressionPending(false), compressed(false),
+                                                                            topics(), publications(), publicationBytes(0), pausedFiles(), context(nullptr) {
         InitializeCriticalSection(&SockCritSec);
     }
 
@@ -162,24 +488,67 @@ public:
         id = sock.id;
         s = sock.s;
         address = sock.address;
+        host = sock.host;
         port = sock.port;
         state = sock.state;
         af = sock.af;
         OutstandingRecv = sock.OutstandingRecv;
         OutstandingSend = sock.OutstandingSend;
         pendingByteSent = sock.pendingByteSent;
+        maxPendingByteSent = sock.maxPendingByteSent;
         SockCritSec = sock.SockCritSec;
         client = sock.client;
         timeWaitStartTime = sock.timeWaitStartTime;
+        framer = sock.framer;
+        relayTo = sock.relayTo;
+        relayManager = sock.relayManager;
+        relayPaused = sock.relayPaused;
+        readsPaused = sock.readsPaused;
+        readHeld = sock.readHeld;
+        drainNotify = sock.drainNotify;
+        isbSampled = sock.isbSampled;
+        isbSampleTime = sock.isbSampleTime;
+        isbDelivered = sock.isbDelivered;
+        sendQueues[0] = sock.sendQueues[0];
+        sendQueues[1] = sock.sendQueues[1];
+        deficit = sock.deficit;
+        inFlight = sock.inFlight;
+        inBulkSend = sock.inBulkSend;
+        inSendQueue = sock.inSendQueue;
+        inControlQueue = sock.inControlQueue;
+        sendBucket = sock.sendBucket;
+        readProbe = sock.readProbe;
+        handler = sock.handler;
+        race = sock.race;
+        raceAddress = sock.raceAddress;
+        datagram = sock.datagram;
+        inlineCompletions = sock.inlineCompletions;
+        segmentOffload = sock.segmentOffload;
+        ring = sock.ring;
+        negotiating = sock.negotiating;
+        tls = sock.tls;
+        compression = sock.compression;
+        compressionPending = sock.compressionPending;
+        compressed = sock.compressed;
+        topics = sock.topics;
+        publications = sock.publications;
+        publicationBytes = sock.publicationBytes;
+        pausedFiles = sock.pausedFiles;
+        context = sock.context;
         critList = sock.critList;
         it = sock.it;
         return *this;
     }
+
+    inline UUID     GetId                   () const        { return id; }                          // Same unique id as the one returned by ListenToNewSocket / ConnectToNewSocket
+    inline void *   GetContext              () const        { return context; }
+    inline void     SetContext              (void *c)       { context = c; }                        // Per connection state of whoever reads the socket, given back to ReleaseContext when it closes
 private:
 
     UUID                        id;                             // Socket unique identifier (used to store it in a map)
     SOCKET                      s;                              // Socket handle
     const char *                address;                        // IP address of connection
+    std::string                 host;                           // Client : copy of the address connected to, still valid once the caller's string is gone (default TLS server name)
     u_short                     port;                           // Port of connection
     SocketState                 state;                          // State the socket is in
     int                         af;                             // Address family of socket
@@ -190,12 +559,52 @@ private:
     SocketManager*              client;                         // Pointer to containing class
     DWORD                       timeWaitStartTime;              // Counter to test if socket has gotten out of TIME_WAIT state after a disconnect
     ULONG                       maxPendingByteSent;             // Max pending byte sent calculated using ISB, used as threshold to prevent more send if memory becomes limited
+    MessageFramer               framer;                         // Split received data into messages if framing is enabled
+    UUID                        relayTo;                        // Id of the socket every read is sent to as is instead of being given to ReceiveData, looked up on each read as it may close meanwhile
+    SocketManager*              relayManager;                   // Manager owning relayTo (nullptr if not relaying)
+    bool                        relayPaused;                    // No recv posted because relayTo has too much pending send, the next of its relayed sends to complete posts it
+    bool                        readsPaused;                    // SocketManager::PauseReads : no recv is posted until ResumeReads
+    bool                        readHeld;                       // A recv was held back while readsPaused, ResumeReads posts it
+    bool                        drainNotify;                    // SendsDrained is called once pendingByteSent falls to 0
+    bool                        isbSampled;                     // ISB is estimated from TCP_INFO samples instead of ideal send backlog notifications
+    DWORD                       isbSampleTime;                  // Tick count of the last TCP_INFO sample
+    ULONG64                     isbDelivered;                   // Bytes sent and acknowledged at the last TCP_INFO sample, to get the delivery rate
+    std::deque<Buffer*>         sendQueues[2];                  // Send scheduling : buffers waiting to be posted, by SocketManager::SendClass
+    LONG64                      deficit;                        // Send scheduling : bytes of bulk this socket can still post in the current round
+    volatile LONG64             inFlight;                       // Send scheduling : bytes posted and not completed
+    bool                        inBulkSend;                     // Send scheduling : the last bulk buffer posted wasn't the end of its SendData, control must wait
+    bool                        inSendQueue;                    // Send scheduling : socket is in the manager's round robin of sockets with buffers waiting (holds one OutstandingSend)
+    bool                        inControlQueue;                 // Send scheduling : socket is in the manager's queue of sockets with control buffers waiting (holds one OutstandingSend)
+    TokenBucket                 sendBucket;                     // Send scheduling : per socket rate limit
+    WSAOVERLAPPED               readProbe;                      // Zero-byte recv posted instead of a read buffer over the soft memory limit, recognised by its address on completion
+    SocketHandler *             handler;                        // Handler of the listener which accepted the socket (or of the listener itself), nullptr to give what is read to the manager
+    ConnectRace *               race;                           // Connect in flight : the connect this socket is one attempt of, nullptr once it is over for this socket
+    size_t                      raceAddress;                    // Connect in flight : index of the address it connects to in race->addresses
+    bool                        datagram;                       // UDP socket of OpenDatagramSocket : CONNECTED while open, reads are datagrams given to ReceiveDatagram
+    bool                        inlineCompletions;              // Datagram : operations completed right away are handled by the caller, no completion packet is queued for them
+    bool                        segmentOffload;                 // Datagram : several datagrams of the same size can go in one send (UDP_SEND_MSG_SIZE)
+    SharedRing *                ring;                           // Unix domain socket : data goes through this shared memory ring, reads on the socket are only doorbells, nullptr if not negotiated
+    bool                        negotiating;                    // Unix domain socket : waiting for the ring hello (server) or its answer (client), not ready to send
+    TlsSession *                tls;                            // TLS context of the connection, not ready to send until its handshake is done, nullptr without TLS
+    CompressionSession *        compression;                    // Contexts of the last compressed connection, kept across reuses of the socket and given back to the manager's pool once it is closed
+    bool                        compressionPending;             // Waiting for the compression hello (server) or its answer (client), not ready to send
+    bool                        compressed;                     // Compression negotiated : sends are packed in blocks by compression, reads are blocks
+    std::vector<Topic*>         topics;                         // Pub/sub : topics the socket is subscribed to, left when it is closed
+    std::deque<Publication*>    publications;                   // Pub/sub : publications to a DROP_OLDEST subscription waiting for room in the pending send, in order
+    u_long                      publicationBytes;               // Pub/sub : bytes of them
+    std::vector<Buffer*>        pausedFiles;                    // File sends whose next chunk waits for room in the max pending send, the next send of the socket to complete posts them
+    void *                      context;                        // Set by the manager or handler reading the socket, nullptr once given back to its ReleaseContext
     static const ULONG          DEFAULT_MAX_PENDING_BYTE_SENT   = 65536;    //64k
 
     static void     Delete                  (Socket *obj);                                          // Close socket before deleting it
     static void     DeleteOrDisconnect      (Socket *obj, CriticalMap<UUID, Socket*> &critMap);     // Try to disconnect socket for reuse or close and delete it if is is not possible
     void            Disconnect              (CriticalMap<UUID, Socket*> &critMap);                  // Disconnect socket so it can be used again
     void            Close                   (bool forceClose);                                      // Permanently close connexion
+    void            ReleaseContext          ();                                                     // Give the context back to the handler or manager reading the socket
+    void            LeaveTopics             ();                                                     // Unsubscribe from every topic and drop the publications queued, lock held
+    void            ReleaseCompression      ();                                                     // Give the compression contexts back to the manager's pool, lock held
+    void            ReleasePausedFiles      ();                                                     // Give the file sends waiting for room back to ReleaseFile as not sent, lock held
+    void            NotifyTlsClose          ();                                                     // Send the TLS close_notify alert, so the peer tells a graceful close from a truncation, lock held
 
 };
 ////////////// Socket ////////////
@@ -214,6 +623,10 @@ private:
         Disconnect,
         Accept,
         ISBChange,
+        Drain,
+        Resolve,
+        Publish,
+        FileRead,
         End
     };
 
@@ -221,11 +634,33 @@ public:
     explicit Buffer(CriticalRecyclableList<Buffer> &l)                              : Buffer(l, Operation::Read) {}
     Buffer(CriticalRecyclableList<Buffer> &l, Operation op)                         : ListElt(l),
                                                                                       ol{}, buf(), bufLen(DEFAULT_BUFFER_SIZE),
-                                                                                      operation(op) {}
+                                                                                      operation(op), acceptSocket(nullptr),
+                                                                                      external(nullptr), context(nullptr),
+                                                                                      file(nullptr), fileOffset(0), fileRemaining(0), fileChunk(0),
+                                                                                      relaySocket(nullptr), publication(nullptr), endOfSend(false), scheduled(false), compressed(false),
+                                                                                      peer{}, msg{}, data{}, control(), datagramSize(0) {}
 
     Buffer& operator=(const Buffer& buff){
         ol = buff.ol;
+        bufLen = buff.bufLen;
         operation = buff.operation;
+        acceptSocket = buff.acceptSocket;
+        external = buff.external;
+        context = buff.context;
+        file = buff.file;
+        fileOffset = buff.fileOffset;
+        fileRemaining = buff.fileRemaining;
+        fileChunk = buff.fileChunk;
+        relaySocket = buff.relaySocket;
+        publication = buff.publication;
+        endOfSend = buff.endOfSend;
+        scheduled = buff.scheduled;
+        compressed = buff.compressed;
+        peer = buff.peer;
+        msg = buff.msg;
+        data = buff.data;
+        memcpy(control, buff.control, sizeof(control));
+        datagramSize = buff.datagramSize;
         critList = buff.critList;
         it = buff.it;
         return *this;
@@ -239,6 +674,23 @@ private:
     char                        buf[DEFAULT_BUFFER_SIZE];   // Buffer for recv/send
     u_long                      bufLen;
     Operation                   operation;                  // Type of operation issued
+    Socket *                    acceptSocket;               // Accept only : socket the connection is accepted on (completion is raised on the listen socket), FileRead only : TLS socket the chunk is read for
+    const char *                external;                   // Write only : caller's data sent in place of buf (zero-copy send), bufLen bytes long
+    void *                      context;                    // Write only : given back with external or file when the send is over, Drain only : manager closing its sockets, Resolve only : connect whose host name got resolved
+    HANDLE                      file;                       // Write only : file sent by chunks of bufLen bytes with TransmitFile instead of buf
+    ULONG64                     fileOffset;                 // Write only : offset of the chunk being sent in file
+    ULONG64                     fileRemaining;              // Write only : bytes of file left to send, current chunk included
+    u_long                      fileChunk;                  // Write only : bytes of file in the current chunk, bufLen being the TLS record around them on a TLS socket
+    Socket *                    relaySocket;                // Write only : socket this buffer was read on, it goes back to it as a recv once sent
+    Publication *               publication;                // Write only : publication whose data is external, released once sent
+    bool                        endOfSend;                  // Write only : last buffer of a SendData, a control send can be posted after it
+    bool                        scheduled;                  // Write only : posted by the send scheduler, counted in its in flight bytes
+    bool                        compressed;                 // Write only : block of a compressed batch, the last one sent packs the sends staged meanwhile
+    SOCKADDR_STORAGE            peer;                       // Datagram only : sender of a read, destination of a write
+    WSAMSG                      msg;                        // Datagram only : WSARecvMsg / WSASendMsg arguments, the stack updates them until completion
+    WSABUF                      data;                       // Datagram only : buf, as given in msg
+    char                        control[WSA_CMSG_SPACE(sizeof(DWORD))];    // Datagram only : UDP_COALESCED_INFO of a read, UDP_SEND_MSG_SIZE of a write
+    u_long                      datagramSize;               // Datagram write only : size of each of the datagrams packed in buf
 
 };
 ////////////// Buffer ////////////
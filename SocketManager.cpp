@@ -1,9 +1,13 @@
+#include <algorithm>
 #include "SocketManager.h"
 #include "SocketHelperClasses.h"
 
 LPFN_CONNECTEX          SocketManager::ConnectEx             = nullptr;
 LPFN_DISCONNECTEX       SocketManager::DisconnectEx          = nullptr;
 LPFN_ACCEPTEX           SocketManager::AcceptEx              = nullptr;
+LPFN_TRANSMITFILE       SocketManager::TransmitFile          = nullptr;
+LPFN_WSARECVMSG         SocketManager::WSARecvMsg            = nullptr;
+const char              SocketManager::UNIX_ADDRESS_PREFIX[]  = "unix:";
 const TCHAR *           SocketManager::TIME_WAIT_REG_KEY     = TEXT("SYSTEM\\CurrentControlSet\\Services\\Tcpip\\Parameters");
 const TCHAR *           SocketManager::TIME_WAIT_REG_VALUE   = TEXT("TcpTimedWaitDelay");
 DWORD                   SocketManager::TimeWaitValue         = 0;
@@ -16,33 +20,255 @@ void SocketManager::ChangeSocketState (Socket *sock, Socket::SocketState state){
     LeaveCriticalSection(&sock->SockCritSec);
 }
 
-bool SocketManager::SendData(const char *data, u_long length, Socket *socket) {
-    if (socket == nullptr || socket->state != Socket::SocketState::CONNECTED) {
+bool SocketManager::SendData(const char *data, u_long length, Socket *socket, SendClass sendClass) {
+    WSABUF piece;
+
+    piece.buf = const_cast<char*>(data);
+    piece.len = length;
+    return SendData(&piece, 1, socket, sendClass);
+}
+
+bool SocketManager::SendData(const WSABUF *pieces, DWORD count, Socket *socket, SendClass sendClass) {
+    u_long                  length      = 0;
+    DWORD                   piece       = 0;
+    u_long                  pieceOffset = 0;
+    std::vector<Buffer*>    queued;
+
+    if (socket == nullptr || socket->state != Socket::SocketState::CONNECTED || draining) {
+        return false;
+    }
+    if (socket->ring != nullptr || socket->negotiating)     //same-host peer, no buffer of the pool is used
+        return SendToRing(socket, pieces, count);
+    if (socket->compressionPending) {
+        LOG_ERROR("Socket %llu : compression not settled, retry once the socket is ready\n", socket->s);
+        return false;
+    }
+    if (CheckMemory() == MemoryPressure::OVER_HARD_LIMIT) {
+        LOG_ERROR("Socket %llu : Over the hard memory limit, send refused\n", socket->s);
+        InterlockedIncrement64(&rejectedSends);
         return false;
     }
+    for (DWORD i = 0 ; i < count ; i++)
+        length += pieces[i].len;
     if (length + socket->pendingByteSent > socket->maxPendingByteSent){
         LOG_ERROR("Socket %llu : Too mush pending send, retry after more data has been acknowledged by receiver\n", socket->s);
         return false;
     }
-    LOG("send %lu : %s\n", length, data);
-
-    while(length > 0){
-        Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+    LOG("send %lu bytes\n", length);
+    if (socket->tls != nullptr)                                         // records are numbered, they are posted as they are sealed
+        return SendToTls(socket, pieces, count, length);
+    if (socket->compressed)                                             // blocks are packed straight in the buffers
+        return SendToCompression(socket, pieces, count, length, sendClass);
+    u_long total = length;
+
+    EnterCriticalSection(&socket->SockCritSec);         //the buffers of a send go out together, a send of another thread can't come between them
+    {
+        while(length > 0){
+            Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
 
-        u_long currentLen = length > Buffer::DEFAULT_BUFFER_SIZE ? Buffer::DEFAULT_BUFFER_SIZE : length;
-        strncpy(sendObj->buf, data, currentLen);
-        sendObj->bufLen = currentLen;
+            u_long currentLen = length > Buffer::DEFAULT_BUFFER_SIZE ? Buffer::DEFAULT_BUFFER_SIZE : length;
+            GatherPieces(pieces, piece, pieceOffset, sendObj->buf, currentLen);
+            sendObj->bufLen = currentLen;
 
-        if(PostSend(socket, sendObj) == SOCKET_ERROR){
-            EnterCriticalSection(&socket->SockCritSec);
-            {
+            if (scheduling.enabled) {
+                sendObj->endOfSend = currentLen == length;
+                queued.push_back(sendObj);
+            }
+            else if(PostSend(socket, sendObj) == SOCKET_ERROR){
                 socket->state = Socket::SocketState::FAILURE;
+                Buffer::Delete(sendObj);
+                break;
             }
-            LeaveCriticalSection(&socket->SockCritSec);
-            Buffer::Delete(sendObj);
-            break;
+            length -= currentLen;
+        }
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    if (scheduling.enabled)                             //queued without the socket lock, the scheduler takes its own first
+        return QueueSend(socket, queued, total, sendClass);
+    return true;
+}
+
+void SocketManager::GatherPieces(const WSABUF *pieces, DWORD &piece, u_long &pieceOffset, char *to, u_long length) {
+    u_long filled = 0;
+
+    while (filled < length) {                                           // pieces are packed together, a buffer can hold the end of one and the start of the next
+        u_long take = pieces[piece].len - pieceOffset;
+        if (take > length - filled)
+            take = length - filled;
+        memcpy(to + filled, pieces[piece].buf + pieceOffset, take);     // data may be binary, don't stop at first null byte
+        filled += take;
+        pieceOffset += take;
+        if (pieceOffset == pieces[piece].len) {
+            piece++;
+            pieceOffset = 0;
+        }
+    }
+}
+
+bool SocketManager::SendMessage(const char *data, u_long length, Socket *socket, SendClass sendClass) {
+    WSABUF  pieces[3];
+    DWORD   count = 0;
+    char    header[MessageFramer::MAX_HEADER_SIZE];
+
+    if (socket == nullptr) {
+        return false;
+    }
+    const MessageFramer &framer = socket->framer;
+    if (!framer.CanFrame(length)) {
+        LOG_ERROR("Socket %llu : message of %lu bytes can't be framed\n", socket->s, length);
+        return false;
+    }
+    if ((pieces[count].len = framer.EncodeHeader(length, header)) > 0)
+        pieces[count++].buf = header;
+    pieces[count].buf = const_cast<char*>(data);
+    pieces[count++].len = length;
+    if (framer.GetMode() == MessageFramer::Mode::DELIMITER) {
+        pieces[count].buf = const_cast<char*>(framer.Trailer().data());
+        pieces[count++].len = static_cast<u_long>(framer.Trailer().size());
+    }
+    return SendData(pieces, count, socket, sendClass);
+}
+
+bool SocketManager::SendDataNoCopy(const char *data, u_long length, Socket *socket, void *context) {
+    if (zeroCopyThreshold == 0 || length < zeroCopyThreshold ||         // small enough to be copied, the caller gets its buffer back right away
+        (socket != nullptr && (socket->ring != nullptr || socket->negotiating || socket->tls != nullptr ||   // or copied in a shared memory ring, a TLS record
+                               socket->compressionPending || socket->compressed))) {                        // or a compressed block anyway
+        if (!SendData(data, length, socket))
+            return false;
+        ReleaseSendData(data, length, context, true, socket);
+        return true;
+    }
+    if (socket == nullptr || socket->state != Socket::SocketState::CONNECTED || draining) {
+        return false;
+    }
+    if (CheckMemory() == MemoryPressure::OVER_HARD_LIMIT) {
+        LOG_ERROR("Socket %llu : Over the hard memory limit, send refused\n", socket->s);
+        InterlockedIncrement64(&rejectedSends);
+        return false;
+    }
+    if (length + socket->pendingByteSent > socket->maxPendingByteSent){
+        LOG_ERROR("Socket %llu : Too mush pending send, retry after more data has been acknowledged by receiver\n", socket->s);
+        return false;
+    }
+    LOG("send %lu bytes without copy\n", length);
+
+    // ----------------------------- one send straight from the caller's memory, the kernel locks its pages instead of copying them
+    Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+    sendObj->external = data;
+    sendObj->context = context;
+    sendObj->bufLen = length;
+    if(PostSend(socket, sendObj) == SOCKET_ERROR){
+        ChangeSocketState(socket, Socket::SocketState::FAILURE);
+        Buffer::Delete(sendObj);
+        return false;                                                   // never posted, the caller keeps its buffer
+    }
+    return true;
+}
+
+bool SocketManager::SendFile(HANDLE file, ULONG64 offset, ULONG64 length, Socket *socket, void *context) {
+    if (socket == nullptr || socket->state != Socket::SocketState::CONNECTED || draining || file == nullptr || file == INVALID_HANDLE_VALUE || length == 0 ||
+        socket->ring != nullptr || socket->negotiating ||            // TransmitFile can't write in a shared memory ring
+        socket->compressionPending || socket->compressed ||           // nor compress
+        (socket->tls != nullptr && !socket->tls->IsEstablished())) {
+        return false;
+    }
+    // ----------------------------- the file is sent one chunk at a time, each one fitting in what is left of the max pending send
+    if (CheckMemory() == MemoryPressure::OVER_HARD_LIMIT) {
+        LOG_ERROR("Socket %llu : Over the hard memory limit, send refused\n", socket->s);
+        InterlockedIncrement64(&rejectedSends);
+        return false;
+    }
+    if (socket->pendingByteSent >= socket->maxPendingByteSent){
+        LOG_ERROR("Socket %llu : Too mush pending send, retry after more data has been acknowledged by receiver\n", socket->s);
+        return false;
+    }
+    LOG("send %llu bytes of file\n", length);
+
+    Buffer *fileObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+    fileObj->file = file;
+    fileObj->context = context;
+    fileObj->fileOffset = offset;
+    fileObj->fileRemaining = length;
+    if(PostTransmitFile(socket, fileObj) == SOCKET_ERROR){
+        ChangeSocketState(socket, Socket::SocketState::FAILURE);
+        Buffer::Delete(fileObj);
+        return false;                                                   // never posted, the caller keeps its file
+    }
+    return true;
+}
+
+bool SocketManager::RelayData(Socket *source, Socket *destination) {
+    bool resume;
+
+    if (source == nullptr || source->state != Socket::SocketState::CONNECTED || draining ||
+        (destination != nullptr && destination->state != Socket::SocketState::CONNECTED)) {
+        return false;
+    }
+    if (source->ring != nullptr || source->negotiating || source->tls != nullptr ||    // reads of a ring socket are doorbells, of a TLS one records, of a compressed one blocks, and relayed buffers are sent as they were read
+        source->compressionPending || source->compressed ||
+        (destination != nullptr && (destination->ring != nullptr || destination->negotiating || destination->tls != nullptr ||
+                                    destination->compressionPending || destination->compressed))) {
+        return false;
+    }
+    EnterCriticalSection(&source->SockCritSec);
+    {
+        source->relayTo = destination != nullptr ? destination->GetId() : Misc::CreateNilUUID();   //by id : the destination may be closed and its memory reused while relaying
+        source->relayManager = destination != nullptr ? destination->client : nullptr;
+        resume = destination == nullptr && source->relayPaused;    //reads were waiting for the previous destination
+        if (resume)
+            source->relayPaused = false;
+    }
+    LeaveCriticalSection(&source->SockCritSec);
+    if (resume) {
+        Buffer *recvObj = Buffer::Create(source->client->inUseBufferList, Buffer::Operation::Read);
+        if (PostRecv(source, recvObj) == SOCKET_ERROR) {
+            ChangeSocketState(source, Socket::SocketState::FAILURE);
+            Buffer::Delete(recvObj);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SocketManager::PauseReads(Socket *socket) {
+    bool paused;
+
+    if (socket == nullptr)
+        return false;
+    EnterCriticalSection(&socket->SockCritSec);
+    {
+        paused = socket->state == Socket::SocketState::CONNECTED && socket->pendingByteSent > 0;   //with nothing pending no completion would call SendsDrained
+        if (paused) {
+            socket->readsPaused = true;
+            socket->drainNotify = true;
+        }
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    return paused;
+}
+
+bool SocketManager::ResumeReads(Socket *socket) {
+    bool post;
+
+    if (socket == nullptr)
+        return false;
+    EnterCriticalSection(&socket->SockCritSec);
+    {
+        post = socket->readHeld;
+        socket->readsPaused = false;
+        socket->readHeld = false;
+        socket->drainNotify = false;
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    if (socket->state != Socket::SocketState::CONNECTED)
+        return false;
+    if (post) {
+        Buffer *recvObj = Buffer::Create(socket->client->inUseBufferList, Buffer::Operation::Read);
+        if (PostRecv(socket, recvObj) == SOCKET_ERROR) {
+            ChangeSocketState(socket, Socket::SocketState::FAILURE);
+            Buffer::Delete(recvObj);
+            return false;
         }
-        length -= currentLen;
     }
     return true;
 }
@@ -51,9 +277,23 @@ int SocketManager::PostRecv(Socket *sock, Buffer *recvObj) {
     WSABUF  wbuf;
     int     err;
     DWORD   flags = 0;
+    bool    held;
 
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        held = sock->readsPaused;       //a handler holds reads back until its sends drain, ResumeReads posts a new one
+        if (held)
+            sock->readHeld = true;
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    if (held) {
+        Buffer::Delete(recvObj);
+        return NO_ERROR;
+    }
     wbuf.buf = recvObj->buf;
-    wbuf.len = recvObj->bufLen;
+    wbuf.len = Buffer::DEFAULT_BUFFER_SIZE;     //not bufLen, send paths size it to what they send, well past buf for zero-copy, file and publication sends
+    if (sock->tls != nullptr)            //records are read straight where they are decrypted, recvObj only carries the overlapped
+        wbuf.buf = sock->tls->ReadSpace(wbuf.len);
     EnterCriticalSection(&(sock->SockCritSec));
     {
         err = WSARecv(sock->s,           //s : A descriptor identifying a connected socket.
@@ -80,11 +320,47 @@ int SocketManager::PostRecv(Socket *sock, Buffer *recvObj) {
     return err;
 }
 
-int SocketManager::PostSend(Socket *sock, Buffer *sendObj) {
+int SocketManager::PostReadProbe(Socket *sock) {
+    WSABUF  wbuf;
+    int     err;
+    DWORD   flags = 0;
+
+    wbuf.buf = nullptr;
+    wbuf.len = 0;
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        sock->readProbe = WSAOVERLAPPED{};
+        err = WSARecv(sock->s,              //s : A descriptor identifying a connected socket.
+                      &wbuf,                //lpBuffers : A pointer to an array of WSABUF structures. A zero-length buffer completes once data is waiting, without taking any of it.
+                      1,                    //dwBufferCount : The number of WSABUF structures in the lpBuffers array.
+                      nullptr,              //lpNumberOfBytesRecvd : A pointer to the number, in bytes, of data received by this call if the receive operation completes immediately. Use NULL for this parameter if the lpOverlapped parameter is not NULL to avoid potentially erroneous results
+                      &flags,               //lpFlags : A pointer to flags used to modify the behavior of the WSARecv function call.
+                      &(sock->readProbe),   //lpOverlapped : A pointer to a WSAOVERLAPPED structure (ignored for nonoverlapped sockets).
+                      nullptr);             //lpCompletionRoutine : A pointer to the completion routine called when the receive operation has been completed (ignored for nonoverlapped sockets).
+
+        if (err == SOCKET_ERROR) {
+            if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
+                LOG_ERROR("WSARecv* (zero-byte) failed: %d\n", err);
+                err = SOCKET_ERROR;
+            } else
+                err = NO_ERROR;
+        }
+        if (err == NO_ERROR) {
+            // Increment outstanding overlapped operations
+            sock->OutstandingRecv++;
+        }
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    if (err == NO_ERROR)
+        InterlockedIncrement64(&readProbes);
+    return err;
+}
+
+int SocketManager::PostSend(Socket *sock, Buffer *sendObj, bool queued) {
     WSABUF  wbuf;
     int     err;
 
-    wbuf.buf = sendObj->buf;
+    wbuf.buf = sendObj->external != nullptr ? const_cast<char*>(sendObj->external) : sendObj->buf;
     wbuf.len = sendObj->bufLen;
 
     EnterCriticalSection(&(sock->SockCritSec));
@@ -104,6 +380,101 @@ int SocketManager::PostSend(Socket *sock, Buffer *sendObj) {
             } else
                 err = NO_ERROR;
         }
+        if (err == NO_ERROR) {
+            // Increment the outstanding operation count
+            sock->OutstandingSend++;
+            if (!queued)
+                InterlockedExchangeAdd64(&sock->pendingByteSent, static_cast<LONG64>(sendObj->bufLen));
+        }
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    return err;
+}
+
+int SocketManager::PostDatagramRecv(Socket *sock, Buffer *recvObj, DWORD &bytesTransfered, bool &completed) {
+    int     err;
+
+    completed = false;
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        while (true) {
+            recvObj->data.buf = recvObj->buf;
+            recvObj->data.len = Buffer::DEFAULT_BUFFER_SIZE;
+            recvObj->msg.name = (LPSOCKADDR)&recvObj->peer;
+            recvObj->msg.namelen = sizeof(recvObj->peer);
+            recvObj->msg.lpBuffers = &recvObj->data;
+            recvObj->msg.dwBufferCount = 1;
+            recvObj->msg.Control.buf = recvObj->control;
+            recvObj->msg.Control.len = sizeof(recvObj->control);
+            recvObj->msg.dwFlags = 0;
+            if (WSARecvMsg(sock->s,                 //s : A descriptor that identifies the socket.
+                           &recvObj->msg,           //lpMsg : A WSAMSG data structure based on the Posix.1g msghdr structure.
+                           &bytesTransfered,        //lpdwNumberOfBytesRecvd : A pointer to the number of bytes received by this call if the WSARecvMsg operation completes immediately.
+                           &(recvObj->ol),          //lpOverlapped : A pointer to a WSAOVERLAPPED structure (ignored for nonoverlapped sockets).
+                           nullptr                  //lpCompletionRoutine : A pointer to the completion routine called when the receive operation completes (ignored for nonoverlapped sockets).
+                          ) == 0) {
+                completed = sock->inlineCompletions;    //else its completion packet is queued all the same
+                err = NO_ERROR;
+                break;
+            }
+            if ((err = WSAGetLastError()) == WSA_IO_PENDING) {
+                err = NO_ERROR;
+                break;
+            }
+            if (err != WSAEMSGSIZE && err != WSAECONNRESET && err != WSAENETRESET) {
+                LOG_ERROR("WSARecvMsg failed: %d\n", err);
+                err = SOCKET_ERROR;
+                break;
+            }
+            InterlockedIncrement64(&datagramsDropped);  //one datagram failed right away (too big, ICMP error of an earlier send), not the socket
+        }
+        if (err == NO_ERROR) {
+            // Increment outstanding overlapped operations
+            sock->OutstandingRecv++;
+        }
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    return err;
+}
+
+int SocketManager::PostDatagramSend(Socket *sock, Buffer *sendObj, bool &completed) {
+    int     err;
+
+    completed = false;
+    sendObj->data.buf = sendObj->buf;
+    sendObj->data.len = sendObj->bufLen;
+    sendObj->msg.name = (LPSOCKADDR)&sendObj->peer;
+    sendObj->msg.namelen = AddressLength(sendObj->peer);
+    sendObj->msg.lpBuffers = &sendObj->data;
+    sendObj->msg.dwBufferCount = 1;
+    sendObj->msg.Control.buf = nullptr;
+    sendObj->msg.Control.len = 0;
+    sendObj->msg.dwFlags = 0;
+    if (sendObj->datagramSize > 0 && sendObj->bufLen > sendObj->datagramSize) {    //segmentation offload (USO) : the stack, or the NIC, cuts the buffer in datagrams of this size
+        auto *cmsg = (WSACMSGHDR*)sendObj->control;
+        cmsg->cmsg_len = WSA_CMSG_LEN(sizeof(DWORD));
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEND_MSG_SIZE;
+        *(DWORD*)WSA_CMSG_DATA(cmsg) = sendObj->datagramSize;
+        sendObj->msg.Control.buf = sendObj->control;
+        sendObj->msg.Control.len = WSA_CMSG_SPACE(sizeof(DWORD));
+    }
+
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        err = WSASendMsg(sock->s,                   //Handle : A descriptor identifying the socket.
+                         &sendObj->msg,             //lpMsg : A WSAMSG structure storing the Posix.1g msghdr structure.
+                         0,                         //dwFlags : The flags used to modify the behavior of the WSASendMsg function call.
+                         nullptr,                   //lpNumberOfBytesSent : A pointer to the number, in bytes, sent by this call if the I/O operation completes immediately. Use NULL for this parameter if the lpOverlapped parameter is not NULL to avoid potentially erroneous results
+                         &(sendObj->ol),            //lpOverlapped : A pointer to a WSAOVERLAPPED structure (ignored for nonoverlapped sockets).
+                         nullptr);                  //lpCompletionRoutine : A pointer to the completion routine called when the send operation has been completed (ignored for nonoverlapped sockets).
+        if (err == 0) {
+            completed = sock->inlineCompletions;
+        } else if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
+            LOG_ERROR("WSASendMsg failed: %d\n", err);
+            err = SOCKET_ERROR;
+        } else
+            err = NO_ERROR;
         if (err == NO_ERROR) {
             // Increment the outstanding operation count
             sock->OutstandingSend++;
@@ -114,6 +485,323 @@ int SocketManager::PostSend(Socket *sock, Buffer *sendObj) {
     return err;
 }
 
+bool SocketManager::QueueSend(Socket *sock, std::vector<Buffer*> &sendObjs, u_long length, SendClass sendClass) {
+    bool    accepted;
+
+    EnterCriticalSection(&sendQueue.critSec);
+    {
+        EnterCriticalSection(&sock->SockCritSec);
+        {
+            // ----------------------------- bytes are pending from now on, each queue the socket joins keeps it alive with one OutstandingSend
+            accepted = sock->state == Socket::SocketState::CONNECTED;
+            if (accepted) {
+                InterlockedExchangeAdd64(&sock->pendingByteSent, static_cast<LONG64>(length));
+                sock->OutstandingSend += (sock->inSendQueue ? 0 : 1) + (sendClass == SendClass::CONTROL && !sock->inControlQueue ? 1 : 0);
+            }
+        }
+        LeaveCriticalSection(&sock->SockCritSec);
+        if (accepted) {
+            // ----------------------------- buffers of one send stay together, another send of the socket can't come in between
+            sock->sendQueues[sendClass].insert(sock->sendQueues[sendClass].end(), sendObjs.begin(), sendObjs.end());
+            if (!sock->inSendQueue) {
+                sock->inSendQueue = true;
+                sendQueue.queue.push(sock);
+            }
+            if (sendClass == SendClass::CONTROL && !sock->inControlQueue) {
+                sock->inControlQueue = true;
+                controlSendQueue.push(sock);
+            }
+        }
+    }
+    LeaveCriticalSection(&sendQueue.critSec);
+    if (!accepted) {
+        for (Buffer *sendObj : sendObjs)
+            Buffer::Delete(sendObj);
+        return false;
+    }
+    DispatchSends();
+    return true;
+}
+
+void SocketManager::DispatchSends() {
+    std::vector<Socket*>    cleanup;                                    // sockets whose last OutstandingSend was held by a queue
+
+    EnterCriticalSection(&sendQueue.critSec);
+    {
+        // ----------------------------- control first, a socket in the middle of a bulk send finishes it before
+        for (size_t i = controlSendQueue.size() ; i > 0 ; i--) {
+            Socket *sock = controlSendQueue.front();
+            std::deque<Buffer*> &control = sock->sendQueues[SendClass::CONTROL];
+            controlSendQueue.pop();
+            while (!control.empty() && !sock->inBulkSend && sock->state <= Socket::SocketState::CLOSING) {
+                Buffer *sendObj = control.front();
+                control.pop_front();
+                if (!PostQueuedSend(sock, sendObj))
+                    control.push_front(sendObj);                        // dropped with the others when the round robin reaches the socket
+            }
+            if (!control.empty() && sock->state <= Socket::SocketState::CLOSING) {
+                controlSendQueue.push(sock);
+            } else {
+                sock->inControlQueue = false;
+                if (LeaveSendQueue(sock))
+                    cleanup.push_back(sock);
+            }
+        }
+        // ----------------------------- bulk in deficit round robin, each socket gets a quantum of bytes per turn
+        bool limited = false;                                           // manager limits reached, next sockets wait for completions or the timer
+        for (size_t i = sendQueue.queue.size() ; i > 0 && !limited ; i--) {
+            Socket *sock = sendQueue.queue.front();
+            std::deque<Buffer*> &bulk = sock->sendQueues[SendClass::BULK];
+            sendQueue.queue.pop();
+            if (!bulk.empty() && sock->state <= Socket::SocketState::CLOSING) {
+                sock->deficit += scheduling.quantum;
+                if (sock->deficit > static_cast<LONG64>(scheduling.quantum + Buffer::DEFAULT_BUFFER_SIZE))
+                    sock->deficit = scheduling.quantum + Buffer::DEFAULT_BUFFER_SIZE;    // a socket held back by its limits doesn't save up turns
+            }
+            while (!bulk.empty() && sock->state <= Socket::SocketState::CLOSING) {
+                Buffer *sendObj = bulk.front();
+                if (sendObj->bufLen > sock->deficit)
+                    break;
+                if ((scheduledInFlight > 0 && scheduledInFlight + sendObj->bufLen > scheduling.maxInFlight) || !sendBucket.CanTake(sendObj->bufLen)) {
+                    limited = true;
+                    break;
+                }
+                if ((sock->inFlight > 0 && sock->inFlight + sendObj->bufLen > scheduling.socketInFlight) || !sock->sendBucket.CanTake(sendObj->bufLen))
+                    break;
+                bulk.pop_front();
+                sock->deficit -= sendObj->bufLen;
+                sock->inBulkSend = !sendObj->endOfSend;
+                if (!PostQueuedSend(sock, sendObj))
+                    bulk.push_front(sendObj);
+            }
+            if (sock->state > Socket::SocketState::CLOSING)
+                DropQueuedSends(sock);
+            if (!sock->sendQueues[SendClass::CONTROL].empty() || !bulk.empty()) {
+                sendQueue.queue.push(sock);
+            } else {
+                sock->deficit = 0;
+                sock->inSendQueue = false;
+                if (LeaveSendQueue(sock))
+                    cleanup.push_back(sock);
+            }
+        }
+    }
+    LeaveCriticalSection(&sendQueue.critSec);
+    for (Socket *sock : cleanup)
+        Socket::DeleteOrDisconnect(sock, socketAccessMap);
+}
+
+bool SocketManager::PostQueuedSend(Socket *sock, Buffer *sendObj) {
+    // ----------------------------- counted before posting, the completion can come before WSASend returns
+    sendObj->scheduled = true;
+    InterlockedExchangeAdd64(&sock->inFlight, static_cast<LONG64>(sendObj->bufLen));
+    InterlockedExchangeAdd64(&scheduledInFlight, static_cast<LONG64>(sendObj->bufLen));
+    sock->sendBucket.Take(sendObj->bufLen);
+    sendBucket.Take(sendObj->bufLen);
+    if (PostSend(sock, sendObj, true) != SOCKET_ERROR)
+        return true;
+    sendObj->scheduled = false;
+    InterlockedExchangeAdd64(&sock->inFlight, -static_cast<LONG64>(sendObj->bufLen));
+    InterlockedExchangeAdd64(&scheduledInFlight, -static_cast<LONG64>(sendObj->bufLen));
+    ChangeSocketState(sock, Socket::SocketState::FAILURE);
+    return false;
+}
+
+void SocketManager::DropQueuedSends(Socket *sock) {
+    LONG64  bytes   = 0;
+
+    for (std::deque<Buffer*> &queue : sock->sendQueues) {
+        for (Buffer *sendObj : queue) {
+            bytes += sendObj->bufLen;
+            Buffer::Delete(sendObj);
+        }
+        queue.clear();
+    }
+    sock->inBulkSend = false;
+    InterlockedExchangeAdd64(&sock->pendingByteSent, -bytes);
+}
+
+bool SocketManager::LeaveSendQueue(Socket *sock) {
+    bool    cleanupSocket;
+
+    EnterCriticalSection(&sock->SockCritSec);
+    {
+        sock->OutstandingSend--;
+        cleanupSocket = sock->OutstandingSend == 0 && sock->OutstandingRecv == 0 && sock->state > Socket::SocketState::CONNECTED;
+    }
+    LeaveCriticalSection(&sock->SockCritSec);
+    return cleanupSocket;
+}
+
+VOID CALLBACK SocketManager::SendTimerCallback(PVOID lpParam, BOOLEAN timerFired) {
+    static_cast<SocketManager*>(lpParam)->DispatchSends();
+}
+
+void SocketManager::SetSendScheduling(const SendScheduling &options) {
+    scheduling = options;
+    if (scheduling.quantum < Buffer::DEFAULT_BUFFER_SIZE)
+        scheduling.quantum = Buffer::DEFAULT_BUFFER_SIZE;               // every turn can post at least one buffer
+    sendBucket.Configure(static_cast<double>(scheduling.globalRate), static_cast<double>(scheduling.globalRate) * scheduling.burst / 1000);
+    if (sendTimer == nullptr && scheduling.enabled && (scheduling.socketRate > 0 || scheduling.globalRate > 0)) {
+        if (!CreateTimerQueueTimer(&sendTimer,              //phNewTimer : A pointer to a buffer that receives a handle to the timer-queue timer on return.
+                                   nullptr,                 //TimerQueue : A handle to the timer queue. If this parameter is NULL, the timer is associated with the default timer queue.
+                                   SendTimerCallback,       //Callback : A pointer to the application-defined function of type WAITORTIMERCALLBACK to be executed when the timer expires.
+                                   this,                    //Parameter : A single parameter value that will be passed to the callback function.
+                                   SEND_TIMER_PERIOD,       //DueTime : The amount of time in milliseconds relative to the current time that must elapse before the timer is signaled for the first time.
+                                   SEND_TIMER_PERIOD,       //Period : The period of the timer, in milliseconds. If this parameter is not zero, the timer is periodic.
+                                   WT_EXECUTEDEFAULT)) {    //Flags : By default, the callback function is queued to a non-I/O worker thread.
+            LOG_ERROR("CreateTimerQueueTimer failed / error %lu\n", GetLastError());
+            sendTimer = nullptr;
+        }
+    }
+}
+
+int SocketManager::PostTransmitFile(Socket *sock, Buffer *fileObj) {
+    int     err     = NO_ERROR;
+    LONG64  room;
+    LONG64  overhead    = sock->tls != nullptr ? sock->tls->Overhead() : 0;
+
+    // ----------------------------- the chunk takes what the other sends of the socket left of the max pending send, or waits for one of them to complete
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        room = static_cast<LONG64>(sock->maxPendingByteSent) - sock->pendingByteSent - overhead;
+        if (room <= 0)
+            sock->pausedFiles.push_back(fileObj);
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    if (room <= 0)
+        return NO_ERROR;
+    if (sock->tls != nullptr)
+        return PostSealedFile(sock, fileObj, static_cast<u_long>(room));
+    fileObj->bufLen = fileObj->fileRemaining < static_cast<ULONG64>(room) ? static_cast<u_long>(fileObj->fileRemaining) : static_cast<u_long>(room);
+    fileObj->fileChunk = fileObj->bufLen;
+    fileObj->ol = WSAOVERLAPPED{};                                       //buffer is reused for each chunk
+    fileObj->ol.Offset = static_cast<DWORD>(fileObj->fileOffset);
+    fileObj->ol.OffsetHigh = static_cast<DWORD>(fileObj->fileOffset >> 32);
+
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        if (!TransmitFile(sock->s,               //hSocket : A handle to a connected socket. The TransmitFile function will transmit the file data on this socket. The socket specified by the hSocket parameter must be a connection-oriented socket.
+                          fileObj->file,         //hFile : A handle to the open file that the TransmitFile function transmits. Since the operating system reads the file data sequentially, you can improve caching performance by opening the handle with FILE_FLAG_SEQUENTIAL_SCAN.
+                          fileObj->bufLen,       //nNumberOfBytesToWrite : The number of bytes in the file to transmit. Set to zero to transmit the entire file. The maximum number of bytes that can be transmitted using a single call to the TransmitFile function is 2,147,483,646.
+                          0,                     //nNumberOfBytesPerSend : The size, in bytes, of each block of data sent in each send operation. Set to zero to select the default send size.
+                          &(fileObj->ol),        //lpOverlapped : A pointer to an OVERLAPPED structure. The Offset and OffsetHigh members of the OVERLAPPED structure specify the offset within the file at which to start the file data transfer.
+                          nullptr,               //lpTransmitBuffers : A pointer to a TRANSMIT_FILE_BUFFERS data structure that contains pointers to data to send before and after the file data is sent.
+                          0)) {                  //dwReserved : A set of flags used to modify the behavior of the TransmitFile function call.
+            if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
+                LOG_ERROR("TransmitFile failed: %d\n", err);
+                err = SOCKET_ERROR;
+            } else
+                err = NO_ERROR;
+        }
+        if (err == NO_ERROR) {
+            // Increment the outstanding operation count
+            sock->OutstandingSend++;
+            InterlockedExchangeAdd64(&sock->pendingByteSent, static_cast<LONG64>(fileObj->bufLen));
+        }
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    return err;
+}
+
+int SocketManager::PostSealedFile(Socket *sock, Buffer *fileObj, u_long room) {
+    TlsSession  *tls    = sock->tls;
+
+    if (room > Buffer::DEFAULT_BUFFER_SIZE - tls->Overhead())
+        room = Buffer::DEFAULT_BUFFER_SIZE - tls->Overhead();
+    if (room > tls->MaxMessage())
+        room = tls->MaxMessage();
+    fileObj->fileChunk = fileObj->fileRemaining < room ? static_cast<u_long>(fileObj->fileRemaining) : room;
+    fileObj->ol = WSAOVERLAPPED{};                                       //buffer is reused for each chunk
+    fileObj->operation = Buffer::Operation::FileRead;
+    fileObj->acceptSocket = sock;
+    fileObj->bufLen = tls->Header();                                    //where the chunk goes, the session may be gone once it is read
+
+    // ----------------------------- TransmitFile can't seal records : the chunk is read on the thread pool, the handle may well be synchronous, and sealed by a worker thread where it was read
+    EnterCriticalSection(&(sock->SockCritSec));
+    {
+        sock->OutstandingSend++;                                        //the socket stays until the chunk is sealed
+        InterlockedExchangeAdd64(&sock->pendingByteSent, static_cast<LONG64>(fileObj->fileChunk));    //the room is taken while the chunk is read, not left to other sends
+    }
+    LeaveCriticalSection(&(sock->SockCritSec));
+    InterlockedIncrement(&pendingFileReads);
+    if (!QueueUserWorkItem(FileReadWorkItem,                //Function : A pointer to the application-defined callback function of type LPTHREAD_START_ROUTINE to be executed by the thread in the thread pool.
+                           fileObj,                         //Context : A single parameter value to be passed to the thread function.
+                           WT_EXECUTEDEFAULT)) {            //Flags : By default, the callback function is queued to a non-I/O worker thread.
+        LOG_ERROR("QueueUserWorkItem failed / error %lu\n", GetLastError());
+        InterlockedDecrement(&pendingFileReads);
+        EnterCriticalSection(&(sock->SockCritSec));
+        {
+            sock->OutstandingSend--;
+            InterlockedExchangeAdd64(&sock->pendingByteSent, -static_cast<LONG64>(fileObj->fileChunk));
+        }
+        LeaveCriticalSection(&(sock->SockCritSec));
+        fileObj->operation = Buffer::Operation::Write;
+        fileObj->acceptSocket = nullptr;
+        return SOCKET_ERROR;
+    }
+    return NO_ERROR;
+}
+
+DWORD WINAPI SocketManager::FileReadWorkItem(LPVOID lpParam) {
+    auto        *fileObj    = static_cast<Buffer*>(lpParam);
+    Socket      *sock       = fileObj->acceptSocket;
+    HANDLE      event       = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    OVERLAPPED  ol{};
+    DWORD       read        = 0;
+
+    ol.Offset = static_cast<DWORD>(fileObj->fileOffset);
+    ol.OffsetHigh = static_cast<DWORD>(fileObj->fileOffset >> 32);
+    ol.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(event) | 1);     //low bit set : no completion packet to a port the caller may have associated the file with
+    if (event == nullptr ||
+        (!ReadFile(fileObj->file,                       //hFile : A handle to the device.
+                   fileObj->buf + fileObj->bufLen,      //lpBuffer : A pointer to the buffer that receives the data read from a file or device.
+                   fileObj->fileChunk,                  //nNumberOfBytesToRead : The maximum number of bytes to be read.
+                   nullptr,                             //lpNumberOfBytesRead : Can be NULL when lpOverlapped is not, the count comes from GetOverlappedResult.
+                   &ol                                  //lpOverlapped : Offset and OffsetHigh give the position in the file, for synchronous and overlapped handles alike.
+         ) && (GetLastError() != ERROR_IO_PENDING || WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)) ||
+        !GetOverlappedResult(fileObj->file, &ol, &read, FALSE)) {
+        LOG_ERROR("ReadFile failed / error %lu\n", GetLastError());
+        read = 0;
+    }
+    if (event != nullptr)
+        CloseHandle(event);
+
+    // ----------------------------- sealed on a worker thread, in order with the other sends of the socket
+    if (!PostQueuedCompletionStatus(sock->client->iocpHandle,  //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                    read,                   //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                    (ULONG_PTR)sock,        //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                    &(fileObj->ol))) {      //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+        LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+        sock->client->HandleFileRead(sock, fileObj, read);
+    }
+    return NO_ERROR;
+}
+
+void SocketManager::HandleFileRead(Socket *sockObj, Buffer *buf, DWORD bytesRead) {
+    bool    posted  = false;
+
+    buf->operation = Buffer::Operation::Write;
+    buf->acceptSocket = nullptr;
+    EnterCriticalSection(&sockObj->SockCritSec);         //sealed and posted in order with the other sends of the socket
+    {
+        sockObj->OutstandingSend--;                     //counted again once posted
+        if (bytesRead == buf->fileChunk && sockObj->state == Socket::SocketState::CONNECTED && sockObj->tls != nullptr) {
+            buf->bufLen = sockObj->tls->Seal(buf->buf, buf->fileChunk);
+            posted = buf->bufLen > 0 && PostSend(sockObj, buf) != SOCKET_ERROR;
+        }
+        InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(buf->fileChunk));    //taken by PostSealedFile, the posted record counts instead
+        if (!posted && sockObj->state == Socket::SocketState::CONNECTED)
+            sockObj->state = Socket::SocketState::FAILURE;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (!posted) {
+        ReleaseFile(buf->file, buf->context, false, sockObj);
+        Buffer::Delete(buf);
+    }
+    InterlockedDecrement(&pendingFileReads);
+}
+
 int SocketManager::PostISBNotify(Socket *sock, Buffer *isbObj) {
     int err;
 
@@ -137,21 +825,19 @@ void SocketManager::HandleError(Socket *sockObj, Buffer *buf, DWORD error) {
     bool    cleanupSocket   = false;
 
     LOG_ERROR("Handle error OP = %d; Error = %lu\n", buf->operation, error);
+    if (buf->operation == Buffer::Operation::Accept)    // sockObj is the listen socket, only the accept socket failed
+        return HandleAcceptError(sockObj, buf, error);
+    if (buf->operation == Buffer::Operation::Connect && sockObj->race != nullptr)  // one attempt failed, the others or the next addresses may still connect
+        return HandleConnectAttemptError(sockObj, buf, error);
+    if (sockObj->datagram && sockObj->state == Socket::SocketState::CONNECTED && error != ERROR_OPERATION_ABORTED && error != WSA_OPERATION_ABORTED)
+        return HandleDatagramError(sockObj, buf, error);    // truncated datagram, ICMP error of an earlier send, unreachable peer...
 
     EnterCriticalSection(&sockObj->SockCritSec);
     {
+        Socket::SocketState previous = sockObj->state;
         switch (buf->operation){
             case Buffer::Operation::Connect :{
-                if (error == WSAEADDRINUSE){ // TimeWaitValue must not have been big enough, update it and connect another socket instead
-                    TimeWaitValue *= 2;
-                    if (TimeWaitValue > MAX_TIME_WAIT_VALUE)
-                        TimeWaitValue = MAX_TIME_WAIT_VALUE;
-                    ConnectToNewSocket(sockObj->address, sockObj->port, sockObj->id);
-                    sockObj->s = INVALID_SOCKET;
-                    sockObj->state = Socket::SocketState::RETRY_CONNECTION;
-                } else {
-                    sockObj->state = Socket::SocketState::CONNECT_FAILURE;
-                }
+                sockObj->state = Socket::SocketState::CONNECT_FAILURE;
                 break;
             }
             case Buffer::Operation::Read :{
@@ -161,6 +847,10 @@ void SocketManager::HandleError(Socket *sockObj, Buffer *buf, DWORD error) {
             }
             case Buffer::Operation::Write :{
                 sockObj->state = Socket::SocketState::FAILURE;
+                if (buf->scheduled) {
+                    InterlockedExchangeAdd64(&sockObj->inFlight, -static_cast<LONG64>(buf->bufLen));
+                    InterlockedExchangeAdd64(&scheduledInFlight, -static_cast<LONG64>(buf->bufLen));
+                }
                 sockObj->OutstandingSend--;;
                 InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(buf->bufLen));
                 break;
@@ -169,15 +859,28 @@ void SocketManager::HandleError(Socket *sockObj, Buffer *buf, DWORD error) {
                 sockObj->state = Socket::SocketState::FAILURE;
             }
         }
+        if (previous == Socket::SocketState::CLOSED)    //closed by Drain, the error is its operation being aborted
+            sockObj->state = previous;
         if (sockObj->OutstandingRecv == 0 && sockObj->OutstandingSend == 0) {
             LOG("Freeing socket obj in HandleError\n");
             cleanupSocket = true;
         }
     }
     LeaveCriticalSection(&sockObj->SockCritSec);
+    if (buf->operation == Buffer::Operation::Write && buf->publication != nullptr)
+        Publication::Release(buf->publication);
+    else if (buf->operation == Buffer::Operation::Write && buf->external != nullptr)
+        ReleaseSendData(buf->external, buf->bufLen, buf->context, false, sockObj);
+    if (buf->operation == Buffer::Operation::Write && buf->file != nullptr)
+        ReleaseFile(buf->file, buf->context, false, sockObj);
+    if (buf->operation == Buffer::Operation::Write && buf->relaySocket != nullptr)
+        ReturnRelayedBuffer(sockObj, buf, false);
     if(cleanupSocket)
         Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
     Buffer::Delete(buf);
+    if (scheduling.enabled)             //drop what the failed socket still has queued, and post what the completion made room for
+        DispatchSends();
+    ResumeAccepts();
 }
 
 void SocketManager::HandleIo(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
@@ -185,11 +888,16 @@ void SocketManager::HandleIo(Socket *sockObj, Buffer *buf, DWORD bytesTransfered
 
     switch(buf->operation) {
         case Buffer::Operation::Read :{
-            HandleRead(sockObj, buf, bytesTransfered);
+            if (sockObj->datagram)
+                HandleDatagramRead(sockObj, buf, bytesTransfered);
+            else
+                HandleRead(sockObj, buf, bytesTransfered);
             break;
         }
         case Buffer::Operation::Write :{
             HandleWrite(sockObj, buf, bytesTransfered);
+            if (scheduling.enabled)
+                DispatchSends();
             break;
         }
         case Buffer::Operation::Connect :
@@ -206,6 +914,10 @@ void SocketManager::HandleIo(Socket *sockObj, Buffer *buf, DWORD bytesTransfered
             UpdateISB(sockObj, buf);
             break;
         }
+        case Buffer::Operation::FileRead :{
+            HandleFileRead(sockObj, buf, bytesTransfered);
+            break;
+        }
         default:
             LOG_ERROR("Unknown OP: %d\n", buf->operation);
     }
@@ -222,6 +934,7 @@ void SocketManager::HandleIo(Socket *sockObj, Buffer *buf, DWORD bytesTransfered
     if (cleanupSocket) {
         Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
     }
+    ResumeAccepts();
 }
 
 void SocketManager::HandleRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
@@ -233,16 +946,32 @@ void SocketManager::HandleRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfer
     LOG("read\n");
 
     // Receive completed successfully
-    if (bytesTransfered > 0) {
+    if (bytesTransfered > 0 && sockObj->tls != nullptr) {
+        HandleTlsRead(sockObj, buf, bytesTransfered);
+    }
+    else if (bytesTransfered > 0 && (sockObj->ring != nullptr || sockObj->negotiating)) {
+        HandleRingRead(sockObj, buf, bytesTransfered);
+    }
+    else if (bytesTransfered > 0 && (sockObj->compressed || sockObj->compressionPending)) {
+        HandleCompressedRead(sockObj, buf, bytesTransfered);
+    }
+    else if (bytesTransfered > 0 && sockObj->relayManager != nullptr) {
+        RelayRead(sockObj, buf, bytesTransfered);
+    }
+    else if (bytesTransfered > 0) {
         buf->bufLen = bytesTransfered;
-        ReceiveData(buf->buf, buf->bufLen, sockObj);
+        DeliverReceivedData(sockObj, buf->buf, buf->bufLen);
         buf->bufLen = Buffer::DEFAULT_BUFFER_SIZE;
         if (sockObj->state != Socket::SocketState::CONNECTED)
             Buffer::Delete(buf);
+        else if (CheckMemory() != MemoryPressure::UNDER_BUDGET) {     //idle sockets don't hold a read buffer, one is taken when data arrives
+            Buffer::Delete(buf);
+            if (PostReadProbe(sockObj) == SOCKET_ERROR)
+                ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        }
         else if(PostRecv(sockObj, buf) == SOCKET_ERROR) {
             LOG_ERROR("PostRecv failed!\n");
             ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
-            LeaveCriticalSection(&sockObj->SockCritSec);
             Buffer::Delete(buf);
         }
     }
@@ -250,477 +979,2483 @@ void SocketManager::HandleRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfer
         LOG("Received 0 byte\n");
         // Graceful close - the receive returned 0 bytes read
         ChangeSocketState(sockObj, Socket::SocketState::CLOSING);
+        Socket *destination = RelayDestination(sockObj);
+        if (destination != nullptr && destination->state == Socket::SocketState::CONNECTED)
+            shutdown(destination->s,        //s : A descriptor identifying a socket.
+                     SD_SEND);              //how : SD_SEND -> Shutdown send operations, the FIN is sent once the pending sends are done so the other end sees the end of the relayed stream.
         // Free the receive buffer
         Buffer::Delete(buf);
     }
 }
 
-void SocketManager::HandleWrite(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
-    LOG("write\n");
+void SocketManager::HandleReadProbe(Socket *sockObj, DWORD error) {
+    bool    cleanupSocket   = false;
 
-    // Update the counters
     EnterCriticalSection(&sockObj->SockCritSec);
     {
-        sockObj->OutstandingSend--;
-        InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(buf->bufLen));
+        sockObj->OutstandingRecv--;
+        if (error != NO_ERROR && sockObj->state != Socket::SocketState::CLOSED)
+            sockObj->state = Socket::SocketState::FAILURE;
     }
     LeaveCriticalSection(&sockObj->SockCritSec);
-    if (bytesTransfered < buf->bufLen){ //incomplete send, very small chance of it ever happening, socket send stream most probably corrupted
-        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+
+    // ----------------------------- data is waiting, the recv with a buffer completes right away (and sees a graceful close)
+    if (error == NO_ERROR && sockObj->state == Socket::SocketState::CONNECTED) {
+        Buffer *buf = Buffer::Create(inUseBufferList, Buffer::Operation::Read);
+        if (PostRecv(sockObj, buf) == SOCKET_ERROR) {
+            LOG_ERROR("PostRecv failed!\n");
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            Buffer::Delete(buf);
+        }
     }
 
-    Buffer::Delete(buf);
-}
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if ((sockObj->OutstandingSend == 0) && (sockObj->OutstandingRecv == 0) && (sockObj->state > Socket::SocketState::CONNECTED)) {
+            cleanupSocket = true;
+        }
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
 
-void SocketManager::HandleConnection(Socket *sockObj, Buffer *buf) {
-    LOG("connected\n");
-    int err;
-    int option, optSize;
-    char *optPtr;
-    if (buf->operation == Buffer::Operation::Connect){
-        option = SO_UPDATE_CONNECT_CONTEXT;               //This option is used with the ConnectEx, WSAConnectByList, and WSAConnectByName functions. This option updates the properties of the socket after the connection is established. This option should be set if the getpeername, getsockname, getsockopt, setsockopt, or shutdown functions are to be used on the connected socket.
-        optSize = 0;
-        optPtr = nullptr;
-    } else {
-        Socket *listenSocketObj = sockObj;
-        sockObj = currentAcceptSocket;                    //sockObj is the listen socket and not the new communication socket
-        option = SO_UPDATE_ACCEPT_CONTEXT;                //This option is used with the AcceptEx function. This option updates the properties of the socket which are inherited from the listening socket. This option should be set if the getpeername, getsockname, getsockopt, or setsockopt functions are to be used on the accepted socket.
-        optSize = sizeof(listenSocketObj->s);
-        optPtr = (char*)&listenSocketObj->s;
-        AddSocketToMap(sockObj, Misc::CreateNilUUID());
-        AcceptNewSocket(listenSocketObj);
+    if (cleanupSocket) {
+        Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
     }
-    ChangeSocketState(sockObj, Socket::SocketState::CONNECTED);
-    // ----------------------------- set needed options
-    err = SetSocketOption(sockObj->s, option, optPtr, optSize);
-    // ----------------------------- trigger first recv
-    buf->operation = Buffer::Operation::Read;
-    if(PostRecv(sockObj, buf) == SOCKET_ERROR){
-        err = SOCKET_ERROR;
-        LOG_ERROR("PostRecv failed!\n");
+    ResumeAccepts();
+}
+
+void SocketManager::DeliverReceivedData(Socket *sockObj, const char *data, u_long length) {
+    SocketHandler *handler = sockObj->handler;    //sockets of a listener with a handler never reach the manager's virtuals
+
+    if (!sockObj->framer.IsEnabled()) {
+        handler != nullptr ? handler->ReceiveData(*this, data, length, sockObj) : ReceiveData(data, length, sockObj);
+        return;
     }
-    // ----------------------------- track isb
-    if (isbFactor > 0) {
-        Buffer *isbBuf = Buffer::Create(inUseBufferList, Buffer::Operation::ISBChange);
-        UpdateISB(sockObj, isbBuf);
+    // ----------------------------- messages fully inside data are given in place, only the ones straddling reads are copied
+    if (!sockObj->framer.Feed(data, length, [this, sockObj, handler](const char *message, u_long messageLength) {
+            handler != nullptr ? handler->ReceiveMessage(*this, message, messageLength, sockObj) : ReceiveMessage(message, messageLength, sockObj);
+            return sockObj->state == Socket::SocketState::CONNECTED && sockObj->framer.IsEnabled();
+        })) {
+        LOG_ERROR("Socket %llu : invalid message framing\n", sockObj->s);
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        return;
     }
+    // ----------------------------- framing was disabled by ReceiveMessage, the rest is raw data
+    if (length > 0 && !sockObj->framer.IsEnabled() && sockObj->state == Socket::SocketState::CONNECTED)
+        handler != nullptr ? handler->ReceiveData(*this, data, length, sockObj) : ReceiveData(data, length, sockObj);
+}
 
-    if (err != NO_ERROR){
+void SocketManager::HandleRingRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    u_long  offset  = 0;
+    bool    drained = true;
+
+    // ----------------------------- the first bytes settle the ring, without one the socket carries the data itself
+    if (sockObj->negotiating)
+        offset = SettleRing(sockObj, buf->buf, bytesTransfered);
+    if (sockObj->ring != nullptr)                       //every other byte on the socket is a doorbell
+        drained = DrainRing(sockObj);
+    else if (offset < bytesTransfered && sockObj->state == Socket::SocketState::CONNECTED)
+        DeliverReceivedData(sockObj, buf->buf + offset, bytesTransfered - offset);
+
+    // ----------------------------- wait for the next doorbell, or come back through the port for the rest of the ring
+    if (sockObj->state != Socket::SocketState::CONNECTED) {
+        Buffer::Delete(buf);
+    }
+    else if (!drained) {
+        EnterCriticalSection(&sockObj->SockCritSec);
+        {
+            sockObj->OutstandingRecv++;
+        }
+        LeaveCriticalSection(&sockObj->SockCritSec);
+        if (!PostQueuedCompletionStatus(iocpHandle,             //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                        1,                      //dwNumberOfBytesTransferred : Seen as a doorbell by HandleRead.
+                                        (ULONG_PTR)sockObj,     //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                        &(buf->ol))) {          //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+            LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+            EnterCriticalSection(&sockObj->SockCritSec);
+            {
+                sockObj->OutstandingRecv--;
+                sockObj->state = Socket::SocketState::FAILURE;
+            }
+            LeaveCriticalSection(&sockObj->SockCritSec);
+            Buffer::Delete(buf);
+        }
+    }
+    else if (PostRecv(sockObj, buf) == SOCKET_ERROR) {
+        LOG_ERROR("PostRecv failed!\n");
         ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
         Buffer::Delete(buf);
-        Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
     }
 }
 
-void SocketManager::HandleDisconnect(Socket *sockObj, Buffer *buf) {
-    EnterCriticalSection(&sockObj->SockCritSec);
+u_long SocketManager::SettleRing(Socket *sockObj, const char *data, u_long length) {
+    SharedRing          *ring       = sockObj->ring;
+    u_long              settled     = 0;
+    SharedRing::Hello   hello;
+
+    if (ring == nullptr) {
+        // ----------------------------- server : a hello names the client's ring, it is answered before any data of the server
+        if (length >= sizeof(hello) && memcmp(data, SharedRing::HELLO_MAGIC, sizeof(SharedRing::HELLO_MAGIC)) == 0) {
+            memcpy(&hello, data, sizeof(hello));
+            ring = hello.capacity <= MAX_RING_CAPACITY ? SharedRing::Open(hello) : nullptr;
+            if (!PostRaw(sockObj, ring != nullptr ? SharedRing::ANSWER_OK : SharedRing::ANSWER_NO, sizeof(SharedRing::ANSWER_OK))) {
+                LOG_ERROR("Socket %llu : shared memory ring answer failed\n", sockObj->s);
+                delete ring;
+                ring = nullptr;
+                ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            }
+            settled = sizeof(hello);
+        }
+    } else if (length >= sizeof(SharedRing::ANSWER_OK) && memcmp(data, SharedRing::ANSWER_OK, sizeof(SharedRing::ANSWER_OK)) == 0) {
+        // ----------------------------- client : the server mapped the ring
+        settled = sizeof(SharedRing::ANSWER_OK);
+    } else {
+        // ----------------------------- client : refused, the socket carries the data itself
+        if (length >= sizeof(SharedRing::ANSWER_NO) && memcmp(data, SharedRing::ANSWER_NO, sizeof(SharedRing::ANSWER_NO)) == 0)
+            settled = sizeof(SharedRing::ANSWER_NO);
+        LOG("Socket %llu : shared memory ring refused\n", sockObj->s);
+        delete ring;
+        ring = nullptr;
+    }
+    EnterCriticalSection(&sockObj->SockCritSec);        //sends see the ring and the end of the negotiation together
     {
-        sockObj->state = Socket::SocketState::DISCONNECTED;
-        sockObj->timeWaitStartTime = GetTickCount();
+        sockObj->ring = ring;
+        sockObj->negotiating = false;
     }
     LeaveCriticalSection(&sockObj->SockCritSec);
-    EnterCriticalSection(&reusableSocketQueue.critSec);
-    {
-        reusableSocketQueue.queue.push(sockObj);
+    return settled;
+}
+
+bool SocketManager::DrainRing(Socket *sockObj) {
+    u_long      budget  = RING_DRAIN_BUDGET;
+    const char  *data;
+
+    while (sockObj->state == Socket::SocketState::CONNECTED) {
+        u_long length = sockObj->ring->Peek(data);
+        if (length == 0 && sockObj->ring->IsBroken()) {
+            LOG_ERROR("Socket %llu : shared memory ring corrupted by the peer, closed\n", sockObj->s);
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            return true;
+        }
+        if (length == 0) {
+            if (sockObj->ring->Sleep())                 //the next write rings the doorbell
+                return true;
+            continue;
+        }
+        if (budget == 0)
+            return false;
+        if (length > budget)
+            length = budget;
+        DeliverReceivedData(sockObj, data, length);     //in place, from the shared memory
+        sockObj->ring->Consume(length);
+        budget -= length;
     }
-    LeaveCriticalSection(&reusableSocketQueue.critSec);
-    LOG("disconnected\n");
-    Buffer::Delete(buf);
+    return true;
 }
 
-void SocketManager::UpdateISB(Socket *sockObj, Buffer *buf) {
-    ULONG isbVal;
-    bool queryFail = false;
+bool SocketManager::OfferRing(Socket *sockObj) {
+    SharedRing::Hello   hello{};
+    SharedRing          *ring   = SharedRing::Create(ringCapacity, hello);
+
+    if (ring == nullptr) {                              //no ring, the socket carries the data itself
+        sockObj->negotiating = false;
+        return true;
+    }
+    sockObj->ring = ring;
+    return PostRaw(sockObj, reinterpret_cast<const char*>(&hello), sizeof(hello));
+}
+
+bool SocketManager::SendToRing(Socket *sockObj, const WSABUF *pieces, DWORD count) {
+    static const char   doorbell    = 0;
+    u_long              length      = 0;
+    bool                written     = false;
+    bool                wake        = false;
+    bool                broken      = false;
 
-    if (PostISBNotify(sockObj, buf) == SOCKET_ERROR ||
-        (idealsendbacklogquery(sockObj->s, &isbVal) == SOCKET_ERROR && (queryFail = true))){
-        if (queryFail) {
-            LOG_ERROR("idealsendbacklogquery failed: %d\n", WSAGetLastError());
+    for (DWORD i = 0 ; i < count ; i++)
+        length += pieces[i].len;
+    EnterCriticalSection(&sockObj->SockCritSec);        //one producer per ring
+    {
+        if (sockObj->state == Socket::SocketState::CONNECTED && !sockObj->negotiating && sockObj->ring != nullptr) {
+            written = sockObj->ring->Write(pieces, count, length, wake);
+            broken = sockObj->ring->IsBroken();
+        }
+        if (broken) {                                   //its pending read is aborted, the completion cleans it up
+            sockObj->state = Socket::SocketState::FAILURE;
+            sockObj->Close(true);
         }
-        isbVal = DEFAULT_MAX_PENDING_BYTE_SENT;
     }
-    LOG("isb changed to %lu\n", isbVal);
-    SetSocketOption(sockObj->s, SO_SNDBUF, (char*)&isbVal, sizeof(isbVal));
-    sockObj->maxPendingByteSent = isbVal*isbFactor;
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (broken) {
+        LOG_ERROR("Socket %llu : shared memory ring corrupted by the peer, closed\n", sockObj->s);
+        return false;
+    }
+    if (!written) {
+        LOG_ERROR("Socket %llu : shared memory ring full or not settled, retry after the receiver read more\n", sockObj->s);
+        return false;
+    }
+    if (wake && !PostRaw(sockObj, &doorbell, sizeof(doorbell))) {
+        LOG_ERROR("Socket %llu : doorbell failed\n", sockObj->s);
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        return false;
+    }
+    return true;
 }
 
-DWORD WINAPI SocketManager::IOCPWorkerThread(LPVOID lpParam) {
-    Socket         *socket;
-    Buffer         *buffer;
-    LPOVERLAPPED   *lpOverlapped        = nullptr;
-    auto            CompletionPort      = (HANDLE)lpParam;
-    DWORD           BytesTransfered;
-    DWORD           Flags;
-    int             rc;
-    DWORD           error;
+bool SocketManager::PostRaw(Socket *sockObj, const char *data, u_long length) {
+    while (length > 0) {                                //handshake flights can be bigger than a buffer
+        Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
 
-    while (true) {
-        error = NO_ERROR;
-        rc = GetQueuedCompletionStatus(CompletionPort,                        //CompletionPort[in] : A handle to the completion port. To create a completion port, use the CreateIoCompletionPort function.
-                                       &BytesTransfered,                      //lpNumberOfBytes[out] : A pointer to a variable that receives the number of bytes transferred during an I/O operation that has completed.
-                                       (PULONG_PTR)&socket,                   //lpCompletionKey[out] : A pointer to a variable that receives the completion key value associated with the file handle whose I/O operation has completed. A completion key is a per-file key that is specified in a call to CreateIoCompletionPort.
-                                       (LPOVERLAPPED *)&lpOverlapped,         //lpOverlapped[out] : A pointer to a variable that receives the address of the OVERLAPPED structure that was specified when the completed I/O operation was started.
-                                       INFINITE);                             //dwMilliseconds[in] : The number of milliseconds that the caller is willing to wait for a completion packet to appear at the completion port.
-        buffer = CONTAINING_RECORD(lpOverlapped, Buffer, ol);
-        if (rc == FALSE) {
-            error = GetLastError();
-            LOG_ERROR("GetQueuedCompletionStatus failed for operation %d : %lu\n", buffer->operation, error);
+        sendObj->bufLen = length < Buffer::DEFAULT_BUFFER_SIZE ? length : Buffer::DEFAULT_BUFFER_SIZE;
+        memcpy(sendObj->buf, data, sendObj->bufLen);
+        data += sendObj->bufLen;
+        length -= sendObj->bufLen;
+        if (PostSend(sockObj, sendObj) == SOCKET_ERROR) {
+            Buffer::Delete(sendObj);
+            return false;
+        }
+    }
+    return true;
+}
 
-            if(socket != nullptr) {
-                rc = WSAGetOverlappedResult(socket->s, &buffer->ol, &BytesTransfered, FALSE, &Flags);
-                if (rc == FALSE) {
-                    error = static_cast<DWORD>(WSAGetLastError());
-                }
+void SocketManager::HandleTlsRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    TlsSession      *tls    = sockObj->tls;
+    SECURITY_STATUS status  = SEC_E_OK;
+    bool            failed  = false;
+    const char      *data;
+    u_long          length;
+    u_long          space;
+
+    // ----------------------------- go on with the handshake, then give the plaintext of every complete record where it was decrypted
+    tls->Received(bytesTransfered);
+    while (sockObj->state == Socket::SocketState::CONNECTED) {
+        if (tls->IsHandshaking()) {
+            if (!StepTlsHandshake(sockObj, status)) {
+                failed = true;
+                break;
             }
+            if (status != SEC_E_OK)                     //the rest of the flight is still to come
+                break;
+            continue;
         }
-        if (buffer->operation == Buffer::Operation::End)
-            break;
-        if (error != NO_ERROR)
-            socket->client->HandleError(socket, buffer, error);
-        else
-            socket->client->HandleIo(socket, buffer, BytesTransfered);
+        status = tls->Decrypt(data, length);
+        if (status != SEC_E_OK && status != SEC_I_RENEGOTIATE)
+            break;                                      //incomplete record, close_notify or error
+        if (length > 0)
+            DeliverReceivedData(sockObj, data, length);
+        tls->Consume();
     }
 
-    LOG("exit thread");
-    return NO_ERROR;
+    // ----------------------------- read the rest of the record or the next one
+    tls->ReadSpace(space);
+    if (sockObj->state == Socket::SocketState::CONNECTED) {
+        if (failed) {
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        } else if (status == SEC_I_CONTEXT_EXPIRED) {   //the peer sent its close_notify
+            ChangeSocketState(sockObj, Socket::SocketState::CLOSING);
+        } else if (status != SEC_E_INCOMPLETE_MESSAGE && status != SEC_I_CONTINUE_NEEDED) {
+            LOG_ERROR("Socket %llu : TLS record refused / status 0x%lx\n", sockObj->s, status);
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        } else if (space == 0 && !(tls->IsHandshaking() && tls->Grow())) {
+            LOG_ERROR("Socket %llu : TLS input full\n", sockObj->s);
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        }
+    }
+    if (sockObj->state != Socket::SocketState::CONNECTED) {
+        Buffer::Delete(buf);
+    }
+    else if (PostRecv(sockObj, buf) == SOCKET_ERROR) {
+        LOG_ERROR("PostRecv failed!\n");
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        Buffer::Delete(buf);
+    }
 }
 
-SocketManager::SocketManager(Type t, unsigned short factor) :   state(State::NOT_INITIALIZED), type(t), isbFactor(factor),
-                                                                iocpHandle(INVALID_HANDLE_VALUE), currentAcceptSocket(nullptr) {
-    int         res;
-
-    // ----------------------------- start WSA
-    
-    WSADATA     wsaData; // gets populated w/ info explaining this sockets implementation
+bool SocketManager::StepTlsHandshake(Socket *sockObj, SECURITY_STATUS &status) {
+    std::string output;
+    bool        established = sockObj->tls->IsEstablished();
+    bool        sent;
 
-    // load Winsock 2.2 DLL. initiates use of the Winsock DLL by a process
-    if ((res = WSAStartup(MAKEWORD(2, 2), &wsaData)) != NO_ERROR) {
-        //WSASYSNOTREADY, WSAVERNOTSUPPORTED, WSAEINPROGRESS, WSAEPROCLIM, WSAEFAULT
-        LOG_ERROR("WSAStartup failed / error %d\n", res);
-        return;
+    EnterCriticalSection(&sockObj->SockCritSec);        //a post-handshake answer goes between the records of the senders
+    {
+        status = sockObj->tls->Handshake(output);
+        sent = output.empty() || PostRaw(sockObj, output.data(), static_cast<u_long>(output.size()));
     }
-    LOG("WSAStartup ok\n");
-    state = State::WSA_INITIALIZED;
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (status == SEC_E_OK && !established)
+        InterlockedIncrement64(&tlsHandshakes);
+    if (sent && (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED || status == SEC_E_INCOMPLETE_MESSAGE))
+        return true;
+    LOG_ERROR("Socket %llu : TLS handshake failed / status 0x%lx\n", sockObj->s, status);
+    if (!established)
+        InterlockedIncrement64(&tlsFailures);
+    return false;
+}
 
-    // ----------------------------- set up IOCP
+bool SocketManager::SendToTls(Socket *socket, const WSABUF *pieces, DWORD count, u_long length) {
+    TlsSession  *tls        = socket->tls;
+    DWORD       piece       = 0;
+    u_long      pieceOffset = 0;
+    bool        sent;
 
-    if ((iocpHandle = CreateIoCompletionPort(INVALID_HANDLE_VALUE,   //FileHandle[in] : If INVALID_HANDLE_VALUE is specified, the function creates an I/O completion port without associating it with a file handle. In this case, the ExistingCompletionPort parameter must be NULL and the CompletionKey parameter is ignored.
-                                             nullptr,                //ExistingCompletionPort[in, optional] : If this parameter is NULL, the function creates a new I/O completion port.
-                                             0,                      //CompletionKey[in] : The per-handle user-defined completion key that is included in every I/O completion packet for the specified file handle. (ignored)
-                                             0                       //NumberOfConcurrentThreads[in] : The maximum number of threads that the operating system can allow to concurrently process I/O completion packets for the I/O completion port. If this parameter is zero, the system allows as many concurrently running threads as there are processors in the system.
-                                            )) == nullptr) {
-        LOG_ERROR("CreateIoCompletionPort failed / error %lu\n", GetLastError());
-        return;
+    EnterCriticalSection(&socket->SockCritSec);         //records are numbered by the session, they must go out in the order they are sealed
+    {
+        u_long room = Buffer::DEFAULT_BUFFER_SIZE - tls->Overhead();
+        if (room > tls->MaxMessage())
+            room = tls->MaxMessage();
+        sent = tls->IsEstablished();
+        while (sent && length > 0) {
+            Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+
+            u_long currentLen = length > room ? room : length;
+            GatherPieces(pieces, piece, pieceOffset, sendObj->buf + tls->Header(), currentLen);
+            sendObj->bufLen = tls->Seal(sendObj->buf, currentLen);      //in place, header and trailer around the plaintext
+            if (sendObj->bufLen == 0 || PostSend(socket, sendObj) == SOCKET_ERROR) {
+                socket->state = Socket::SocketState::FAILURE;
+                Buffer::Delete(sendObj);
+                sent = false;
+            }
+            length -= currentLen;
+        }
     }
-    LOG("CreateIoCompletionPort ok\n");
-    state = State::IOCP_INITIALIZED;
-
-    // count processors
+    LeaveCriticalSection(&socket->SockCritSec);
+    return sent;
+}
 
-    SYSTEM_INFO SystemInfo;
-    GetSystemInfo(&SystemInfo);
+bool SocketManager::OfferCompression(Socket *sockObj) {
+    CompressionSession::Hello   hello{};
 
-    // ----------------------------- create worker threads
+    if (!AttachCompression(sockObj, compressionAlgorithm)) {    //no contexts, the socket carries raw data
+        sockObj->compressionPending = false;
+        InterlockedIncrement64(&compressionRefused);
+        return true;
+    }
+    memcpy(hello.magic, CompressionSession::HELLO_MAGIC, sizeof(hello.magic));
+    hello.algorithm = compressionAlgorithm;
+    return PostRaw(sockObj, reinterpret_cast<const char*>(&hello), sizeof(hello));
+}
 
-    HANDLE      ThreadHandle;
-    DWORD       ThreadID;
-    for (int i = 0; i < (int)SystemInfo.dwNumberOfProcessors * THREADS_PER_PROC; i++) {
-        // create worker thread and pass the completion port to the thread
-        if ((ThreadHandle = CreateThread(nullptr,                 // default security attributes
-                                         0,                       // use default stack size
-                                         IOCPWorkerThread,        // thread function
-                                         iocpHandle,              // argument to thread function
-                                         0,                       // use default creation flags
-                                         &ThreadID                // thread identifier
-                                        )) == nullptr) {
-            LOG_ERROR("CreateThread failed / error %lu\n", GetLastError());
-            ClearThreads();
-            return;
+u_long SocketManager::SettleCompression(Socket *sockObj, const char *data, u_long length) {
+    bool                        compressed  = false;
+    u_long                      settled     = 0;
+    CompressionSession::Hello   hello;
+
+    if (type == Type::SERVER) {
+        // ----------------------------- server : a hello names the algorithm, it is answered before any data of the server
+        if (length >= sizeof(hello) && memcmp(data, CompressionSession::HELLO_MAGIC, sizeof(CompressionSession::HELLO_MAGIC)) == 0) {
+            memcpy(&hello, data, sizeof(hello));
+            compressed = AttachCompression(sockObj, hello.algorithm);
+            if (!PostRaw(sockObj, compressed ? CompressionSession::ANSWER_OK : CompressionSession::ANSWER_NO, sizeof(CompressionSession::ANSWER_OK))) {
+                LOG_ERROR("Socket %llu : compression answer failed\n", sockObj->s);
+                compressed = false;
+                ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            }
+            settled = sizeof(hello);
         }
-        LOG("CreateThread %lu ok\n", ThreadID);
-        threadHandles.push_back(ThreadHandle);
+    } else if (length >= sizeof(CompressionSession::ANSWER_OK) && memcmp(data, CompressionSession::ANSWER_OK, sizeof(CompressionSession::ANSWER_OK)) == 0) {
+        // ----------------------------- client : the server has contexts for the algorithm
+        compressed = true;
+        settled = sizeof(CompressionSession::ANSWER_OK);
+    } else {
+        // ----------------------------- client : refused, the socket carries raw data
+        if (length >= sizeof(CompressionSession::ANSWER_NO) && memcmp(data, CompressionSession::ANSWER_NO, sizeof(CompressionSession::ANSWER_NO)) == 0)
+            settled = sizeof(CompressionSession::ANSWER_NO);
+        LOG("Socket %llu : compression refused\n", sockObj->s);
     }
-    state = State::THREADS_INITIALIZED;
-    if (DisconnectEx == nullptr && !InitAsyncSocketFuncs())
-        return;
-    state = State::MSWSOCK_FUNC_INITIALIZED;
-    if (TimeWaitValue == 0)
-        InitTimeWaitValue();
-    state = State::TIME_WAIT_VALUE_SELECTED;
-    state = State::READY;
+    InterlockedIncrement64(compressed ? &compressionNegotiated : &compressionRefused);
+    EnterCriticalSection(&sockObj->SockCritSec);        //sends see the compression and the end of the negotiation together
+    {
+        sockObj->compressed = compressed;
+        sockObj->compressionPending = false;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    return settled;
 }
 
-SocketManager::~SocketManager() {
-    if(state >= State::THREADS_INITIALIZED){
-        ClearThreads();
+void SocketManager::HandleCompressedRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    u_long  offset  = 0;
+
+    // ----------------------------- the first bytes settle compression, without it the socket carries raw data
+    if (sockObj->compressionPending)
+        offset = SettleCompression(sockObj, buf->buf, bytesTransfered);
+    if (offset < bytesTransfered && sockObj->state == Socket::SocketState::CONNECTED) {
+        if (!sockObj->compressed) {
+            DeliverReceivedData(sockObj, buf->buf + offset, bytesTransfered - offset);
+        } else {
+            // ----------------------------- every block completed by this read, stored ones given in place
+            InterlockedExchangeAdd64(&compressionPackedReceived, static_cast<LONG64>(bytesTransfered - offset));
+            if (!sockObj->compression->Unpack(buf->buf + offset, bytesTransfered - offset, [this, sockObj](const char *data, u_long length) {
+                    InterlockedExchangeAdd64(&compressionRawReceived, static_cast<LONG64>(length));
+                    DeliverReceivedData(sockObj, data, length);
+                    return sockObj->state == Socket::SocketState::CONNECTED;
+                })) {
+                LOG_ERROR("Socket %llu : invalid compressed block\n", sockObj->s);
+                ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            }
+        }
     }
-    ListElt<Socket>::ClearList(inUseSocketList);
-    ListElt<Buffer>::ClearList(inUseBufferList);
-    if(state >= State::IOCP_INITIALIZED){
-        CloseHandle(iocpHandle);
+
+    // ----------------------------- read the rest of the block or the next one
+    if (sockObj->state != Socket::SocketState::CONNECTED) {
+        Buffer::Delete(buf);
     }
-    if(state >= State::WSA_INITIALIZED){
-        if(WSACleanup() == SOCKET_ERROR){
-            //WSANOTINITIALISED, WSAENETDOWN, WSAEINPROGRESS
-            LOG_ERROR("WSACleanup failed / error %d\n", WSAGetLastError());
-        }
+    else if (PostRecv(sockObj, buf) == SOCKET_ERROR) {
+        LOG_ERROR("PostRecv failed!\n");
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        Buffer::Delete(buf);
     }
 }
 
-void SocketManager::ClearThreads() {
-    if(!threadHandles.empty()){
-        for (int i = 0 ; i < threadHandles.size() ; i++){
-            Buffer *endObj = Buffer::Create(inUseBufferList, Buffer::Operation::End);
+bool SocketManager::AttachCompression(Socket *sockObj, DWORD algorithm) {
+    CompressionSession *session = nullptr;
 
-            // Unblock threads from GetQueuedCompletionStatus call and signal application close
-            PostQueuedCompletionStatus(iocpHandle,                      //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
-                                       0,                               //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
-                                       (ULONG_PTR)nullptr,              //dwNumberOfBytesTransferred : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
-                                       &(endObj->ol));                  //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+    if (sockObj->compression != nullptr && sockObj->compression->Algorithm() == algorithm) {
+        InterlockedIncrement64(&compressionReused);     //kept since the previous connection of the socket
+        return true;
+    }
+    EnterCriticalSection(&compressionPool.critSec);
+    {
+        auto it = compressionPool.map.find(algorithm);
+        if (it != compressionPool.map.end() && !it->second.empty()) {
+            session = it->second.back();                //the last one given back, the most likely to be in cache
+            it->second.pop_back();
         }
-        WaitForMultipleObjects(static_cast<DWORD>(threadHandles.size()),//nCount : The number of object handles in the array pointed to by lpHandles
-                               threadHandles.data(),                    //lpHandles : An array of object handles.
-                               TRUE,                                    //bWaitAll : If this parameter is TRUE, the function returns when the state of all objects in the lpHandles array is signaled
+    }
+    LeaveCriticalSection(&compressionPool.critSec);
+    if (session != nullptr)
+        InterlockedIncrement64(&compressionReused);
+    else if ((session = CompressionSession::Create(algorithm)) != nullptr)
+        InterlockedIncrement64(&compressionCreated);
+    else
+        return false;
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if (sockObj->compression != nullptr)            //of another algorithm
+            ReturnCompression(sockObj->compression);
+        sockObj->compression = session;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    return true;
+}
+
+void SocketManager::ReturnCompression(CompressionSession *session) {
+    bool kept;
+
+    session->Reset();
+    EnterCriticalSection(&compressionPool.critSec);
+    {
+        std::vector<CompressionSession*> &pool = compressionPool.map[session->Algorithm()];
+        kept = pool.size() < MAX_POOLED_COMPRESSION;
+        if (kept)
+            pool.push_back(session);
+    }
+    LeaveCriticalSection(&compressionPool.critSec);
+    if (!kept)
+        delete session;
+}
+
+bool SocketManager::SendToCompression(Socket *socket, const WSABUF *pieces, DWORD count, u_long length, SendClass sendClass) {
+    std::vector<Buffer*>    queued;
+    u_long                  packed      = 0;
+    bool                    sent        = true;
+
+    EnterCriticalSection(&socket->SockCritSec);         //blocks are packed and posted in order, one batch in flight at a time
+    {
+        CompressionSession *session = socket->compression;
+        if (socket->state != Socket::SocketState::CONNECTED) {
+            sent = false;
+        } else if (session->IsBatchInFlight()) {        //packed with the other sends made until the batch is sent, pending until then
+            session->Stage(pieces, count);
+            InterlockedExchangeAdd64(&socket->pendingByteSent, static_cast<LONG64>(length));
+        } else if (count == 1) {                        //packed from the caller's memory
+            sent = PackBatch(socket, pieces[0].buf, length, queued);
+        } else {
+            session->Stage(pieces, count);
+            sent = PackBatch(socket, session->Staged().data(), length, queued);
+            session->Staged().clear();
+        }
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    if (queued.empty())
+        return sent;
+    for (Buffer *sendObj : queued)                      //queued without the socket lock, the scheduler takes its own first
+        packed += sendObj->bufLen;
+    return QueueSend(socket, queued, packed, sendClass);
+}
+
+bool SocketManager::PackBatch(Socket *socket, const char *data, u_long length, std::vector<Buffer*> &queued) {
+    CompressionSession  *session    = socket->compression;
+    u_long              room        = Buffer::DEFAULT_BUFFER_SIZE < CompressionSession::MAX_PACKED_SIZE ? Buffer::DEFAULT_BUFFER_SIZE : CompressionSession::MAX_PACKED_SIZE;
+    bool                stored;
+
+    InterlockedIncrement64(&compressionBatches);
+    InterlockedExchangeAdd64(&compressionRawSent, static_cast<LONG64>(length));
+    while (length > 0) {
+        Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+
+        u_long taken = session->Pack(data, length, sendObj->buf, room, sendObj->bufLen, stored);   //in place, the block header then its body
+        sendObj->compressed = true;
+        data += taken;
+        length -= taken;
+        InterlockedIncrement64(&compressionBlocks);
+        if (stored)
+            InterlockedIncrement64(&compressionStoredBlocks);
+        InterlockedExchangeAdd64(&compressionPackedSent, static_cast<LONG64>(sendObj->bufLen));
+        if (scheduling.enabled) {
+            sendObj->endOfSend = length == 0;
+            queued.push_back(sendObj);
+        } else if (PostSend(socket, sendObj) == SOCKET_ERROR) {
+            socket->state = Socket::SocketState::FAILURE;
+            Buffer::Delete(sendObj);
+            return false;
+        }
+        session->Posted();
+    }
+    return true;
+}
+
+void SocketManager::FlushCompression(Socket *sockObj) {
+    std::vector<Buffer*>    queued;
+    u_long                  packed  = 0;
+
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        CompressionSession *session = sockObj->compression;
+        if (session != nullptr && session->IsBatchInFlight() && session->Completed() && !session->Staged().empty()) {
+            std::vector<char> &staged = session->Staged();
+            InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(staged.size()));     //pending as blocks from now on
+            if (sockObj->state == Socket::SocketState::CONNECTED)
+                PackBatch(sockObj, staged.data(), static_cast<u_long>(staged.size()), queued);
+            staged.clear();
+        }
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (queued.empty())
+        return;
+    for (Buffer *sendObj : queued)
+        packed += sendObj->bufLen;
+    QueueSend(sockObj, queued, packed, SendClass::BULK);
+}
+
+void SocketManager::HandleWrite(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    bool                 publicationsQueued;
+    bool                 drained;
+    std::vector<Buffer*> pausedFiles;
+
+    LOG("write\n");
+
+    // Update the counters
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if (buf->scheduled) {
+            InterlockedExchangeAdd64(&sockObj->inFlight, -static_cast<LONG64>(buf->bufLen));
+            InterlockedExchangeAdd64(&scheduledInFlight, -static_cast<LONG64>(buf->bufLen));
+        }
+        sockObj->OutstandingSend--;
+        InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(buf->bufLen));
+        publicationsQueued = !sockObj->publications.empty();
+        pausedFiles.swap(sockObj->pausedFiles);
+        drained = sockObj->drainNotify && sockObj->pendingByteSent == 0;
+        if (drained)
+            sockObj->drainNotify = false;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    for (Buffer *fileObj : pausedFiles) {  //the send made room for the next chunk of a file, paused again if another one took it
+        if (sockObj->state == Socket::SocketState::CONNECTED && PostTransmitFile(sockObj, fileObj) != SOCKET_ERROR)
+            continue;
+        if (sockObj->state == Socket::SocketState::CONNECTED)
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        ReleaseFile(fileObj->file, fileObj->context, false, sockObj);
+        Buffer::Delete(fileObj);
+    }
+    if (sockObj->isbSampled)
+        SampleISB(sockObj);
+    if (buf->compressed)                //the end of a batch packs the sends staged meanwhile
+        FlushCompression(sockObj);
+    if (bytesTransfered < buf->bufLen){ //incomplete send, very small chance of it ever happening, socket send stream most probably corrupted
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+    }
+    if (publicationsQueued)             //the send made room for publications of a DROP_OLDEST subscription
+        SendQueuedPublications(sockObj);
+    if (drained && sockObj->state == Socket::SocketState::CONNECTED) {  //reads were paused until the sends complete
+        SocketHandler *handler = sockObj->handler;
+        handler != nullptr ? handler->SendsDrained(*this, sockObj) : SendsDrained(sockObj);
+    }
+    if (buf->publication != nullptr)    //published, the data is shared by every subscriber
+        Publication::Release(buf->publication);
+    else if (buf->external != nullptr)  //zero-copy send, the kernel is done with the caller's pages
+        ReleaseSendData(buf->external, buf->bufLen, buf->context, bytesTransfered == buf->bufLen, sockObj);
+    if (buf->file != nullptr) {         //file send, the same buffer carries the next chunk until the end of the file
+        bool chunkSent = bytesTransfered == buf->bufLen;
+        buf->fileOffset += buf->fileChunk;
+        buf->fileRemaining -= buf->fileChunk;
+        if (buf->fileRemaining > 0 && sockObj->state == Socket::SocketState::CONNECTED) {
+            if (PostTransmitFile(sockObj, buf) != SOCKET_ERROR)
+                return;
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        }
+        ReleaseFile(buf->file, buf->context, chunkSent && buf->fileRemaining == 0, sockObj);
+    }
+    if (buf->relaySocket != nullptr && ReturnRelayedBuffer(sockObj, buf, bytesTransfered == buf->bufLen))
+        return;
+
+    Buffer::Delete(buf);
+}
+
+void SocketManager::HandleDatagramRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    bool    completed   = true;
+
+    // ----------------------------- reads completed right away don't go through the completion port, a batch of them is handled here like recvmmsg would return it
+    for (int batch = 1 ; completed ; batch++) {
+        EnterCriticalSection(&sockObj->SockCritSec);
+        {
+            sockObj->OutstandingRecv--;
+        }
+        LeaveCriticalSection(&sockObj->SockCritSec);
+        DeliverDatagrams(sockObj, buf, bytesTransfered);
+        if (sockObj->state != Socket::SocketState::CONNECTED) {
+            Buffer::Delete(buf);
+            return;
+        }
+        if (PostDatagramRecv(sockObj, buf, bytesTransfered, completed) == SOCKET_ERROR) {
+            StopDatagramSocket(sockObj, Socket::SocketState::FAILURE);
+            Buffer::Delete(buf);
+            return;
+        }
+        if (completed && batch == DATAGRAM_INLINE_BATCH) {     //the other completions get their turn
+            RequeueDatagramRead(sockObj, buf, bytesTransfered);
+            return;
+        }
+    }
+}
+
+void SocketManager::DeliverDatagrams(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    DWORD   segment     = bytesTransfered;              //one datagram, unless the stack coalesced several of the same size from the same peer (URO)
+    DWORD   offset      = 0;
+
+    if (buf->msg.dwFlags & MSG_TRUNC) {
+        LOG_ERROR("Socket %llu : datagram bigger than %lu bytes dropped\n", sockObj->s, MAX_DATAGRAM_SIZE);
+        InterlockedIncrement64(&datagramsDropped);
+        return;
+    }
+    for (WSACMSGHDR *cmsg = WSA_CMSG_FIRSTHDR(&buf->msg) ; cmsg != nullptr ; cmsg = WSA_CMSG_NXTHDR(&buf->msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_COALESCED_INFO)
+            segment = *(DWORD*)WSA_CMSG_DATA(cmsg);
+    }
+    InterlockedIncrement64(&datagramReads);
+    do {                                                //an empty datagram is still one
+        u_long length = bytesTransfered - offset < segment ? bytesTransfered - offset : segment;
+        ReceiveDatagram(buf->buf + offset, length, buf->peer, sockObj);
+        InterlockedIncrement64(&datagramsReceived);
+        offset += length;
+    } while (segment > 0 && offset < bytesTransfered && sockObj->state == Socket::SocketState::CONNECTED);
+}
+
+void SocketManager::HandleDatagramError(Socket *sockObj, Buffer *buf, DWORD error) {
+    DWORD   bytesTransfered;
+    bool    completed;
+
+    InterlockedIncrement64(&datagramsDropped);
+    if (buf->operation == Buffer::Operation::Read) {
+        EnterCriticalSection(&sockObj->SockCritSec);
+        {
+            sockObj->OutstandingRecv--;
+        }
+        LeaveCriticalSection(&sockObj->SockCritSec);
+        if (PostDatagramRecv(sockObj, buf, bytesTransfered, completed) == SOCKET_ERROR) {
+            StopDatagramSocket(sockObj, Socket::SocketState::FAILURE);
+            Buffer::Delete(buf);
+        } else if (completed)
+            RequeueDatagramRead(sockObj, buf, bytesTransfered);
+    } else {
+        EnterCriticalSection(&sockObj->SockCritSec);
+        {
+            sockObj->OutstandingSend--;
+            InterlockedExchangeAdd64(&sockObj->pendingByteSent, -static_cast<LONG64>(buf->bufLen));
+        }
+        LeaveCriticalSection(&sockObj->SockCritSec);
+        Buffer::Delete(buf);
+    }
+    CloseIfIdle(sockObj);
+}
+
+void SocketManager::RequeueDatagramRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    if (!PostQueuedCompletionStatus(iocpHandle,             //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                    bytesTransfered,        //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                    (ULONG_PTR)sockObj,     //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                    &(buf->ol))) {          //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+        LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+        HandleIo(sockObj, buf, bytesTransfered);
+    }
+}
+
+void SocketManager::StopDatagramSocket(Socket *sockObj, Socket::SocketState state) {
+    ChangeSocketState(sockObj, state);
+    CancelIoEx((HANDLE)sockObj->s, nullptr);            //each aborted operation completes with an error, the last one deletes the socket
+}
+
+void SocketManager::CloseIfIdle(Socket *sockObj) {
+    bool    cleanupSocket   = false;
+
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if ((sockObj->OutstandingSend == 0) && (sockObj->OutstandingRecv == 0) && (sockObj->state > Socket::SocketState::CONNECTED)) {
+            cleanupSocket = true;
+        }
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+
+    if (cleanupSocket) {
+        Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
+    }
+}
+
+bool SocketManager::SendDatagrams(const char *data, u_long datagramSize, u_long count, const SOCKADDR_STORAGE &peer, Socket *socket) {
+    bool    completed;
+
+    if (socket == nullptr || !socket->datagram || socket->state != Socket::SocketState::CONNECTED || draining || datagramSize > MAX_DATAGRAM_SIZE) {
+        return false;
+    }
+    if (CheckMemory() == MemoryPressure::OVER_HARD_LIMIT) {
+        LOG_ERROR("Socket %llu : Over the hard memory limit, send refused\n", socket->s);
+        InterlockedIncrement64(&rejectedSends);
+        return false;
+    }
+    if (static_cast<LONG64>(datagramSize) * count + socket->pendingByteSent > socket->maxPendingByteSent){
+        LOG_ERROR("Socket %llu : Too mush pending send, retry after the stack sent more datagrams\n", socket->s);
+        return false;
+    }
+
+    // ----------------------------- with segmentation offload, as many datagrams as a buffer holds go in one send
+    u_long perSend = socket->segmentOffload && datagramSize > 0 ? MAX_DATAGRAM_SIZE / datagramSize : 1;
+    for (u_long sent = 0 ; sent < count ; ) {
+        u_long batch = count - sent < perSend ? count - sent : perSend;
+        Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+        memcpy(sendObj->buf, data + static_cast<size_t>(sent) * datagramSize, batch * datagramSize);
+        sendObj->bufLen = batch * datagramSize;
+        sendObj->datagramSize = datagramSize;
+        sendObj->peer = peer;
+        if (PostDatagramSend(socket, sendObj, completed) == SOCKET_ERROR) {
+            Buffer::Delete(sendObj);
+            return false;                               //the datagrams before it are sent
+        }
+        InterlockedIncrement64(&datagramSends);
+        InterlockedExchangeAdd64(&datagramsSent, static_cast<LONG64>(batch));
+        if (completed) {                                //no completion packet comes
+            HandleWrite(socket, sendObj, sendObj->bufLen);
+            CloseIfIdle(socket);
+        }
+        sent += batch;
+    }
+    return true;
+}
+
+void SocketManager::RelayRead(Socket *sockObj, Buffer *buf, DWORD bytesTransfered) {
+    Socket  *destination    = RelayDestination(sockObj);
+    bool    resume;
+
+    // ----------------------------- send the read buffer itself, it counts as a recv of the source until it comes back
+    buf->operation = Buffer::Operation::Write;
+    buf->bufLen = bytesTransfered;
+    buf->relaySocket = sockObj;
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        sockObj->OutstandingRecv++;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (destination == nullptr || destination->state != Socket::SocketState::CONNECTED || PostSend(destination, buf) == SOCKET_ERROR) {
+        LOG_ERROR("Socket %llu : relay destination can't send anymore\n", sockObj->s);
+        if (destination != nullptr && destination->state == Socket::SocketState::CONNECTED)
+            ChangeSocketState(destination, Socket::SocketState::FAILURE);
+        EnterCriticalSection(&sockObj->SockCritSec);
+        {
+            sockObj->OutstandingRecv--;
+            sockObj->state = Socket::SocketState::CLOSING;     //nowhere to send what is read
+        }
+        LeaveCriticalSection(&sockObj->SockCritSec);
+        Buffer::Delete(buf);
+        return;
+    }
+    // ----------------------------- keep reading while the destination can take more, else its next relayed send to complete posts the recv
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        resume = destination->pendingByteSent < destination->maxPendingByteSent;
+        sockObj->relayPaused = !resume && sockObj->state == Socket::SocketState::CONNECTED;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (resume && sockObj->state == Socket::SocketState::CONNECTED) {
+        Buffer *recvObj = Buffer::Create(inUseBufferList, Buffer::Operation::Read);
+        if (PostRecv(sockObj, recvObj) == SOCKET_ERROR) {
+            LOG_ERROR("PostRecv failed!\n");
+            ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+            Buffer::Delete(recvObj);
+        }
+    }
+}
+
+bool SocketManager::ReturnRelayedBuffer(Socket *sockObj, Buffer *buf, bool sent) {
+    Socket  *source         = buf->relaySocket;
+    Socket  *destination    = RelayDestination(source);
+    bool    resume;
+    bool    cleanupSource   = false;
+
+    buf->relaySocket = nullptr;
+    EnterCriticalSection(&source->SockCritSec);
+    {
+        source->OutstandingRecv--;
+        if (!sent && source->state == Socket::SocketState::CONNECTED)
+            source->state = Socket::SocketState::CLOSING;       //destination failed, the relayed stream is broken
+        resume = source->relayPaused && source->state == Socket::SocketState::CONNECTED &&
+                 (source->relayManager == nullptr || destination == nullptr || destination->pendingByteSent < destination->maxPendingByteSent);   //a destination gone fails the next relayed read
+        if (resume) {
+            source->relayPaused = false;
+            buf->operation = Buffer::Operation::Read;
+            buf->bufLen = Buffer::DEFAULT_BUFFER_SIZE;
+            if (PostRecv(source, buf) == SOCKET_ERROR) {         //recursive critical section, same thread
+                LOG_ERROR("PostRecv failed!\n");
+                source->state = Socket::SocketState::FAILURE;
+                resume = false;
+            }
+        }
+        cleanupSource = source->OutstandingRecv == 0 && source->OutstandingSend == 0 && source->state > Socket::SocketState::CONNECTED;
+    }
+    LeaveCriticalSection(&source->SockCritSec);
+    if (cleanupSource)                  //source completions won't come anymore, this was its last buffer
+        Socket::DeleteOrDisconnect(source, source->client->socketAccessMap);
+    return resume;
+}
+
+void SocketManager::HandleConnection(Socket *sockObj, Buffer *buf) {
+    LOG("connected\n");
+    int option, optSize;
+    char *optPtr;
+    if (buf->operation == Buffer::Operation::Connect){
+        if (sockObj->race != nullptr && !WinConnectRace(sockObj, buf))
+            return;
+        option = sockObj->af == AF_UNIX ? 0 : SO_UPDATE_CONNECT_CONTEXT;  //This option is used with the ConnectEx, WSAConnectByList, and WSAConnectByName functions. This option updates the properties of the socket after the connection is established. This option should be set if the getpeername, getsockname, getsockopt, setsockopt, or shutdown functions are to be used on the connected socket. Unix domain sockets are connected by connect, nothing to update.
+        optSize = 0;
+        optPtr = nullptr;
+        sockObj->handler = nullptr;
+    } else {
+        Socket *listenSocketObj = sockObj;
+        sockObj = buf->acceptSocket;                      //sockObj is the listen socket and not the new communication socket
+        option = SO_UPDATE_ACCEPT_CONTEXT;                //This option is used with the AcceptEx function. This option updates the properties of the socket which are inherited from the listening socket. This option should be set if the getpeername, getsockname, getsockopt, or setsockopt functions are to be used on the accepted socket.
+        optSize = sizeof(listenSocketObj->s);
+        optPtr = (char*)&listenSocketObj->s;
+        sockObj->handler = listenSocketObj->handler;
+        sockObj->client->AddSocketToMap(sockObj, Misc::CreateNilUUID());
+        sockObj->client->ReplaceAccept(listenSocketObj);     //replace the accept on the same manager, so each one keeps its share of incoming connections
+    }
+    sockObj->client->StartConnection(sockObj, buf, option, optPtr, optSize);
+}
+
+void SocketManager::StartConnection(Socket *sockObj, Buffer *buf, int option, char *optPtr, int optSize) {
+    int     err;
+    bool    accepted    = buf->operation == Buffer::Operation::Accept;
+
+    sockObj->framer.Configure(framingOptions);
+    sockObj->relayTo = Misc::CreateNilUUID();
+    sockObj->relayManager = nullptr;
+    sockObj->relayPaused = false;
+    sockObj->readsPaused = false;
+    sockObj->readHeld = false;
+    sockObj->drainNotify = false;
+    sockObj->deficit = 0;
+    sockObj->inFlight = 0;
+    sockObj->inBulkSend = false;
+    sockObj->sendBucket.Configure(static_cast<double>(scheduling.socketRate), static_cast<double>(scheduling.socketRate) * scheduling.burst / 1000);
+    sockObj->negotiating = sockObj->af == AF_UNIX && ringCapacity > 0 && !tlsEnabled;    //the socket is ready once the server got the hello and the client its answer
+    sockObj->compressed = false;
+    sockObj->compressionPending = compressionAlgorithm != 0 && !tlsEnabled && !sockObj->negotiating;  //same, for the compression hello
+    if (tlsEnabled)                     //before the first recv, which reads into the session
+        sockObj->tls = new TlsSession(&tlsCredentials, accepted, !tlsServerName.empty() ? tlsServerName.c_str() : sockObj->host.c_str());
+    ChangeSocketState(sockObj, Socket::SocketState::CONNECTED);
+    // ----------------------------- set needed options
+    err = option != 0 ? SetSocketOption(sockObj->s, option, optPtr, optSize) : NO_ERROR;
+    if (zeroCopyThreshold > 0) {        //no send buffer : every send is done from the memory it was posted with, the pending sends keep the pipe full
+        int sendBufferSize = 0;
+        if (err == NO_ERROR)
+            err = SetSocketOption(sockObj->s, SO_SNDBUF, (char*)&sendBufferSize, sizeof(sendBufferSize));
+    }
+    // ----------------------------- trigger first recv
+    buf->operation = Buffer::Operation::Read;
+    if(PostRecv(sockObj, buf) == SOCKET_ERROR){
+        err = SOCKET_ERROR;
+        LOG_ERROR("PostRecv failed!\n");
+    }
+    // ----------------------------- offer a shared memory ring to a same-host server
+    if (err == NO_ERROR && sockObj->negotiating && !accepted && !OfferRing(sockObj))
+        err = SOCKET_ERROR;
+    // ----------------------------- offer compression to a server
+    if (err == NO_ERROR && sockObj->compressionPending && !accepted && !OfferCompression(sockObj))
+        err = SOCKET_ERROR;
+    // ----------------------------- the client speaks first in TLS
+    SECURITY_STATUS status;
+    if (err == NO_ERROR && sockObj->tls != nullptr && !accepted && !StepTlsHandshake(sockObj, status))
+        err = SOCKET_ERROR;
+    // ----------------------------- track isb, TCP only, from the default max pending send : a reused socket doesn't keep the estimate of its previous connection
+    sockObj->isbSampled = false;
+    sockObj->isbSampleTime = 0;
+    sockObj->isbDelivered = 0;
+    sockObj->maxPendingByteSent = DEFAULT_MAX_PENDING_BYTE_SENT;
+    if (sockObj->af == AF_UNIX) {
+    } else if (isbFactor > 0 && isbSource == ISBSource::TCP_INFO) {
+        StartISBSampling(sockObj);
+    } else if (isbFactor > 0) {
+        Buffer *isbBuf = Buffer::Create(inUseBufferList, Buffer::Operation::ISBChange);
+        UpdateISB(sockObj, isbBuf);
+    }
+
+    if (err != NO_ERROR){
+        ChangeSocketState(sockObj, Socket::SocketState::FAILURE);
+        Buffer::Delete(buf);
+        Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
+    }
+}
+
+void SocketManager::HandleAcceptError(Socket *listenSockObj, Buffer *buf, DWORD error) {
+    Socket          *acceptSockObj  = buf->acceptSocket;
+    SocketManager   *owner          = acceptSockObj->client;
+
+    ChangeSocketState(acceptSockObj, Socket::SocketState::FAILURE);
+    Socket::Delete(acceptSockObj);
+    if (listenSockObj->state == Socket::SocketState::LISTENING)   //listen socket is still open, keep the same number of accepts pending
+        owner->ReplaceAccept(listenSockObj);
+    Buffer::Delete(buf);
+}
+
+void SocketManager::HandleDisconnect(Socket *sockObj, Buffer *buf) {
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        sockObj->state = Socket::SocketState::DISCONNECTED;
+        sockObj->timeWaitStartTime = GetTickCount();
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    EnterCriticalSection(&reusableSocketQueue.critSec);
+    {
+        reusableSocketQueue.queue.push(sockObj);
+    }
+    LeaveCriticalSection(&reusableSocketQueue.critSec);
+    LOG("disconnected\n");
+    Buffer::Delete(buf);
+}
+
+void SocketManager::UpdateISB(Socket *sockObj, Buffer *buf) {
+    ULONG isbVal;
+
+    if (PostISBNotify(sockObj, buf) == SOCKET_ERROR){       //notifications not supported (or socket closing), estimate it instead
+        Buffer::Delete(buf);
+        if (sockObj->state == Socket::SocketState::CONNECTED && !sockObj->isbSampled)
+            StartISBSampling(sockObj);
+        return;
+    }
+    if (idealsendbacklogquery(sockObj->s, &isbVal) == SOCKET_ERROR){
+        LOG_ERROR("idealsendbacklogquery failed: %d\n", WSAGetLastError());
+        isbVal = DEFAULT_MAX_PENDING_BYTE_SENT;
+    }
+    ApplyISB(sockObj, isbVal);
+}
+
+void SocketManager::StartISBSampling(Socket *sockObj) {
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        sockObj->isbSampled = true;
+        sockObj->isbSampleTime = GetTickCount() - ISB_SAMPLE_INTERVAL;    //first sample right away
+        sockObj->isbDelivered = 0;
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    ApplyISB(sockObj, DEFAULT_MAX_PENDING_BYTE_SENT);                 //in case the first sample fails
+    SampleISB(sockObj);
+
+    // ----------------------------- sampled on a period too, a socket with no send completing would keep its last estimate
+    EnterCriticalSection(&isbSampledSockets.critSec);
+    {
+        isbSampledSockets.map[sockObj->GetId()] = sockObj;
+        if (isbTimer == nullptr &&
+            !CreateTimerQueueTimer(&isbTimer,               //phNewTimer : A pointer to a buffer that receives a handle to the timer-queue timer on return.
+                                   nullptr,                 //TimerQueue : A handle to the timer queue. If this parameter is NULL, the timer is associated with the default timer queue.
+                                   ISBTimerCallback,        //Callback : A pointer to the application-defined function of type WAITORTIMERCALLBACK to be executed when the timer expires.
+                                   this,                    //Parameter : A single parameter value that will be passed to the callback function.
+                                   ISB_SAMPLE_INTERVAL,     //DueTime : The amount of time in milliseconds relative to the current time that must elapse before the timer is signaled for the first time.
+                                   ISB_SAMPLE_INTERVAL,     //Period : The period of the timer, in milliseconds. If this parameter is not zero, the timer is periodic.
+                                   WT_EXECUTEDEFAULT)) {    //Flags : By default, the callback function is queued to a non-I/O worker thread.
+            LOG_ERROR("CreateTimerQueueTimer failed / error %lu\n", GetLastError());
+            isbTimer = nullptr;
+        }
+    }
+    LeaveCriticalSection(&isbSampledSockets.critSec);
+}
+
+VOID CALLBACK SocketManager::ISBTimerCallback(PVOID lpParam, BOOLEAN timerFired) {
+    auto                                        *manager    = static_cast<SocketManager*>(lpParam);
+    std::vector<std::pair<UUID, Socket*>>       sampled;
+    std::vector<UUID>                           closed;
+    RPC_STATUS                                  status;
+
+    EnterCriticalSection(&manager->isbSampledSockets.critSec);
+    {
+        sampled.assign(manager->isbSampledSockets.map.begin(), manager->isbSampledSockets.map.end());
+    }
+    LeaveCriticalSection(&manager->isbSampledSockets.critSec);
+    for (auto &entry : sampled) {
+        bool sample = false;
+        if (manager->socketAccessMap.Get(entry.first) == entry.second) {
+            EnterCriticalSection(&entry.second->SockCritSec);       //the socket may have been reused for another connection meanwhile
+            {
+                sample = UuidEqual(&entry.second->id, &entry.first, &status) && entry.second->isbSampled &&
+                         entry.second->state == Socket::SocketState::CONNECTED;
+                if (sample)
+                    manager->SampleISB(entry.second);
+            }
+            LeaveCriticalSection(&entry.second->SockCritSec);
+        }
+        if (!sample)
+            closed.push_back(entry.first);
+    }
+    EnterCriticalSection(&manager->isbSampledSockets.critSec);
+    {
+        for (UUID &id : closed)
+            manager->isbSampledSockets.map.erase(id);
+    }
+    LeaveCriticalSection(&manager->isbSampledSockets.critSec);
+}
+
+void SocketManager::SampleISB(Socket *sockObj) {
+    TCP_INFO_v0     info;
+    DWORD           version     = 0;
+    DWORD           bytes;
+    DWORD           now         = GetTickCount();
+    DWORD           elapsed;
+    ULONG64         isbVal      = 0;
+
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        elapsed = now - sockObj->isbSampleTime;
+        if (elapsed >= ISB_SAMPLE_INTERVAL) {
+            sockObj->isbSampleTime = now;
+            if (WSAIoctl(sockObj->s,                        //s : A descriptor identifying a socket.
+                         SIO_TCP_INFO,                      //dwIoControlCode : The control code of operation to perform.
+                         &version,                          //lpvInBuffer : A pointer to the input buffer, the version of TCP_INFO structure wanted.
+                         sizeof(version),                   //cbInBuffer : The size, in bytes, of the input buffer.
+                         &info,                             //lpvOutBuffer : A pointer to the output buffer.
+                         sizeof(info),                      //cbOutBuffer : The size, in bytes, of the output buffer.
+                         &bytes,                            //lpcbBytesReturned : A pointer to actual number of bytes of output.
+                         nullptr,                           //lpOverlapped : A pointer to a WSAOVERLAPPED structure (ignored for non-overlapped sockets).
+                         nullptr                            //lpCompletionRoutine : A pointer to the completion routine called when the operation has been completed (ignored for non-overlapped sockets).
+                        ) != 0) {
+                LOG_ERROR("WSAIoctl SIO_TCP_INFO failed / error %d\n", WSAGetLastError());
+            } else {
+                // ----------------------------- bandwidth-delay product : delivery rate since last sample * min RTT, at least the congestion window
+                ULONG64 delivered = info.BytesOut - info.BytesInFlight;
+                if (sockObj->isbDelivered > 0 && delivered > sockObj->isbDelivered)
+                    isbVal = (delivered - sockObj->isbDelivered) * info.MinRttUs / (static_cast<ULONG64>(elapsed) * 1000);
+                sockObj->isbDelivered = delivered;
+                if (isbVal < info.Cwnd)
+                    isbVal = info.Cwnd;
+                if (isbVal < MIN_ESTIMATED_ISB)
+                    isbVal = MIN_ESTIMATED_ISB;
+            }
+        }
+    }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (isbVal > 0)
+        ApplyISB(sockObj, isbVal > MAXLONG ? MAXLONG : static_cast<ULONG>(isbVal));
+}
+
+void SocketManager::ApplyISB(Socket *sockObj, ULONG isbVal) {
+    LOG("isb changed to %lu\n", isbVal);
+    if (zeroCopyThreshold == 0)         //zero-copy sockets keep no send buffer
+        SetSocketOption(sockObj->s, SO_SNDBUF, (char*)&isbVal, sizeof(isbVal));
+    sockObj->maxPendingByteSent = isbVal*isbFactor;
+}
+
+DWORD WINAPI SocketManager::IOCPWorkerThread(LPVOID lpParam) {
+    Socket         *socket;
+    Buffer         *buffer;
+    LPOVERLAPPED   *lpOverlapped        = nullptr;
+    auto            CompletionPort      = (HANDLE)lpParam;
+    DWORD           BytesTransfered;
+    DWORD           Flags;
+    int             rc;
+    DWORD           error;
+    bool            probe;
+
+    while (true) {
+        error = NO_ERROR;
+        rc = GetQueuedCompletionStatus(CompletionPort,                        //CompletionPort[in] : A handle to the completion port. To create a completion port, use the CreateIoCompletionPort function.
+                                       &BytesTransfered,                      //lpNumberOfBytes[out] : A pointer to a variable that receives the number of bytes transferred during an I/O operation that has completed.
+                                       (PULONG_PTR)&socket,                   //lpCompletionKey[out] : A pointer to a variable that receives the completion key value associated with the file handle whose I/O operation has completed. A completion key is a per-file key that is specified in a call to CreateIoCompletionPort.
+                                       (LPOVERLAPPED *)&lpOverlapped,         //lpOverlapped[out] : A pointer to a variable that receives the address of the OVERLAPPED structure that was specified when the completed I/O operation was started.
+                                       INFINITE);                             //dwMilliseconds[in] : The number of milliseconds that the caller is willing to wait for a completion packet to appear at the completion port.
+        buffer = CONTAINING_RECORD(lpOverlapped, Buffer, ol);
+        probe = socket != nullptr && (LPWSAOVERLAPPED)lpOverlapped == &socket->readProbe;    //zero-byte recv, no buffer behind it
+        if (rc == FALSE) {
+            error = GetLastError();
+            LOG_ERROR("GetQueuedCompletionStatus failed for operation %d : %lu\n", probe ? Buffer::Operation::Read : buffer->operation, error);
+
+            if(socket != nullptr) {
+                rc = WSAGetOverlappedResult(socket->s, &buffer->ol, &BytesTransfered, FALSE, &Flags);
+                if (rc == FALSE) {
+                    error = static_cast<DWORD>(WSAGetLastError());
+                }
+            }
+        }
+        if (probe) {
+            socket->client->HandleReadProbe(socket, error);
+            continue;
+        }
+        if (buffer->operation == Buffer::Operation::Drain) {
+            static_cast<SocketManager*>(buffer->context)->HandleDrain(buffer);
+            continue;
+        }
+        if (buffer->operation == Buffer::Operation::Resolve) {
+            static_cast<ConnectRace*>(buffer->context)->client->HandleResolve(buffer);
+            continue;
+        }
+        if (buffer->operation == Buffer::Operation::Publish) {
+            static_cast<Publication*>(buffer->context)->manager->HandlePublish(buffer);
+            continue;
+        }
+        if (buffer->operation == Buffer::Operation::End)
+            break;
+        if (error != NO_ERROR)
+            socket->client->HandleError(socket, buffer, error);
+        else
+            socket->client->HandleIo(socket, buffer, BytesTransfered);
+    }
+
+    LOG("exit thread");
+    return NO_ERROR;
+}
+
+SocketManager::SocketManager(Type t, unsigned short factor, DWORD threadCount, const Placement &placement) :
+                                                                                    inUseSocketList(CriticalRecyclableList<Socket>::DEFAULT_MAX_RECYCLED_SIZE, placement.numaNode),
+                                                                                    inUseBufferList(CriticalRecyclableList<Buffer>::DEFAULT_MAX_RECYCLED_SIZE, placement.numaNode),
+                                                                                    state(State::NOT_INITIALIZED), type(t), isbFactor(factor), isbSource(ISBSource::IDEAL_SEND_BACKLOG), isbTimer(nullptr), zeroCopyThreshold(0),
+                                                                                    scheduledInFlight(0), sendTimer(nullptr),
+                                                                                    memoryPressure(MemoryPressure::UNDER_BUDGET), peakMemory(0), pausedAccepts(0),
+                                                                                    acceptPauses(0), rejectedSends(0), readProbes(0),
+                                                                                    draining(false), drainNext(0), drainWorkers(0), drainDone(nullptr), shardIndex(0),
+                                                                                    connectTimer(nullptr), connectTimerDone(nullptr), connectAttemptDelay(CONNECT_ATTEMPT_DELAY),
+                                                                                    dnsServer{}, pendingResolutions(0), dnsCacheHits(0), dnsNegativeHits(0), dnsResolutions(0), dnsFailures(0),
+                                                                                    datagramsReceived(0), datagramReads(0), datagramsSent(0), datagramSends(0), datagramsDropped(0), ringCapacity(0),
+                                                                                    tlsEnabled(false), tlsCredentials{}, tlsHandshakes(0), tlsFailures(0), pendingFileReads(0),
+                                                                                    compressionAlgorithm(0), compressionNegotiated(0), compressionRefused(0), compressionCreated(0), compressionReused(0),
+                                                                                    compressionBatches(0), compressionBlocks(0), compressionStoredBlocks(0), compressionRawSent(0), compressionPackedSent(0),
+                                                                                    compressionPackedReceived(0), compressionRawReceived(0),
+                                                                                    published(0), delivered(0), publicationsDropped(0), slowSubscribers(0),
+                                                                                    iocpHandle(INVALID_HANDLE_VALUE) {
+    int         res;
+
+    // ----------------------------- start WSA
+    
+    WSADATA     wsaData; // gets populated w/ info explaining this sockets implementation
+
+    // load Winsock 2.2 DLL. initiates use of the Winsock DLL by a process
+    if ((res = WSAStartup(MAKEWORD(2, 2), &wsaData)) != NO_ERROR) {
+        //WSASYSNOTREADY, WSAVERNOTSUPPORTED, WSAEINPROGRESS, WSAEPROCLIM, WSAEFAULT
+        LOG_ERROR("WSAStartup failed / error %d\n", res);
+        return;
+    }
+    LOG("WSAStartup ok\n");
+    state = State::WSA_INITIALIZED;
+
+    // count processors, before the port : its concurrency is the thread count of the node, not every processor
+
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    if (threadCount == 0 && placement.numaNode != Numa::ANY_NODE)
+        threadCount = static_cast<DWORD>(Numa::Processors(placement.numaNode).size()) * THREADS_PER_PROC;
+    if (threadCount == 0)
+        threadCount = SystemInfo.dwNumberOfProcessors * THREADS_PER_PROC;
+
+    // ----------------------------- set up IOCP
+
+    if ((iocpHandle = CreateIoCompletionPort(INVALID_HANDLE_VALUE,   //FileHandle[in] : If INVALID_HANDLE_VALUE is specified, the function creates an I/O completion port without associating it with a file handle. In this case, the ExistingCompletionPort parameter must be NULL and the CompletionKey parameter is ignored.
+                                             nullptr,                //ExistingCompletionPort[in, optional] : If this parameter is NULL, the function creates a new I/O completion port.
+                                             0,                      //CompletionKey[in] : The per-handle user-defined completion key that is included in every I/O completion packet for the specified file handle. (ignored)
+                                             threadCount             //NumberOfConcurrentThreads[in] : The maximum number of threads that the operating system can allow to concurrently process I/O completion packets for the I/O completion port. If this parameter is zero, the system allows as many concurrently running threads as there are processors in the system.
+                                            )) == nullptr) {
+        LOG_ERROR("CreateIoCompletionPort failed / error %lu\n", GetLastError());
+        return;
+    }
+    LOG("CreateIoCompletionPort ok\n");
+    state = State::IOCP_INITIALIZED;
+
+    // ----------------------------- create worker threads
+
+    HANDLE      ThreadHandle;
+    DWORD       ThreadID;
+    for (DWORD i = 0; i < threadCount; i++) {
+        // create worker thread and pass the completion port to the thread
+        if ((ThreadHandle = CreateThread(nullptr,                 // default security attributes
+                                         0,                       // use default stack size
+                                         IOCPWorkerThread,        // thread function
+                                         iocpHandle,              // argument to thread function
+                                         CREATE_SUSPENDED,        // started once pinned, so its stack is touched on the right node
+                                         &ThreadID                // thread identifier
+                                        )) == nullptr) {
+            LOG_ERROR("CreateThread failed / error %lu\n", GetLastError());
+            ClearThreads();
+            return;
+        }
+        LOG("CreateThread %lu ok\n", ThreadID);
+        if (placement.affinity != ThreadAffinity::NO_AFFINITY)
+            Numa::PinThread(ThreadHandle, placement.numaNode, placement.affinity == ThreadAffinity::CORE_AFFINITY ? static_cast<int>(placement.firstProcessor + i) : -1);
+        ResumeThread(ThreadHandle);
+        threadHandles.push_back(ThreadHandle);
+    }
+    state = State::THREADS_INITIALIZED;
+    if (DisconnectEx == nullptr && !InitAsyncSocketFuncs())
+        return;
+    state = State::MSWSOCK_FUNC_INITIALIZED;
+    if (TimeWaitValue == 0)
+        InitTimeWaitValue();
+    state = State::TIME_WAIT_VALUE_SELECTED;
+    state = State::READY;
+}
+
+SocketManager::~SocketManager() {
+    HANDLE timer;
+
+    if (state >= State::READY && !draining)     // closes sockets while the worker threads can still handle their aborted operations
+        Drain(0);
+    while (pendingResolutions > 0 || pendingFileReads > 0)  // a resolution completing later would start attempts and the connect timer on a manager going away, a file read post to its port
+        Sleep(DRAIN_POLL_PERIOD);
+    if (sendTimer != nullptr)               // waits for a running callback, before the sockets it dispatches go away
+        DeleteTimerQueueTimer(nullptr, sendTimer, INVALID_HANDLE_VALUE);
+    EnterCriticalSection(&connectRaces.critSec);
+    {
+        timer = connectTimer;               // a running callback doesn't delete it as well once the last connect is done
+        connectTimer = nullptr;
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    if (timer != nullptr)
+        DeleteTimerQueueTimer(nullptr, timer, INVALID_HANDLE_VALUE);
+    if (connectTimerDone != nullptr) {      // callbacks of a timer deleted when the connects were done
+        WaitForSingleObject(connectTimerDone, INFINITE);
+        CloseHandle(connectTimerDone);
+    }
+    if (isbTimer != nullptr)
+        DeleteTimerQueueTimer(nullptr, isbTimer, INVALID_HANDLE_VALUE);
+    if(state >= State::THREADS_INITIALIZED){
+        ClearThreads();
+    }
+    ListElt<Socket>::ClearList(inUseSocketList);
+    ListElt<Buffer>::ClearList(inUseBufferList);
+    if (tlsEnabled)                         // after the sessions of the sockets
+        FreeCredentialsHandle(&tlsCredentials);
+    for (auto &race : connectRaces.map)     // connects still in flight
+        delete race.second;
+    for (auto &topic : topics.map)          // after the sockets, which leave them when closed
+        delete topic.second;
+    for (auto &pool : compressionPool.map)  // after the sockets, which give their compression sessions back when deleted
+        for (CompressionSession *session : pool.second)
+            delete session;
+    if(state >= State::IOCP_INITIALIZED){
+        CloseHandle(iocpHandle);
+    }
+    if(state >= State::WSA_INITIALIZED){
+        if(WSACleanup() == SOCKET_ERROR){
+            //WSANOTINITIALISED, WSAENETDOWN, WSAEINPROGRESS
+            LOG_ERROR("WSACleanup failed / error %d\n", WSAGetLastError());
+        }
+    }
+}
+
+void SocketManager::ClearThreads() {
+    if(!threadHandles.empty()){
+        for (int i = 0 ; i < threadHandles.size() ; i++){
+            Buffer *endObj = Buffer::Create(inUseBufferList, Buffer::Operation::End);
+
+            // Unblock threads from GetQueuedCompletionStatus call and signal application close
+            PostQueuedCompletionStatus(iocpHandle,                      //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                       0,                               //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                       (ULONG_PTR)nullptr,              //dwNumberOfBytesTransferred : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                       &(endObj->ol));                  //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+        }
+        WaitForMultipleObjects(static_cast<DWORD>(threadHandles.size()),//nCount : The number of object handles in the array pointed to by lpHandles
+                               threadHandles.data(),                    //lpHandles : An array of object handles.
+                               TRUE,                                    //bWaitAll : If this parameter is TRUE, the function returns when the state of all objects in the lpHandles array is signaled
                                INFINITE);                               //dwMilliseconds : The time-out interval, in milliseconds. If dwMilliseconds is INFINITE, the function will return only when the specified objects are signaled.
         for (HANDLE &threadHandle : threadHandles){
             CloseHandle(threadHandle);
         }
-        threadHandles.clear();
+        threadHandles.clear();
+    }
+}
+
+Socket *SocketManager::GenerateSocket(bool reuse, int family){
+    SOCKET sock;
+    Socket *sockObj = reuse ? ReuseSocket(family) : nullptr;
+
+    if(sockObj == nullptr) {
+        if ((sock = WSASocket(family,                      //af : The address family specification
+                              SOCK_STREAM,                 //type : SOCK_STREAM -> A socket type that provides sequenced, reliable, two-way, connection-based byte streams with an OOB data transmission mechanism. This socket type uses the Transmission Control Protocol (TCP) for the Internet address family (AF_INET or AF_INET6).
+                              family == AF_UNIX ? 0 : IPPROTO_TCP, //protocol : IPPROTO_TCP -> The Transmission Control Protocol (TCP). This is a possible value when the af parameter is AF_INET or AF_INET6 and the type parameter is SOCK_STREAM. 0 for a Unix domain socket.
+                              nullptr,                     //lpProtocolInfo : A pointer to a WSAPROTOCOL_INFO structure that defines the characteristics of the socket to be created.
+                              0,                           //g : An existing socket group ID or an appropriate action to take when creating a new socket and a new socket group. 0 -> No group operation is performed.
+                              WSA_FLAG_OVERLAPPED          //dwFlags : A set of flags used to specify additional socket attributes. WSA_FLAG_OVERLAPPED -> Create a socket that supports overlapped I/O operations.
+        )) == INVALID_SOCKET) {
+            LOG_ERROR("WSASocket failed / error %d\n", WSAGetLastError());
+            return nullptr;
+        }
+        LOG("WSASocket ok\n");
+        sockObj = Socket::Create(inUseSocketList, this, sock, family);
+    }
+    return sockObj;
+}
+
+bool SocketManager::AssociateSocketToIOCP(Socket *sockObj){
+    HANDLE hrc = CreateIoCompletionPort((HANDLE)sockObj->s,          //FileHandle[in] : An open file handle. The handle must be to an object that supports overlapped I/O.
+                                        iocpHandle,                  //ExistingCompletionPort[in, optional] : A handle to an existing I/O completion, the function associates it with the handle specified by the FileHandle parameter.
+                                        (ULONG_PTR)sockObj,          //CompletionKey[in] : The per-handle user-defined completion key that is included in every I/O completion packet for the specified file handle.
+                                        0);                          //NumberOfConcurrentThreads[in] : This parameter is ignored if the ExistingCompletionPort parameter is not NULL.
+    if (hrc == nullptr) {
+        LOG_ERROR("CreateIoCompletionPort failed / error %lu\n", GetLastError());
+        Socket::Delete(sockObj);
+        return false;
+    }
+    LOG("CreateIoCompletionPort ok\n");
+    sockObj->state = Socket::SocketState::ASSOCIATED;
+    return true;
+}
+
+bool SocketManager::BindSocket(Socket *sockObj, const SOCKADDR *sockAddr, int length){
+    if (sockAddr->sa_family != AF_UNIX &&                                           //a path has no port to share
+        (SetSocketOption(sockObj->s, SO_REUSE_UNICASTPORT, true) == SOCKET_ERROR || //works on Windows 10 only, use SO_PORT_SCALABILITY instead on Windows 7-8
+         SetSocketOption(sockObj->s, SO_EXCLUSIVEADDRUSE, true) == SOCKET_ERROR))
+        return false;
+    if (bind(sockObj->s,                        //s : A descriptor identifying an unconnected socket.
+             sockAddr,                          //name : A pointer to a sockaddr structure of the local address to assign to the bound socket.
+             length                             //namelen : The length, in bytes, of the value pointed to by the name parameter.
+    ) == SOCKET_ERROR){
+        LOG_ERROR("bind failed / error %d\n", WSAGetLastError());
+        Socket::Delete(sockObj);
+        return false;
+    }
+    LOG("bind ok\n");
+    sockObj->state = Socket::SocketState::BOUND;
+    return true;
+}
+
+int SocketManager::SetSocketOption(SOCKET s, int option, const char *optPtr, int optSize){
+    int err = NO_ERROR;
+
+    if(setsockopt(s,                                      //s : A descriptor that identifies a socket.
+                  SOL_SOCKET,                             //level : The level at which the option is defined
+                  option,                                 //optname : The socket option for which the value is to be set. The optname parameter must be a socket option defined within the specified level, or behavior is undefined.
+                  optPtr,                                 //optval : A pointer to the buffer in which the value for the requested option is specified.
+                  optSize                                 //optlen : The size, in bytes, of the buffer pointed to by the optval parameter.
+    ) == SOCKET_ERROR){ //shouldn't ever happens
+        err = WSAGetLastError();
+        LOG_ERROR("setsockopt for option %d failed : %d\n", option, err);
+    }
+    return err;
+}
+
+int SocketManager::GetSocketOption(SOCKET s, int option, char *optPtr, int optSize){
+    int err = NO_ERROR;
+
+    if(getsockopt(s,                                      //s : A descriptor that identifies a socket.
+                  SOL_SOCKET,                             //level : The level at which the option is defined
+                  option,                                 //optname : The socket option for which the value is to be retrieved. The optname parameter must be a socket option defined within the specified level, or behavior is undefined.
+                  optPtr,                                 //optval : A pointer to the buffer in which the value for the requested option is specified.
+                  &optSize                                //optlen : A pointer to the size, in bytes, of the optval buffer.
+    ) == SOCKET_ERROR){ //shouldn't ever happens
+        err = WSAGetLastError();
+        LOG_ERROR("getsockopt for option %d failed : %d\n", option, err);
+    }
+    return err;
+}
+
+UUID SocketManager::CreateId() {
+    UUID id;
+    RPC_STATUS status = UuidCreateSequential(&id);
+    if (status == RPC_S_UUID_NO_ADDRESS)
+        UuidCreate(&id);
+    id.Data4[6] = static_cast<unsigned char>(shardIndex >> 8);       //last bytes of the node, the same for every id of the host, the time keeps them unique
+    id.Data4[7] = static_cast<unsigned char>(shardIndex);
+    return id;
+}
+
+void SocketManager::AddSocketToMap(Socket *sockObj, UUID id){
+    RPC_STATUS status;
+    if (UuidIsNil(&id, &status))
+        id = CreateId();
+    sockObj->id = id;
+    EnterCriticalSection(&socketAccessMap.critSec);
+    {
+        socketAccessMap.map[sockObj->id] = sockObj;
+    }
+    LeaveCriticalSection(&socketAccessMap.critSec);
+}
+
+UUID SocketManager::ConnectToNewSocket(const char *address, u_short port, UUID id) {
+    RPC_STATUS status;
+    UUID nullId = Misc::CreateNilUUID();
+    SOCKADDR_STORAGE sockAddr;
+    int sockAddrLength;
+    if (state < State::READY || type != Type::CLIENT || address == nullptr)
+        return nullId;
+
+    if (UuidIsNil(&id, &status))
+        id = CreateId();
+    auto *race = new ConnectRace(id, this, address, port);
+
+    // ----------------------------- numeric address, or host name resolved lately
+    if (ParseAddress(address, port, sockAddr, sockAddrLength)) {
+        race->addresses.push_back(sockAddr);
+    } else if (dnsCache.Get(race->host, race->addresses)) {
+        if (race->addresses.empty()) {                  //failed lately, negative caching
+            InterlockedIncrement64(&dnsNegativeHits);
+            delete race;
+            return nullId;
+        }
+        InterlockedIncrement64(&dnsCacheHits);
+        for (auto &cached : race->addresses)
+            SetPort(cached, port);
+    } else {
+        // ----------------------------- resolve the host name on the thread pool, the worker thread handling its completion starts the first attempt
+        Buffer *resolveObj = Buffer::Create(inUseBufferList, Buffer::Operation::Resolve);
+        resolveObj->context = race;
+        race->resolving = true;
+        EnterCriticalSection(&connectRaces.critSec);
+        {
+            connectRaces.map[id] = race;
+        }
+        LeaveCriticalSection(&connectRaces.critSec);
+        InterlockedIncrement(&pendingResolutions);
+        InterlockedIncrement64(&dnsResolutions);
+        if (!QueueUserWorkItem(ResolveWorkItem,                 //Function : A pointer to the application-defined callback function of type LPTHREAD_START_ROUTINE to be executed by the thread in the thread pool.
+                               resolveObj,                      //Context : A single parameter value to be passed to the thread function.
+                               WT_EXECUTELONGFUNCTION)) {       //Flags : The callback function can perform a long wait, this helps the system decide if it should create a new thread.
+            LOG_ERROR("QueueUserWorkItem failed / error %lu\n", GetLastError());
+            EnterCriticalSection(&connectRaces.critSec);
+            {
+                connectRaces.map.erase(id);
+                StopConnectTimer();
+            }
+            LeaveCriticalSection(&connectRaces.critSec);
+            InterlockedDecrement(&pendingResolutions);
+            Buffer::Delete(resolveObj);
+            delete race;
+            return nullId;
+        }
+        return id;
+    }
+
+    // ----------------------------- first attempt, the next ones start once it failed or after connectAttemptDelay
+    EnterCriticalSection(&connectRaces.critSec);
+    {
+        if (!StartNextConnectAttempt(race)) {
+            delete race;
+            id = nullId;
+        } else {
+            connectRaces.map[id] = race;
+            if (race->addresses.size() > 1)
+                StartConnectTimer();
+        }
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    return id;
+}
+
+DWORD WINAPI SocketManager::ResolveWorkItem(LPVOID lpParam) {
+    auto                           *resolveObj  = static_cast<Buffer*>(lpParam);
+    auto                           *race        = static_cast<ConnectRace*>(resolveObj->context);
+    SocketManager                  *manager     = race->client;
+    std::vector<SOCKADDR_STORAGE>   addresses;
+    DWORD                           ttlMs;
+
+    if (!ResolveHostName(race->host.c_str(), manager->dnsServer.AddrCount > 0 ? &manager->dnsServer : nullptr, addresses, ttlMs))
+        InterlockedIncrement64(&manager->dnsFailures);
+    manager->dnsCache.Put(race->host, addresses, ttlMs);
+    for (auto &sockAddr : addresses)
+        SetPort(sockAddr, race->port);
+    race->addresses.swap(addresses);                    //nothing reads them while resolving, the completion packet orders this write before the worker thread clears it
+
+    // ----------------------------- complete on a worker thread, like an overlapped operation
+    if (!PostQueuedCompletionStatus(manager->iocpHandle,    //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                    0,                      //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                    (ULONG_PTR)nullptr,     //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                    &(resolveObj->ol))) {   //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+        LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+        manager->HandleResolve(resolveObj);
+    }
+    return NO_ERROR;
+}
+
+void SocketManager::HandleResolve(Buffer *buf) {
+    auto *race = static_cast<ConnectRace*>(buf->context);
+
+    EnterCriticalSection(&connectRaces.critSec);
+    {
+        race->resolving = false;
+        if (!StartNextConnectAttempt(race))             //no address, or none could be connected : the id was never in the socket map, the connect just fails
+            race->done = true;
+        else if (race->addresses.size() > 1)
+            StartConnectTimer();
+        EndConnectRace(race);
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    Buffer::Delete(buf);
+    InterlockedDecrement(&pendingResolutions);
+}
+
+void SocketManager::StartConnectTimer() {
+    if (connectTimer == nullptr &&
+        !CreateTimerQueueTimer(&connectTimer,               //phNewTimer : A pointer to a buffer that receives a handle to the timer-queue timer on return.
+                               nullptr,                     //TimerQueue : A handle to the timer queue. If this parameter is NULL, the timer is associated with the default timer queue.
+                               ConnectTimerCallback,        //Callback : A pointer to the application-defined function of type WAITORTIMERCALLBACK to be executed when the timer expires.
+                               this,                        //Parameter : A single parameter value that will be passed to the callback function.
+                               CONNECT_TIMER_PERIOD,        //DueTime : The amount of time in milliseconds relative to the current time that must elapse before the timer is signaled for the first time.
+                               CONNECT_TIMER_PERIOD,        //Period : The period of the timer, in milliseconds. If this parameter is not zero, the timer is periodic.
+                               WT_EXECUTEDEFAULT)) {        //Flags : By default, the callback function is queued to a non-I/O worker thread.
+        LOG_ERROR("CreateTimerQueueTimer failed / error %lu\n", GetLastError());   //addresses are then only tried once the previous one failed
+        connectTimer = nullptr;
+    }
+}
+
+void SocketManager::StopConnectTimer() {
+    if (connectTimer == nullptr || !connectRaces.map.empty())
+        return;
+    if (connectTimerDone == nullptr)
+        connectTimerDone = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+    if (connectTimerDone != nullptr)
+        ResetEvent(connectTimerDone);
+    if (DeleteTimerQueueTimer(nullptr,                      //TimerQueue : A handle to the timer queue. If the timer was created using the default timer queue, this parameter should be NULL.
+                              connectTimer,                 //Timer : A handle to the timer-queue timer. This handle is returned by the CreateTimerQueueTimer function.
+                              connectTimerDone)) {          //CompletionEvent : Signaled once the callbacks in progress are done, without waiting for them : the callback itself may be the caller.
+        if (connectTimerDone != nullptr)
+            SetEvent(connectTimerDone);
+    } else if (GetLastError() != ERROR_IO_PENDING) {
+        LOG_ERROR("DeleteTimerQueueTimer failed / error %lu\n", GetLastError());
+        if (connectTimerDone != nullptr)
+            SetEvent(connectTimerDone);
+    }
+    connectTimer = nullptr;
+}
+
+VOID CALLBACK SocketManager::ConnectTimerCallback(PVOID lpParam, BOOLEAN timerFired) {
+    auto                *manager    = static_cast<SocketManager*>(lpParam);
+    DWORD               now         = GetTickCount();
+    std::vector<UUID>   due;
+
+    EnterCriticalSection(&manager->connectRaces.critSec);
+    {
+        for (auto &entry : manager->connectRaces.map) {
+            ConnectRace *race = entry.second;
+            if (!race->done && !race->resolving && static_cast<LONG>(now - race->nextAttemptTime) >= 0)
+                due.push_back(entry.first);
+        }
+        // ----------------------------- started after the walk, an attempt failing right away can end its race and erase it from the map
+        for (const UUID &id : due) {
+            auto it = manager->connectRaces.map.find(id);
+            if (it != manager->connectRaces.map.end() && !it->second->done)
+                manager->StartNextConnectAttempt(it->second);
+        }
+        manager->StopConnectTimer();
+    }
+    LeaveCriticalSection(&manager->connectRaces.critSec);
+}
+
+bool SocketManager::StartNextConnectAttempt(ConnectRace *race) {
+    while (race->next < race->addresses.size()) {
+        if (StartConnectAttempt(race, race->next++))
+            return true;
+    }
+    return false;
+}
+
+bool SocketManager::StartConnectAttempt(ConnectRace *race, size_t index) {
+    int err;
+    const SOCKADDR_STORAGE &sockAddr = race->addresses[index];
+
+    // ----------------------------- create socket
+
+    Socket *sockObj = GenerateSocket(true, sockAddr.ss_family);
+    if (sockObj == nullptr){
+        return false;
+    }
+    sockObj->id = Misc::CreateNilUUID();                //only the holder of the race is in the map
+    sockObj->address = race->address;
+    sockObj->host = race->host;                         //the race and the caller's address may be gone when the connect completes
+    sockObj->port = race->port;
+    LOG("GetSocketObj ok\n");
+
+    if (sockObj->state != Socket::SocketState::DISCONNECTED && sockAddr.ss_family == AF_UNIX) {
+        if (!AssociateSocketToIOCP(sockObj)){           //connect binds it
+            return false;
+        }
+    } else if (sockObj->state != Socket::SocketState::DISCONNECTED) { //if not recycled socket
+        SOCKADDR_STORAGE anyAddr;                       //any address and port of the family
+        ZeroMemory(&anyAddr, sizeof(anyAddr));
+        anyAddr.ss_family = sockAddr.ss_family;
+
+        // ----------------------------- associate socket to IOCP
+        if (!AssociateSocketToIOCP(sockObj)){
+            return false;
+        }
+
+        // ----------------------------- bind socket
+        if (!BindSocket(sockObj, (SOCKADDR*)&anyAddr, AddressLength(anyAddr))){
+            return false;
+        }
+    }
+
+    // ----------------------------- connect socket
+    Buffer *connectObj = Buffer::Create(inUseBufferList, Buffer::Operation::Connect);
+    if (sockAddr.ss_family == AF_UNIX) {                //ConnectEx is TCP only, a local connect doesn't wait on the network : it is made here and completed through the port below
+        if (connect(sockObj->s,                         //s : A descriptor identifying an unconnected socket.
+                    (SOCKADDR*)(&sockAddr),             //name : A pointer to the sockaddr structure to which the connection should be established.
+                    AddressLength(sockAddr)             //namelen : The length, in bytes, of the sockaddr structure pointed to by the name parameter.
+        ) == SOCKET_ERROR) {
+            LOG_ERROR("ConnectToNewSocket: connect failed: %d\n", WSAGetLastError());
+            Buffer::Delete(connectObj);
+            sockObj->state = Socket::SocketState::FAILURE;   //closes it
+            Socket::Delete(sockObj);
+            return false;
+        }
+    } else if (!ConnectEx(sockObj->s,                  //s : A descriptor identifying an unconnected socket.
+                   (SOCKADDR*)(&sockAddr),      //name : A pointer to a sockaddr structure that specifies the address to which to connect. For IPv4, the sockaddr contains AF_INET for the address family, the destination IPv4 address, and the destination port.
+                   AddressLength(sockAddr),     //namelen : The length, in bytes, of the sockaddr structure pointed to by the name parameter.
+                   nullptr,                     //lpSendBuffer : A pointer to the buffer to be transferred after a connection is established. This parameter is optional.
+                   0,                           //dwSendDataLength : The length, in bytes, of data pointed to by the lpSendBuffer parameter. This parameter is ignored when the lpSendBuffer parameter is NULL.
+                   nullptr,                     //lpdwBytesSent : On successful return, this parameter points to a DWORD value that indicates the number of bytes that were sent after the connection was established. This parameter is ignored when the lpSendBuffer parameter is NULL.
+                   &(connectObj->ol)            //lpOverlapped : An OVERLAPPED structure used to process the request. The lpOverlapped parameter must be specified, and cannot be NULL.
+                  )) {
+        if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
+            LOG_ERROR("ConnectToNewSocket: ConnectEx failed: %d\n", err);
+            Buffer::Delete(connectObj);
+            sockObj->state = Socket::SocketState::FAILURE;   //closes it
+            Socket::Delete(sockObj);
+            return false; // connect error
+        }
+    }
+    LOG("ConnectEx ok\n");
+    // ----------------------------- the completion waits for the connectRaces lock held by the caller
+    sockObj->race = race;
+    sockObj->raceAddress = index;
+    race->attempts.push_back(sockObj);
+    if (race->holder == nullptr) {
+        race->holder = sockObj;
+        AddSocketToMap(sockObj, race->id);
+    }
+    race->nextAttemptTime = GetTickCount() + connectAttemptDelay;
+    if (sockAddr.ss_family == AF_UNIX && !PostQueuedCompletionStatus(iocpHandle,              //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                                                     0,                       //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                                                     (ULONG_PTR)sockObj,      //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                                                     &(connectObj->ol))) {    //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+        LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+        HandleIo(sockObj, connectObj, 0);               //the connectRaces lock can be taken again by this thread
+    }
+    return true;
+}
+
+bool SocketManager::WinConnectRace(Socket *sockObj, Buffer *buf) {
+    bool won;
+
+    EnterCriticalSection(&connectRaces.critSec);
+    {
+        ConnectRace *race = sockObj->race;
+        LeaveConnectRace(sockObj);
+        won = !race->done;
+        if (won) {
+            race->done = true;
+            if (race->holder != sockObj) {              //the id moves to the attempt which connected
+                race->holder->id = Misc::CreateNilUUID();
+                race->holder = sockObj;
+                AddSocketToMap(sockObj, race->id);
+            }
+            // ----------------------------- cancel the other attempts, their connect completes with an error
+            for (Socket *other : race->attempts)
+                CancelIoEx((HANDLE)other->s, nullptr);
+        }
+        EndConnectRace(race);
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    if (!won) {                                         //connected too late, abortive close
+        sockObj->state = Socket::SocketState::FAILURE;
+        Socket::Delete(sockObj);
+        Buffer::Delete(buf);
+    }
+    return won;
+}
+
+void SocketManager::HandleConnectAttemptError(Socket *sockObj, Buffer *buf, DWORD error) {
+    bool failed = false;                                //every address failed, the caller's id goes away with the last attempt
+    UUID id;
+
+    EnterCriticalSection(&connectRaces.critSec);
+    {
+        ConnectRace *race = sockObj->race;
+        id = race->id;
+        LeaveConnectRace(sockObj);
+        if (!race->done) {
+            if (race->holder == sockObj) {              //the id moves to another attempt in flight, or to the next one started
+                race->holder = race->attempts.empty() ? nullptr : race->attempts.front();
+                if (race->holder != nullptr)
+                    AddSocketToMap(race->holder, id);
+            }
+            if (error == WSAEADDRINUSE) {               //TimeWaitValue must not have been big enough, update it and try the same address with another socket
+                TimeWaitValue *= 2;
+                if (TimeWaitValue > MAX_TIME_WAIT_VALUE)
+                    TimeWaitValue = MAX_TIME_WAIT_VALUE;
+            }
+            if (error != WSAEADDRINUSE || !StartConnectAttempt(race, sockObj->raceAddress))
+                StartNextConnectAttempt(race);          //RFC 8305 : a failed attempt starts the next address right away
+            if (race->attempts.empty()) {
+                race->done = true;
+                failed = true;
+            }
+        }
+        EndConnectRace(race);
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    if (failed) {
+        EnterCriticalSection(&socketAccessMap.critSec);
+        {
+            socketAccessMap.map.erase(id);
+        }
+        LeaveCriticalSection(&socketAccessMap.critSec);
+    }
+    sockObj->state = Socket::SocketState::FAILURE;      //closes it
+    Socket::Delete(sockObj);
+    Buffer::Delete(buf);
+}
+
+void SocketManager::LeaveConnectRace(Socket *sockObj) {
+    std::vector<Socket*> &attempts = sockObj->race->attempts;
+    for (auto it = attempts.begin() ; it != attempts.end() ; it++) {
+        if (*it == sockObj) {
+            attempts.erase(it);
+            break;
+        }
+    }
+    sockObj->race = nullptr;
+}
+
+void SocketManager::EndConnectRace(ConnectRace *race) {
+    if (race->done && race->attempts.empty()) {
+        connectRaces.map.erase(race->id);
+        delete race;
+        StopConnectTimer();
+    }
+}
+
+bool SocketManager::AcceptNewSocket(Socket *listenSockObj){
+    int err;
+    DWORD addressLength = (listenSockObj->af == AF_UNIX ? sizeof(SOCKADDR_UN) : sizeof(SOCKADDR_IN6)) + 16;
+    Socket *acceptSockObj = GenerateSocket(true, listenSockObj->af);     //AcceptEx needs a socket of the listen socket family
+    if (acceptSockObj == nullptr){
+        return false;
+    }
+    if (acceptSockObj->state != Socket::SocketState::DISCONNECTED && !AssociateSocketToIOCP(acceptSockObj)){ //recycled socket is already associated
+        return false;
+    }
+    acceptSockObj->state = Socket::SocketState::ACCEPTING;   //before AcceptEx, the completion may be handled before it returns
+
+    Buffer *acceptObj = Buffer::Create(inUseBufferList, Buffer::Operation::Accept);
+    acceptObj->acceptSocket = acceptSockObj;
+    if (!AcceptEx(listenSockObj->s,             //sListenSocket : A descriptor identifying a socket that has already been called with the listen function. A server application waits for attempts to connect on this socket.
+                  acceptSockObj->s,             //sAcceptSocket : A descriptor identifying a socket on which to accept an incoming connection. This socket must not be bound or connected.
+                  acceptObj->buf,               //lpOutputBuffer : A pointer to a buffer that receives the first block of data sent on a new connection, the local address of the server, and the remote address of the client. The receive data is written to the first part of the buffer starting at offset zero, while the addresses are written to the latter part of the buffer. This parameter must be specified.
+                  0,                            //dwReceiveDataLength : The number of bytes in lpOutputBuffer that will be used for actual receive data at the beginning of the buffer. This size should not include the size of the local address of the server, nor the remote address of the client; they are appended to the output buffer. If dwReceiveDataLength is zero, accepting the connection will not result in a receive operation. Instead, AcceptEx completes as soon as a connection arrives, without waiting for any data.
+                  addressLength,                //dwLocalAddressLength : The number of bytes reserved for the local address information. This value must be at least 16 bytes more than the maximum address length for the transport protocol in use.
+                  addressLength,                //dwRemoteAddressLength : The number of bytes reserved for the remote address information. This value must be at least 16 bytes more than the maximum address length for the transport protocol in use. Cannot be zero.
+                  nullptr,                      //lpdwBytesReceived : A pointer to a DWORD that receives the count of bytes received. This parameter is set only if the operation completes synchronously. If it returns ERROR_IO_PENDING and is completed later, then this DWORD is never set and you must obtain the number of bytes read from the completion notification mechanism.
+                  &(acceptObj->ol)              //lpOverlapped : An OVERLAPPED structure used to process the request. The lpOverlapped parameter must be specified, and cannot be NULL.
+    )) {
+        if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
+            LOG_ERROR("AcceptEx failed: %d\n", err);
+            Buffer::Delete(acceptObj);
+            Socket::Delete(acceptSockObj);
+            return false; // accept error
+        }
+    }
+    LOG("AcceptEx ok\n");
+    return true;
+}
+
+void SocketManager::ReplaceAccept(Socket *listenSockObj) {
+    if (draining)
+        return;
+    if (CheckMemory() == MemoryPressure::UNDER_BUDGET) {
+        AcceptNewSocket(listenSockObj);
+        return;
+    }
+    // ----------------------------- connections wait in the listen backlog (and get refused once it is full) until memory is released
+    EnterCriticalSection(&pausedListenSockets.critSec);
+    {
+        pausedListenSockets.queue.push(listenSockObj);
+        InterlockedIncrement(&pausedAccepts);
+    }
+    LeaveCriticalSection(&pausedListenSockets.critSec);
+    InterlockedIncrement64(&acceptPauses);
+}
+
+void SocketManager::ResumeAccepts() {
+    if (pausedAccepts == 0 || draining || CheckMemory() != MemoryPressure::UNDER_BUDGET)
+        return;
+    while (pausedAccepts > 0) {
+        Socket *listenSockObj = nullptr;
+        EnterCriticalSection(&pausedListenSockets.critSec);
+        {
+            if (!pausedListenSockets.queue.empty()) {   //another thread may have taken the last one
+                listenSockObj = pausedListenSockets.queue.front();
+                pausedListenSockets.queue.pop();
+                InterlockedDecrement(&pausedAccepts);
+            }
+        }
+        LeaveCriticalSection(&pausedListenSockets.critSec);
+        if (listenSockObj != nullptr && listenSockObj->state == Socket::SocketState::LISTENING)
+            AcceptNewSocket(listenSockObj);
+    }
+}
+
+SocketManager::MemoryPressure SocketManager::CheckMemory() {
+    if (memoryBudget.soft == 0 && memoryBudget.hard == 0)
+        return MemoryPressure::UNDER_BUDGET;
+    auto used = static_cast<LONG64>(inUseBufferList.allocated * sizeof(Buffer) + inUseSocketList.allocated * sizeof(Socket));
+    if (used > peakMemory)
+        peakMemory = used;              //racy, only a stat
+    MemoryPressure pressure = MemoryPressure::UNDER_BUDGET;
+    if (memoryBudget.hard > 0 && static_cast<ULONG64>(used) >= memoryBudget.hard)
+        pressure = MemoryPressure::OVER_HARD_LIMIT;
+    else if (memoryBudget.soft > 0 && static_cast<ULONG64>(used) >= memoryBudget.soft)
+        pressure = MemoryPressure::OVER_SOFT_LIMIT;
+    if (InterlockedExchange(&memoryPressure, pressure) == MemoryPressure::UNDER_BUDGET && pressure != MemoryPressure::UNDER_BUDGET) {
+        LOG_ERROR("Over the soft memory limit : %lld bytes used\n", used);
+        inUseBufferList.shrink();       //objects kept for reuse are the first thing to give back
+        inUseSocketList.shrink();
+    }
+    return pressure;
+}
+
+SocketManager::MemoryStats SocketManager::GetMemoryStats() {
+    MemoryStats stats;
+
+    stats.pressure = CheckMemory();
+    stats.bufferBytes = static_cast<ULONG64>(inUseBufferList.allocated) * sizeof(Buffer);
+    stats.socketBytes = static_cast<ULONG64>(inUseSocketList.allocated) * sizeof(Socket);
+    stats.usedBytes = stats.bufferBytes + stats.socketBytes;
+    stats.peakBytes = static_cast<ULONG64>(peakMemory) > stats.usedBytes ? static_cast<ULONG64>(peakMemory) : stats.usedBytes;
+    stats.pausedAccepts = pausedAccepts;
+    stats.acceptPauses = acceptPauses;
+    stats.rejectedSends = rejectedSends;
+    stats.readProbes = readProbes;
+    return stats;
+}
+
+bool SocketManager::SetDnsServer(const char *address) {
+    SOCKADDR_STORAGE sockAddr;
+    int sockAddrLength;
+
+    if (address == nullptr) {
+        dnsServer.AddrCount = 0;
+    } else if (!ParseAddress(address, 0, sockAddr, sockAddrLength) || sockAddr.ss_family != AF_INET) {   //DnsQuery only takes IPv4 servers
+        LOG_ERROR("%s is not a numeric IPv4 address\n", address);
+        return false;
+    } else {
+        dnsServer.AddrCount = 1;
+        dnsServer.AddrArray[0] = ((SOCKADDR_IN*)&sockAddr)->sin_addr.s_addr;
+    }
+    dnsCache.Clear();                                   //resolved by the previous servers
+    return true;
+}
+
+SocketManager::DnsStats SocketManager::GetDnsStats() {
+    DnsStats stats;
+
+    stats.cacheHits = dnsCacheHits;
+    stats.negativeHits = dnsNegativeHits;
+    stats.resolutions = dnsResolutions;
+    stats.failures = dnsFailures;
+    stats.pending = pendingResolutions;
+    return stats;
+}
+
+SocketManager::DatagramStats SocketManager::GetDatagramStats() {
+    DatagramStats stats;
+
+    stats.received = datagramsReceived;
+    stats.reads = datagramReads;
+    stats.sent = datagramsSent;
+    stats.sends = datagramSends;
+    stats.dropped = datagramsDropped;
+    return stats;
+}
+
+void SocketManager::SetSharedMemoryRing(DWORD capacity) {
+    DWORD rounded = MIN_RING_CAPACITY;
+
+    while (rounded < capacity && rounded < MAX_RING_CAPACITY)
+        rounded <<= 1;
+    ringCapacity = capacity == 0 ? 0 : rounded;
+}
+
+bool SocketManager::SetTls(const TlsOptions &options) {
+    SCHANNEL_CRED   schannelCred{};
+    PCCERT_CONTEXT  certificate     = options.certificate;
+    SECURITY_STATUS status;
+
+    if (type == Type::SERVER && certificate == nullptr)
+        return false;
+    schannelCred.dwVersion = SCHANNEL_CRED_VERSION;
+    if (certificate != nullptr) {
+        schannelCred.cCreds = 1;
+        schannelCred.paCred = &certificate;
+    }
+    if (type == Type::CLIENT)
+        schannelCred.dwFlags = SCH_CRED_NO_DEFAULT_CREDS | (options.verifyPeer ? SCH_CRED_AUTO_CRED_VALIDATION : SCH_CRED_MANUAL_CRED_VALIDATION);
+    if (tlsEnabled) {
+        FreeCredentialsHandle(&tlsCredentials);
+        tlsEnabled = false;
+    }
+    if ((status = AcquireCredentialsHandleA(nullptr,                                //pszPrincipal : nullptr for SChannel.
+                                            const_cast<LPSTR>(UNISP_NAME_A),        //pszPackage : The name of the security package, SChannel.
+                                            type == Type::CLIENT ? SECPKG_CRED_OUTBOUND : SECPKG_CRED_INBOUND,  //fCredentialUse : Outbound for a client, inbound for a server.
+                                            nullptr,                                //pvLogonId : Unused by SChannel.
+                                            &schannelCred,                          //pAuthData : Certificate and options of the credentials.
+                                            nullptr, nullptr,                       //pGetKeyFn, pvGetKeyArgument : Not used.
+                                            &tlsCredentials,                        //phCredential : Receives the credential handle.
+                                            nullptr                                 //ptsExpiry : Optional expiration time.
+    )) != SEC_E_OK) {
+        LOG_ERROR("AcquireCredentialsHandle failed / status 0x%lx\n", status);
+        return false;
+    }
+    tlsServerName = options.serverName != nullptr ? options.serverName : "";
+    tlsEnabled = true;
+    return true;
+}
+
+SocketManager::TlsStats SocketManager::GetTlsStats() {
+    TlsStats stats;
+
+    stats.handshakes = tlsHandshakes;
+    stats.failures = tlsFailures;
+    return stats;
+}
+
+void SocketManager::SetCompression(Compression compression) {
+    switch (compression) {
+        case Compression::FAST_COMPRESSION :    compressionAlgorithm = COMPRESS_ALGORITHM_XPRESS; break;
+        case Compression::STRONG_COMPRESSION :  compressionAlgorithm = COMPRESS_ALGORITHM_XPRESS_HUFF; break;
+        default :                               compressionAlgorithm = 0;
+    }
+}
+
+SocketManager::CompressionStats SocketManager::GetCompressionStats() {
+    CompressionStats stats;
+
+    stats.negotiated = compressionNegotiated;
+    stats.refused = compressionRefused;
+    stats.contextsCreated = compressionCreated;
+    stats.contextsReused = compressionReused;
+    stats.batches = compressionBatches;
+    stats.blocks = compressionBlocks;
+    stats.storedBlocks = compressionStoredBlocks;
+    stats.rawBytesSent = compressionRawSent;
+    stats.packedBytesSent = compressionPackedSent;
+    stats.packedBytesReceived = compressionPackedReceived;
+    stats.rawBytesReceived = compressionRawReceived;
+    return stats;
+}
+
+bool SocketManager::isSocketInitialising(UUID socketId) {
+    bool resolving;
+
+    EnterCriticalSection(&connectRaces.critSec);        //before the socket map : a resolved connect has its first attempt in it once the lock is free
+    {
+        auto it = connectRaces.map.find(socketId);
+        resolving = it != connectRaces.map.end() && it->second->resolving;
+    }
+    LeaveCriticalSection(&connectRaces.critSec);
+    if (resolving)
+        return true;
+    Socket *sockObj = socketAccessMap.Get(socketId);
+    return sockObj != nullptr && (sockObj->state <= Socket::SocketState::RETRY_CONNECTION || (sockObj->state == Socket::SocketState::CONNECTED && (sockObj->negotiating || sockObj->compressionPending || (sockObj->tls != nullptr && !sockObj->tls->IsEstablished()))));
+}
+
+bool SocketManager::Drain(DWORD timeoutMs) {
+    DWORD                   start       = GetTickCount();
+    std::vector<Socket*>    unused;
+    bool                    flushed;
+
+    if (state < State::READY)
+        return false;
+    StartDrain();
+
+    // ----------------------------- let pending sends flush until the deadline
+    while ((flushed = PendingSendBytes() == 0) == false && GetTickCount() - start < timeoutMs)
+        Sleep(DRAIN_POLL_PERIOD);
+
+    // ----------------------------- close every connected socket, each worker thread taking batches of them
+    EnterCriticalSection(&socketAccessMap.critSec);
+    {
+        drainIds.clear();
+        drainIds.reserve(socketAccessMap.map.size());
+        for (auto &entry : socketAccessMap.map) {
+            Socket::SocketState sockState = entry.second->state;
+            if (sockState == Socket::SocketState::CONNECTED || sockState == Socket::SocketState::CLOSING || sockState == Socket::SocketState::FAILURE)
+                drainIds.push_back(entry.first);                //not the closed listen sockets, nor sockets still connecting
+        }
+    }
+    LeaveCriticalSection(&socketAccessMap.critSec);
+    drainNext = 0;
+    drainWorkers = static_cast<LONG>(threadHandles.size());
+    drainDone = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    for (size_t i = 0 ; i < threadHandles.size() ; i++) {
+        Buffer *drainObj = Buffer::Create(inUseBufferList, Buffer::Operation::Drain);
+        drainObj->context = this;
+        PostQueuedCompletionStatus(iocpHandle,                      //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                   0,                               //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                   (ULONG_PTR)nullptr,              //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                   &(drainObj->ol));                //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+    }
+    if (drainDone != nullptr) {
+        WaitForSingleObject(drainDone, INFINITE);               //batches are short, and drainIds must outlive them
+        CloseHandle(drainDone);
+        drainDone = nullptr;
+    } else {
+        while (drainWorkers > 0)
+            Sleep(1);
+    }
+
+    // ----------------------------- wait for the aborted operations of closed sockets, each one removes its socket from the map
+    DWORD   closeStart  = GetTickCount();
+    size_t  gone        = 0;
+    while (GetTickCount() - closeStart < DRAIN_CLOSE_TIMEOUT) {
+        EnterCriticalSection(&socketAccessMap.critSec);
+        {
+            while (gone < drainIds.size() && socketAccessMap.map.find(drainIds[gone]) == socketAccessMap.map.end())
+                gone++;
+        }
+        LeaveCriticalSection(&socketAccessMap.critSec);
+        if (gone == drainIds.size())
+            break;
+        Sleep(DRAIN_POLL_PERIOD);
+    }
+    drainIds.clear();
+
+    // ----------------------------- disconnected sockets kept for reuse only have a handle left
+    EnterCriticalSection(&reusableSocketQueue.critSec);
+    {
+        while (!reusableSocketQueue.queue.empty()) {
+            unused.push_back(reusableSocketQueue.queue.front());
+            reusableSocketQueue.queue.pop();
+        }
+    }
+    LeaveCriticalSection(&reusableSocketQueue.critSec);
+    for (Socket *sock : unused) {
+        EnterCriticalSection(&sock->SockCritSec);
+        {
+            if (sock->s != INVALID_SOCKET)
+                sock->Close(true);
+        }
+        LeaveCriticalSection(&sock->SockCritSec);
     }
+    LOG("drained in %lu ms, sends %s\n", GetTickCount() - start, flushed ? "flushed" : "aborted");
+    return flushed;
 }
 
-Socket *SocketManager::GenerateSocket(bool reuse){
-    SOCKET sock;
-    Socket *sockObj = reuse ? ReuseSocket() : nullptr;
+void SocketManager::StartDrain() {
+    std::vector<Socket*>    listening;
 
-    if(sockObj == nullptr) {
-        if ((sock = WSASocket(FAMILY,                      //af : The address family specification
-                              SOCK_STREAM,                 //type : SOCK_STREAM -> A socket type that provides sequenced, reliable, two-way, connection-based byte streams with an OOB data transmission mechanism. This socket type uses the Transmission Control Protocol (TCP) for the Internet address family (AF_INET or AF_INET6).
-                              IPPROTO_TCP,                 //protocol : IPPROTO_TCP -> The Transmission Control Protocol (TCP). This is a possible value when the af parameter is AF_INET or AF_INET6 and the type parameter is SOCK_STREAM.
-                              nullptr,                     //lpProtocolInfo : A pointer to a WSAPROTOCOL_INFO structure that defines the characteristics of the socket to be created.
-                              0,                           //g : An existing socket group ID or an appropriate action to take when creating a new socket and a new socket group. 0 -> No group operation is performed.
-                              WSA_FLAG_OVERLAPPED          //dwFlags : A set of flags used to specify additional socket attributes. WSA_FLAG_OVERLAPPED -> Create a socket that supports overlapped I/O operations.
-        )) == INVALID_SOCKET) {
-            LOG_ERROR("WSASocket failed / error %d\n", WSAGetLastError());
-            return nullptr;
+    if (state < State::READY)
+        return;
+    draining = true;
+    // ----------------------------- stop accepting : pending accepts are aborted and not replaced
+    EnterCriticalSection(&inUseSocketList.critSec);
+    {
+        for (Socket &sock : inUseSocketList.list) {
+            if (sock.state == Socket::SocketState::LISTENING)
+                listening.push_back(&sock);
         }
-        LOG("WSASocket ok\n");
-        const int fam = FAMILY;
-        sockObj = Socket::Create(inUseSocketList, this, sock, fam); //can't use FAMILY directly else undefined reference to `SocketManager::FAMILY' STRANGEST ERROR EVER, compiler bug ?
     }
-    return sockObj;
-}
-
-bool SocketManager::AssociateSocketToIOCP(Socket *sockObj){
-    HANDLE hrc = CreateIoCompletionPort((HANDLE)sockObj->s,          //FileHandle[in] : An open file handle. The handle must be to an object that supports overlapped I/O.
-                                        iocpHandle,                  //ExistingCompletionPort[in, optional] : A handle to an existing I/O completion, the function associates it with the handle specified by the FileHandle parameter.
-                                        (ULONG_PTR)sockObj,          //CompletionKey[in] : The per-handle user-defined completion key that is included in every I/O completion packet for the specified file handle.
-                                        0);                          //NumberOfConcurrentThreads[in] : This parameter is ignored if the ExistingCompletionPort parameter is not NULL.
-    if (hrc == nullptr) {
-        LOG_ERROR("CreateIoCompletionPort failed / error %lu\n", GetLastError());
-        Socket::Delete(sockObj);
-        return false;
+    LeaveCriticalSection(&inUseSocketList.critSec);
+    for (Socket *sock : listening) {
+        EnterCriticalSection(&sock->SockCritSec);
+        {
+            if (sock->state == Socket::SocketState::LISTENING)
+                sock->Close(true);
+        }
+        LeaveCriticalSection(&sock->SockCritSec);
     }
-    LOG("CreateIoCompletionPort ok\n");
-    sockObj->state = Socket::SocketState::ASSOCIATED;
-    return true;
 }
 
-bool SocketManager::BindSocket(Socket *sockObj, SOCKADDR_IN sockAddr){
-    if (SetSocketOption(sockObj->s, SO_REUSE_UNICASTPORT, true) == SOCKET_ERROR || //works on Windows 10 only, use SO_PORT_SCALABILITY instead on Windows 7-8
-        SetSocketOption(sockObj->s, SO_EXCLUSIVEADDRUSE, true) == SOCKET_ERROR)
-        return false;
-    if (bind(sockObj->s,                        //s : A descriptor identifying an unconnected socket.
-             (SOCKADDR*)(&sockAddr),            //name : A pointer to a sockaddr structure that specifies the address to which to connect. For IPv4, the sockaddr contains AF_INET for the address family, the destination IPv4 address, and the destination port.
-             sizeof(sockAddr)                   //namelen : The length, in bytes, of the sockaddr structure pointed to by the name parameter.
-    ) == SOCKET_ERROR){
-        LOG_ERROR("bind failed / error %d\n", WSAGetLastError());
-        Socket::Delete(sockObj);
-        return false;
+void SocketManager::HandleDrain(Buffer *buf) {
+    LONG    first;
+    auto    count   = static_cast<LONG>(drainIds.size());
+
+    while ((first = InterlockedExchangeAdd(&drainNext, DRAIN_BATCH_SIZE)) < count) {
+        LONG last = first + DRAIN_BATCH_SIZE < count ? first + DRAIN_BATCH_SIZE : count;
+        for (LONG i = first ; i < last ; i++) {
+            Socket *sockObj = socketAccessMap.Get(drainIds[i]);
+            if (sockObj != nullptr)
+                CloseForDrain(sockObj);
+        }
     }
-    LOG("bind ok\n");
-    sockObj->state = Socket::SocketState::BOUND;
-    return true;
+    Buffer::Delete(buf);
+    if (InterlockedDecrement(&drainWorkers) == 0)
+        SetEvent(drainDone);
 }
 
-int SocketManager::SetSocketOption(SOCKET s, int option, const char *optPtr, int optSize){
-    int err = NO_ERROR;
-
-    if(setsockopt(s,                                      //s : A descriptor that identifies a socket.
-                  SOL_SOCKET,                             //level : The level at which the option is defined
-                  option,                                 //optname : The socket option for which the value is to be set. The optname parameter must be a socket option defined within the specified level, or behavior is undefined.
-                  optPtr,                                 //optval : A pointer to the buffer in which the value for the requested option is specified.
-                  optSize                                 //optlen : The size, in bytes, of the buffer pointed to by the optval parameter.
-    ) == SOCKET_ERROR){ //shouldn't ever happens
-        err = WSAGetLastError();
-        LOG_ERROR("setsockopt for option %d failed : %d\n", option, err);
+void SocketManager::CloseForDrain(Socket *sockObj) {
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        switch (sockObj->state) {
+            case Socket::SocketState::CONNECTED :
+                /** NOBREAK **/
+            case Socket::SocketState::CLOSING :{       // data of completed sends is still delivered after a graceful close
+                sockObj->Close(sockObj->pendingByteSent > 0);
+                break;
+            }
+            case Socket::SocketState::FAILURE :{
+                sockObj->Close(true);
+                break;
+            }
+            default:
+                break;                                  // connecting, or already on its way out
+        }
     }
-    return err;
+    LeaveCriticalSection(&sockObj->SockCritSec);
 }
 
-int SocketManager::GetSocketOption(SOCKET s, int option, char *optPtr, int optSize){
-    int err = NO_ERROR;
+LONG64 SocketManager::PendingSendBytes() {
+    LONG64 pending = 0;
 
-    if(getsockopt(s,                                      //s : A descriptor that identifies a socket.
-                  SOL_SOCKET,                             //level : The level at which the option is defined
-                  option,                                 //optname : The socket option for which the value is to be retrieved. The optname parameter must be a socket option defined within the specified level, or behavior is undefined.
-                  optPtr,                                 //optval : A pointer to the buffer in which the value for the requested option is specified.
-                  &optSize                                //optlen : A pointer to the size, in bytes, of the optval buffer.
-    ) == SOCKET_ERROR){ //shouldn't ever happens
-        err = WSAGetLastError();
-        LOG_ERROR("getsockopt for option %d failed : %d\n", option, err);
+    EnterCriticalSection(&inUseSocketList.critSec);
+    {
+        for (Socket &sock : inUseSocketList.list) {
+            if (sock.state == Socket::SocketState::CONNECTED || sock.state == Socket::SocketState::CLOSING)
+                pending += sock.pendingByteSent;
+        }
     }
-    return err;
+    LeaveCriticalSection(&inUseSocketList.critSec);
+    return pending;
 }
 
-void SocketManager::AddSocketToMap(Socket *sockObj, UUID id){
-    RPC_STATUS status;
-    if (UuidIsNil(&id, &status)) {
-        status = UuidCreateSequential(&id);
-        if (status == RPC_S_UUID_NO_ADDRESS)
-            UuidCreate(&id);
-    }
-    sockObj->id = id;
+void SocketManager::GetPendingBytes(const UUID *ids, size_t count, LONG64 *pending) {
     EnterCriticalSection(&socketAccessMap.critSec);
     {
-        socketAccessMap.map[sockObj->id] = sockObj;
+        for (size_t i = 0 ; i < count ; i++) {
+            auto it = socketAccessMap.map.find(ids[i]);
+            Socket *sockObj = it != socketAccessMap.map.end() ? it->second : nullptr;
+            bool ready = sockObj != nullptr && sockObj->state == Socket::SocketState::CONNECTED && !sockObj->negotiating && !sockObj->compressionPending && (sockObj->tls == nullptr || sockObj->tls->IsEstablished());
+            pending[i] = ready ? sockObj->pendingByteSent : -1;
+        }
     }
     LeaveCriticalSection(&socketAccessMap.critSec);
 }
 
-UUID SocketManager::ConnectToNewSocket(const char *address, u_short port, UUID id) {
-    int err;
-    UUID nullId = Misc::CreateNilUUID();
-    if (state < State::READY || type != Type::CLIENT)
-        return nullId;
+bool SocketManager::Subscribe(const std::string &topic, Socket *socket, Backpressure policy) {
+    Topic  *topicObj;
+    bool    subscribed  = false;
 
-    // ----------------------------- create socket
+    if (socket == nullptr || socket->datagram || socket->state != Socket::SocketState::CONNECTED) {
+        return false;
+    }
+    EnterCriticalSection(&topics.critSec);
+    {
+        Topic *&entry = topics.map[topic];
+        if (entry == nullptr)
+            entry = new Topic();
+        topicObj = entry;
+    }
+    LeaveCriticalSection(&topics.critSec);
+    EnterCriticalSection(&socket->SockCritSec);
+    {
+        if (socket->state == Socket::SocketState::CONNECTED) {         // else it would never be removed, the socket already left its topics
+            if (topicObj->Add(socket->id, policy))
+                socket->topics.push_back(topicObj);
+            subscribed = true;
+        }
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    return subscribed;
+}
 
-    Socket *sockObj = GenerateSocket(true);
-    if (sockObj == nullptr){
-        return nullId;
+bool SocketManager::Unsubscribe(const std::string &topic, Socket *socket) {
+    Topic  *topicObj    = topics.Get(topic);
+    bool    removed     = false;
+
+    if (socket == nullptr || topicObj == nullptr) {
+        return false;
     }
-    SOCKET sock = sockObj->s;
-    sockObj->address = address;
-    sockObj->port = port;
-    LOG("GetSocketObj ok\n");
+    EnterCriticalSection(&socket->SockCritSec);
+    {
+        auto it = std::find(socket->topics.begin(), socket->topics.end(), topicObj);
+        if (it != socket->topics.end()) {
+            socket->topics.erase(it);
+            removed = topicObj->Remove(socket->id);
+        }
+    }
+    LeaveCriticalSection(&socket->SockCritSec);
+    return removed;
+}
 
-    SOCKADDR_IN sockAddr;
-    ZeroMemory(&sockAddr, sizeof(SOCKADDR_IN));
-    sockAddr.sin_family = FAMILY;
-    sockAddr.sin_addr.s_addr = INADDR_ANY;
-    sockAddr.sin_port = 0;
+int SocketManager::Publish(const std::string &topic, const WSABUF *pieces, DWORD count) {
+    Topic  *topicObj    = topics.Get(topic);
+    u_long  length      = 0;
+    DWORD   piece       = 0;
+    u_long  pieceOffset = 0;
 
-    if (sockObj->state != Socket::SocketState::DISCONNECTED) { //if not recycled socket
-        // ----------------------------- associate socket to IOCP
-        if (!AssociateSocketToIOCP(sockObj)){
-            return nullId;
+    if (topicObj == nullptr || draining || state < State::READY) {
+        return 0;
+    }
+    for (DWORD i = 0 ; i < count ; i++)
+        length += pieces[i].len;
+    if (length == 0)
+        return 0;
+    if (CheckMemory() == MemoryPressure::OVER_HARD_LIMIT) {
+        LOG_ERROR("Over the hard memory limit, publication refused\n");
+        InterlockedIncrement64(&rejectedSends);
+        return 0;
+    }
+    Topic::Snapshot *snapshot = topicObj->Acquire();
+    auto subscriberCount = static_cast<LONG>(snapshot->subscribers.size());
+    if (subscriberCount == 0) {
+        Topic::Release(snapshot);
+        return 0;
+    }
+    InterlockedIncrement64(&published);
+
+    // ----------------------------- serialized once, every subscriber is sent these bytes
+    auto *publication = new Publication(this, snapshot);
+    publication->data.resize(length);
+    GatherPieces(pieces, piece, pieceOffset, publication->data.data(), length);
+
+    // ----------------------------- fan out : worker threads take batches of subscribers, and the caller with them
+    LONG batches = (subscriberCount + PUBLISH_BATCH_SIZE - 1) / PUBLISH_BATCH_SIZE;
+    auto helpers = static_cast<LONG>(threadHandles.size()) < batches - 1 ? static_cast<LONG>(threadHandles.size()) : batches - 1;
+    publication->fanOuts = helpers + 1;
+    publication->refs = helpers + 1;
+    for (LONG i = 0 ; i < helpers ; i++) {
+        Buffer *publishObj = Buffer::Create(inUseBufferList, Buffer::Operation::Publish);
+        publishObj->context = publication;
+        if (!PostQueuedCompletionStatus(iocpHandle,                 //CompletionPort : A handle to an I/O completion port to which the I/O completion packet is to be posted.
+                                        0,                          //dwNumberOfBytesTransferred : The value to be returned through the lpNumberOfBytesTransferred parameter of the GetQueuedCompletionStatus function.
+                                        (ULONG_PTR)nullptr,         //dwCompletionKey : The value to be returned through the lpCompletionKey parameter of the GetQueuedCompletionStatus function.
+                                        &(publishObj->ol))) {       //lpOverlapped : The value to be returned through the lpOverlapped parameter of the GetQueuedCompletionStatus function.
+            LOG_ERROR("PostQueuedCompletionStatus failed / error %lu\n", GetLastError());
+            HandlePublish(publishObj);                              // its share is taken by the caller
         }
+    }
+    FanOut(publication);
+    return subscriberCount;
+}
 
-        // ----------------------------- bind socket
-        if (!BindSocket(sockObj, sockAddr)){
-            return nullId;
+void SocketManager::HandlePublish(Buffer *buf) {
+    auto *publication = static_cast<Publication*>(buf->context);
+
+    Buffer::Delete(buf);
+    FanOut(publication);
+}
+
+void SocketManager::FanOut(Publication *publication) {
+    LONG                first;
+    Topic::Snapshot    *snapshot    = publication->snapshot;
+    auto                count       = static_cast<LONG>(snapshot->subscribers.size());
+
+    while ((first = InterlockedExchangeAdd(&publication->next, PUBLISH_BATCH_SIZE)) < count) {
+        LONG last = first + PUBLISH_BATCH_SIZE < count ? first + PUBLISH_BATCH_SIZE : count;
+        for (LONG i = first ; i < last ; i++) {
+            const Topic::Subscriber &subscriber = snapshot->subscribers[i];
+            Socket *sockObj = socketAccessMap.Get(subscriber.id);
+            if (sockObj != nullptr)
+                DeliverPublication(sockObj, subscriber.id, publication, subscriber.policy);
         }
     }
+    if (InterlockedDecrement(&publication->fanOuts) == 0) {    // every subscriber was given it, queued sends only need the data
+        publication->snapshot = nullptr;
+        Topic::Release(snapshot);
+    }
+    Publication::Release(publication);
+}
 
-    // ----------------------------- connect socket
-    sockAddr.sin_addr.s_addr = inet_addr(address);
-    if(WSAHtons(sockObj->s, port, &sockAddr.sin_port) == SOCKET_ERROR) { // host-to-network-short: big-endian conversion of a 16 byte value
-        //WSANOTINITIALISED, WSAENETDOWN, WSAENOTSOCK, WSAEFAULT
-        LOG_ERROR("WSAHtonl failed / error %lu\n", GetLastError());
-        Socket::Delete(sockObj);
-        return nullId;
+void SocketManager::DeliverPublication(Socket *sockObj, UUID subscriberId, Publication *publication, Backpressure policy) {
+    auto    length          = static_cast<u_long>(publication->data.size());
+    bool    copied          = false;
+    bool    slow            = false;
+    bool    cleanupSocket   = false;
+    RPC_STATUS status;
+
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if (!UuidEqual(&sockObj->id, &subscriberId, &status) || sockObj->state != Socket::SocketState::CONNECTED) {
+            // closing, it leaves its topics, or already reused for another connection which didn't subscribe
+        } else if (sockObj->ring != nullptr || sockObj->negotiating || sockObj->tls != nullptr ||  // copied in a shared memory ring, sealed in records of its own
+                   sockObj->compressionPending || sockObj->compressed) {                          // or packed in blocks of its own anyway
+            copied = true;
+            sockObj->OutstandingSend++;                                 // not reused while SendData copies it, which can't run under the lock as it may queue
+        } else if (sockObj->publications.empty() &&                     // queued ones go first, in order
+                   (sockObj->pendingByteSent == 0 || length + sockObj->pendingByteSent <= sockObj->maxPendingByteSent)) {   // a publication bigger than the max pending send goes alone
+            PostPublication(sockObj, publication);
+        } else {
+            switch (policy) {
+                case Backpressure::DROP_OLDEST :{
+                    InterlockedIncrement(&publication->refs);
+                    sockObj->publications.push_back(publication);
+                    sockObj->publicationBytes += length;
+                    while (sockObj->publications.size() > 1 && sockObj->publicationBytes > sockObj->maxPendingByteSent) {
+                        Publication *oldest = sockObj->publications.front();
+                        sockObj->publications.pop_front();
+                        sockObj->publicationBytes -= static_cast<u_long>(oldest->data.size());
+                        Publication::Release(oldest);
+                        InterlockedIncrement64(&publicationsDropped);
+                    }
+                    break;
+                }
+                case Backpressure::DISCONNECT :{
+                    slow = true;
+                    break;
+                }
+                default :
+                    InterlockedIncrement64(&publicationsDropped);
+            }
+        }
+        if (slow) {                                                     // its pending sends are aborted, each completion with an error releases its part
+            LOG_ERROR("Socket %llu : Too slow for its subscriptions, closed\n", sockObj->s);
+            sockObj->Close(true);
+            InterlockedIncrement64(&slowSubscribers);
+        }
     }
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (!copied)
+        return;
 
-    Buffer *connectObj = Buffer::Create(inUseBufferList, Buffer::Operation::Connect);
-    if (!ConnectEx(sock,                        //s : A descriptor identifying an unconnected socket.
-                   (SOCKADDR*)(&sockAddr),      //name : A pointer to a sockaddr structure that specifies the address to which to connect. For IPv4, the sockaddr contains AF_INET for the address family, the destination IPv4 address, and the destination port.
-                   sizeof(sockAddr),            //namelen : The length, in bytes, of the sockaddr structure pointed to by the name parameter.
-                   nullptr,                     //lpSendBuffer : A pointer to the buffer to be transferred after a connection is established. This parameter is optional.
-                   0,                           //dwSendDataLength : The length, in bytes, of data pointed to by the lpSendBuffer parameter. This parameter is ignored when the lpSendBuffer parameter is NULL.
-                   nullptr,                     //lpdwBytesSent : On successful return, this parameter points to a DWORD value that indicates the number of bytes that were sent after the connection was established. This parameter is ignored when the lpSendBuffer parameter is NULL.
-                   &(connectObj->ol)            //lpOverlapped : An OVERLAPPED structure used to process the request. The lpOverlapped parameter must be specified, and cannot be NULL.
-                  )) {
-        if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
-            LOG_ERROR("ConnectToNewSocket: ConnectEx failed: %d\n", err);
-            Socket::Delete(sockObj);
-            return nullId; // connect error
+    // ----------------------------- copied sends queue nothing : a refused one is dropped, or closes a socket disconnected when too slow
+    bool sent = SendData(publication->data.data(), length, sockObj);
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        if (sent)
+            InterlockedIncrement64(&delivered);
+        else if (policy != Backpressure::DISCONNECT || sockObj->state != Socket::SocketState::CONNECTED)
+            InterlockedIncrement64(&publicationsDropped);
+        else {
+            LOG_ERROR("Socket %llu : Too slow for its subscriptions, closed\n", sockObj->s);
+            sockObj->Close(true);
+            InterlockedIncrement64(&slowSubscribers);
         }
+        sockObj->OutstandingSend--;
+        cleanupSocket = sockObj->OutstandingSend == 0 && sockObj->OutstandingRecv == 0 && sockObj->state > Socket::SocketState::CONNECTED;
     }
-    LOG("ConnectEx ok\n");
-    AddSocketToMap(sockObj, id);
-    return sockObj->id;
+    LeaveCriticalSection(&sockObj->SockCritSec);
+    if (cleanupSocket)
+        Socket::DeleteOrDisconnect(sockObj, socketAccessMap);
 }
 
-bool SocketManager::AcceptNewSocket(Socket *listenSockObj){
-    int err;
-    Socket *acceptSockObj = GenerateSocket(true);
-    if (acceptSockObj == nullptr){
-        return false;
-    }
-    if (!AssociateSocketToIOCP(acceptSockObj)){
+bool SocketManager::PostPublication(Socket *sockObj, Publication *publication) {
+    Buffer *sendObj = Buffer::Create(inUseBufferList, Buffer::Operation::Write);
+
+    sendObj->external = publication->data.data();
+    sendObj->publication = publication;
+    sendObj->bufLen = static_cast<u_long>(publication->data.size());
+    InterlockedIncrement(&publication->refs);
+    if (PostSend(sockObj, sendObj) == SOCKET_ERROR) {
+        sockObj->state = Socket::SocketState::FAILURE;
+        Publication::Release(publication);                              // the caller still holds a reference
+        Buffer::Delete(sendObj);
         return false;
     }
-    currentAcceptSocket = acceptSockObj;
+    InterlockedIncrement64(&delivered);
+    return true;
+}
 
-    Buffer *acceptObj = Buffer::Create(inUseBufferList, Buffer::Operation::Accept);
-    if (!AcceptEx(listenSockObj->s,             //sListenSocket : A descriptor identifying a socket that has already been called with the listen function. A server application waits for attempts to connect on this socket.
-                  acceptSockObj->s,             //sAcceptSocket : A descriptor identifying a socket on which to accept an incoming connection. This socket must not be bound or connected.
-                  acceptObj->buf,               //lpOutputBuffer : A pointer to a buffer that receives the first block of data sent on a new connection, the local address of the server, and the remote address of the client. The receive data is written to the first part of the buffer starting at offset zero, while the addresses are written to the latter part of the buffer. This parameter must be specified.
-                  0,                            //dwReceiveDataLength : The number of bytes in lpOutputBuffer that will be used for actual receive data at the beginning of the buffer. This size should not include the size of the local address of the server, nor the remote address of the client; they are appended to the output buffer. If dwReceiveDataLength is zero, accepting the connection will not result in a receive operation. Instead, AcceptEx completes as soon as a connection arrives, without waiting for any data.
-                  sizeof(SOCKADDR_IN)+16,       //dwLocalAddressLength : The number of bytes reserved for the local address information. This value must be at least 16 bytes more than the maximum address length for the transport protocol in use.
-                  sizeof(SOCKADDR_IN)+16,       //dwRemoteAddressLength : The number of bytes reserved for the remote address information. This value must be at least 16 bytes more than the maximum address length for the transport protocol in use. Cannot be zero.
-                  nullptr,                      //lpdwBytesReceived : A pointer to a DWORD that receives the count of bytes received. This parameter is set only if the operation completes synchronously. If it returns ERROR_IO_PENDING and is completed later, then this DWORD is never set and you must obtain the number of bytes read from the completion notification mechanism.
-                  &(acceptObj->ol)              //lpOverlapped : An OVERLAPPED structure used to process the request. The lpOverlapped parameter must be specified, and cannot be NULL.
-    )) {
-        if ((err = WSAGetLastError()) != WSA_IO_PENDING) {
-            LOG_ERROR("ConnectEx failed: %d\n", err);
-            Socket::Delete(acceptSockObj);
-            return false; // connect error
+void SocketManager::SendQueuedPublications(Socket *sockObj) {
+    EnterCriticalSection(&sockObj->SockCritSec);
+    {
+        while (sockObj->state == Socket::SocketState::CONNECTED && !sockObj->publications.empty()) {
+            Publication *publication = sockObj->publications.front();
+            auto length = static_cast<u_long>(publication->data.size());
+            if (sockObj->pendingByteSent > 0 && length + sockObj->pendingByteSent > sockObj->maxPendingByteSent)
+                break;
+            sockObj->publications.pop_front();
+            sockObj->publicationBytes -= length;
+            bool posted = PostPublication(sockObj, publication);
+            Publication::Release(publication);                          // the queue's reference, the send has its own
+            if (!posted)
+                break;
         }
     }
-    LOG("AcceptEx ok\n");
-    acceptSockObj->state = Socket::SocketState::ACCEPTING;
-    return true;
+    LeaveCriticalSection(&sockObj->SockCritSec);
+}
+
+SocketManager::PubSubStats SocketManager::GetPubSubStats() {
+    PubSubStats stats;
+
+    stats.published = published;
+    stats.delivered = delivered;
+    stats.dropped = publicationsDropped;
+    stats.disconnected = slowSubscribers;
+    return stats;
 }
 
-UUID SocketManager::ListenToNewSocket(u_short port, bool fewCLientsExpected) {
+UUID SocketManager::ListenToNewSocket(u_short port, bool fewCLientsExpected, const std::vector<SocketManager*> &managers) {
+    Listener listener(port);
+    if (fewCLientsExpected) {
+        listener.pendingAccepts = 1;
+        listener.backlog = 5;
+    }
+    return ListenToNewSocket(listener, managers);
+}
+
+UUID SocketManager::ListenToNewSocket(const Listener &listener, const std::vector<SocketManager*> &managers) {
     UUID nullId = Misc::CreateNilUUID();
-    if (state != State::READY || type != Type::SERVER) //can't have several listen socket, create a manager for each
+    SOCKADDR_STORAGE sockAddr;
+    int sockAddrLength;
+    if (state < State::READY || type != Type::SERVER || managers.empty() || draining || listener.pendingAccepts <= 0)
+        return nullId;
+    for (SocketManager *manager : managers) {
+        if (manager->state < State::READY || manager->type != Type::SERVER)
+            return nullId;
+    }
+    if (!ParseAddress(listener.address, listener.port, sockAddr, sockAddrLength)) {
+        LOG_ERROR("%s is not a numeric IPv4 or IPv6 address or a unix: path\n", listener.address != nullptr ? listener.address : "(null)");
         return nullId;
+    }
 
     // ----------------------------- create socket
 
-    Socket *listenSockObj = GenerateSocket(false);
+    Socket *listenSockObj = GenerateSocket(false, sockAddr.ss_family);
     if (listenSockObj == nullptr){
         return nullId;
     }
-    listenSockObj->port = port;
+    listenSockObj->address = listener.address;
+    listenSockObj->port = listener.port;
+    listenSockObj->handler = listener.handler;
     LOG("GetSocketObj ok\n");
 
-    SOCKADDR_IN sockAddr;
-    ZeroMemory(&sockAddr, sizeof(SOCKADDR_IN));
-    sockAddr.sin_family = FAMILY;
-    sockAddr.sin_addr.s_addr = INADDR_ANY;
-    if(WSAHtons(listenSockObj->s, port, &sockAddr.sin_port) == SOCKET_ERROR) { // host-to-network-short: big-endian conversion of a 16 byte value
-        //WSANOTINITIALISED, WSAENETDOWN, WSAENOTSOCK, WSAEFAULT
-        LOG_ERROR("WSAHtonl failed / error %lu\n", GetLastError());
-        Socket::Delete(listenSockObj);
-        return nullId;
-    }
-
     // ----------------------------- associate socket to IOCP
     if (!AssociateSocketToIOCP(listenSockObj)){
         return nullId;
     }
 
-    // ----------------------------- bind socket
-    if (!BindSocket(listenSockObj, sockAddr)){
+    // ----------------------------- dual-stack, accepted sockets inherit it
+    if (sockAddr.ss_family == AF_INET6) {
+        DWORD v6Only = listener.v6Only ? 1 : 0;
+        if (setsockopt(listenSockObj->s,                //s : A descriptor that identifies a socket.
+                       IPPROTO_IPV6,                    //level : The level at which the option is defined.
+                       IPV6_V6ONLY,                     //optname : IPV6_V6ONLY -> Indicates if a socket created for the AF_INET6 address family is restricted to IPv6 communications only (on by default on Windows).
+                       (char*)&v6Only,                  //optval : A pointer to the buffer in which the value for the requested option is specified.
+                       sizeof(v6Only)                   //optlen : The size, in bytes, of the buffer pointed to by the optval parameter.
+        ) == SOCKET_ERROR) {
+            LOG_ERROR("setsockopt IPV6_V6ONLY failed / error %d\n", WSAGetLastError());
+            Socket::Delete(listenSockObj);
+            return nullId;
+        }
+    }
+
+    // ----------------------------- bind socket, a Unix domain socket creates its file, which a previous listener may have left
+    if (sockAddr.ss_family == AF_UNIX)
+        DeleteFileA(reinterpret_cast<SOCKADDR_UN*>(&sockAddr)->sun_path);
+    if (!BindSocket(listenSockObj, (SOCKADDR*)&sockAddr, sockAddrLength)){
         return nullId;
     }
     // ----------------------------- listen
     if (listen(listenSockObj->s,                        //s : A descriptor identifying a bound, unconnected socket.
-               fewCLientsExpected ? 5 : SOMAXCONN       //backlog : The maximum length of the queue of pending connections. If set to SOMAXCONN, the underlying service provider responsible for socket s will set the backlog to a maximum reasonable value.
+               listener.backlog                         //backlog : The maximum length of the queue of pending connections. If set to SOMAXCONN, the underlying service provider responsible for socket s will set the backlog to a maximum reasonable value.
     ) == SOCKET_ERROR){
         LOG_ERROR("listen failed / error %d\n", WSAGetLastError());
         Socket::Delete(listenSockObj);
@@ -729,9 +3464,14 @@ UUID SocketManager::ListenToNewSocket(u_short port, bool fewCLientsExpected) {
     LOG("bind ok\n");
     listenSockObj->state = Socket::SocketState::LISTENING;
 
-    // ----------------------------- start accepting sockets
+    // ----------------------------- start accepting sockets, each manager on its own IOCP
 
-    if (!AcceptNewSocket(listenSockObj)){
+    int posted = 0;
+    for (int i = 0 ; i < listener.pendingAccepts ; i++) {  // interleaved so each manager gets its share of the first connections
+        for (SocketManager *manager : managers)
+            posted += manager->AcceptNewSocket(listenSockObj);
+    }
+    if (posted == 0){                                   // listen socket can only be deleted while no accept is pending on it
         Socket::Delete(listenSockObj);
         return nullId;
     }
@@ -740,6 +3480,260 @@ UUID SocketManager::ListenToNewSocket(u_short port, bool fewCLientsExpected) {
     return listenSockObj->id;
 }
 
+UUID SocketManager::OpenDatagramSocket(const char *address, u_short port) {
+    UUID                nullId          = Misc::CreateNilUUID();
+    SOCKADDR_STORAGE    sockAddr;
+    int                 sockAddrLength;
+    SOCKET              sock;
+    DWORD               bytes;
+
+    if (state < State::READY || draining)
+        return nullId;
+    if (!ParseAddress(address, port, sockAddr, sockAddrLength)) {
+        LOG_ERROR("%s is not a numeric IPv4 or IPv6 address\n", address != nullptr ? address : "(null)");
+        return nullId;
+    }
+
+    // ----------------------------- create socket
+    if ((sock = WSASocket(sockAddr.ss_family,           //af : The address family specification
+                          SOCK_DGRAM,                   //type : SOCK_DGRAM -> A socket type that supports datagrams, which are connectionless, unreliable buffers of a fixed (typically small) maximum length. This socket type uses the User Datagram Protocol (UDP) for the Internet address family (AF_INET or AF_INET6).
+                          IPPROTO_UDP,                  //protocol : IPPROTO_UDP -> The User Datagram Protocol (UDP). This is a possible value when the af parameter is AF_INET or AF_INET6 and the type parameter is SOCK_DGRAM.
+                          nullptr,                      //lpProtocolInfo : A pointer to a WSAPROTOCOL_INFO structure that defines the characteristics of the socket to be created.
+                          0,                            //g : An existing socket group ID or an appropriate action to take when creating a new socket and a new socket group. 0 -> No group operation is performed.
+                          WSA_FLAG_OVERLAPPED           //dwFlags : A set of flags used to specify additional socket attributes. WSA_FLAG_OVERLAPPED -> Create a socket that supports overlapped I/O operations.
+    )) == INVALID_SOCKET) {
+        LOG_ERROR("WSASocket failed / error %d\n", WSAGetLastError());
+        return nullId;
+    }
+    Socket *sockObj = Socket::Create(inUseSocketList, this, sock, sockAddr.ss_family);
+    sockObj->datagram = true;
+    sockObj->address = address;
+    sockObj->port = port;
+
+    // ----------------------------- associate socket to IOCP
+    if (!AssociateSocketToIOCP(sockObj))
+        return nullId;
+
+    // ----------------------------- bind socket
+    if (SetSocketOption(sock, SO_EXCLUSIVEADDRUSE, true) == SOCKET_ERROR ||
+        bind(sock,                                      //s : A descriptor identifying an unbound socket.
+             (SOCKADDR*)&sockAddr,                      //name : A pointer to a sockaddr structure of the local address to assign to the bound socket.
+             sockAddrLength                             //namelen : The length, in bytes, of the value pointed to by the name parameter.
+        ) == SOCKET_ERROR) {
+        LOG_ERROR("bind failed / error %d\n", WSAGetLastError());
+        Socket::Delete(sockObj);
+        return nullId;
+    }
+
+    // ----------------------------- ICMP port unreachable of a send must not fail the next read
+    BOOL connReset = FALSE;
+    if (WSAIoctl(sock,                                  //s : A descriptor identifying a socket.
+                 SIO_UDP_CONNRESET,                     //dwIoControlCode : The control code of operation to perform. SIO_UDP_CONNRESET -> FALSE stops reporting ICMP port unreachable messages as WSAECONNRESET on the next read.
+                 &connReset,                            //lpvInBuffer : A pointer to the input buffer.
+                 sizeof(connReset),                     //cbInBuffer : The size, in bytes, of the input buffer.
+                 nullptr,                               //lpvOutBuffer : A pointer to the output buffer.
+                 0,                                     //cbOutBuffer : The size, in bytes, of the output buffer.
+                 &bytes,                                //lpcbBytesReturned : A pointer to actual number of bytes of output.
+                 nullptr,                               //lpOverlapped : A pointer to a WSAOVERLAPPED structure (ignored for non-overlapped sockets).
+                 nullptr                                //lpCompletionRoutine : A pointer to the completion routine called when the operation has been completed (ignored for non-overlapped sockets).
+                ) == SOCKET_ERROR) {
+        LOG_ERROR("SIO_UDP_CONNRESET failed / error %d\n", WSAGetLastError());    //WSAECONNRESET reads are then dropped one by one
+    }
+
+    // ----------------------------- offloads, each one is used only if the stack has it (Windows 10 2004 / Server 2022 and later)
+    DWORD coalescedSize = MAX_DATAGRAM_SIZE;           //receive segment coalescing (URO) : datagrams of the same size from the same peer come in one read, up to a buffer
+    if (setsockopt(sock,                                //s : A descriptor that identifies a socket.
+                   IPPROTO_UDP,                         //level : The level at which the option is defined.
+                   UDP_RECV_MAX_COALESCED_SIZE,         //optname : The socket option for which the value is to be set. UDP_RECV_MAX_COALESCED_SIZE -> Max bytes of datagrams coalesced in one read, their size is given by the UDP_COALESCED_INFO control message.
+                   (const char*)&coalescedSize,         //optval : A pointer to the buffer in which the value for the requested option is specified.
+                   sizeof(coalescedSize)                //optlen : The size, in bytes, of the buffer pointed to by the optval parameter.
+    ) == SOCKET_ERROR) {
+        LOG("UDP_RECV_MAX_COALESCED_SIZE not supported : %d\n", WSAGetLastError());
+    }
+    DWORD segmentSize = 0;
+    int segmentSizeLength = sizeof(segmentSize);
+    sockObj->segmentOffload = getsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, (char*)&segmentSize, &segmentSizeLength) == 0;  //segmentation offload (USO) of sends
+    WSAPROTOCOL_INFOW protocolInfo;
+    int protocolInfoLength = sizeof(protocolInfo);
+    if (getsockopt(sock, SOL_SOCKET, SO_PROTOCOL_INFOW, (char*)&protocolInfo, &protocolInfoLength) == 0 &&
+        (protocolInfo.dwServiceFlags1 & XP1_IFS_HANDLES) != 0 &&      //no layered provider which would still queue a completion
+        SetFileCompletionNotificationModes((HANDLE)sock,                //FileHandle : A handle to the file.
+                                           FILE_SKIP_COMPLETION_PORT_ON_SUCCESS | FILE_SKIP_SET_EVENT_ON_HANDLE))   //Flags : FILE_SKIP_COMPLETION_PORT_ON_SUCCESS -> If the following three conditions are true, the I/O Manager does not queue a completion entry to the port, when it would ordinarily do so : a completion port is associated with the file handle, the file is opened for asynchronous I/O, a request returns success immediately without returning ERROR_PENDING.
+        sockObj->inlineCompletions = true;
+
+    // ----------------------------- post the reads, the ones completed right away are handed to worker threads
+    sockObj->state = Socket::SocketState::CONNECTED;
+    AddSocketToMap(sockObj, nullId);
+    for (int i = 0 ; i < DATAGRAM_RECVS_PER_SOCKET ; i++) {
+        Buffer *recvObj = Buffer::Create(inUseBufferList, Buffer::Operation::Read);
+        bool completed;
+        if (PostDatagramRecv(sockObj, recvObj, bytes, completed) == SOCKET_ERROR) {
+            Buffer::Delete(recvObj);
+            StopDatagramSocket(sockObj, Socket::SocketState::FAILURE);
+            CloseIfIdle(sockObj);
+            return nullId;
+        }
+        if (completed)
+            RequeueDatagramRead(sockObj, recvObj, bytes);
+    }
+    LOG("datagram socket open (inline completions %d, segmentation offload %d)\n", sockObj->inlineCompletions, sockObj->segmentOffload);
+    return sockObj->id;
+}
+
+bool SocketManager::ParseAddress(const char *address, u_short port, SOCKADDR_STORAGE &sockAddr, int &length) {
+    char addressCopy[INET6_ADDRSTRLEN];                 // WSAStringToAddress doesn't take a const string
+
+    if (address != nullptr && strncmp(address, UNIX_ADDRESS_PREFIX, sizeof(UNIX_ADDRESS_PREFIX) - 1) == 0) {
+        auto *unixAddr = reinterpret_cast<SOCKADDR_UN*>(&sockAddr);
+        const char *path = address + sizeof(UNIX_ADDRESS_PREFIX) - 1;
+        if (*path == '\0' || strlen(path) >= sizeof(unixAddr->sun_path))
+            return false;
+        ZeroMemory(&sockAddr, sizeof(sockAddr));
+        unixAddr->sun_family = AF_UNIX;
+        strcpy(unixAddr->sun_path, path);
+        length = sizeof(SOCKADDR_UN);
+        return true;
+    }
+    if (address == nullptr || strlen(address) >= sizeof(addressCopy))
+        return false;
+    strcpy(addressCopy, address);
+    for (int family : {AF_INET, AF_INET6}) {
+        ZeroMemory(&sockAddr, sizeof(sockAddr));
+        length = sizeof(sockAddr);
+        if (WSAStringToAddressA(addressCopy,            //AddressString : A pointer to the zero-terminated string that contains a network address in standard text form to convert.
+                                family,                 //AddressFamily : The address family of the network address pointed to by the AddressString parameter.
+                                nullptr,                //lpProtocolInfo : The WSAPROTOCOL_INFO structure associated with the provider to be used. If this is NULL, the call is routed to the provider of the first protocol supporting the indicated AddressFamily.
+                                (SOCKADDR*)&sockAddr,   //lpAddress : A pointer to a buffer that is filled with a sockaddr structure for the address string if the function succeeds.
+                                &length                 //lpAddressLength : A pointer to the length, in bytes, of the buffer pointed to by the lpAddress parameter. If the function is successful, a pointer to a value that is the length of the sockaddr structure returned.
+        ) == SOCKET_ERROR)
+            continue;                                   //not an address of this family
+        SetPort(sockAddr, port);
+        return true;
+    }
+    return false;                                       //host name, or not an address at all
+}
+
+bool SocketManager::ResolveHostName(const char *name, const IP4_ARRAY *server, std::vector<SOCKADDR_STORAGE> &addresses, DWORD &ttlMs) {
+    DNS_STATUS status[2];
+
+    // ----------------------------- AAAA then A records, IPv6 first like the RFC 6724 default policy
+    ttlMs = MAXDWORD;
+    status[0] = QueryDns(name, DNS_TYPE_AAAA, server, addresses, ttlMs);
+    status[1] = QueryDns(name, DNS_TYPE_A, server, addresses, ttlMs);
+    if (!addresses.empty()) {
+        InterleaveFamilies(addresses);
+        return true;
+    }
+
+    // ----------------------------- the DNS answered that the name has no address, negative caching
+    bool answered = true;
+    for (DNS_STATUS familyStatus : status)
+        answered = answered && (familyStatus == DNS_ERROR_RCODE_NAME_ERROR || familyStatus == DNS_INFO_NO_RECORDS);
+    if (answered) {
+        ttlMs = ttlMs == MAXDWORD ? DNS_NEGATIVE_TTL : (ttlMs > MAX_DNS_NEGATIVE_TTL ? MAX_DNS_NEGATIVE_TTL : ttlMs);
+        LOG_ERROR("%s has no address\n", name);
+        return false;
+    }
+
+    // ----------------------------- the DNS couldn't answer (no server, timeout, name it doesn't know like NetBIOS ones), getaddrinfo gives no TTL
+    ttlMs = DNS_FALLBACK_TTL;
+    if (ResolveAddress(name, addresses))
+        return true;
+    ttlMs = DNS_NEGATIVE_TTL;
+    return false;
+}
+
+DNS_STATUS SocketManager::QueryDns(const char *name, WORD type, const IP4_ARRAY *server, std::vector<SOCKADDR_STORAGE> &addresses, DWORD &ttlMs) {
+    PDNS_RECORD results     = nullptr;
+    DWORD       negativeTtl = MAXDWORD;
+    bool        found       = false;
+    DNS_STATUS  status      = DnsQuery_A(name,                  //pszName : A pointer to a string that represents the DNS name to query.
+                                         type,                  //wType : A value that represents the Resource Record (RR) DNS Record Type that is queried.
+                                         server != nullptr ? DNS_QUERY_BYPASS_CACHE : DNS_QUERY_STANDARD,  //Options : A value that contains a bitmap of DNS Query Options to use in the DNS query. Our own cache replaces the system one for a server of our own.
+                                         (PVOID)server,         //pExtra : IP4_ARRAY of the DNS servers to query, nullptr for the ones of the system.
+                                         &results,              //ppQueryResults : Optional. A pointer to a pointer that points to the list of RRs that comprise the response.
+                                         nullptr);              //pReserved : This parameter is reserved for future use and must be set to NULL.
+
+    for (PDNS_RECORD record = results ; record != nullptr ; record = record->pNext) {
+        DWORD recordTtl = record->dwTtl > MAXDWORD / 1000 ? MAXDWORD : record->dwTtl * 1000;
+        if (record->wType == DNS_TYPE_SOA) {            //RFC 2308 : a negative answer is cached for the min of the SOA TTL and its MINIMUM field
+            DWORD minimum = record->Data.SOA.dwDefaultTtl > MAXDWORD / 1000 ? MAXDWORD : record->Data.SOA.dwDefaultTtl * 1000;
+            negativeTtl = recordTtl < minimum ? recordTtl : minimum;
+            continue;
+        }
+        if (record->wType != type)                      //CNAME chain
+            continue;
+        SOCKADDR_STORAGE sockAddr;
+        ZeroMemory(&sockAddr, sizeof(sockAddr));
+        if (type == DNS_TYPE_AAAA) {
+            sockAddr.ss_family = AF_INET6;
+            memcpy(&((SOCKADDR_IN6*)&sockAddr)->sin6_addr, &record->Data.AAAA.Ip6Address, sizeof(IP6_ADDRESS));
+        } else {
+            sockAddr.ss_family = AF_INET;
+            ((SOCKADDR_IN*)&sockAddr)->sin_addr.s_addr = record->Data.A.IpAddress;
+        }
+        addresses.push_back(sockAddr);
+        found = true;
+        if (recordTtl < ttlMs)
+            ttlMs = recordTtl;
+    }
+    if (!found && negativeTtl < ttlMs)
+        ttlMs = negativeTtl;
+    if (results != nullptr)
+        DnsRecordListFree(results, DnsFreeRecordList);
+    return status;
+}
+
+bool SocketManager::ResolveAddress(const char *address, std::vector<SOCKADDR_STORAGE> &addresses) {
+    int err;
+    ADDRINFOA hints{};
+    ADDRINFOA *results = nullptr;
+
+    hints.ai_family = AF_UNSPEC;                        //IPv4 and IPv6
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if ((err = getaddrinfo(address,                     //pNodeName : A pointer to a NULL-terminated ANSI string that contains a host (node) name or a numeric host address string.
+                           nullptr,                     //pServiceName : A pointer to a NULL-terminated ANSI string that contains either a service name or port number represented as a string.
+                           &hints,                      //pHints : A pointer to an addrinfo structure that provides hints about the type of socket the caller supports.
+                           &results                     //ppResult : A pointer to a linked list of one or more addrinfo structures that contains response information about the host.
+    )) != 0) {
+        LOG_ERROR("getaddrinfo failed for %s / error %d\n", address, err);
+        return false;
+    }
+    for (ADDRINFOA *result = results ; result != nullptr ; result = result->ai_next) {
+        if ((result->ai_family != AF_INET && result->ai_family != AF_INET6) || result->ai_addrlen > sizeof(SOCKADDR_STORAGE))
+            continue;
+        SOCKADDR_STORAGE sockAddr;
+        ZeroMemory(&sockAddr, sizeof(sockAddr));
+        memcpy(&sockAddr, result->ai_addr, result->ai_addrlen);
+        addresses.push_back(sockAddr);
+    }
+    freeaddrinfo(results);
+    InterleaveFamilies(addresses);                      //the first family is the one ranked first by the resolver (RFC 6724 order)
+    return !addresses.empty();
+}
+
+void SocketManager::InterleaveFamilies(std::vector<SOCKADDR_STORAGE> &addresses) {
+    std::vector<SOCKADDR_STORAGE> byFamily[2];          //family of the first address, other family
+
+    for (const SOCKADDR_STORAGE &sockAddr : addresses)
+        byFamily[sockAddr.ss_family == addresses.front().ss_family ? 0 : 1].push_back(sockAddr);
+    addresses.clear();
+    for (size_t i = 0 ; i < byFamily[0].size() || i < byFamily[1].size() ; i++) {
+        if (i < byFamily[0].size())
+            addresses.push_back(byFamily[0][i]);
+        if (i < byFamily[1].size())
+            addresses.push_back(byFamily[1][i]);
+    }
+}
+
+void SocketManager::SetPort(SOCKADDR_STORAGE &sockAddr, u_short port) {
+    if (sockAddr.ss_family == AF_INET6)
+        ((SOCKADDR_IN6*)&sockAddr)->sin6_port = htons(port);   // host-to-network-short: big-endian conversion of a 16 byte value
+    else
+        ((SOCKADDR_IN*)&sockAddr)->sin_port = htons(port);
+}
+
 bool SocketManager::InitAsyncSocketFuncs() {
     //dummy socket to pass to WSAIoctl call
     SOCKET sock = WSASocket(FAMILY,                      //af : The address family specification
@@ -754,7 +3748,9 @@ bool SocketManager::InitAsyncSocketFuncs() {
     }
     return InitAsyncSocketFunc(sock, WSAID_CONNECTEX, &ConnectEx, sizeof(ConnectEx)) &&
            InitAsyncSocketFunc(sock, WSAID_ACCEPTEX, &AcceptEx, sizeof(AcceptEx)) &&
-           InitAsyncSocketFunc(sock, WSAID_DISCONNECTEX, &DisconnectEx, sizeof(DisconnectEx));
+           InitAsyncSocketFunc(sock, WSAID_TRANSMITFILE, &TransmitFile, sizeof(TransmitFile)) &&
+           InitAsyncSocketFunc(sock, WSAID_DISCONNECTEX, &DisconnectEx, sizeof(DisconnectEx)) &&
+           InitAsyncSocketFunc(sock, WSAID_WSARECVMSG, &WSARecvMsg, sizeof(WSARecvMsg));
 }
 
 bool SocketManager::InitAsyncSocketFunc(SOCKET sock, GUID guid, LPVOID func, DWORD size) {
@@ -798,14 +3794,14 @@ void SocketManager::InitTimeWaitValue() {
     }
 }
 
-Socket *SocketManager::ReuseSocket() {
+Socket *SocketManager::ReuseSocket(int family) {
     Socket *sockObj = nullptr;
     EnterCriticalSection(&reusableSocketQueue.critSec);
     {
         if (!reusableSocketQueue.queue.empty()){
             sockObj = reusableSocketQueue.queue.front();
             DWORD currentTime = GetTickCount();
-            if(currentTime - sockObj->timeWaitStartTime > TimeWaitValue) {
+            if(sockObj->af == family && currentTime - sockObj->timeWaitStartTime > TimeWaitValue) {  //oldest first, a socket of the other family waits for a listener or connect of its own
                 LOG("Recycling socket\n");
                 sockObj->timeWaitStartTime = 0;
                 reusableSocketQueue.queue.pop();
@@ -7,23 +7,50 @@
 
 class SocketManager {                            // Manage a client connected to an arbitrary number of socket server
     friend class Socket;
+    friend class SocketHandler;
 
 private:
     /********************** Static Attributes ************************/
 
-    static const int            FAMILY                          = AF_INET;      // IPv4 address family.
+    static const int            FAMILY                          = AF_INET;      // Default address family, listeners and connects take the one of their address
     static const int            THREADS_PER_PROC                = 1;
     static const int            MAX_UNUSED_SOCKET               = 30;
+    static const int            PENDING_ACCEPTS_PER_MANAGER     = 4;            // AcceptEx kept posted by each manager accepting on a listen socket, so a burst of connections doesn't wait for a repost
     static const int            DEFAULT_TIME_WAIT_VALUE         = 120000;       // Either 120 or 240sec depending on doc page, but tests confirmed 120 (https://docs.microsoft.com/en-us/biztalk/technical-guides/settings-that-can-be-modified-to-improve-network-performance | https://docs.microsoft.com/en-us/previous-versions/windows/it-pro/windows-2000-server/cc938217(v=technet.10))
     static const int            MIN_TIME_WAIT_VALUE             = 30000;        // Range goes from 30 to 300sec according to microsoft doc
     static const int            MAX_TIME_WAIT_VALUE             = 300000;       // Range goes from 30 to 300sec according to microsoft doc
     static const LONG64         DEFAULT_MAX_PENDING_BYTE_SENT   = 65536;        // 64k, default value only if isb query fail (shouldn't happen)
+    static const DWORD          ISB_SAMPLE_INTERVAL             = 100;          // Min ms between two TCP_INFO samples of a socket, a few RTT on a LAN and about one on a WAN
+    static const ULONG          MIN_ESTIMATED_ISB               = 8192;         // Floor of ISB estimated from TCP_INFO, so an idle connection can still start sending
+    static const DWORD          SEND_TIMER_PERIOD               = 5;            // ms between two refills of the send rate limits, when there are some
+    static const LONG           DRAIN_BATCH_SIZE                = 256;          // Sockets closed by a worker thread each time it takes its share of a drain
+    static const DWORD          DRAIN_POLL_PERIOD               = 10;           // ms between two checks of a drain waiting for sends or aborted operations
+    static const DWORD          DRAIN_CLOSE_TIMEOUT             = 5000;         // Max ms a drain waits for the operations of closed sockets to be aborted
+    static const LONG           PUBLISH_BATCH_SIZE              = 256;          // Subscribers sent a publication by a worker thread each time it takes its share of the fan-out
+    static const DWORD          CONNECT_ATTEMPT_DELAY           = 250;          // ms a connect attempt is given before the next address is tried in parallel, recommended by RFC 8305
+    static const DWORD          CONNECT_TIMER_PERIOD            = 10;           // ms between two checks of the connects waiting for their next attempt
+    static const DWORD          DNS_FALLBACK_TTL                = 30000;        // ms a host name resolved by getaddrinfo (hosts file, NetBIOS...) is cached, no TTL comes with it
+    static const DWORD          DNS_NEGATIVE_TTL                = 5000;         // ms a failed resolution is cached when the DNS server gave no SOA record to take it from
+    static const DWORD          MAX_DNS_NEGATIVE_TTL            = 10800000;     // 3h, upper bound of negative caching recommended by RFC 2308
+    static const int            DATAGRAM_RECVS_PER_SOCKET       = 16;           // Reads kept posted on a datagram socket, so a burst is read without waiting for reposts
+    static const int            DATAGRAM_INLINE_BATCH           = 64;           // Datagram reads completed right away handled in a row by a worker thread before it lets other completions in
+    static const DWORD          MIN_RING_CAPACITY               = 65536;        // Shared memory rings are at least 64k per direction, so a full ring is as rare as a full socket send buffer
+    static const DWORD          MAX_RING_CAPACITY               = 67108864;     // 64M per direction, bigger ones offered by a client are refused
+    static const u_long         RING_DRAIN_BUDGET               = 262144;       // Bytes a worker thread delivers from one ring in a row before it lets other completions in
+    static const size_t         MAX_POOLED_COMPRESSION          = 64;           // Compression sessions of closed sockets kept per algorithm for the next connections, the others are freed
+public:
+    static const u_long         DEFAULT_ZERO_COPY_THRESHOLD     = 16384;        // 16k, below it copying is cheaper than locking the caller's pages for the whole send
+    static const u_long         MAX_DATAGRAM_SIZE               = Buffer::DEFAULT_BUFFER_SIZE;  // Datagrams are read and sent in one buffer of the pool, bigger ones are dropped
+    static const char           UNIX_ADDRESS_PREFIX[];                          // "unix:" before the path of a Unix domain socket address
+private:
     static const TCHAR *        TIME_WAIT_REG_KEY;
     static const TCHAR *        TIME_WAIT_REG_VALUE;
     static DWORD                TimeWaitValue;
     static LPFN_CONNECTEX       ConnectEx;
     static LPFN_DISCONNECTEX    DisconnectEx;
     static LPFN_ACCEPTEX        AcceptEx;
+    static LPFN_TRANSMITFILE    TransmitFile;
+    static LPFN_WSARECVMSG      WSARecvMsg;
 
     ////////////////////// End Static Attributes /////////////////////
 
@@ -34,6 +61,134 @@ public:
         SERVER
     };
 
+    enum ISBSource {
+        IDEAL_SEND_BACKLOG,                                     // Ideal send backlog notifications of the TCP stack (default), estimated from TCP_INFO if they are not available
+        TCP_INFO                                                // Estimated from TCP_INFO samples taken on send completions : max of congestion window and delivery rate * min RTT
+    };
+
+    enum SendClass {
+        CONTROL,                                                // Small latency sensitive sends, posted before any bulk send waiting (only with send scheduling)
+        BULK                                                    // Everything else (default), shared fairly between sockets
+    };
+
+    struct SendScheduling {
+        bool            enabled;                                // Queue sends in the manager instead of posting them right away (default false)
+        u_long          quantum;                                // Bytes of bulk each socket can post per round robin turn, at least one buffer
+        LONG64          maxInFlight;                            // Max bytes posted and not completed, all sockets of the manager together
+        LONG64          socketInFlight;                         // Max bytes posted and not completed by one socket
+        ULONG64         socketRate;                             // Bytes per second one socket can send, 0 for no limit
+        ULONG64         globalRate;                             // Bytes per second all sockets of the manager can send together, 0 for no limit
+        DWORD           burst;                                  // Max burst of the rate limits, in ms of their rate
+
+        SendScheduling() : enabled(false), quantum(16384), maxInFlight(1048576), socketInFlight(65536), socketRate(0), globalRate(0), burst(100) {}
+    };
+
+    struct Listener {
+        const char *    address;                                // Numeric IPv4 or IPv6 address to listen on, "0.0.0.0" or "::" for any
+        u_short         port;
+        SocketHandler * handler;                                // Gets what is read on the accepted sockets instead of ReceiveData / ReceiveMessage, nullptr for the manager itself (must outlive the listener)
+        int             pendingAccepts;                         // AcceptEx kept posted on the listener by each accepting manager, so a busy listener doesn't take the accepts of the others
+        int             backlog;                                // Max connections waiting to be accepted, SOMAXCONN for the maximum reasonable value
+        bool            v6Only;                                 // IPv6 listener : IPv6 connections only, else IPv4 ones too as IPv4-mapped addresses (dual-stack, default)
+
+        explicit Listener(u_short p, const char *a = "0.0.0.0", SocketHandler *h = nullptr) : address(a), port(p), handler(h), pendingAccepts(PENDING_ACCEPTS_PER_MANAGER), backlog(SOMAXCONN), v6Only(false) {}
+    };
+
+    enum MemoryPressure {
+        UNDER_BUDGET,
+        OVER_SOFT_LIMIT,                                        // Accepts are paused, idle sockets wait for data with zero-byte recvs and recycled objects are freed
+        OVER_HARD_LIMIT                                         // Same, and sends are refused
+    };
+
+    struct MemoryBudget {
+        ULONG64         soft;                                   // Bytes of buffers and sockets of the manager above which it sheds load, 0 for no limit
+        ULONG64         hard;                                   // Bytes above which sends are refused too, 0 for no limit
+
+        MemoryBudget() : soft(0), hard(0) {}
+    };
+
+    struct MemoryStats {
+        ULONG64         bufferBytes;                            // Buffers allocated, in use or kept for reuse
+        ULONG64         socketBytes;                            // Sockets allocated, in use or kept for reuse
+        ULONG64         usedBytes;                              // Both, what the budget is checked against
+        ULONG64         peakBytes;                              // Highest usedBytes seen by a check of the budget
+        MemoryPressure  pressure;
+        LONG64          pausedAccepts;                          // Accepts waiting for memory to go back under the soft limit
+        LONG64          acceptPauses;                           // Accepts not replaced right away, since the start
+        LONG64          rejectedSends;                          // Sends refused over the hard limit, since the start
+        LONG64          readProbes;                             // Zero-byte recvs posted instead of read buffers, since the start
+    };
+
+    struct DnsStats {                                           // Host names of connects, since the start
+        LONG64          cacheHits;                              // Resolved from the cache
+        LONG64          negativeHits;                           // Failed right away from a cached failure
+        LONG64          resolutions;                            // Resolved on a thread pool thread, the cache having nothing fresh
+        LONG64          failures;                               // Resolutions which found no address
+        LONG            pending;                                // Resolutions not completed yet
+    };
+
+    struct DatagramStats {                                      // Datagram sockets, since the start
+        LONG64          received;                               // Datagrams given to ReceiveDatagram
+        LONG64          reads;                                  // Reads they came in, fewer when the stack coalesced datagrams (URO)
+        LONG64          sent;                                   // Datagrams posted
+        LONG64          sends;                                  // Sends they went in, fewer with segmentation offload (USO)
+        LONG64          dropped;                                // Reads failed (datagram bigger than MAX_DATAGRAM_SIZE, ICMP error...) and sends failed after being posted
+    };
+
+    struct TlsOptions {
+        PCCERT_CONTEXT  certificate     = nullptr;              // Server : certificate with its private key, valid as long as the manager
+        const char *    serverName      = nullptr;              // Client : name the server certificate must have, sent as SNI, nullptr for the address of each connect
+        bool            verifyPeer      = true;                 // Client : validate the server certificate, false for self-signed test certificates
+    };
+
+    typedef Topic::Backpressure Backpressure;                   // DROP_NEWEST, DROP_OLDEST or DISCONNECT, for each subscription
+
+    struct PubSubStats {                                        // Publications, since the start
+        LONG64          published;                              // Publish calls which had subscribers
+        LONG64          delivered;                              // Sends to subscribers posted
+        LONG64          dropped;                                // Not sent to a subscriber out of room (DROP_NEWEST), or dropped from its queue (DROP_OLDEST)
+        LONG64          disconnected;                           // Subscribers closed for being too slow (DISCONNECT)
+    };
+
+    struct TlsStats {                                           // TLS connections, since the start
+        LONG64          handshakes;                             // Handshakes completed
+        LONG64          failures;                               // Handshakes failed
+    };
+
+    enum Compression {
+        NO_COMPRESSION,                                         // Default
+        FAST_COMPRESSION,                                       // XPRESS (LZ77) : LZ4 class, for links of hundreds of Mb/s and more
+        STRONG_COMPRESSION                                      // XPRESS with Huffman coding : zstd class, a better ratio for a few times the CPU, for slower links
+    };
+
+    struct CompressionStats {                                   // Compressed connections, since the start
+        LONG64          negotiated;                             // Connections settled with compression
+        LONG64          refused;                                // Connections settled without : peer without compression, or no contexts for it
+        LONG64          contextsCreated;                        // Compression sessions created
+        LONG64          contextsReused;                         // Connections which got theirs from the pool, or kept the one of the previous connection of their socket
+        LONG64          batches;                                // Sends, and sends staged together while a batch was in flight, packed at once
+        LONG64          blocks;                                 // Blocks they were packed in, one send buffer each
+        LONG64          storedBlocks;                           // Blocks sent as is, compression didn't make them smaller
+        LONG64          rawBytesSent;                           // Bytes given to sends
+        LONG64          packedBytesSent;                        // Bytes of the blocks they were packed in, headers included
+        LONG64          packedBytesReceived;
+        LONG64          rawBytesReceived;                       // Bytes given to ReceiveData / ReceiveMessage
+    };
+
+    enum ThreadAffinity {
+        NO_AFFINITY,                                            // Worker threads run anywhere (default)
+        NODE_AFFINITY,                                          // Worker threads run on the processors of the NUMA node
+        CORE_AFFINITY                                           // Each worker thread is pinned to one processor of the NUMA node, starting at firstProcessor
+    };
+
+    struct Placement {
+        DWORD           numaNode;                               // Node of socket and buffer pools (and of worker threads with an affinity), ANY_NODE for the default heap
+        ThreadAffinity  affinity;
+        DWORD           firstProcessor;                         // CORE_AFFINITY : index among the processors of the node (of all nodes for ANY_NODE)
+
+        Placement() : numaNode(Numa::ANY_NODE), affinity(NO_AFFINITY), firstProcessor(0) {}
+    };
+
 private:
     enum State {
         NOT_INITIALIZED,
@@ -53,13 +208,78 @@ private:
     CriticalRecyclableList<Socket>  inUseSocketList;            // All sockets this instance is currently connected to (linked list are used here because pointers to its elements are used elsewhere and it's the only container to guarantee they will never be moved once allocated, no matter what operation is done on the list)
     CriticalRecyclableList<Buffer>  inUseBufferList;            // All buffers currently used in an overlapped operation
     CriticalQueue<Socket*>          reusableSocketQueue;        // All sockets previously disconnected that can be reused
-    Socket*                         currentAcceptSocket;        // Last accept socket if manager is in server mode (because event is raised in the listen socket)
     CriticalMap<UUID, Socket*>      socketAccessMap;            // Only way to access a socket pointer from outside of this class, to prevent invalid memory access
 
     State                           state;                      // Current state of this instance, used for cleanup and to test readiness
     std::vector<HANDLE>             threadHandles;              // Handles to all threads receiving IOCP events
     HANDLE                          iocpHandle;                 // Handle to IO completion port
     unsigned short                  isbFactor;                  // Factor of isb that sendbuffer can fill before no new send are allowed (0 for no limit)
+    ISBSource                       isbSource;                  // Where isb of sockets connected from now on comes from
+    CriticalMap<UUID, Socket*>      isbSampledSockets;          // Sockets estimating ISB from TCP_INFO, by id : sampled by isbTimer as well as on their send completions
+    HANDLE                          isbTimer;                   // Samples isbSampledSockets every ISB_SAMPLE_INTERVAL, so an idle socket or a collapsed window doesn't keep a stale estimate, nullptr until a socket is sampled
+    MessageFramer::Options          framingOptions;             // Framing given to each socket when it gets connected
+    u_long                          zeroCopyThreshold;          // SendDataNoCopy sends data at least this long from the caller's memory, sockets get no send buffer (0 to disable)
+    SendScheduling                  scheduling;                 // How sends are queued and shared between sockets
+    CriticalQueue<Socket*>          sendQueue;                  // Send scheduling : round robin of sockets with buffers waiting, its lock also guards the send queues of all sockets
+    std::queue<Socket*>             controlSendQueue;           // Send scheduling : sockets with control buffers waiting, guarded by the sendQueue lock
+    volatile LONG64                 scheduledInFlight;          // Send scheduling : bytes posted by the scheduler and not completed
+    TokenBucket                     sendBucket;                 // Send scheduling : rate limit of the whole manager, guarded by the sendQueue lock
+    HANDLE                          sendTimer;                  // Send scheduling : timer refilling rate limits, nullptr without rate limits
+    MemoryBudget                    memoryBudget;               // Limits on bytes of buffers and sockets, checked when they are allocated
+    volatile LONG                   memoryPressure;             // MemoryPressure at the last check
+    volatile LONG64                 peakMemory;                 // Highest memory use seen by a check
+    CriticalQueue<Socket*>          pausedListenSockets;        // Listen socket of each accept to post once back under the soft limit
+    volatile LONG                   pausedAccepts;              // Size of pausedListenSockets, read without its lock
+    volatile LONG64                 acceptPauses;               // Stats, see MemoryStats
+    volatile LONG64                 rejectedSends;
+    volatile LONG64                 readProbes;
+    bool                            draining;                   // Drain started : no new accept or send
+    std::vector<UUID>               drainIds;                   // Drain : sockets to close, shared by the worker threads
+    volatile LONG                   drainNext;                  // Drain : index of the next batch of drainIds to close
+    volatile LONG                   drainWorkers;               // Drain : worker threads still closing
+    HANDLE                          drainDone;                  // Drain : set by the last worker thread done closing
+    u_short                         shardIndex;                 // ShardedServer : index of this manager, stamped in the ids it creates (see ShardOf)
+    CriticalMap<UUID, ConnectRace*> connectRaces;               // Connects with attempts in flight by id, its lock guards every race
+    HANDLE                          connectTimer;               // Starts the next attempt of connects whose attempt delay elapsed, nullptr while no connect has several addresses
+    HANDLE                          connectTimerDone;           // Set once the callbacks of the last connectTimer deleted are done, waited for by the destructor
+    DWORD                           connectAttemptDelay;        // ms an attempt is given before the next address is tried in parallel
+    DnsCache                        dnsCache;                   // Host names of connects resolved lately, by name
+    IP4_ARRAY                       dnsServer;                  // DNS server queried instead of the system ones, AddrCount 0 for the system ones
+    volatile LONG                   pendingResolutions;         // Resolutions queued to the thread pool and not handled by a worker thread yet
+    volatile LONG64                 dnsCacheHits;               // Stats, see DnsStats
+    volatile LONG64                 dnsNegativeHits;
+    volatile LONG64                 dnsResolutions;
+    volatile LONG64                 dnsFailures;
+    volatile LONG64                 datagramsReceived;          // Stats, see DatagramStats
+    volatile LONG64                 datagramReads;
+    volatile LONG64                 datagramsSent;
+    volatile LONG64                 datagramSends;
+    volatile LONG64                 datagramsDropped;
+    DWORD                           ringCapacity;               // Bytes of each direction of the shared memory rings offered (client) or accepted (server) on Unix domain sockets, 0 to disable
+    bool                            tlsEnabled;                 // Every connection of the manager is TLS, with tlsCredentials
+    CredHandle                      tlsCredentials;             // SChannel credentials of SetTls
+    std::string                     tlsServerName;              // Client : SetTls server name, empty for the address of each connect
+    volatile LONG64                 tlsHandshakes;              // Stats, see TlsStats
+    volatile LONG64                 tlsFailures;
+    volatile LONG                   pendingFileReads;           // TLS file chunks read on the thread pool and not sealed by a worker thread yet
+    DWORD                           compressionAlgorithm;       // COMPRESS_ALGORITHM_* offered by the client, a server accepts any one offered, 0 to disable
+    CriticalMap<DWORD, std::vector<CompressionSession*>>  compressionPool;    // Compression sessions given back by closed sockets, by algorithm
+    volatile LONG64                 compressionNegotiated;      // Stats, see CompressionStats
+    volatile LONG64                 compressionRefused;
+    volatile LONG64                 compressionCreated;
+    volatile LONG64                 compressionReused;
+    volatile LONG64                 compressionBatches;
+    volatile LONG64                 compressionBlocks;
+    volatile LONG64                 compressionStoredBlocks;
+    volatile LONG64                 compressionRawSent;
+    volatile LONG64                 compressionPackedSent;
+    volatile LONG64                 compressionPackedReceived;
+    volatile LONG64                 compressionRawReceived;
+    CriticalMap<std::string, Topic*>    topics;                 // Pub/sub : topics by name, created by their first subscription and kept as long as the manager
+    volatile LONG64                 published;                  // Stats, see PubSubStats
+    volatile LONG64                 delivered;
+    volatile LONG64                 publicationsDropped;
+    volatile LONG64                 slowSubscribers;
 protected:
     Type                            type;                       // Type of this manager, either client or server
     //////////////////////// End Attributes //////////////////////
@@ -67,50 +287,211 @@ protected:
     /************************ Methods **************************/
 private:
     static DWORD WINAPI IOCPWorkerThread        (LPVOID lpParam);                                       // Per-thread function receiving IOCP events
+    static VOID CALLBACK SendTimerCallback      (PVOID lpParam, BOOLEAN timerFired);                    // Dispatch sends held back by rate limits
+    static VOID CALLBACK ISBTimerCallback       (PVOID lpParam, BOOLEAN timerFired);                    // Sample the sockets estimating ISB from TCP_INFO, forget the closed ones
+    static VOID CALLBACK ConnectTimerCallback   (PVOID lpParam, BOOLEAN timerFired);                    // Start the next attempt of connects whose attempt delay elapsed
+    static DWORD WINAPI ResolveWorkItem         (LPVOID lpParam);                                       // Thread pool function resolving the host name of a connect, completed on a worker thread
 
     void                HandleError             (Socket *sockObj, Buffer *buf, DWORD error);            // Manage one IOCP error
     void                HandleIo                (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Manage one IOCP event, calling all needed functions
     void                HandleRead              (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);
+    void                HandleReadProbe         (Socket *sockObj, DWORD error);                         // Data is waiting on a socket which had no read buffer, read it with one
+    void                HandleDrain             (Buffer *buf);                                          // Close batches of drainIds until none is left
+    void                CloseForDrain           (Socket *sockObj);                                      // Gracefully if all its sends are done, abortively otherwise
+    void                HandlePublish           (Buffer *buf);                                          // Take batches of subscribers of a publication until none is left
+    void                FanOut                  (Publication *publication);                             // Same, on the thread of the caller of Publish or a worker thread, releases its reference
+    void                DeliverPublication      (Socket *sockObj, UUID subscriberId, Publication *publication, Backpressure policy);   // Post, queue or drop one publication for one subscriber, unless the socket was reused since it subscribed
+    bool                PostPublication         (Socket *sockObj, Publication *publication);            // Post a send straight from the data of the publication, the socket fails if it can't be posted, lock held
+    void                SendQueuedPublications  (Socket *sockObj);                                      // Post the queued publications the pending send has room for, after a send completed
+    LONG64              PendingSendBytes        ();                                                     // Bytes given to sends and not completed, all sockets together
+    void                DeliverReceivedData     (Socket *sockObj, const char *data, u_long length);     // Give received data to ReceiveData, or to ReceiveMessage one message at a time if framing is enabled
     void                HandleWrite             (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);
+    void                RelayRead               (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Send a read buffer as is to the socket relayTo, and keep reading while it can take more
+    bool                ReturnRelayedBuffer     (Socket *sockObj, Buffer *buf, bool sent);              // Post a relayed buffer back as a recv on its source if it was paused, false if it wasn't needed (caller deletes it)
+    static inline Socket *RelayDestination      (Socket *source)                                        { return source->relayManager != nullptr ? source->relayManager->socketAccessMap.Get(source->relayTo) : nullptr; }  // nullptr once it is closed
     void                HandleConnection        (Socket *sockObj, Buffer *buf);
+    bool                WinConnectRace          (Socket *sockObj, Buffer *buf);                         // Give the id to the first attempt connected and cancel the others, false if another one was first (attempt and buffer are freed)
+    void                HandleConnectAttemptError(Socket *sockObj, Buffer *buf, DWORD error);           // Drop a failed attempt and start the next address, the connect fails with the last one
+    bool                StartConnectAttempt     (ConnectRace *race, size_t index);                      // Connect a new socket to one address of the race, connectRaces lock held
+    bool                StartNextConnectAttempt (ConnectRace *race);                                    // Start the next address of the race which can be started, false if none is left
+    void                LeaveConnectRace        (Socket *sockObj);                                      // Remove an attempt from the attempts in flight of its race
+    void                EndConnectRace          (ConnectRace *race);                                    // Free the race once it is done and has no attempt in flight
+    void                StartConnectTimer       ();                                                     // Create the timer starting delayed attempts if it doesn't exist yet, connectRaces lock held
+    void                StopConnectTimer        ();                                                     // Delete the timer once no connect is left, connectRaces lock held
+    void                HandleResolve           (Buffer *buf);                                          // Start the first attempt of a connect whose host name got resolved, or fail it
+    void                StartConnection         (Socket *sockObj, Buffer *buf, int option, char *optPtr, int optSize);  // Finish a connect or accept on the manager owning the socket and post its first recv
+    void                HandleAcceptError       (Socket *listenSockObj, Buffer *buf, DWORD error);      // Drop the failed accept socket and post another one on the same manager
     void                HandleDisconnect        (Socket *sockObj, Buffer *buf);
     void                UpdateISB               (Socket *sockObj, Buffer *buf);                         // Get ISB value to calculate threshold value for pending send operation
-    int                 PostRecv                (Socket *sock, Buffer *recvObj);                        // Post an overlapped recv operation on the socket
-    int                 PostSend                (Socket *sock, Buffer *sendObj);                        // Post an overlapped send operation on the socket
+    void                StartISBSampling        (Socket *sockObj);                                      // Estimate ISB from TCP_INFO from now on
+    void                SampleISB               (Socket *sockObj);                                      // Estimate ISB from TCP_INFO if the last sample is old enough
+    void                ApplyISB                (Socket *sockObj, ULONG isbVal);                        // Set send buffer size and threshold value for pending send operation from an ISB value
+    int                 PostRecv                (Socket *sock, Buffer *recvObj);                        // Post an overlapped recv operation on the socket, held back while its reads are paused
+    int                 PostReadProbe           (Socket *sock);                                         // Post an overlapped zero-byte recv on the socket, completed when data is waiting
+    int                 PostSend                (Socket *sock, Buffer *sendObj, bool queued = false);   // Post an overlapped send operation on the socket, queued if its bytes are already pending (send scheduling)
+    bool                QueueSend               (Socket *sock, std::vector<Buffer*> &sendObjs, u_long length, SendClass sendClass);  // Queue the buffers of one send on the socket and dispatch
+    void                DispatchSends           ();                                                     // Post queued buffers : control first, then bulk in deficit round robin within in flight and rate limits
+    bool                PostQueuedSend          (Socket *sock, Buffer *sendObj);                        // Post a queued buffer, the socket fails if it can't be posted
+    void                DropQueuedSends         (Socket *sock);                                         // Delete buffers still queued on a failed socket
+    bool                LeaveSendQueue          (Socket *sock);                                         // Release the OutstandingSend held by one queue, true if the socket must be cleaned up
+    int                 PostTransmitFile        (Socket *sock, Buffer *fileObj);                        // Post an overlapped send of the next chunk of a file on the socket, sized to the room left in its max pending send (paused while there is none)
     int                 PostISBNotify           (Socket *sock, Buffer *isbObj);                         // Post an overlapped operation on the socket to be notified of ideal send backlog value change
+    int                 PostDatagramRecv        (Socket *sock, Buffer *recvObj, DWORD &bytesTransfered, bool &completed);   // Post an overlapped read of a datagram, completed is true if the caller must handle it (inline completions)
+    int                 PostDatagramSend        (Socket *sock, Buffer *sendObj, bool &completed);       // Post an overlapped send of the datagrams of a buffer to its peer, completed as above
+    void                HandleDatagramRead      (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Deliver a read and repost it, handling the reads which complete right away in a row
+    void                DeliverDatagrams        (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Give each datagram of a read to ReceiveDatagram, several if the stack coalesced them
+    void                HandleDatagramError     (Socket *sockObj, Buffer *buf, DWORD error);            // One datagram failed, not the socket : drop it and repost the read
+    void                RequeueDatagramRead     (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Hand a read completed right away to a worker thread through the completion port
+    void                StopDatagramSocket      (Socket *sockObj, Socket::SocketState state);           // Change the state of a datagram socket and abort its posted reads, which only complete with a datagram
+    void                CloseIfIdle             (Socket *sockObj);                                      // Delete a socket on its way out once it has no operation left
+    bool                OfferRing               (Socket *sockObj);                                      // Client : create a shared memory ring and send its hello as the first bytes of the connection
+    u_long              SettleRing              (Socket *sockObj, const char *data, u_long length);     // Read the hello (server) or its answer (client) at the start of data, return its size (0 if the peer doesn't offer a ring)
+    void                HandleRingRead          (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Read on a Unix domain socket negotiating or using a ring : settle it, or drain the ring on a doorbell
+    bool                DrainRing               (Socket *sockObj);                                      // Deliver what the ring holds, true once it is empty and waits for a doorbell, false if the budget ran out first
+    bool                SendToRing              (Socket *sockObj, const WSABUF *pieces, DWORD count);   // Copy a send in the ring and ring the doorbell if the peer waits for one, false if the ring is full
+    bool                PostRaw                 (Socket *sockObj, const char *data, u_long length);     // Send bytes of the ring or compression protocol or of a TLS handshake on the socket itself
+    void                HandleTlsRead           (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Read on a TLS socket : go on with the handshake, or decrypt the records in place and deliver them
+    bool                StepTlsHandshake        (Socket *sockObj, SECURITY_STATUS &status);             // Feed what was read to the handshake and send its answer, false if the socket can't go on
+    bool                SendToTls               (Socket *socket, const WSABUF *pieces, DWORD count, u_long length);   // Seal the pieces in records of pool buffers and post them in order, never queued
+    int                 PostSealedFile          (Socket *sock, Buffer *fileObj, u_long room);           // TLS socket : read the next chunk of a file (at most room bytes) on the thread pool, HandleFileRead seals and posts it
+    static DWORD WINAPI FileReadWorkItem        (LPVOID lpParam);                                       // Thread pool function reading a chunk behind its record header, completed on a worker thread
+    void                HandleFileRead          (Socket *sockObj, Buffer *buf, DWORD bytesRead);        // Seal a chunk read by FileReadWorkItem where it was read and post it
+    bool                OfferCompression        (Socket *sockObj);                                      // Client : take compression contexts and send the hello as the first bytes of the connection
+    u_long              SettleCompression       (Socket *sockObj, const char *data, u_long length);     // Read the hello (server) or its answer (client) at the start of data, return its size (0 if the peer doesn't offer compression)
+    void                HandleCompressedRead    (Socket *sockObj, Buffer *buf, DWORD bytesTransfered);  // Read on a socket negotiating or using compression : settle it, or unpack the blocks and deliver them
+    bool                AttachCompression       (Socket *sockObj, DWORD algorithm);                     // Give the socket contexts of algorithm : its own if they match, else from the pool or new ones, false if none can be created
+    void                ReturnCompression       (CompressionSession *session);                          // Back in the pool, for any socket of the manager
+    bool                SendToCompression       (Socket *socket, const WSABUF *pieces, DWORD count, u_long length, SendClass sendClass);   // Pack the pieces in blocks now, or stage them for the batch after the one in flight
+    bool                PackBatch               (Socket *socket, const char *data, u_long length, std::vector<Buffer*> &queued);   // Pack a batch in blocks of pool buffers and post them in order (queue them with send scheduling), lock held
+    void                FlushCompression        (Socket *sockObj);                                      // A block was sent : once the batch is, pack the sends staged meanwhile as the next one
+    static void         GatherPieces            (const WSABUF *pieces, DWORD &piece, u_long &pieceOffset, char *to, u_long length);  // Copy length bytes of pieces from piece/pieceOffset, which move past them
     void                ClearThreads            ();                                                     // Tells all working threads to shut down and free resources
     bool                InitAsyncSocketFuncs    ();                                                     // Initialize function pointer to needed mswsock functions
     bool                InitAsyncSocketFunc     (SOCKET sock, GUID guid, LPVOID func, DWORD size);      // Initialize function pointer to one mswsock function
     void                InitTimeWaitValue       ();                                                     // Initialize TIME_WAIT detected value
     bool                ShouldReuseSocket       ();                                                     // returns a bool indicating if manager is accepting to reuse socket
-    Socket*             ReuseSocket             ();                                                     // Try to recycle a disconnected socket, or create a new one
+    Socket*             ReuseSocket             (int family);                                           // Try to recycle a disconnected socket of the given address family, nullptr if none is out of TIME_WAIT
     UUID                ConnectToNewSocket      (const char *address, u_short port, UUID id);           // Connect to and start listening to new read/write event on this socket
-    Socket *            GenerateSocket          (bool reuse);                                           // Generate a new socket object, reuse one if possible
+    Socket *            GenerateSocket          (bool reuse, int family = FAMILY);                      // Generate a new socket object, reuse one if possible
     bool                AssociateSocketToIOCP   (Socket *sockObj);                                      // Associate socket to IOCP, delete it if failure
-    bool                BindSocket              (Socket *sockObj, SOCKADDR_IN sockAddr);                // Bind socket to given address, delete it if failure
+    bool                BindSocket              (Socket *sockObj, const SOCKADDR *sockAddr, int length);// Bind socket to given address, delete it if failure
+    static bool         ResolveHostName         (const char *name, const IP4_ARRAY *server, std::vector<SOCKADDR_STORAGE> &addresses, DWORD &ttlMs);  // Host name to all its addresses and how long they can be cached, families interleaved (blocking)
+    static DNS_STATUS   QueryDns                (const char *name, WORD type, const IP4_ARRAY *server, std::vector<SOCKADDR_STORAGE> &addresses, DWORD &ttlMs);  // Add the A or AAAA records of a host name, ttlMs lowered to their TTL (or the SOA one)
+    static bool         ResolveAddress          (const char *address, std::vector<SOCKADDR_STORAGE> &addresses);   // Host name to all its addresses with getaddrinfo, no TTL (blocking)
+    static void         InterleaveFamilies      (std::vector<SOCKADDR_STORAGE> &addresses);             // RFC 8305 : families alternate, starting with the one of the first address
+    static void         SetPort                 (SOCKADDR_STORAGE &sockAddr, u_short port);
+    static inline int   AddressLength           (const SOCKADDR_STORAGE &sockAddr)                      { return sockAddr.ss_family == AF_INET6 ? sizeof(SOCKADDR_IN6) : sockAddr.ss_family == AF_UNIX ? sizeof(SOCKADDR_UN) : sizeof(SOCKADDR_IN); }
+    UUID                CreateId                ();                                                     // New unique socket id, stamped with the shard index
     int                 SetSocketOption         (SOCKET s, int option, const char *optPtr, int optSize);// Set a socket option to a given value and return error status
     inline int          SetSocketOption         (SOCKET s, int option, bool value)                      { return SetSocketOption(s, option, (const char*)&value, sizeof(value)); }
     int                 GetSocketOption         (SOCKET s, int option, char *optPtr, int optSize);      // Get the value of a given socket option and return error status
     void                AddSocketToMap          (Socket *sockObj, UUID id);                             // Give unique id to socket and add it to access map
-    bool                AcceptNewSocket         (Socket *listenSockObj);                                // Create a new socket waiting to accept new connection
+    bool                AcceptNewSocket         (Socket *listenSockObj);                                // Create a new socket of this manager waiting to accept new connection on the listen socket
+    void                ReplaceAccept           (Socket *listenSockObj);                                // Post an accept in place of a completed one, or keep it for later over the soft memory limit
+    void                ResumeAccepts           ();                                                     // Post the paused accepts if memory went back under the soft limit
+    MemoryPressure      CheckMemory             ();                                                     // Compare memory use to the budget, free recycled objects when crossing the soft limit
     void                ChangeSocketState       (Socket *sock, Socket::SocketState state);              // Change the state of a socket (for manual close or failure for example)
 protected:
-    inline void         CloseSocket             (Socket *sock)                                          { ChangeSocketState(sock, Socket::SocketState::CLOSING); }
-    bool                SendData                (const char *data, u_long length, Socket *socket);      // Send a given buffer to the given socket
-    virtual int         ReceiveData             (const char* data, u_long length, Socket *socket) = 0;  // Do what needs to be done when receiving content from a socket
+    inline void         CloseSocket             (Socket *sock)                                          { sock->datagram ? StopDatagramSocket(sock, Socket::SocketState::CLOSING) : ChangeSocketState(sock, Socket::SocketState::CLOSING); }
+    bool                SendData                (const char *data, u_long length, Socket *socket, SendClass sendClass = SendClass::BULK);     // Send a given buffer to the given socket
+    bool                SendData                (const WSABUF *pieces, DWORD count, Socket *socket, SendClass sendClass = SendClass::BULK);   // Send the concatenation of several buffers to the given socket, never interleaved with a send of another thread
+    bool                SendMessage             (const char *data, u_long length, Socket *socket, SendClass sendClass = SendClass::BULK);     // Send a given buffer as one message, using the framing of the socket
+    bool                SendDataNoCopy          (const char *data, u_long length, Socket *socket, void *context);   // Send a given buffer without copying it if it is long enough, it must stay valid until given back to ReleaseSendData
+    virtual void        ReleaseSendData         (const char *data, u_long length, void *context, bool sent, Socket *socket)    {}  // Take back a buffer given to SendDataNoCopy, sent is false if the socket failed before the end of the send
+    bool                SendFile                (HANDLE file, ULONG64 offset, ULONG64 length, Socket *socket, void *context);   // Send part of a file without reading it in user memory, the handle must stay open until given back to ReleaseFile
+    virtual void        ReleaseFile             (HANDLE file, void *context, bool sent, Socket *socket) {}  // Take back a file given to SendFile, sent is false if the socket failed before the end of the file
+    virtual void        ReleaseContext          (void *context, Socket *socket)                         {}  // Take back the context set on a socket (Socket::SetContext) once it is closed, no read of it is in progress anymore
+    bool                RelayData               (Socket *source, Socket *destination);                  // Send everything read on source to destination (of any manager) without going through ReceiveData, nullptr to stop
+    bool                PauseReads              (Socket *socket);                                       // Post no recv on the socket until ResumeReads, SendsDrained is called once its sends complete, false if none is pending
+    bool                ResumeReads             (Socket *socket);                                       // Post the recv held back since PauseReads, false if the socket isn't connected
+    virtual void        SendsDrained            (Socket *socket)                                        {}  // Every send of a socket whose reads are paused has completed, send what was held back and resume its reads
+    inline void         SetFraming              (Socket *sock, const MessageFramer::Options &options)   { sock->framer.Configure(options); }    // Change framing of one socket, call it from ReceiveData/ReceiveMessage only
+    virtual int         ReceiveData             (const char* data, u_long length, Socket *socket)       { return 0; }   // Do what needs to be done when receiving content from a socket without framing
+    virtual int         ReceiveMessage          (const char* data, u_long length, Socket *socket)       { return 0; }   // Do what needs to be done when receiving one complete message from a socket with framing
+    virtual void        ReceiveDatagram         (const char *data, u_long length, const SOCKADDR_STORAGE &peer, Socket *socket)   {}  // Do what needs to be done when receiving one datagram on a datagram socket
+    inline bool         SendDatagram            (const char *data, u_long length, const SOCKADDR_STORAGE &peer, Socket *socket)   { return SendDatagrams(data, length, 1, peer, socket); }
+    bool                Subscribe               (const std::string &topic, Socket *socket, Backpressure policy = Backpressure::DROP_NEWEST);   // The socket gets what is published on topic until it is closed or unsubscribed, false if it isn't connected
+    bool                Unsubscribe             (const std::string &topic, Socket *socket);             // false if it wasn't subscribed
+    bool                SendDatagrams           (const char *data, u_long datagramSize, u_long count, const SOCKADDR_STORAGE &peer, Socket *socket);   // Send count datagrams of datagramSize bytes each, back to back in data, in as few sends as segmentation offload allows
 public:
-    explicit            SocketManager           (Type t, unsigned short factor = 0);
+    explicit            SocketManager           (Type t, unsigned short factor = 0, DWORD threadCount = 0, const Placement &placement = Placement());  // threadCount 0 for one worker thread per processor (of the node if any)
                         ~SocketManager          ();
-    UUID                ListenToNewSocket       (u_short port, bool fewCLientsExpected = false);        // Start listening to new connection event on this socket and handle those connection in new sockets
-    inline UUID         ConnectToNewSocket      (const char *address, u_short port)                     { return ConnectToNewSocket(address, port, Misc::CreateNilUUID()); }
-    inline bool         isReady                 () const                                                { return state == State::READY; };
-    inline bool         isSocketInitialising    (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); return sockObj != nullptr && sockObj->state <= Socket::SocketState::RETRY_CONNECTION; };
-    inline bool         isClientSocketReady     (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); return sockObj != nullptr && sockObj->state == Socket::SocketState::CONNECTED; };
+    inline UUID         ListenToNewSocket       (u_short port, bool fewCLientsExpected = false)         { return ListenToNewSocket(port, fewCLientsExpected, std::vector<SocketManager*>(1, this)); }   // Start listening to new connection event on this socket and handle those connection in new sockets
+    UUID                ListenToNewSocket       (u_short port, bool fewCLientsExpected, const std::vector<SocketManager*> &managers);   // Same, but connections are accepted by each of the given server managers in turn (sharding)
+    inline UUID         ListenToNewSocket       (const Listener &listener)                              { return ListenToNewSocket(listener, std::vector<SocketManager*>(1, this)); }   // Add a listener, a manager can have any number of them sharing its worker threads
+    UUID                ListenToNewSocket       (const Listener &listener, const std::vector<SocketManager*> &managers);    // Same, accepted by each of the given server managers in turn (sharding)
+    inline UUID         ConnectToNewSocket      (const char *address, u_short port)                     { return ConnectToNewSocket(address, port, Misc::CreateNilUUID()); }  // address is a numeric IPv4 or IPv6 address or a host name, all its addresses are raced (Happy Eyeballs)
+    inline void         SetConnectAttemptDelay  (DWORD delayMs)                                         { connectAttemptDelay = delayMs; }  // ms an attempt is given before the next address is tried in parallel (250 by default)
+    bool                SetDnsServer            (const char *address);                                  // Numeric IPv4 address of the DNS server host names are resolved with, nullptr for the system ones
+    DnsStats            GetDnsStats             ();
+    UUID                OpenDatagramSocket      (const char *address, u_short port);                    // Bind a UDP socket to a numeric address and port (0 for any) and start reading datagrams, on any type of manager
+    inline void         CloseDatagramSocket     (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); if (sockObj != nullptr && sockObj->datagram) CloseSocket(sockObj); }
+    inline bool         SendDatagram            (const char *data, u_long length, const SOCKADDR_STORAGE &peer, UUID socketId)    { return SendDatagram(data, length, peer, socketAccessMap.Get(socketId)); }
+    inline bool         SendDatagrams           (const char *data, u_long datagramSize, u_long count, const SOCKADDR_STORAGE &peer, UUID socketId)    { return SendDatagrams(data, datagramSize, count, peer, socketAccessMap.Get(socketId)); }
+    DatagramStats       GetDatagramStats        ();
+    bool                SetTls                  (const TlsOptions &options);                            // Call it before connecting or listening, every stream connection is TLS from then on (SChannel)
+    TlsStats            GetTlsStats             ();
+    void                SetCompression          (Compression compression);                              // Call it before connecting or listening, stream connections are compressed if both ends enable it (not with TLS or a shared memory ring)
+    CompressionStats    GetCompressionStats     ();
+    static bool         ParseAddress            (const char *address, u_short port, SOCKADDR_STORAGE &sockAddr, int &length);  // Numeric IPv4 or IPv6 address and port, or "unix:" and a path (port ignored), to a sockaddr of the matching family
+    inline bool         isReady                 () const                                                { return state >= State::READY; };
+    bool                isSocketInitialising    (UUID socketId);                                        // Connecting, host name resolution, ring and compression negotiation and TLS handshake included, or listening not started yet
+    inline bool         isClientSocketReady     (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); return sockObj != nullptr && sockObj->state == Socket::SocketState::CONNECTED && !sockObj->negotiating && !sockObj->compressionPending && (sockObj->tls == nullptr || sockObj->tls->IsEstablished()); };
     inline bool         isServerSocketReady     (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); return sockObj != nullptr && sockObj->state == Socket::SocketState::LISTENING; };
-    inline bool         SendData                (const char *data, u_long length, UUID socketId)        { return SendData(data, length, socketAccessMap.Get(socketId)); }
+    inline ULONG        MaxPendingByteSent      (UUID socketId)                                         { Socket *sockObj = socketAccessMap.Get(socketId); return sockObj != nullptr ? sockObj->maxPendingByteSent : 0; }   // Current backpressure threshold of a socket, follows its isb if the manager has an isb factor
+    inline bool         OwnsSocket              (UUID socketId)                                         { return socketAccessMap.Get(socketId) != nullptr; }
+    inline void         SetShardIndex           (u_short index)                                         { shardIndex = index; }     // Call it before listening, ShardedServer routes ids to this manager by it
+    static inline u_short ShardOf               (UUID socketId)                                         { return static_cast<u_short>(socketId.Data4[6] << 8 | socketId.Data4[7]); }  // Index of the manager which created an id, without any lock
+    void                GetPendingBytes         (const UUID *ids, size_t count, LONG64 *pending);       // Bytes given to sends and not completed of each socket, sampled under one lock of the socket map, -1 for a socket not ready (see isClientSocketReady)
+    inline bool         SendData                (const char *data, u_long length, UUID socketId, SendClass sendClass = SendClass::BULK)       { return SendData(data, length, socketAccessMap.Get(socketId), sendClass); }
+    inline bool         SendData                (const WSABUF *pieces, DWORD count, UUID socketId, SendClass sendClass = SendClass::BULK)    { return SendData(pieces, count, socketAccessMap.Get(socketId), sendClass); }
+    inline bool         SendMessage             (const char *data, u_long length, UUID socketId, SendClass sendClass = SendClass::BULK)       { return SendMessage(data, length, socketAccessMap.Get(socketId), sendClass); }
+    inline bool         SendDataNoCopy          (const char *data, u_long length, UUID socketId, void *context = nullptr)  { return SendDataNoCopy(data, length, socketAccessMap.Get(socketId), context); }
+    inline bool         SendFile                (HANDLE file, ULONG64 offset, ULONG64 length, UUID socketId, void *context = nullptr)  { return SendFile(file, offset, length, socketAccessMap.Get(socketId), context); }
+    inline bool         RelayData               (UUID sourceId, UUID destinationId)                     { return RelayData(sourceId, *this, destinationId); }
+    inline bool         RelayData               (UUID sourceId, SocketManager &destinationManager, UUID destinationId)  { Socket *destination = destinationManager.socketAccessMap.Get(destinationId); return destination != nullptr && RelayData(socketAccessMap.Get(sourceId), destination); }
+    inline bool         StopRelayData           (UUID sourceId)                                         { return RelayData(socketAccessMap.Get(sourceId), nullptr); }
+    inline void         SetISBSource            (ISBSource source)                                      { isbSource = source; }     // Call it before connecting sockets, used only with an isb factor
+    inline void         SetZeroCopyThreshold    (u_long threshold)                                      { zeroCopyThreshold = threshold; }  // Call it before connecting sockets, 0 to disable zero-copy sends
+    void                SetSharedMemoryRing     (DWORD capacity);                                       // Call it before connecting or listening, Unix domain sockets carry their data in a shared memory ring of capacity bytes per direction (rounded up to a power of 2), 0 to disable
+    inline void         SetDefaultFraming       (const MessageFramer::Options &options)                 { framingOptions = options; }       // Framing of sockets connected from now on
+    void                SetSendScheduling       (const SendScheduling &options);                        // Call it before connecting sockets, SendDataNoCopy, SendFile, publications and relays are never queued
+    inline void         SetMemoryBudget         (const MemoryBudget &budget)                            { memoryBudget = budget; }
+    MemoryStats         GetMemoryStats          ();
+    bool                Drain                   (DWORD timeoutMs);                                      // Stop accepting, let sends flush for up to timeoutMs then close every socket, true if all sends were done
+    void                StartDrain              ();                                                     // First step of Drain only : stop accepting and refuse new sends
     inline int          SendDataToAll           (const char *data, u_long length)                       { int nbSucc = 0; for (Socket& sock : inUseSocketList.list) nbSucc += SendData(data, length, &sock); return nbSucc; }
+    inline bool         Subscribe               (const std::string &topic, UUID socketId, Backpressure policy = Backpressure::DROP_NEWEST)    { return Subscribe(topic, socketAccessMap.Get(socketId), policy); }
+    inline bool         Unsubscribe             (const std::string &topic, UUID socketId)               { return Unsubscribe(topic, socketAccessMap.Get(socketId)); }
+    inline int          Publish                 (const std::string &topic, const char *data, u_long length) { WSABUF piece; piece.buf = const_cast<char*>(data); piece.len = length; return Publish(topic, &piece, 1); }
+    int                 Publish                 (const std::string &topic, const WSABUF *pieces, DWORD count);  // Copy the pieces once and send them to every subscriber of topic across the worker threads, returns the number of subscribers
+    PubSubStats         GetPubSubStats          ();
 
     //////////////////////// End Methods ///////////////////////
 };
 
+
+/************* SocketHandler ***********/
+class SocketHandler {                           // Gets what is read on the sockets accepted by one listener, in place of their manager
+public:
+    virtual             ~SocketHandler          ()                                                      {}
+    virtual int         ReceiveData             (SocketManager &manager, const char* data, u_long length, Socket *socket)      { return 0; }   // Same as SocketManager::ReceiveData, manager is the one owning the socket
+    virtual int         ReceiveMessage          (SocketManager &manager, const char* data, u_long length, Socket *socket)      { return 0; }   // Same as SocketManager::ReceiveMessage
+    virtual void        ReleaseContext          (SocketManager &manager, void *context, Socket *socket)                         {}  // Same as SocketManager::ReleaseContext
+    virtual void        SendsDrained            (SocketManager &manager, Socket *socket)                                        {}  // Same as SocketManager::SendsDrained
+protected:
+    // Protected methods of the manager, for the handler's sockets
+    inline void         CloseSocket             (SocketManager &manager, Socket *sock)                  { manager.CloseSocket(sock); }
+    inline bool         SendData                (SocketManager &manager, const char *data, u_long length, Socket *socket, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)    { return manager.SendData(data, length, socket, sendClass); }
+    inline bool         SendData                (SocketManager &manager, const WSABUF *pieces, DWORD count, Socket *socket, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)    { return manager.SendData(pieces, count, socket, sendClass); }
+    inline bool         SendMessage             (SocketManager &manager, const char *data, u_long length, Socket *socket, SocketManager::SendClass sendClass = SocketManager::SendClass::BULK)    { return manager.SendMessage(data, length, socket, sendClass); }
+    inline bool         RelayData               (SocketManager &manager, Socket *source, Socket *destination)   { return manager.RelayData(source, destination); }
+    inline bool         PauseReads              (SocketManager &manager, Socket *socket)                { return manager.PauseReads(socket); }
+    inline bool         ResumeReads             (SocketManager &manager, Socket *socket)                { return manager.ResumeReads(socket); }
+    inline void         SetFraming              (SocketManager &manager, Socket *sock, const MessageFramer::Options &options)  { manager.SetFraming(sock, options); }
+    inline bool         Subscribe               (SocketManager &manager, const std::string &topic, Socket *socket, SocketManager::Backpressure policy = SocketManager::Backpressure::DROP_NEWEST)   { return manager.Subscribe(topic, socket, policy); }
+    inline bool         Unsubscribe             (SocketManager &manager, const std::string &topic, Socket *socket)     { return manager.Unsubscribe(topic, socket); }
+};
+////////////// SocketHandler ////////////
+
 #endif //SOCKETMANAGER_SOCKETMANAGER_H
@@ -0,0 +1,254 @@
+#include <cstdio>
+#include <vector>
+#include "WebSocketHandler.h"
+#include "HttpHandler.h"
+
+namespace {
+
+    const char      SWITCHING_PROTOCOLS[]   = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+    const char      END_OF_HEAD[]           = "\r\n\r\n";
+
+}
+
+const char WebSocketHandler::ACCEPT_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+WebSocketHandler::WebSocketHandler(const WebSocketParser::Limits &l, const HttpParser::Limits &h) : httpLimits(h), limits(l), provider(0) {
+    if (!CryptAcquireContextA(&provider,                    //phProv : Receives the handle of the CSP.
+                              nullptr,                      //szContainer : No key container, hashing needs no key.
+                              nullptr,                      //szProvider : nullptr for the default provider of the type.
+                              PROV_RSA_FULL,                //dwProvType : Any provider type has SHA-1.
+                              CRYPT_VERIFYCONTEXT           //dwFlags : No access to private keys needed, nothing persisted.
+    )) {
+        LOG_ERROR("CryptAcquireContext failed / error %lu\n", GetLastError());
+        provider = 0;                                       // upgrades will be answered 500
+    }
+}
+
+WebSocketHandler::~WebSocketHandler() {
+    if (provider != 0)
+        CryptReleaseContext(provider, 0);
+}
+
+int WebSocketHandler::ReceiveData(SocketManager &manager, const char *data, u_long length, Socket *socket) {
+    auto   *connection  = static_cast<Connection*>(socket->GetContext());
+    bool    upgraded    = false;
+
+    if (connection == nullptr) {                                // first read of the connection
+        connection = new Connection(httpLimits, limits);
+        socket->SetContext(connection);
+    }
+    if (connection->closing)
+        return 1;
+    // ----------------------------- upgrade request, what follows it in the same read is already frames
+    if (!connection->open) {
+        bool valid = connection->http->Feed(data, length, [&](const HttpRequest &request) {
+            upgraded = Upgrade(manager, request, connection, socket);
+            return false;                                       // one request only, the parser stops on the first byte after it
+        });
+        if (!valid) {
+            Refuse(manager, connection->http->GetError(), socket);
+            return 1;
+        }
+        if (!upgraded)                                          // refused, or not complete yet
+            return 1;
+        delete connection->http;                                // not needed anymore, it is the biggest part of the context
+        connection->http = nullptr;
+    }
+    // ----------------------------- frames, unmasked in the read buffer : it belongs to the socket and nothing else reads it until ReceiveData returns
+    auto frames = const_cast<char*>(data);
+    if (!connection->parser.Feed(frames, length, [&](Opcode opcode, const char *payload, u_long size) {
+            return HandleFrame(manager, opcode, payload, size, connection, socket);
+        }))
+        Close(manager, socket, connection->parser.GetError());
+    return 1;
+}
+
+bool WebSocketHandler::Upgrade(SocketManager &manager, const HttpRequest &request, Connection *connection, Socket *socket) {
+    char    accept[ACCEPT_SIZE + 1];
+    WSABUF  pieces[3];
+
+    // ----------------------------- check the request (RFC 6455 4.2.1), the key is the base64 of 16 bytes
+    std::string_view key = request.Header("sec-websocket-key");
+    if (request.method != "GET" || request.minorVersion < 1 || !request.HasToken("upgrade", "websocket") || !request.HasToken("connection", "upgrade") || key.size() != 24) {
+        Refuse(manager, 400, socket);
+        return false;
+    }
+    if (request.Header("sec-websocket-version") != "13") {
+        Refuse(manager, 426, socket);
+        return false;
+    }
+    if (!Open(manager, request, socket)) {
+        Refuse(manager, 403, socket);
+        return false;
+    }
+    if (!Accept(key, accept)) {
+        Refuse(manager, 500, socket);
+        return false;
+    }
+    // ----------------------------- no Sec-WebSocket-Extensions : extensions offered (permessage-deflate) are declined, frames are sent and read as they are
+    pieces[0].buf = const_cast<char*>(SWITCHING_PROTOCOLS);
+    pieces[0].len = sizeof(SWITCHING_PROTOCOLS) - 1;
+    pieces[1].buf = accept;
+    pieces[1].len = ACCEPT_SIZE;
+    pieces[2].buf = const_cast<char*>(END_OF_HEAD);
+    pieces[2].len = sizeof(END_OF_HEAD) - 1;
+    if (!SendData(manager, pieces, 3, socket)) {
+        CloseSocket(manager, socket);
+        return false;
+    }
+    connection->open = true;
+    if (connection->subscribed) {                               // subscribed from Open : broadcasts only once the 101 is posted
+        EnterCriticalSection(&subscribers.critSec);
+        {
+            subscribers.map[socket->GetId()] = &manager;
+        }
+        LeaveCriticalSection(&subscribers.critSec);
+    }
+    return true;
+}
+
+void WebSocketHandler::Refuse(SocketManager &manager, u_short status, Socket *socket) {
+    char    response[160];
+    int     length;
+
+    length = snprintf(response, sizeof(response), "HTTP/1.1 %03u %s\r\n%sContent-Length: 0\r\nConnection: close\r\n\r\n",
+                      status, HttpResponse::ReasonOf(status), status == 426 ? "Sec-WebSocket-Version: 13\r\n" : "");
+    if (length > 0 && length < static_cast<int>(sizeof(response)))
+        SendData(manager, response, static_cast<u_long>(length), socket);
+    CloseSocket(manager, socket);
+}
+
+bool WebSocketHandler::Accept(std::string_view key, char *accept) {
+    HCRYPTHASH  hash;
+    BYTE        digest[20];
+    DWORD       digestLength    = sizeof(digest);
+    DWORD       acceptLength    = ACCEPT_SIZE + 1;
+    bool        hashed;
+
+    if (provider == 0)
+        return false;
+    if (!CryptCreateHash(provider,                          //hProv : Handle of the CSP, from CryptAcquireContext.
+                         CALG_SHA1,                         //Algid : The hash algorithm, SHA-1 as required by the handshake.
+                         0,                                 //hKey : Only for keyed hashes (MAC, HMAC).
+                         0,                                 //dwFlags : None.
+                         &hash                              //phHash : Receives the handle of the hash object.
+    )) {
+        LOG_ERROR("CryptCreateHash failed / error %lu\n", GetLastError());
+        return false;
+    }
+    hashed = CryptHashData(hash, reinterpret_cast<const BYTE*>(key.data()), static_cast<DWORD>(key.size()), 0) &&
+             CryptHashData(hash, reinterpret_cast<const BYTE*>(ACCEPT_GUID), sizeof(ACCEPT_GUID) - 1, 0) &&
+             CryptGetHashParam(hash, HP_HASHVAL, digest, &digestLength, 0);
+    CryptDestroyHash(hash);
+    if (!hashed) {
+        LOG_ERROR("SHA-1 of the handshake failed / error %lu\n", GetLastError());
+        return false;
+    }
+    if (!CryptBinaryToStringA(digest,                                       //pbBinary : The bytes to encode.
+                              digestLength,                                 //cbBinary : Their number.
+                              CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF,    //dwFlags : Base64 on a single line.
+                              accept,                                       //pszString : Receives the string, null terminated.
+                              &acceptLength                                 //pcchString : Size of pszString in, length written without the null out.
+    ) || acceptLength != ACCEPT_SIZE) {
+        LOG_ERROR("CryptBinaryToString failed / error %lu\n", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool WebSocketHandler::HandleFrame(SocketManager &manager, Opcode opcode, const char *payload, u_long length, Connection *connection, Socket *socket) {
+    switch (opcode) {
+        case WebSocketParser::PING :{
+            Send(manager, payload, length, socket, WebSocketParser::PONG);     // same payload
+            break;
+        }
+        case WebSocketParser::PONG :
+            break;                                              // unsolicited, no ping is sent
+        case WebSocketParser::CLOSE :{                          // answered with the status it came with, then closed without waiting for the client
+            Send(manager, payload, length < 2 ? 0 : 2, socket, WebSocketParser::CLOSE);
+            connection->closing = true;
+            CloseSocket(manager, socket);
+            break;
+        }
+        default :
+            HandleMessage(manager, opcode, payload, length, socket);
+    }
+    return !connection->closing;
+}
+
+void WebSocketHandler::ReleaseContext(SocketManager &manager, void *context, Socket *socket) {
+    auto *connection = static_cast<Connection*>(context);
+
+    if (connection->subscribed)
+        Unsubscribe(socket);
+    delete connection;
+}
+
+bool WebSocketHandler::Send(SocketManager &manager, const char *data, u_long length, Socket *socket, Opcode opcode) {
+    char    header[WebSocketParser::MAX_HEADER_SIZE];
+    WSABUF  pieces[2];
+
+    pieces[0].buf = header;
+    pieces[0].len = WebSocketParser::EncodeHeader(opcode, true, length, header);
+    pieces[1].buf = const_cast<char*>(data);
+    pieces[1].len = length;
+    return SendData(manager, pieces, 2, socket, opcode >= WebSocketParser::CLOSE ? SocketManager::SendClass::CONTROL : SocketManager::SendClass::BULK);
+}
+
+void WebSocketHandler::Close(SocketManager &manager, Socket *socket, u_short status) {
+    auto   *connection  = static_cast<Connection*>(socket->GetContext());
+    char    payload[2]  = {static_cast<char>(status >> 8), static_cast<char>(status & 0xFF)};
+
+    if (connection == nullptr || connection->closing)
+        return;
+    connection->closing = true;
+    Send(manager, payload, sizeof(payload), socket, WebSocketParser::CLOSE);
+    CloseSocket(manager, socket);
+}
+
+void WebSocketHandler::Subscribe(SocketManager &manager, Socket *socket) {
+    auto *connection = static_cast<Connection*>(socket->GetContext());
+
+    if (connection == nullptr || connection->subscribed)
+        return;
+    connection->subscribed = true;
+    if (!connection->open)                                      // from Open, added by Upgrade once the 101 is posted
+        return;
+    EnterCriticalSection(&subscribers.critSec);
+    {
+        subscribers.map[socket->GetId()] = &manager;
+    }
+    LeaveCriticalSection(&subscribers.critSec);
+}
+
+void WebSocketHandler::Unsubscribe(Socket *socket) {
+    auto *connection = static_cast<Connection*>(socket->GetContext());
+
+    if (connection != nullptr)
+        connection->subscribed = false;
+    EnterCriticalSection(&subscribers.critSec);
+    {
+        subscribers.map.erase(socket->GetId());
+    }
+    LeaveCriticalSection(&subscribers.critSec);
+}
+
+int WebSocketHandler::Broadcast(const char *data, u_long length, Opcode opcode) {
+    static thread_local std::vector<std::pair<UUID, SocketManager*>> targets;
+    char    header[WebSocketParser::MAX_HEADER_SIZE];
+    WSABUF  pieces[2];
+    int     nbSucc      = 0;
+
+    pieces[0].buf = header;                                     // server frames aren't masked, the same bytes go to every subscriber
+    pieces[0].len = WebSocketParser::EncodeHeader(opcode, true, length, header);
+    pieces[1].buf = const_cast<char*>(data);
+    pieces[1].len = length;
+    EnterCriticalSection(&subscribers.critSec);
+    {
+        targets.assign(subscribers.map.begin(), subscribers.map.end());
+    }
+    LeaveCriticalSection(&subscribers.critSec);
+    for (auto &target : targets)                                // sent outside of the lock : a closing socket takes it (ReleaseContext) under its own lock
+        nbSucc += target.second->SendData(pieces, 2, target.first, opcode >= WebSocketParser::CLOSE ? SocketManager::SendClass::CONTROL : SocketManager::SendClass::BULK);
+    return nbSucc;
+}
@@ -0,0 +1,59 @@
+#ifndef SOCKETMANAGER_WEBSOCKETHANDLER_H
+#define SOCKETMANAGER_WEBSOCKETHANDLER_H
+
+#include "SocketManager.h"
+#include "HttpParser.h"
+#include "WebSocketParser.h"
+
+/************* WebSocketHandler ***********/
+class WebSocketHandler : public SocketHandler {  // Listener handler speaking WebSocket (RFC 6455) : upgrade handshake, then messages both ways and broadcasts
+public:
+    typedef WebSocketParser::Opcode Opcode;
+private:
+    static const char           ACCEPT_GUID[];                  // Appended to the key of the client before hashing (RFC 6455 4.2.2)
+    static const DWORD          ACCEPT_SIZE                     = 28;           // Base64 of a SHA-1
+
+    struct Connection {                                         // Context of each socket
+        HttpParser *            http;                           // Upgrade request, deleted once answered
+        WebSocketParser         parser;
+        bool                    open;                           // 101 sent, frames from then on
+        bool                    subscribed;                     // Gets broadcasts, in subscribers once open
+        bool                    closing;                        // Close frame sent, what follows is not read
+
+        Connection(const HttpParser::Limits &h, const WebSocketParser::Limits &w) : http(new HttpParser(h)), parser(w), open(false), subscribed(false), closing(false) {}
+        ~Connection() { delete http; }
+    };
+
+    HttpParser::Limits                  httpLimits;
+    WebSocketParser::Limits             limits;
+    HCRYPTPROV                          provider;               // SHA-1 of the handshake
+    CriticalMap<UUID, SocketManager*>   subscribers;            // Sockets Broadcast sends to, with the manager owning each of them (shards)
+
+    bool                Upgrade             (SocketManager &manager, const HttpRequest &request, Connection *connection, Socket *socket);  // Answer the upgrade request, false if refused
+    void                Refuse              (SocketManager &manager, u_short status, Socket *socket);                          // Answer the upgrade request with an HTTP error and close
+    bool                Accept              (std::string_view key, char *accept);                                               // Sec-WebSocket-Accept of a Sec-WebSocket-Key, null terminated
+    bool                HandleFrame         (SocketManager &manager, Opcode opcode, const char *payload, u_long length, Connection *connection, Socket *socket);  // false once closing
+public:
+    explicit            WebSocketHandler    (const WebSocketParser::Limits &l = WebSocketParser::Limits(), const HttpParser::Limits &h = HttpParser::Limits());
+                        ~WebSocketHandler   ();
+
+    int                 ReceiveData         (SocketManager &manager, const char *data, u_long length, Socket *socket) final;
+    void                ReleaseContext      (SocketManager &manager, void *context, Socket *socket) final;     // Parsers of the connection
+
+    // Send one message to every subscriber, the frame header is encoded once for all of them, returns the number of sockets that took it
+    int                 Broadcast           (const char *data, u_long length, Opcode opcode = WebSocketParser::BINARY);
+protected:
+    // Accept an upgrade request (target, Origin...), false answers 403. The handshake answer is sent once it returns.
+    virtual bool        Open                (SocketManager &manager, const HttpRequest &request, Socket *socket)   { return true; }
+    // Handle one TEXT (not checked to be UTF-8) or BINARY message, fragments reassembled, called on a worker thread for each message of a connection in order.
+    // The payload is only valid until it returns. Pings are answered and close frames handled before getting here.
+    virtual void        HandleMessage       (SocketManager &manager, Opcode opcode, const char *payload, u_long length, Socket *socket) = 0;
+
+    bool                Send                (SocketManager &manager, const char *data, u_long length, Socket *socket, Opcode opcode = WebSocketParser::BINARY);   // One unfragmented frame, control frames as SendClass CONTROL
+    void                Close               (SocketManager &manager, Socket *socket, u_short status = 1000);       // Send a close frame with status and close the connection
+    void                Subscribe           (SocketManager &manager, Socket *socket);                              // From Open or HandleMessage, the socket gets broadcasts until closed
+    void                Unsubscribe         (Socket *socket);
+};
+////////////// WebSocketHandler ////////////
+
+#endif //SOCKETMANAGER_WEBSOCKETHANDLER_H
@@ -0,0 +1,182 @@
+#include "WebSocketParser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WEBSOCKET_PARSER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // Byte i of data is XORed with key[(offset + i) % 4] : the key is rotated once so the loops start on its first byte.
+    inline void RotateKey(const u_char key[4], size_t offset, u_char rotated[8]) {
+        for (size_t i = 0 ; i < 8 ; i++)
+            rotated[i] = key[(offset + i) & 3];
+    }
+
+    void MaskScalar(char *data, size_t length, const u_char key[4], size_t offset) {
+        u_char  rotated[8];
+        ULONG64 key64;
+        ULONG64 block;
+        size_t  i       = 0;
+
+        RotateKey(key, offset, rotated);
+        memcpy(&key64, rotated, sizeof(key64));
+        for (; i + 8 <= length ; i += 8) {                          // a word at a time, memcpy keeps unaligned accesses defined
+            memcpy(&block, data + i, sizeof(block));
+            block ^= key64;
+            memcpy(data + i, &block, sizeof(block));
+        }
+        for (; i < length ; i++)
+            data[i] = static_cast<char>(data[i] ^ rotated[i & 3]);
+    }
+
+#ifdef WEBSOCKET_PARSER_X86
+    __attribute__((target("sse2")))
+    void MaskSse2(char *data, size_t length, const u_char key[4], size_t offset) {
+        u_char  rotated[8];
+        int     key32;
+        size_t  i       = 0;
+
+        RotateKey(key, offset, rotated);
+        memcpy(&key32, rotated, sizeof(key32));
+        const __m128i keys = _mm_set1_epi32(key32);
+        for (; i + 16 <= length ; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, keys));
+        }
+        MaskScalar(data + i, length - i, key, offset + i);
+    }
+
+    __attribute__((target("avx2")))
+    void MaskAvx2(char *data, size_t length, const u_char key[4], size_t offset) {
+        u_char  rotated[8];
+        int     key32;
+        size_t  i       = 0;
+
+        RotateKey(key, offset, rotated);
+        memcpy(&key32, rotated, sizeof(key32));
+        const __m256i keys = _mm256_set1_epi32(key32);
+        for (; i + 32 <= length ; i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(block, keys));
+        }
+        MaskScalar(data + i, length - i, key, offset + i);
+    }
+#endif //WEBSOCKET_PARSER_X86
+
+    DelimiterScanner::Level BestLevel() {                           // not DelimiterScanner::GetLevel, it may not be initialised yet
+        if (DelimiterScanner::IsSupported(DelimiterScanner::AVX2))
+            return DelimiterScanner::AVX2;
+        if (DelimiterScanner::IsSupported(DelimiterScanner::SSE2))
+            return DelimiterScanner::SSE2;
+        return DelimiterScanner::SCALAR;
+    }
+
+}
+
+DelimiterScanner::Level         WebSocketParser::level  = BestLevel();
+WebSocketParser::MaskFunction   WebSocketParser::mask   = WebSocketParser::FunctionOf(WebSocketParser::level);
+
+WebSocketParser::MaskFunction WebSocketParser::FunctionOf(DelimiterScanner::Level l) {
+    switch (l) {
+#ifdef WEBSOCKET_PARSER_X86
+        case DelimiterScanner::AVX2 : return MaskAvx2;
+        case DelimiterScanner::SSE2 : return MaskSse2;
+#endif
+        default :                     return MaskScalar;
+    }
+}
+
+bool WebSocketParser::SetLevel(DelimiterScanner::Level l) {
+    if (!DelimiterScanner::IsSupported(l))
+        return false;
+    level = l;
+    mask = FunctionOf(l);
+    return true;
+}
+
+bool WebSocketParser::ParseHeader() {
+    ULONG64 length  = header[1] & 0x7F;
+    u_long  at      = 2;
+
+    fin = (header[0] & 0x80) != 0;
+    opcode = static_cast<Opcode>(header[0] & 0x0F);
+    if ((header[0] & 0x70) != 0)                                    // no extension was negotiated, reserved bits must be 0
+        return Fail(1002);
+    if ((header[1] & 0x80) == 0)                                    // every client frame is masked (RFC 6455 5.1)
+        return Fail(1002);
+    if (length == 126) {
+        length = (static_cast<ULONG64>(header[2]) << 8) | header[3];
+        at = 4;
+    } else if (length == 127) {
+        length = 0;
+        for (at = 2 ; at < 10 ; at++)
+            length = (length << 8) | header[at];
+        if ((length >> 63) != 0)
+            return Fail(1002);
+    }
+    memcpy(key, header + at, sizeof(key));
+
+    switch (opcode) {
+        case CONTINUATION :
+            if (messageOpcode == CONTINUATION)                      // no message to continue
+                return Fail(1002);
+            break;
+        case TEXT :
+            /** NOBREAK **/
+        case BINARY :
+            if (messageOpcode != CONTINUATION)                      // previous message not finished
+                return Fail(1002);
+            break;
+        case CLOSE :
+            /** NOBREAK **/
+        case PING :
+            /** NOBREAK **/
+        case PONG :
+            if (!fin || length > MAX_CONTROL_SIZE)
+                return Fail(1002);
+            break;
+        default :                                                   // reserved opcodes
+            return Fail(1002);
+    }
+    if (opcode < CLOSE && message.size() + length > limits.maxMessageSize)
+        return Fail(1009);
+    payloadSize = static_cast<u_long>(length);
+    received = 0;
+    inPayload = true;
+    return true;
+}
+
+void WebSocketParser::ResetMessage() {
+    if (message.capacity() > MESSAGE_SHRINK_THRESHOLD)
+        std::vector<char>().swap(message);          // a big message went through, don't keep its memory for the life of the connection
+    else
+        message.clear();
+    messageOpcode = CONTINUATION;
+}
+
+u_long WebSocketParser::EncodeHeader(Opcode opcode, bool fin, ULONG64 length, char *out, const u_char *maskKey) {
+    auto   *bytes   = reinterpret_cast<u_char*>(out);
+    u_long  size    = 2;
+
+    bytes[0] = static_cast<u_char>((fin ? 0x80 : 0x00) | opcode);
+    bytes[1] = maskKey != nullptr ? 0x80 : 0x00;
+    if (length < 126)
+        bytes[1] |= static_cast<u_char>(length);
+    else if (length <= 0xFFFF) {                                    // network byte order
+        bytes[1] |= 126;
+        bytes[2] = static_cast<u_char>(length >> 8);
+        bytes[3] = static_cast<u_char>(length);
+        size = 4;
+    } else {
+        bytes[1] |= 127;
+        for (int i = 0 ; i < 8 ; i++)
+            bytes[2 + i] = static_cast<u_char>(length >> (56 - 8 * i));
+        size = 10;
+    }
+    if (maskKey != nullptr) {
+        memcpy(out + size, maskKey, 4);
+        size += 4;
+    }
+    return size;
+}
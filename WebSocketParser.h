@@ -0,0 +1,137 @@
+#ifndef SOCKETMANAGER_WEBSOCKETPARSER_H
+#define SOCKETMANAGER_WEBSOCKETPARSER_H
+
+#include <cstring>
+#include <vector>
+#include "socket_headers.h"
+#include "DelimiterScanner.h"
+
+/************* WebSocketParser ***********/
+class WebSocketParser {                     // Cut the byte stream a client sends into RFC 6455 messages, payloads unmasked in place and delivered in place when they fit in a single read
+public:
+    enum Opcode : u_char {
+        CONTINUATION    = 0x0,
+        TEXT            = 0x1,
+        BINARY          = 0x2,
+        CLOSE           = 0x8,
+        PING            = 0x9,
+        PONG            = 0xA
+    };
+
+    struct Limits {
+        u_long                  maxMessageSize;                     // Fragments included, a bigger message closes the connection with 1009
+
+        Limits() : maxMessageSize(1048576) {}
+    };
+
+    static const u_long         MAX_HEADER_SIZE             = 14;           // 2, 8 bytes of extended length and 4 of mask key
+    static const u_long         MAX_CONTROL_SIZE            = 125;          // Control frames are never fragmented nor longer (RFC 6455 5.5)
+
+    typedef void (*MaskFunction)(char *data, size_t length, const u_char key[4], size_t offset);
+
+private:
+    static const size_t         MESSAGE_SHRINK_THRESHOLD    = 65536;        // Message buffer capacity kept between messages
+
+    static MaskFunction         mask;                   // Implementation selected for the instruction set of the cpu
+    static DelimiterScanner::Level level;               // Same instruction sets as the delimiter scanner
+
+    Limits                      limits;
+    u_char                      header[MAX_HEADER_SIZE];// Header of the current frame, copied as it may straddle reads
+    u_long                      headerSize;             // Bytes of it received, 0 between frames
+    u_long                      headerNeeded;           // Size of the whole header, known from its first 2 bytes
+    bool                        inPayload;              // Header parsed, payload being received
+    bool                        fin;                    // Current frame is the last one of its message
+    Opcode                      opcode;                 // Of the current frame
+    u_char                      key[4];                 // Mask key of the current frame
+    u_long                      payloadSize;            // Of the current frame
+    u_long                      received;               // Payload bytes of the current frame received (and unmasked), where the key starts again
+    Opcode                      messageOpcode;          // TEXT or BINARY of the fragmented message being received, CONTINUATION for none
+    std::vector<char>           message;                // Fragments received so far, or a frame straddling reads
+    char                        control[MAX_CONTROL_SIZE];  // Control frame straddling reads, it can come between the fragments of a message
+    u_short                     error;                  // Close status the connection must be closed with
+
+    bool                ParseHeader         ();                                                 // Frame header complete in header, error set on failure
+    bool                Fail                (u_short status)        { error = status; return false; }
+    void                ResetMessage        ();
+
+public:
+    explicit            WebSocketParser     (const Limits &l = Limits()) : limits(l), header(), headerSize(0), headerNeeded(2), inPayload(false), fin(false), opcode(CONTINUATION),
+                                                                           key(), payloadSize(0), received(0), messageOpcode(CONTINUATION), control(), error(0) {}
+
+    inline u_short      GetError            () const                { return error; }                       // 1002 (protocol error) or 1009 (message too big) after Feed failed
+
+    // Call onMessage(Opcode opcode, const char *payload, u_long length) -> bool for each complete message (TEXT, BINARY) and control frame (CLOSE, PING, PONG) of data.
+    // Payloads are unmasked in data itself, the caller must own it. Fragmented messages are reassembled, control frames between their fragments delivered in order.
+    // onMessage returns false to stop (connection closed), data and length are then left on the first unread byte.
+    // Returns false on protocol error, GetError gives the close status : the rest of the stream can't be parsed.
+    template<typename F>
+    bool                Feed                (char *&data, u_long &length, F onMessage);
+
+    // Frame header of a payload of length bytes, masked with key unless nullptr (servers don't mask), returns its size
+    static u_long       EncodeHeader        (Opcode opcode, bool fin, ULONG64 length, char *out, const u_char *maskKey = nullptr);
+    // XOR data with key, starting offset bytes into it (masking and unmasking are the same), vectorized
+    static inline void  Mask                (char *data, size_t length, const u_char key[4], size_t offset = 0)    { mask(data, length, key, offset); }
+    static inline DelimiterScanner::Level GetLevel  ()                  { return level; }
+    static MaskFunction FunctionOf          (DelimiterScanner::Level l);
+    static bool         SetLevel            (DelimiterScanner::Level l);                        // Force an implementation (benchmarks), false if not supported by the cpu
+};
+
+template<typename F>
+bool WebSocketParser::Feed(char *&data, u_long &length, F onMessage) {
+    bool stop = false;
+
+    while (length > 0 && !stop) {
+        // ----------------------------- header, up to 14 bytes, copied as it may straddle reads
+        if (!inPayload) {
+            u_long take = headerNeeded - headerSize < length ? headerNeeded - headerSize : length;
+            memcpy(header + headerSize, data, take);
+            headerSize += take;
+            data += take;
+            length -= take;
+            if (headerSize == 2) {
+                u_char lengthCode = header[1] & 0x7F;
+                headerNeeded = 2 + (lengthCode == 126 ? 2 : lengthCode == 127 ? 8 : 0) + ((header[1] & 0x80) ? 4 : 0);
+            }
+            if (headerSize < headerNeeded)
+                continue;
+            if (!ParseHeader())
+                return false;
+            if (payloadSize > 0)
+                continue;
+        }
+        // ----------------------------- payload : unmasked where it was read, then delivered in place or appended
+        u_long take = payloadSize - received < length ? payloadSize - received : length;
+        Mask(data, take, key, received);
+        bool isControl = opcode >= CLOSE;
+        bool inPlace = received == 0 && take == payloadSize && (isControl || (fin && messageOpcode == CONTINUATION));
+        if (inPlace) {
+            stop = !onMessage(opcode, static_cast<const char*>(data), payloadSize);
+        } else if (isControl) {
+            memcpy(control + received, data, take);
+        } else
+            message.insert(message.end(), data, data + take);
+        data += take;
+        length -= take;
+        received += take;
+        if (received < payloadSize)
+            continue;
+        // ----------------------------- frame complete
+        inPayload = false;
+        headerSize = 0;
+        headerNeeded = 2;
+        if (inPlace)
+            continue;
+        if (isControl) {
+            stop = !onMessage(opcode, static_cast<const char*>(control), payloadSize);
+        } else if (fin) {
+            Opcode messageType = messageOpcode != CONTINUATION ? messageOpcode : opcode;
+            stop = !onMessage(messageType, static_cast<const char*>(message.data()), static_cast<u_long>(message.size()));
+            ResetMessage();
+        } else if (messageOpcode == CONTINUATION)
+            messageOpcode = opcode;                                     // first fragment
+    }
+    return true;
+}
+////////////// WebSocketParser ////////////
+
+#endif //SOCKETMANAGER_WEBSOCKETPARSER_H
@@ -0,0 +1,239 @@
+#ifndef SOCKETMANAGER_BENCHMARKUTILS_H
+#define SOCKETMANAGER_BENCHMARKUTILS_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+
+namespace Benchmark {
+
+/************* Clock ***********/
+    class Clock {                                       // QueryPerformanceCounter wrapper, ticks are shared by all threads of the process
+    public:
+        static LONGLONG     Now             ()                  { LARGE_INTEGER t; QueryPerformanceCounter(&t); return t.QuadPart; }
+        static LONGLONG     Frequency       ()                  { static LONGLONG f = [](){ LARGE_INTEGER t; QueryPerformanceFrequency(&t); return t.QuadPart; }(); return f; }
+        static double       ToSeconds       (LONGLONG ticks)    { return static_cast<double>(ticks) / static_cast<double>(Frequency()); }
+        static uint64_t     ToNanoseconds   (LONGLONG ticks)    { return ticks <= 0 ? 0 : static_cast<uint64_t>(static_cast<double>(ticks) * 1e9 / static_cast<double>(Frequency())); }
+        static LONGLONG     FromSeconds     (double seconds)    { return static_cast<LONGLONG>(seconds * static_cast<double>(Frequency())); }
+    };
+////////////// Clock ////////////
+
+/************* LatencyHistogram ***********/
+    class LatencyHistogram {                            // Log-linear histogram (HdrHistogram like, ~1.5% precision) of nanosecond values, not thread safe
+    private:
+        static const int        SUB_BUCKET_BITS     = 7;
+        static const int        SUB_BUCKET_HALF     = 1 << (SUB_BUCKET_BITS - 1);
+        static const int        BUCKET_COUNT        = (64 - SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF;
+
+        uint64_t                counts[BUCKET_COUNT];
+        uint64_t                total;
+        uint64_t                minValue;
+        uint64_t                maxValue;
+        double                  sum;
+
+        static int          IndexOf         (uint64_t v) {
+            if (v < (1u << SUB_BUCKET_BITS))
+                return static_cast<int>(v);
+            int msb = 63 - __builtin_clzll(v);
+            int shift = msb - (SUB_BUCKET_BITS - 1);
+            return (shift + 1) * SUB_BUCKET_HALF + static_cast<int>((v >> shift) - SUB_BUCKET_HALF);
+        }
+        static uint64_t     ValueOf         (int idx) {                     // Middle of the value range covered by bucket idx
+            if (idx < (1 << SUB_BUCKET_BITS))
+                return static_cast<uint64_t>(idx);
+            int shift = idx / SUB_BUCKET_HALF - 1;
+            uint64_t low = static_cast<uint64_t>(idx % SUB_BUCKET_HALF + SUB_BUCKET_HALF) << shift;
+            return low + ((uint64_t(1) << shift) >> 1);
+        }
+    public:
+                            LatencyHistogram()              { Reset(); }
+
+        void                Reset           ()              { memset(counts, 0, sizeof(counts)); total = 0; minValue = UINT64_MAX; maxValue = 0; sum = 0; }
+        void                Record          (uint64_t ns)   { counts[IndexOf(ns)]++; total++; sum += static_cast<double>(ns); if (ns < minValue) minValue = ns; if (ns > maxValue) maxValue = ns; }
+        uint64_t            Count           () const        { return total; }
+        uint64_t            Min             () const        { return total ? minValue : 0; }
+        uint64_t            Max             () const        { return maxValue; }
+        double              Mean            () const        { return total ? sum / static_cast<double>(total) : 0; }
+
+        void                Merge           (const LatencyHistogram &other) {
+            for (int i = 0 ; i < BUCKET_COUNT ; i++)
+                counts[i] += other.counts[i];
+            total += other.total;
+            sum += other.sum;
+            if (other.total && other.minValue < minValue) minValue = other.minValue;
+            if (other.maxValue > maxValue) maxValue = other.maxValue;
+        }
+
+        uint64_t            Percentile      (double p) const {              // p in [0, 100]
+            if (total == 0)
+                return 0;
+            auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total) + 0.5);
+            if (rank == 0) rank = 1;
+            uint64_t seen = 0;
+            for (int i = 0 ; i < BUCKET_COUNT ; i++) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    uint64_t v = ValueOf(i);
+                    return v > maxValue ? maxValue : (v < minValue ? minValue : v);
+                }
+            }
+            return maxValue;
+        }
+    };
+////////////// LatencyHistogram ////////////
+
+/************* LatencyRecorder ***********/
+    class LatencyRecorder {                             // Gather latency samples from any thread without contention, one histogram per recording thread
+    private:
+        CRITICAL_SECTION                                    critSec{};
+        std::vector<std::unique_ptr<LatencyHistogram>>      histograms;
+        volatile LONG                                       recording;
+
+        LatencyHistogram   *ThreadHistogram () {
+            static thread_local LatencyRecorder    *owner      = nullptr;
+            static thread_local LatencyHistogram   *histogram  = nullptr;
+            if (owner != this) {
+                EnterCriticalSection(&critSec);
+                {
+                    histograms.emplace_back(new LatencyHistogram());
+                    histogram = histograms.back().get();
+                }
+                LeaveCriticalSection(&critSec);
+                owner = this;
+            }
+            return histogram;
+        }
+    public:
+                            LatencyRecorder ()  : recording(0)  { InitializeCriticalSection(&critSec); }
+                            ~LatencyRecorder()                  { DeleteCriticalSection(&critSec); }
+
+        void                Start           ()                  { InterlockedExchange(&recording, 1); }
+        void                Stop            ()                  { InterlockedExchange(&recording, 0); }
+        bool                IsRecording     () const            { return recording != 0; }
+        void                Record          (uint64_t ns)       { if (recording) ThreadHistogram()->Record(ns); }
+
+        LatencyHistogram    Collect         () {                // Only meaningful once recording threads are idle
+            LatencyHistogram merged;
+            EnterCriticalSection(&critSec);
+            {
+                for (auto &h : histograms)
+                    merged.Merge(*h);
+            }
+            LeaveCriticalSection(&critSec);
+            return merged;
+        }
+    };
+////////////// LatencyRecorder ////////////
+
+/************* ProcessUsage ***********/
+    struct ProcessUsage {                               // Snapshot of CPU time, private memory and threads of the whole process
+        uint64_t            cpuTime100ns;               // user + kernel time, in 100ns unit
+        uint64_t            privateBytes;
+        int                 threads;
+
+        static ProcessUsage Sample          () {
+            ProcessUsage                usage{};
+            FILETIME                    creation, exit, kernel, user;
+            PROCESS_MEMORY_COUNTERS_EX  mem{};
+
+            if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+                usage.cpuTime100ns = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime) +
+                                     (static_cast<uint64_t>(user.dwHighDateTime) << 32 | user.dwLowDateTime);
+            }
+            mem.cb = sizeof(mem);
+            if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PPROCESS_MEMORY_COUNTERS>(&mem), sizeof(mem)))
+                usage.privateBytes = mem.PrivateUsage;
+            HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);     // threads of every process, ours are picked by owner
+            if (snapshot != INVALID_HANDLE_VALUE) {
+                THREADENTRY32 thread{};
+                thread.dwSize = sizeof(thread);
+                for (BOOL more = Thread32First(snapshot, &thread) ; more ; more = Thread32Next(snapshot, &thread)) {
+                    if (thread.th32OwnerProcessID == GetCurrentProcessId())
+                        usage.threads++;
+                }
+                CloseHandle(snapshot);
+            }
+            return usage;
+        }
+    };
+////////////// ProcessUsage ////////////
+
+/************* JsonWriter ***********/
+    class JsonWriter {                                  // Minimal streaming JSON writer, keys and string values are expected to be plain ascii
+    private:
+        FILE               *out;
+        std::vector<bool>   firstInScope;
+
+        void                Separator       () {
+            if (!firstInScope.empty()) {
+                if (!firstInScope.back())
+                    fputc(',', out);
+                firstInScope.back() = false;
+            }
+        }
+        void                Key             (const char *key) { Separator(); if (key) fprintf(out, "\"%s\":", key); }
+    public:
+        explicit            JsonWriter      (FILE *f) : out(f) {}
+
+        void                BeginObject     (const char *key = nullptr) { Key(key); fputc('{', out); firstInScope.push_back(true); }
+        void                EndObject       ()                          { fputc('}', out); firstInScope.pop_back(); if (firstInScope.empty()) fputc('\n', out); }
+        void                BeginArray      (const char *key = nullptr) { Key(key); fputc('[', out); firstInScope.push_back(true); }
+        void                EndArray        ()                          { fputc(']', out); firstInScope.pop_back(); }
+        void                Value           (const char *key, const char *v) { Key(key); fprintf(out, "\"%s\"", v); }
+        void                Value           (const char *key, double v)      { Key(key); fprintf(out, "%.6g", v); }
+        void                Value           (const char *key, uint64_t v)    { Key(key); fprintf(out, "%llu", static_cast<unsigned long long>(v)); }
+        void                Value           (const char *key, int v)         { Key(key); fprintf(out, "%d", v); }
+        void                Value           (const char *key, bool v)        { Key(key); fputs(v ? "true" : "false", out); }
+
+        void                Latency         (const char *key, const LatencyHistogram &h) {  // Latency summary in microseconds
+            BeginObject(key);
+            Value("count",  h.Count());
+            Value("min",    static_cast<double>(h.Min()) / 1e3);
+            Value("mean",   h.Mean() / 1e3);
+            Value("p50",    static_cast<double>(h.Percentile(50)) / 1e3);
+            Value("p90",    static_cast<double>(h.Percentile(90)) / 1e3);
+            Value("p99",    static_cast<double>(h.Percentile(99)) / 1e3);
+            Value("p999",   static_cast<double>(h.Percentile(99.9)) / 1e3);
+            Value("p9999",  static_cast<double>(h.Percentile(99.99)) / 1e3);
+            Value("max",    static_cast<double>(h.Max()) / 1e3);
+            EndObject();
+        }
+    };
+////////////// JsonWriter ////////////
+
+/************* Arguments ***********/
+    class Arguments {                                   // "--key=value" or "--key value" command line parser
+    private:
+        int                 argc;
+        char              **argv;
+    public:
+                            Arguments       (int c, char **v) : argc(c), argv(v) {}
+
+        const char         *Get             (const char *key, const char *def = nullptr) const {
+            size_t keyLen = strlen(key);
+            for (int i = 1 ; i < argc ; i++) {
+                const char *arg = argv[i];
+                if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, key, keyLen) != 0)
+                    continue;
+                if (arg[2 + keyLen] == '=')
+                    return arg + 3 + keyLen;
+                if (arg[2 + keyLen] == '\0')
+                    return (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) ? argv[i + 1] : "";
+            }
+            return def;
+        }
+        bool                Has             (const char *key) const                 { return Get(key) != nullptr; }
+        double              GetDouble       (const char *key, double def) const     { const char *v = Get(key); return v && *v ? atof(v) : def; }
+        long long           GetInt          (const char *key, long long def) const  { const char *v = Get(key); return v && *v ? atoll(v) : def; }
+    };
+////////////// Arguments ////////////
+
+}
+
+#endif //SOCKETMANAGER_BENCHMARKUTILS_H
@@ -0,0 +1,1887 @@
+#include "SocketManager.h"
+#include "ShardedServer.h"
+#include "HttpHandler.h"
+#include "WebSocketHandler.h"
+#include "ConnectionPool.h"
+#include "RpcClient.h"
+#include "RpcHandler.h"
+#include "BenchmarkUtils.h"
+
+/*
+ * Loopback load generator : one server manager and one client manager in the same process, talking over 127.0.0.1.
+ * Every message starts with the QueryPerformanceCounter tick at which it was *intended* to be sent, so in open-loop mode
+ * (--rate > 0) a stalled connection keeps accumulating latency instead of silently lowering the offered load
+ * (no coordinated omission).
+ *
+ * Scenarios :
+ *  - echo      : clients send at --rate (total msg/s, 0 = as fast as --pipeline allows), server echoes, latency = round trip
+ *  - pingpong  : closed loop, each connection keeps --pipeline messages in flight and sends a new one on each response
+ *  - stream    : clients send one way at --rate (0 = as fast as backpressure allows), latency = one way
+ *  - broadcast : server sends to all clients at --rate (broadcast/s, 0 = as fast as possible), latency = one way
+ *  - accept    : --connections slots each connect, exchange one message and get closed by the server, then start over,
+ *                latency = connect + first round trip, throughput = connections per second
+ *  - file      : clients send a temporary file of --size bytes again and again, with SendFile (TransmitFile) or, with
+ *                --sendfile=0, read in memory by 16kB slices given to SendData, latency = one way per file
+ *  - relay     : each of --connections pairs has a source and a sink connection to the server, which relays the source
+ *                to the sink with RelayData (or, with --relay=0, copies it with SendData from ReceiveData), clients
+ *                keep --pipeline messages in flight per pair, latency = one way through the relay
+ *  - priority  : each connection sends --size control messages at --rate (SendClass CONTROL) while also sending
+ *                --bulk-size bulk messages as fast as backpressure allows, latency = one way of control messages only.
+ *                A control message refused by backpressure is retried, the wait counts in its latency. Compare the p99
+ *                with --schedule=1 (send scheduling, control goes before queued bulk) and --schedule=0
+ *  - datagram  : each of --connections client UDP sockets sends --size datagrams to the server UDP socket at --rate
+ *                (0 = as fast as backpressure allows), --pipeline datagrams per SendDatagrams call, latency = one way,
+ *                throughput = datagrams received per second, the report's datagram object has the loss and how many
+ *                datagrams each read and send carried (above 1 with receive coalescing and segmentation offload).
+ *                --address must be numeric, run it with --size=64 and --size=1200
+ *  - http      : closed loop like pingpong over HTTP/1.1 keep-alive connections, each request is a POST of --size bytes
+ *                the server's HttpHandler echoes as its response body, --pipeline requests in flight per connection,
+ *                throughput = requests per second. Run it with --pipeline=1 and --pipeline=16
+ *  - websocket : closed loop like pingpong over WebSocket connections upgraded once connected, each message is a masked
+ *                binary frame of --size bytes the server's WebSocketHandler unmasks in place and echoes in a frame of its own,
+ *                --pipeline messages in flight per connection, throughput = messages per second. Run it with --connections=10000
+ *  - wsbroadcast : broadcast over WebSocket connections, every one of them subscribed, each message framed once by
+ *                WebSocketHandler::Broadcast for all of them, at --rate (0 = as fast as possible), latency = one way
+ *  - pubsub    : broadcast through a topic every connection subscribes to with its hello, each message copied once by
+ *                Publish and fanned out across the server worker threads, at --rate (0 = as fast as possible), latency = one
+ *                way. --backpressure=newest|oldest|disconnect is the policy of every subscriber, the report's pubsub object
+ *                counts what was delivered, dropped and disconnected. Run it with --connections=100000 for the fan-out latency
+ *  - pool      : requests echoed by --listeners backends, each a server of its own, sent through a ConnectionPool keeping
+ *                --connections / --listeners warm connections to each of them. Closed loop with --connections * --pipeline
+ *                requests in flight, or open loop at --rate, latency = round trip. --slow=D makes backend 0 hold every read
+ *                D ms before echoing it, --balance=least|roundrobin picks the pool balancing. The report's pool object has the
+ *                requests routed to each backend. Run it with --listeners=4 --slow=5 and both balancings for throughput and p99
+ *  - rpc       : closed loop of calls made with RpcClient, each a request of --size bytes the server's RpcHandler answers with
+ *                the same payload, --pipeline calls in flight per connection multiplexed by their id, latency = round trip,
+ *                throughput = calls per second. The report's rpc object counts completions, timeouts and refusals.
+ *                Run it with --size=32 and --pipeline=1, 64 and 1024
+ *
+ * --shards=N runs the server as N sharded managers with one worker thread each (see ShardedServer), run it with 1, 2, 4...
+ * to measure accept and echo scaling with cores. The default 0 is a single manager with one worker thread per processor.
+ * Shards are pinned to their own processor with node local pools unless --pin=0.
+ *
+ * --isb=F gives clients an ISB factor of F, --isb-source=tcpinfo estimates ISB from TCP_INFO instead of using ideal send backlog
+ * notifications. With --shape=B, the server reads each stream connection at B bytes/s only, so the report's
+ * max_pending_send_bytes shows whether client buffering follows the bandwidth-delay product.
+ *
+ * --zerocopy=N makes clients send messages of at least N bytes with SendDataNoCopy, from per connection message slots
+ * released by ReleaseSendData, and without socket send buffer. Compare throughput_mb_per_s and cpu_us_per_msg of
+ * --scenario=stream --size=32768 with and without it.
+ *
+ * --memory-budget=B gives the server a hard memory limit of B bytes (soft limit at 3/4 of it). Run echo or accept with more
+ * --connections than fit in it to check the overload behaviour : the report's server memory stays bounded while accepts
+ * are paused, idle connections switch to zero-byte reads and echoes get refused over the hard limit.
+ *
+ * --drain=T measures the shutdown of the server once the run is over : Drain(T) with every connection still open, sends
+ * in flight included (use echo or broadcast to have some). Run it with --connections=10000 and 100000 (the latter needs a
+ * dynamic port range of more than 100k, see netsh int ipv4 set dynamicport) for shutdown_ms.
+ *
+ * --listeners=N makes the server listen on N ports from --port, each listener with its own handler and pending accepts,
+ * clients spread their connections over them. They all share the server manager (and its worker threads) unless
+ * --listener-managers=1, which gives each listener after the first a server of its own like before multi-listener support.
+ * Compare the report's threads and setup_memory_bytes of both (echo, pingpong, stream or accept).
+ *
+ * --address is where clients connect, a host name is resolved and all its addresses raced (Happy Eyeballs), --listen-address
+ * is where the server listens ("::" for dual-stack). --scenario=accept --address=localhost --listen-address=:: measures
+ * connects racing ::1 and 127.0.0.1, --connect-delay=D sets the client attempt delay in ms (250 by default).
+ *
+ * --dns-stub=A runs a stub DNS server on A:53 (an IPv4 address) answering every A query with 127.0.0.1 and every AAAA
+ * query with no record, with a TTL of --dns-ttl seconds, and makes clients resolve host names with it. Run
+ * --scenario=accept --address=bench.test --dns-stub=127.0.0.1 for connects per second to a host name, the report's dns
+ * counts cache hits and resolutions : --dns-ttl=0 resolves on every connect, the default 60 once per minute.
+ *
+ * --address=unix:C:\tmp\bench.sock --listen-address=unix:C:\tmp\bench.sock runs echo, pingpong or stream over a Unix domain
+ * socket instead of TCP loopback (one listener only, the port is ignored), --ring=B makes both ends carry the data in a shared
+ * memory ring of B bytes per direction. Compare latency_us and cpu_us_per_msg of TCP loopback, the unix socket and the ring.
+ *
+ * --tls=1 runs every connection over TLS (SChannel), the server with a self-signed certificate made for the run. The accept
+ * scenario measures full handshakes per second (throughput is connections, each one a handshake), stream and echo measure
+ * encrypted throughput and cpu_us_per_msg against --tls=0. Not with relay, datagram or ring.
+ *
+ * --compress=fast|strong compresses every echo or stream connection (XPRESS, or XPRESS with Huffman), --payload=text fills
+ * messages after their stamp with JSON like log lines (zeros by default, random for incompressible data). With --shape=B
+ * the server charges each read for its compressed size, a link of B bytes/s : compare throughput_mb_per_s, cpu_us_per_msg
+ * and the report's compression ratio of --compress=none, fast and strong with --scenario=stream --payload=text.
+ *
+ * Usage : SocketManagerLoadGenerator --scenario=echo --connections=100 --size=64 --rate=100000 --duration=10
+ *                                    [--pipeline=1] [--warmup=1] [--shards=0] [--pin=1] [--zerocopy=0] [--sendfile=1] [--relay=1] [--isb=0] [--isb-source=notify] [--shape=0] [--bulk-size=16384] [--schedule=1] [--memory-budget=0] [--drain=-1] [--listeners=1] [--listener-managers=0] [--address=127.0.0.1] [--listen-address=0.0.0.0] [--connect-delay=250] [--dns-stub=] [--dns-ttl=60] [--ring=0] [--tls=0] [--compress=none] [--payload=zeros] [--backpressure=newest] [--slow=0] [--balance=least] [--port=55555] [--output=result.json]
+ * Result is written as JSON on stdout (or in --output).
+ */
+
+namespace {
+
+    enum class Scenario {
+        Echo,
+        PingPong,
+        Stream,
+        Broadcast,
+        Accept,
+        File,
+        Relay,
+        Priority,
+        Datagram,
+        Http,
+        WebSocket,
+        WsBroadcast,
+        PubSub,
+        Pool,
+        Rpc
+    };
+
+    enum class Payload {                            // What messages carry after their stamp
+        Zeros,
+        Text,                                       // JSON like log lines, about what compression gets on real traffic
+        Random                                      // Incompressible
+    };
+
+    const char *ScenarioName(Scenario s) {
+        switch (s) {
+            case Scenario::Echo :       return "echo";
+            case Scenario::PingPong :   return "pingpong";
+            case Scenario::Stream :     return "stream";
+            case Scenario::Broadcast :  return "broadcast";
+            case Scenario::Accept :     return "accept";
+            case Scenario::File :       return "file";
+            case Scenario::Relay :      return "relay";
+            case Scenario::Priority :   return "priority";
+            case Scenario::Datagram :   return "datagram";
+            case Scenario::Http :       return "http";
+            case Scenario::WebSocket :  return "websocket";
+            case Scenario::WsBroadcast :return "wsbroadcast";
+            case Scenario::PubSub :     return "pubsub";
+            case Scenario::Pool :       return "pool";
+            case Scenario::Rpc :        return "rpc";
+        }
+        return "unknown";
+    }
+
+    struct Config {
+        Scenario        scenario        = Scenario::Echo;
+        const char     *address         = "127.0.0.1";      // Numeric address or host name clients connect to
+        const char     *listenAddress   = "0.0.0.0";        // Numeric address the server listens on
+        long long       connectDelay    = -1;       // Client connect attempt delay in ms, -1 for the default
+        const char     *dnsStub         = nullptr;  // IPv4 address of the stub DNS server clients resolve host names with, nullptr for the system DNS
+        long long       dnsTtl          = 60;       // Seconds of TTL the stub DNS server answers with
+        DWORD           ring            = 0;        // Bytes per direction of the shared memory rings of unix sockets, 0 for none
+        bool            tls             = false;    // Connections over TLS, server certificate self-signed for the run
+        SocketManager::Compression compression = SocketManager::Compression::NO_COMPRESSION;  // Echo and stream : both ends compress every connection
+        Payload         payload         = Payload::Zeros;
+        u_short         port            = 55555;
+        int             connections     = 10;
+        u_long          messageSize     = 64;
+        double          rate            = 0;        // Total messages per second over all connections, 0 for closed loop / max speed
+        double          duration        = 10;       // Measured seconds
+        double          warmup          = 1;        // Seconds run before measuring
+        int             pipeline        = 1;        // Max messages in flight per connection (echo and pingpong), datagrams per send (datagram)
+        int             shards          = 0;        // Server managers, 0 for a single unsharded one
+        bool            pin             = true;     // Sharded server : pin each shard to its own processor and NUMA node
+        u_long          zeroCopy        = 0;        // Client zero-copy send threshold, 0 to copy every message
+        bool            sendFile        = true;     // File : send with SendFile, else read the file and copy it with SendData
+        bool            relay           = true;     // Relay : pipe sources to sinks with RelayData, else copy from ReceiveData with SendData
+        int             isbFactor       = 0;        // Client isb factor, 0 for the fixed 64kB max pending send
+        SocketManager::ISBSource isbSource = SocketManager::ISBSource::IDEAL_SEND_BACKLOG;
+        double          shape           = 0;        // Stream : bytes/s the server reads each connection at, 0 for no limit
+        u_long          bulkSize        = 16384;    // Priority : size of bulk messages, 0 for control messages alone
+        bool            schedule        = true;     // Priority : clients use send scheduling
+        ULONG64         memoryBudget    = 0;        // Server hard memory limit in bytes, 0 for none
+        long long       drain           = -1;       // Drain timeout in ms of the server shutdown measured after the run, -1 to skip it
+        int             listeners       = 1;        // Server listen ports, from port on
+        bool            listenerManagers = false;   // Each listener after the first gets a server of its own instead of sharing the first one
+        SocketManager::Backpressure backpressure = SocketManager::Backpressure::DROP_NEWEST;   // PubSub : policy of every subscriber
+        DWORD           slow            = 0;        // Pool : ms backend 0 holds every read before echoing it
+        ConnectionPool::Balancing balancing = ConnectionPool::Balancing::LEAST_LOADED;     // Pool : how requests are spread over backends
+        const char     *output          = nullptr;
+    };
+
+    const u_long STAMP_SIZE = sizeof(LONGLONG);
+    const u_long FILE_SLICE_SIZE = 16384;           // File : read size of the buffered path
+
+    class MessageReader {                           // Split a byte stream of fixed size messages and extract their time stamp
+    private:
+        char            stamp[STAMP_SIZE]{};
+        u_long          offset          = 0;        // Position inside the current message
+    public:
+        template<typename F>
+        void            Feed            (const char *data, u_long length, u_long messageSize, F onMessage, u_long stampOffset = 0) {  // stamp at stampOffset of each message (after the head of an HTTP response)
+            while (length > 0) {
+                u_long take = messageSize - offset < length ? messageSize - offset : length;
+                u_long from = offset > stampOffset ? offset : stampOffset;
+                u_long to = offset + take < stampOffset + STAMP_SIZE ? offset + take : stampOffset + STAMP_SIZE;
+                if (from < to)
+                    memcpy(stamp + from - stampOffset, data + from - offset, to - from);
+                offset += take;
+                data += take;
+                length -= take;
+                if (offset == messageSize) {
+                    LONGLONG sentAt;
+                    memcpy(&sentAt, stamp, STAMP_SIZE);
+                    offset = 0;
+                    onMessage(sentAt);
+                }
+            }
+        }
+    };
+
+    struct SendSlot {                               // Zero-copy : a message given to SendDataNoCopy, busy until released
+        std::vector<char>   data;
+        volatile LONG       busy            = 0;
+    };
+
+    struct Connection {
+        UUID            id{};
+        UUID            sinkId{};                   // Relay : connection receiving what is sent on id
+        std::vector<std::unique_ptr<SendSlot>> slots;   // Zero-copy : enough messages to fill the max pending send
+        MessageReader   reader;
+        volatile LONG   outstanding     = 0;        // Messages sent and not yet answered
+        LONGLONG        nextSendTime    = 0;        // Intended time of next open-loop send
+        LONGLONG        connectTime     = 0;        // Accept : when the current connection was started
+        bool            sent            = false;    // Accept : message of the current connection is sent, File : stamp of the current file is sent
+        ULONG64         fileOffset      = 0;        // File : bytes of the current file already given to the manager
+        u_short         port            = 0;        // Listener the connection (and its sink) connects to
+        volatile LONG   handshake       = 0;        // WebSocket : bytes of the 101 answer to the upgrade not received yet
+    };
+
+    struct Context {
+        Config                          config;
+        Benchmark::LatencyRecorder      latencies;
+        volatile LONG                   running         = 1;    // Generators stop sending when 0
+        volatile LONG64                 sendFailures    = 0;    // SendData refused (backpressure or closed socket)
+        volatile LONG64                 echoFailures    = 0;    // Server could not echo a chunk (its own backpressure)
+        volatile LONG64                 helloBytes      = 0;    // Broadcast, pubsub and relay : bytes received by server to know every client has been accepted
+        double                          maxPendingSend  = 0;    // Mean max pending send of client connections at the end of the run
+        SocketManager::MemoryStats      serverMemory{};         // Server memory at the end of the run
+        double                          shutdownMs      = 0;    // Time taken by the server drain
+        bool                            shutdownFlushed = false;// Every send was done before the drain timeout
+        SocketManager::DnsStats         dns{};                  // Client host name resolutions at the end of the run
+        LONG64                          dnsQueries      = 0;    // Queries answered by the stub DNS server
+        SocketManager::DatagramStats    serverDatagrams{};      // Datagram : server side at the end of the run
+        SocketManager::DatagramStats    clientDatagrams{};      // Datagram : client side at the end of the run
+        SocketManager::TlsStats         serverTls{};            // Server handshakes at the end of the run
+        SocketManager::CompressionStats serverCompression{};    // Compression of the server at the end of the run
+        SocketManager::CompressionStats clientCompression{};    // Same for the client
+        SocketManager::PubSubStats      serverPubSub{};         // PubSub : server publications at the end of the run
+        ConnectionPool::PoolStats       pool{};                 // Pool : client pool at the end of the run
+        std::vector<ConnectionPool::BackendStats> poolBackends; // Pool : each backend at the end of the run
+        RpcClient::Stats                rpc{};                  // Rpc : client calls at the end of the run
+        std::string                     httpHead;               // Http : head of every request, its body is the message
+        u_long                          httpResponseHead = 0;   // Http : size of the head of every response, its body is the echoed message
+        std::string                     wsUpgrade;              // WebSocket : upgrade request sent on every connection
+        u_long                          wsResponseHead  = 0;    // WebSocket : size of its 101 answer
+        u_long                          wsFrameHead     = 0;    // WebSocket : size of the header of every frame the server sends, its payload is the message
+    };
+
+    void Stamp(std::vector<char> &msg, LONGLONG at) {
+        memcpy(msg.data(), &at, STAMP_SIZE);
+    }
+
+    void FillPayload(std::vector<char> &msg, Payload payload) {  // Everything after the stamp
+        ULONG   seed    = 12345;
+        size_t  i       = STAMP_SIZE;
+
+        if (payload == Payload::Random) {
+            for ( ; i < msg.size() ; i++) {
+                seed = seed * 1103515245 + 12345;
+                msg[i] = static_cast<char>(seed >> 16);
+            }
+            return;
+        }
+        while (payload == Payload::Text && i < msg.size()) {
+            char line[160];
+            seed = seed * 1103515245 + 12345;
+            int length = snprintf(line, sizeof(line), "{\"ts\":%lu,\"level\":\"%s\",\"user\":%lu,\"path\":\"/api/items/%lu\",\"status\":%d,\"ms\":%lu}\n",
+                                  1700000000UL + (seed >> 20), (seed & 7) == 0 ? "warn" : "info", (seed >> 8) % 5000, (seed >> 4) % 100000,
+                                  (seed & 15) == 0 ? 404 : 200, (seed >> 12) % 250);
+            for (int j = 0 ; j < length && i < msg.size() ; j++)
+                msg[i++] = line[j];
+        }
+    }
+
+    void RecordLatency(Context &ctx, LONGLONG sentAt) {
+        ctx.latencies.Record(Benchmark::Clock::ToNanoseconds(Benchmark::Clock::Now() - sentAt));
+    }
+
+    /************* BenchServer ***********/
+    class BenchServer : public SocketManager {
+    private:
+        Context                                 &ctx;
+        CriticalMap<Socket*, MessageReader*>    readers;        // Stream scenario only, one reader per accepted socket
+        std::vector<std::unique_ptr<MessageReader>> readerStorage;
+        CriticalMap<LONGLONG, Socket*>          halves;         // Relay : connections waiting for the other side of their pair, by hello
+        CriticalMap<Socket*, Socket*>           sinks;          // Relay with copy : sink of each source
+        CriticalMap<Socket*, LONGLONG>          shapeClocks;    // Stream with --shape : time at which everything read on a socket is allowed
+
+        void            Shape           (Socket *socket, u_long length) {      // Stream : hold the reading thread so the socket is read at --shape bytes/s, the client sees a slow receiver
+            LONGLONG now = Benchmark::Clock::Now();
+            LONGLONG until;
+            auto     wire = static_cast<double>(length);
+            if (ctx.config.compression != SocketManager::Compression::NO_COMPRESSION) {  // charged for what went on the link, at the ratio so far
+                CompressionStats stats = GetCompressionStats();
+                if (stats.rawBytesReceived > 0)
+                    wire = wire * static_cast<double>(stats.packedBytesReceived) / static_cast<double>(stats.rawBytesReceived);
+            }
+            EnterCriticalSection(&shapeClocks.critSec);
+            {
+                LONGLONG &clock = shapeClocks.map[socket];
+                if (clock < now)
+                    clock = now;
+                clock += static_cast<LONGLONG>(wire * static_cast<double>(Benchmark::Clock::Frequency()) / ctx.config.shape);
+                until = clock;
+            }
+            LeaveCriticalSection(&shapeClocks.critSec);
+            while (Benchmark::Clock::Now() < until)
+                Sleep(1);
+        }
+
+        void            Pair            (const char *data, u_long length, Socket *socket) {    // Relay : hello is pair index * 2, + 1 for the sink
+            LONGLONG    hello;
+            Socket     *partner     = nullptr;
+
+            if (length != STAMP_SIZE)
+                return;
+            memcpy(&hello, data, STAMP_SIZE);
+            EnterCriticalSection(&halves.critSec);
+            {
+                auto it = halves.map.find(hello ^ 1);
+                if (it != halves.map.end()) {
+                    partner = it->second;
+                    halves.map.erase(it);
+                } else
+                    halves.map[hello] = socket;
+            }
+            LeaveCriticalSection(&halves.critSec);
+            if (partner != nullptr) {
+                Socket *source = hello & 1 ? partner : socket;
+                Socket *sink = hello & 1 ? socket : partner;
+                if (ctx.config.relay) {
+                    if (!RelayData(source, sink))
+                        InterlockedIncrement64(&ctx.echoFailures);
+                } else {
+                    EnterCriticalSection(&sinks.critSec);
+                    {
+                        sinks.map[source] = sink;
+                    }
+                    LeaveCriticalSection(&sinks.critSec);
+                }
+            }
+            InterlockedExchangeAdd64(&ctx.helloBytes, static_cast<LONG64>(length));   // after pairing, clients start sending once every hello is counted
+        }
+
+        MessageReader  *ReaderOf        (Socket *socket) {
+            MessageReader *reader = readers.Get(socket);
+            if (reader == nullptr) {
+                EnterCriticalSection(&readers.critSec);
+                {
+                    readerStorage.emplace_back(new MessageReader());
+                    reader = readerStorage.back().get();
+                    readers.map[socket] = reader;
+                }
+                LeaveCriticalSection(&readers.critSec);
+            }
+            return reader;
+        }
+
+        int             ReceiveData     (const char *data, u_long length, Socket *socket) final {
+            switch (ctx.config.scenario) {
+                case Scenario::Pool :
+                    if (holdMs > 0)                             // the slow backend, its other connections are read by the other worker threads meanwhile
+                        Sleep(holdMs);
+                    /** NOBREAK **/
+                case Scenario::Echo :
+                    /** NOBREAK **/
+                case Scenario::PingPong :{
+                    if (!SendData(data, length, socket))
+                        InterlockedIncrement64(&ctx.echoFailures);
+                    break;
+                }
+                case Scenario::Accept :{                        // messages are small enough to arrive in one read
+                    if (!SendData(data, length, socket))
+                        InterlockedIncrement64(&ctx.echoFailures);
+                    CloseSocket(socket);                        // server closes first so TIME_WAIT doesn't eat client ephemeral ports
+                    break;
+                }
+                case Scenario::Stream :
+                    if (ctx.config.shape > 0)
+                        Shape(socket, length);
+                    /** NOBREAK **/
+                case Scenario::File :{
+                    ReaderOf(socket)->Feed(data, length, ctx.config.messageSize, [this](LONGLONG sentAt){ RecordLatency(ctx, sentAt); });
+                    break;
+                }
+                case Scenario::Broadcast :{
+                    InterlockedExchangeAdd64(&ctx.helloBytes, static_cast<LONG64>(length));
+                    break;
+                }
+                case Scenario::PubSub :{                        // subscribed by its hello, again if it takes more than one read (no-op)
+                    if (!Subscribe("bench", socket, ctx.config.backpressure))
+                        InterlockedIncrement64(&ctx.echoFailures);
+                    InterlockedExchangeAdd64(&ctx.helloBytes, static_cast<LONG64>(length));
+                    break;
+                }
+                case Scenario::Relay :{
+                    Socket *sink = sinks.Get(socket);
+                    if (sink == nullptr)
+                        Pair(data, length, socket);
+                    else if (!SendData(data, length, sink))
+                        InterlockedIncrement64(&ctx.echoFailures);
+                    break;
+                }
+                case Scenario::Priority :
+                    break;                                      // framed, see ReceiveMessage
+                case Scenario::Datagram :
+                    break;                                      // no stream connection, see ReceiveDatagram
+                case Scenario::Http :
+                    break;                                      // answered by the HttpHandler of the listener
+                case Scenario::WebSocket :
+                    /** NOBREAK **/
+                case Scenario::WsBroadcast :
+                    break;                                      // answered by the WebSocketHandler of the listener
+                case Scenario::Rpc :
+                    break;                                      // answered by the RpcHandler of the listener
+            }
+            return 1;
+        }
+
+        void            ReceiveDatagram (const char *data, u_long length, const SOCKADDR_STORAGE &peer, Socket *socket) final {
+            LONGLONG sentAt;
+            if (length < STAMP_SIZE)
+                return;
+            memcpy(&sentAt, data, STAMP_SIZE);
+            RecordLatency(ctx, sentAt);
+        }
+
+        int             ReceiveMessage  (const char *data, u_long length, Socket *socket) final {   // Priority : bulk messages are stamped 0
+            LONGLONG sentAt = 0;
+            if (length >= STAMP_SIZE)
+                memcpy(&sentAt, data, STAMP_SIZE);
+            if (sentAt != 0)
+                RecordLatency(ctx, sentAt);
+            return 1;
+        }
+    public:
+        class Handler : public SocketHandler {      // --listeners : handler of each listener, gives what it reads to the server which accepted it
+        public:
+            int         ReceiveData     (SocketManager &manager, const char *data, u_long length, Socket *socket) final { return static_cast<BenchServer&>(manager).ReceiveData(data, length, socket); }
+            int         ReceiveMessage  (SocketManager &manager, const char *data, u_long length, Socket *socket) final { return static_cast<BenchServer&>(manager).ReceiveMessage(data, length, socket); }
+        };
+
+        DWORD           holdMs          = 0;        // Pool : ms every read is held before it is echoed, set on backend 0 only
+
+                        BenchServer     (Context &c, DWORD threadCount, const Placement &placement) : SocketManager(Type::SERVER, 0, threadCount, placement), ctx(c) {}
+    };
+    ////////////// BenchServer ////////////
+
+    /************* EchoHttpHandler ***********/
+    class EchoHttpHandler : public HttpHandler {        // Http : the body of each request is the body of its response, not copied before the send
+    protected:
+        void            HandleRequest   (SocketManager &manager, const HttpRequest &request, HttpResponse &response, Socket *socket) final {
+            response.Body(request.body);
+        }
+    };
+    ////////////// EchoHttpHandler ////////////
+
+    /************* EchoWebSocketHandler ***********/
+    class EchoWebSocketHandler : public WebSocketHandler {  // WebSocket : each message is sent back in a frame of its own, WsBroadcast : every connection subscribes
+    private:
+        Context        &ctx;
+    protected:
+        bool            Open            (SocketManager &manager, const HttpRequest &request, Socket *socket) final {
+            if (ctx.config.scenario == Scenario::WsBroadcast)
+                Subscribe(manager, socket);
+            return true;
+        }
+        void            HandleMessage   (SocketManager &manager, Opcode opcode, const char *payload, u_long length, Socket *socket) final {
+            if (!Send(manager, payload, length, socket, opcode))
+                InterlockedIncrement64(&ctx.echoFailures);
+        }
+    public:
+        explicit        EchoWebSocketHandler (Context &c) : ctx(c) {}
+
+        int             SendDataToAll   (const char *data, u_long length) { return Broadcast(data, length); }   // What GenerateBroadcastLoad sends with
+    };
+    ////////////// EchoWebSocketHandler ////////////
+
+    /************* EchoRpcHandler ***********/
+    class EchoRpcHandler : public RpcHandler {          // Rpc : each request is answered right away with its own payload, not copied before the send
+    private:
+        Context        &ctx;
+    protected:
+        void            HandleCall      (const Call &call, const char *payload, u_long length, Socket *socket) final {
+            if (!Reply(call, payload, length))
+                InterlockedIncrement64(&ctx.echoFailures);
+        }
+    public:
+        explicit        EchoRpcHandler  (Context &c) : ctx(c) {}
+    };
+    ////////////// EchoRpcHandler ////////////
+
+    /************* BenchClient ***********/
+    class BenchClient : public SocketManager {
+    private:
+        Context                                 &ctx;
+        std::unordered_map<UUID, Connection*>   connectionMap;  // Filled before any traffic, read only afterward
+        CriticalMap<UUID, Connection*>          acceptMap;      // Accept : current connection of each slot, changes during the run
+
+        Connection     *ConnectionOf    (UUID id) {
+            if (ctx.config.scenario == Scenario::Accept)
+                return acceptMap.Get(id);
+            auto it = connectionMap.find(id);
+            return it == connectionMap.end() ? nullptr : it->second;
+        }
+
+        int             ReceiveData     (const char *data, u_long length, Socket *socket) final {
+            if (ctx.config.scenario == Scenario::Pool)
+                return ReceivePooled(data, length, socket);
+            Connection *conn = ConnectionOf(socket->GetId());
+            if (conn == nullptr)
+                return 0;
+            if (conn->handshake > 0) {                          // WebSocket : 101 answer of the upgrade, frames follow it
+                u_long skip = static_cast<u_long>(conn->handshake) < length ? static_cast<u_long>(conn->handshake) : length;
+                data += skip;
+                length -= skip;
+                InterlockedExchangeAdd(&conn->handshake, -static_cast<LONG>(skip));
+            }
+            bool websocket = ctx.config.scenario == Scenario::WebSocket || ctx.config.scenario == Scenario::WsBroadcast;
+            u_long head = ctx.config.scenario == Scenario::Http ? ctx.httpResponseHead : websocket ? ctx.wsFrameHead : 0;
+            conn->reader.Feed(data, length, head + ctx.config.messageSize, [this, conn, socket](LONGLONG sentAt){
+                RecordLatency(ctx, sentAt);
+                if (ctx.config.scenario == Scenario::Broadcast || ctx.config.scenario == Scenario::WsBroadcast || ctx.config.scenario == Scenario::PubSub)
+                    return;
+                if (ctx.config.scenario == Scenario::Accept) {
+                    CloseSocket(socket);
+                    InterlockedDecrement(&conn->outstanding);
+                    return;
+                }
+                InterlockedDecrement(&conn->outstanding);
+                if ((ctx.config.scenario == Scenario::PingPong || ctx.config.scenario == Scenario::Http || ctx.config.scenario == Scenario::WebSocket) && ctx.running) {
+                    static thread_local std::vector<char> msg;
+                    msg.resize(ctx.config.messageSize);
+                    Stamp(msg, Benchmark::Clock::Now());
+                    InterlockedIncrement(&conn->outstanding);
+                    if (!SendStamped(msg, socket)) {
+                        InterlockedDecrement(&conn->outstanding);
+                        InterlockedIncrement64(&ctx.sendFailures);
+                    }
+                }
+            }, head);
+            return 1;
+        }
+
+        int             ReceivePooled   (const char *data, u_long length, Socket *socket) {   // Pool : connections are the pool's, each response completes a request of the one it came on
+            UUID            id      = socket->GetId();
+            MessageReader  *reader  = pooledReaders.Get(id);
+            if (reader == nullptr) {                            // first response on this connection, replaced connections get a new one
+                EnterCriticalSection(&pooledReaders.critSec);
+                {
+                    readerStorage.emplace_back(new MessageReader());
+                    reader = readerStorage.back().get();
+                    pooledReaders.map[id] = reader;
+                }
+                LeaveCriticalSection(&pooledReaders.critSec);
+            }
+            reader->Feed(data, length, ctx.config.messageSize, [this, id](LONGLONG sentAt){
+                RecordLatency(ctx, sentAt);
+                pool->Complete(id);
+                if (ctx.config.rate <= 0 && ctx.running) {     // closed loop : the response makes room for the next request, wherever the pool sends it
+                    static thread_local std::vector<char> msg;
+                    msg.resize(ctx.config.messageSize);
+                    Stamp(msg, Benchmark::Clock::Now());
+                    SendPooled(msg);
+                }
+            });
+            return 1;
+        }
+
+        int             ReceiveMessage  (const char *data, u_long length, Socket *socket) final {   // Rpc : every message is a response
+            if (rpc != nullptr)
+                rpc->Dispatch(data, length);
+            return 1;
+        }
+
+        void            Returned        (Connection *conn, RpcClient::Status status, const char *payload, u_long length) {    // Rpc : a call completed, the next one goes on the same connection
+            LONGLONG sentAt;
+            if (status == RpcFrame::OK && length >= STAMP_SIZE) {
+                memcpy(&sentAt, payload, STAMP_SIZE);
+                RecordLatency(ctx, sentAt);
+            }
+            InterlockedDecrement(&conn->outstanding);
+            if (ctx.running) {
+                static thread_local std::vector<char> msg;
+                msg.resize(ctx.config.messageSize);
+                SendCall(*conn, msg, Benchmark::Clock::Now());
+            }
+        }
+
+        void            ReleaseSendData (const char *data, u_long length, void *context, bool sent, Socket *socket) final {
+            InterlockedExchange(&static_cast<SendSlot*>(context)->busy, 0);
+        }
+
+        void            ReleaseFile     (HANDLE file, void *context, bool sent, Socket *socket) final {
+            if (!sent)
+                InterlockedIncrement64(&ctx.sendFailures);
+            InterlockedDecrement(&static_cast<Connection*>(context)->outstanding);
+        }
+
+        SendSlot       *FreeSlot        (Connection &conn) {
+            if (conn.slots.empty()) {
+                for (u_long i = 0 ; i < 65536 / ctx.config.messageSize + 1 ; i++) {
+                    conn.slots.emplace_back(new SendSlot());
+                    conn.slots.back()->data.resize(ctx.config.messageSize);
+                    FillPayload(conn.slots.back()->data, ctx.config.payload);
+                }
+            }
+            for (auto &slot : conn.slots) {
+                if (InterlockedCompareExchange(&slot->busy, 1, 0) == 0)
+                    return slot.get();
+            }
+            return nullptr;
+        }
+    public:
+        std::vector<std::unique_ptr<Connection>> connections;
+        std::unique_ptr<ConnectionPool>         pool;           // Pool : owns every connection of the client
+        CriticalMap<UUID, MessageReader*>       pooledReaders;  // Pool : reader of each connection of the pool
+        std::vector<std::unique_ptr<MessageReader>> readerStorage;  // Guarded by the pooledReaders lock
+        std::unique_ptr<RpcClient>              rpc;            // Rpc : destroyed before connections, so calls failed by its destructor find theirs
+
+        explicit        BenchClient     (Context &c) : SocketManager(Type::CLIENT, static_cast<unsigned short>(c.config.isbFactor)), ctx(c) {
+            SetISBSource(ctx.config.isbSource);
+            SetZeroCopyThreshold(ctx.config.zeroCopy);
+            SetSharedMemoryRing(ctx.config.ring);
+            SetCompression(ctx.config.compression);
+            if (ctx.config.connectDelay >= 0)
+                SetConnectAttemptDelay(static_cast<DWORD>(ctx.config.connectDelay));
+            if (ctx.config.scenario == Scenario::Priority) {
+                SendScheduling scheduling;
+                scheduling.enabled = ctx.config.schedule;
+                SetSendScheduling(scheduling);
+                SetDefaultFraming(MessageFramer::LengthPrefixed());
+            }
+            if (ctx.config.scenario == Scenario::Rpc) {
+                RpcClient::Options options;
+                options.capacity = static_cast<DWORD>(ctx.config.connections) * static_cast<DWORD>(ctx.config.pipeline);
+                SetDefaultFraming(RpcFrame::Framing());
+                rpc.reset(new RpcClient(*this, options));
+            }
+        }
+
+        bool            Connect         () {
+            RPC_STATUS status;
+            for (int i = 0 ; i < ctx.config.connections ; i++) {
+                std::unique_ptr<Connection> conn(new Connection());
+                conn->port = static_cast<u_short>(ctx.config.port + i % ctx.config.listeners);
+                conn->id = ConnectToNewSocket(ctx.config.address, conn->port);
+                if (UuidIsNil(&conn->id, &status)) {
+                    LOG_ERROR("connection %d failed\n", i);
+                    return false;
+                }
+                connectionMap[conn->id] = conn.get();
+                if (ctx.config.scenario == Scenario::Relay) {
+                    conn->sinkId = ConnectToNewSocket(ctx.config.address, conn->port);
+                    if (UuidIsNil(&conn->sinkId, &status)) {
+                        LOG_ERROR("sink connection %d failed\n", i);
+                        return false;
+                    }
+                    connectionMap[conn->sinkId] = conn.get();
+                }
+                connections.push_back(std::move(conn));
+            }
+            return true;
+        }
+
+        bool            OpenPool        (DWORD timeoutMs) {       // Pool : one backend per listener, wait for all their warm connections
+            ConnectionPool::Options options;
+            options.connectionsPerBackend = ctx.config.connections / ctx.config.listeners > 0 ? ctx.config.connections / ctx.config.listeners : 1;
+            options.balancing = ctx.config.balancing;
+            pool.reset(new ConnectionPool(*this, options));
+            for (int i = 0 ; i < ctx.config.listeners ; i++)
+                pool->AddBackend(ctx.config.address, static_cast<u_short>(ctx.config.port + i));
+            DWORD start = GetTickCount();
+            for (int i = 0 ; i < ctx.config.listeners ; i++) {
+                while (pool->GetBackendStats(i).healthy < options.connectionsPerBackend) {
+                    if (GetTickCount() - start > timeoutMs)
+                        return false;
+                    Sleep(10);
+                }
+            }
+            return true;
+        }
+
+        bool            SendPooled      (const std::vector<char> &msg) {
+            RPC_STATUS status;
+            UUID id = pool->Send(msg.data(), ctx.config.messageSize);
+            if (UuidIsNil(&id, &status)) {
+                InterlockedIncrement64(&ctx.sendFailures);
+                return false;
+            }
+            return true;
+        }
+
+        bool            OpenDatagrams   () {                          // Datagram : one UDP socket per connection, on an ephemeral port
+            RPC_STATUS status;
+            for (int i = 0 ; i < ctx.config.connections ; i++) {
+                std::unique_ptr<Connection> conn(new Connection());
+                conn->id = OpenDatagramSocket(ctx.config.address, 0);
+                if (UuidIsNil(&conn->id, &status)) {
+                    LOG_ERROR("datagram socket %d failed\n", i);
+                    return false;
+                }
+                connections.push_back(std::move(conn));
+            }
+            return true;
+        }
+
+        void            Reconnect       (Connection &conn) {      // Accept : start a new connection in this slot
+            RPC_STATUS status;
+            if (!UuidIsNil(&conn.id, &status)) {
+                EnterCriticalSection(&acceptMap.critSec);
+                {
+                    acceptMap.map.erase(conn.id);
+                }
+                LeaveCriticalSection(&acceptMap.critSec);
+            }
+            conn.reader = MessageReader();
+            conn.sent = false;
+            conn.outstanding = 0;
+            conn.connectTime = Benchmark::Clock::Now();
+            conn.id = ConnectToNewSocket(ctx.config.address, conn.port);
+            if (UuidIsNil(&conn.id, &status)) {
+                InterlockedIncrement64(&ctx.sendFailures);
+                return;
+            }
+            EnterCriticalSection(&acceptMap.critSec);
+            {
+                acceptMap.map[conn.id] = &conn;
+            }
+            LeaveCriticalSection(&acceptMap.critSec);
+        }
+
+        bool            WaitConnected   (DWORD timeoutMs) {
+            DWORD start = GetTickCount();
+            RPC_STATUS status;
+            for (auto &conn : connections) {
+                for (UUID id : {conn->id, conn->sinkId}) {
+                    while (!UuidIsNil(&id, &status) && !isClientSocketReady(id)) {
+                        if (!isSocketInitialising(id) || GetTickCount() - start > timeoutMs)
+                            return false;
+                        Sleep(10);
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool            Upgrade         (DWORD timeoutMs) {       // WebSocket : upgrade every connection, traffic starts once all of them got their 101
+            DWORD start = GetTickCount();
+            for (auto &conn : connections) {
+                conn->handshake = static_cast<LONG>(ctx.wsResponseHead);
+                if (!SendData(ctx.wsUpgrade.data(), static_cast<u_long>(ctx.wsUpgrade.size()), conn->id))
+                    return false;
+            }
+            for (auto &conn : connections) {
+                while (conn->handshake > 0) {
+                    if (GetTickCount() - start > timeoutMs)
+                        return false;
+                    Sleep(10);
+                }
+            }
+            return true;
+        }
+
+        template<typename To>
+        bool            SendStamped     (const std::vector<char> &msg, To to) {    // The message as is, as the body of a request (Http) sent as one gather write with its head, or in a masked frame (WebSocket)
+            if (ctx.config.scenario == Scenario::WebSocket) {   // masked with a key of its own like a browser would, the server unmasks it in place
+                static thread_local std::vector<char> frame;
+                static const u_char key[4] = {0x5A, 0x3C, 0x96, 0xE1};
+                frame.resize(WebSocketParser::MAX_HEADER_SIZE + ctx.config.messageSize);
+                u_long head = WebSocketParser::EncodeHeader(WebSocketParser::BINARY, true, ctx.config.messageSize, frame.data(), key);
+                memcpy(frame.data() + head, msg.data(), ctx.config.messageSize);
+                WebSocketParser::Mask(frame.data() + head, ctx.config.messageSize, key);
+                return SendData(frame.data(), head + ctx.config.messageSize, to);
+            }
+            if (ctx.config.scenario != Scenario::Http)
+                return SendData(msg.data(), ctx.config.messageSize, to);
+            WSABUF pieces[2];
+            pieces[0].buf = const_cast<char*>(ctx.httpHead.data());
+            pieces[0].len = static_cast<u_long>(ctx.httpHead.size());
+            pieces[1].buf = const_cast<char*>(msg.data());
+            pieces[1].len = ctx.config.messageSize;
+            return SendData(pieces, 2, to);
+        }
+
+        bool            Send            (Connection &conn, std::vector<char> &msg, LONGLONG stamp) {
+            if (ctx.config.zeroCopy > 0)
+                return SendNoCopy(conn, stamp);
+            Stamp(msg, stamp);
+            InterlockedIncrement(&conn.outstanding);
+            if (!SendStamped(msg, conn.id)) {
+                InterlockedDecrement(&conn.outstanding);
+                InterlockedIncrement64(&ctx.sendFailures);
+                return false;
+            }
+            return true;
+        }
+
+        bool            SendCall        (Connection &conn, std::vector<char> &msg, LONGLONG stamp) {   // Rpc : one call on the connection, its payload is the stamped message
+            Stamp(msg, stamp);
+            InterlockedIncrement(&conn.outstanding);
+            Connection *target = &conn;
+            if (!rpc->Call(conn.id, 0, msg.data(), ctx.config.messageSize, [this, target](RpcClient::Status status, const char *payload, u_long length) {
+                    Returned(target, status, payload, length);
+                })) {
+                InterlockedDecrement(&conn.outstanding);
+                InterlockedIncrement64(&ctx.sendFailures);
+                return false;
+            }
+            return true;
+        }
+
+        bool            SendNoCopy      (Connection &conn, LONGLONG stamp) {
+            SendSlot *slot = FreeSlot(conn);
+            if (slot == nullptr) {                                  // every slot is still in the kernel's hands
+                InterlockedIncrement64(&ctx.sendFailures);
+                return false;
+            }
+            Stamp(slot->data, stamp);
+            InterlockedIncrement(&conn.outstanding);
+            if (!SendDataNoCopy(slot->data.data(), ctx.config.messageSize, conn.id, slot)) {
+                InterlockedExchange(&slot->busy, 0);
+                InterlockedDecrement(&conn.outstanding);
+                InterlockedIncrement64(&ctx.sendFailures);
+                return false;
+            }
+            return true;
+        }
+
+        bool            SendFilePart    (Connection &conn, HANDLE file, std::vector<char> &slice) {    // File : give the next part of the current file to the manager, false if the socket can't take it now
+            ULONG64 bodySize = ctx.config.messageSize - STAMP_SIZE;
+            if (!conn.sent) {
+                slice.resize(STAMP_SIZE);
+                Stamp(slice, Benchmark::Clock::Now());
+                if (!SendData(slice.data(), STAMP_SIZE, conn.id))
+                    return false;
+                conn.sent = true;
+                conn.fileOffset = 0;
+            }
+            if (ctx.config.sendFile) {
+                InterlockedIncrement(&conn.outstanding);
+                if (!SendFile(file, 0, bodySize, conn.id, &conn)) {
+                    InterlockedDecrement(&conn.outstanding);
+                    return false;
+                }
+                conn.fileOffset = bodySize;
+            } else {
+                OVERLAPPED  at{};
+                DWORD       read;
+                u_long      take = bodySize - conn.fileOffset < FILE_SLICE_SIZE ? static_cast<u_long>(bodySize - conn.fileOffset) : FILE_SLICE_SIZE;
+                at.Offset = static_cast<DWORD>(conn.fileOffset);
+                at.OffsetHigh = static_cast<DWORD>(conn.fileOffset >> 32);
+                slice.resize(take);
+                if (!ReadFile(file, slice.data(), take, &read, &at) || read != take) {
+                    InterlockedIncrement64(&ctx.sendFailures);
+                    return false;
+                }
+                if (!SendData(slice.data(), take, conn.id))
+                    return false;                               // read again on next pass, like a server without its own cache would
+                conn.fileOffset += take;
+            }
+            if (conn.fileOffset == bodySize)
+                conn.sent = false;                              // next call starts a new file
+            return true;
+        }
+    };
+    ////////////// BenchClient ////////////
+
+    const int MAX_BURST_PER_CONNECTION = 16;        // Max sends to one connection per generator pass, to stay fair between connections
+
+    void GenerateClientLoad(Context &ctx, BenchClient &client, LONGLONG endTime) {  // echo and stream sender loop
+        const Config       &cfg         = ctx.config;
+        bool                openLoop    = cfg.rate > 0;
+        bool                pipelined   = cfg.scenario == Scenario::Echo || cfg.scenario == Scenario::Relay;
+        LONGLONG            interval    = openLoop ? static_cast<LONGLONG>(static_cast<double>(Benchmark::Clock::Frequency()) * cfg.connections / cfg.rate) : 0;
+        std::vector<char>   msg(cfg.messageSize);
+        LONGLONG            now         = Benchmark::Clock::Now();
+
+        FillPayload(msg, cfg.payload);
+        for (size_t i = 0 ; i < client.connections.size() ; i++)        // spread first sends over one interval
+            client.connections[i]->nextSendTime = now + (openLoop ? interval * static_cast<LONGLONG>(i) / static_cast<LONGLONG>(client.connections.size()) : 0);
+
+        while ((now = Benchmark::Clock::Now()) < endTime) {
+            LONGLONG nextDue = endTime;
+            for (auto &conn : client.connections) {
+                for (int burst = 0 ; burst < MAX_BURST_PER_CONNECTION ; burst++) {
+                    if (pipelined && conn->outstanding >= cfg.pipeline)
+                        break;                                          // intended time is kept, wait is accounted in latency
+                    if (openLoop && conn->nextSendTime > now)
+                        break;
+                    if (!client.Send(*conn, msg, openLoop ? conn->nextSendTime : now))
+                        break;
+                    if (openLoop)
+                        conn->nextSendTime += interval;
+                }
+                if (openLoop && conn->nextSendTime < nextDue)
+                    nextDue = conn->nextSendTime;
+            }
+            if (openLoop && nextDue - Benchmark::Clock::Now() > Benchmark::Clock::FromSeconds(0.002))
+                Sleep(1);
+            else if (!openLoop)
+                Sleep(0);
+        }
+    }
+
+    void GenerateDatagramLoad(Context &ctx, BenchClient &client, const SOCKADDR_STORAGE &server, LONGLONG endTime) {  // datagram scenario, --pipeline datagrams per send
+        const Config       &cfg         = ctx.config;
+        bool                openLoop    = cfg.rate > 0;
+        LONGLONG            interval    = openLoop ? static_cast<LONGLONG>(static_cast<double>(Benchmark::Clock::Frequency()) * cfg.connections * cfg.pipeline / cfg.rate) : 0;
+        std::vector<char>   batch(static_cast<size_t>(cfg.messageSize) * cfg.pipeline);
+        LONGLONG            now         = Benchmark::Clock::Now();
+
+        for (size_t i = 0 ; i < client.connections.size() ; i++)
+            client.connections[i]->nextSendTime = now + (openLoop ? interval * static_cast<LONGLONG>(i) / static_cast<LONGLONG>(client.connections.size()) : 0);
+
+        while ((now = Benchmark::Clock::Now()) < endTime) {
+            LONGLONG nextDue = endTime;
+            for (auto &conn : client.connections) {
+                for (int burst = 0 ; burst < MAX_BURST_PER_CONNECTION ; burst++) {
+                    if (openLoop && conn->nextSendTime > now)
+                        break;
+                    LONGLONG stamp = openLoop ? conn->nextSendTime : now;
+                    for (int i = 0 ; i < cfg.pipeline ; i++)
+                        memcpy(batch.data() + static_cast<size_t>(i) * cfg.messageSize, &stamp, STAMP_SIZE);
+                    if (!client.SendDatagrams(batch.data(), cfg.messageSize, static_cast<u_long>(cfg.pipeline), server, conn->id)) {
+                        InterlockedExchangeAdd64(&ctx.sendFailures, cfg.pipeline);     // a datagram is never retried, like a real-time sender would
+                        if (openLoop)
+                            conn->nextSendTime += interval;
+                        break;
+                    }
+                    if (openLoop)
+                        conn->nextSendTime += interval;
+                }
+                if (openLoop && conn->nextSendTime < nextDue)
+                    nextDue = conn->nextSendTime;
+            }
+            if (openLoop && nextDue - Benchmark::Clock::Now() > Benchmark::Clock::FromSeconds(0.002))
+                Sleep(1);
+            else if (!openLoop)
+                Sleep(0);
+        }
+    }
+
+    void GeneratePriorityLoad(Context &ctx, BenchClient &client, LONGLONG endTime) {  // priority scenario, open loop control messages over closed loop bulk
+        const Config       &cfg         = ctx.config;
+        LONGLONG            interval    = cfg.rate > 0 ? static_cast<LONGLONG>(static_cast<double>(Benchmark::Clock::Frequency()) * cfg.connections / cfg.rate) : 0;
+        std::vector<char>   control(cfg.messageSize);
+        std::vector<char>   bulk(cfg.bulkSize);                 // stamped 0, left out of the latency
+        LONGLONG            now         = Benchmark::Clock::Now();
+
+        for (size_t i = 0 ; i < client.connections.size() ; i++)
+            client.connections[i]->nextSendTime = now + interval * static_cast<LONGLONG>(i) / static_cast<LONGLONG>(client.connections.size());
+
+        while ((now = Benchmark::Clock::Now()) < endTime) {
+            for (auto &conn : client.connections) {
+                // ----------------------------- control first, so it gets any room the completed sends made
+                for (int burst = 0 ; burst < MAX_BURST_PER_CONNECTION && conn->nextSendTime <= now ; burst++) {
+                    Stamp(control, conn->nextSendTime);
+                    if (!client.SendMessage(control.data(), cfg.messageSize, conn->id, SocketManager::SendClass::CONTROL)) {
+                        InterlockedIncrement64(&ctx.sendFailures);
+                        break;                                  // intended time is kept, wait is accounted in latency
+                    }
+                    conn->nextSendTime += interval;
+                }
+                for (int burst = 0 ; burst < MAX_BURST_PER_CONNECTION && cfg.bulkSize > 0 ; burst++) {
+                    if (!client.SendMessage(bulk.data(), cfg.bulkSize, conn->id, SocketManager::SendClass::BULK))
+                        break;                                  // backpressure is the point here, not counted
+                }
+            }
+            Sleep(0);
+        }
+    }
+
+    void GenerateConnectionLoad(Context &ctx, BenchClient &client, LONGLONG endTime) {  // accept scenario, closed loop over --connections slots
+        std::vector<char>   msg(ctx.config.messageSize);
+        RPC_STATUS          status;
+
+        for (int i = 0 ; i < ctx.config.connections ; i++) {
+            client.connections.emplace_back(new Connection());
+            client.connections.back()->port = static_cast<u_short>(ctx.config.port + i % ctx.config.listeners);
+        }
+        for (auto &conn : client.connections)
+            client.Reconnect(*conn);
+        while (Benchmark::Clock::Now() < endTime) {
+            for (auto &conn : client.connections) {
+                if (UuidIsNil(&conn->id, &status) || (conn->sent && conn->outstanding == 0)) {
+                    client.Reconnect(*conn);                        // done (or could not even start), next connection
+                } else if (!conn->sent) {
+                    if (client.isClientSocketReady(conn->id)) {
+                        conn->sent = true;
+                        if (!client.Send(*conn, msg, conn->connectTime))
+                            client.Reconnect(*conn);
+                    } else if (!client.isSocketInitialising(conn->id)) {
+                        InterlockedIncrement64(&ctx.sendFailures);  // connect failed
+                        client.Reconnect(*conn);
+                    }
+                }
+            }
+            Sleep(0);
+        }
+    }
+
+    void GenerateFileLoad(Context &ctx, BenchClient &client, HANDLE file, LONGLONG endTime) {  // file scenario, closed loop, a connection sends its next file as soon as the previous one is handed over
+        std::vector<char>   slice;
+
+        while (Benchmark::Clock::Now() < endTime) {
+            for (auto &conn : client.connections) {
+                for (int burst = 0 ; burst < MAX_BURST_PER_CONNECTION ; burst++) {
+                    if (conn->outstanding > 0 || !client.SendFilePart(*conn, file, slice))
+                        break;                                      // SendFile of the previous file still running, or backpressure
+                }
+            }
+            Sleep(0);
+        }
+    }
+
+    HANDLE CreateBenchFile(u_long size) {               // File : temporary file deleted when closed
+        TCHAR               dir[MAX_PATH];
+        TCHAR               path[MAX_PATH];
+        std::vector<char>   chunk(65536, 'f');
+        DWORD               written;
+
+        if (GetTempPath(MAX_PATH, dir) == 0 || GetTempFileName(dir, TEXT("smb"), 0, path) == 0)
+            return INVALID_HANDLE_VALUE;
+        HANDLE file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return file;
+        for (u_long done = 0 ; done < size ; done += written) {
+            DWORD take = size - done < chunk.size() ? size - done : static_cast<DWORD>(chunk.size());
+            if (!WriteFile(file, chunk.data(), take, &written, nullptr) || written == 0) {
+                CloseHandle(file);
+                return INVALID_HANDLE_VALUE;
+            }
+        }
+        return file;
+    }
+
+    template<typename Server>
+    void GenerateBroadcastLoad(Context &ctx, Server &server, LONGLONG endTime) {
+        const Config       &cfg         = ctx.config;
+        LONGLONG            interval    = cfg.rate > 0 ? static_cast<LONGLONG>(static_cast<double>(Benchmark::Clock::Frequency()) / cfg.rate) : 0;
+        LONGLONG            next        = Benchmark::Clock::Now();
+        std::vector<char>   msg(cfg.messageSize);
+        LONGLONG            now;
+
+        while ((now = Benchmark::Clock::Now()) < endTime) {
+            if (interval > 0 && next > now) {
+                if (next - now > Benchmark::Clock::FromSeconds(0.002))
+                    Sleep(1);
+                continue;
+            }
+            Stamp(msg, interval > 0 ? next : now);
+            int sent = server.SendDataToAll(msg.data(), cfg.messageSize);
+            InterlockedExchangeAdd64(&ctx.sendFailures, cfg.connections - sent);
+            next += interval;
+        }
+    }
+
+    void GeneratePoolLoad(Context &ctx, BenchClient &client, LONGLONG endTime) {    // Pool : requests at --rate through the pool, closed loop from ReceivePooled when 0
+        const Config       &cfg         = ctx.config;
+        LONGLONG            interval    = cfg.rate > 0 ? static_cast<LONGLONG>(static_cast<double>(Benchmark::Clock::Frequency()) / cfg.rate) : 0;
+        LONGLONG            next        = Benchmark::Clock::Now();
+        std::vector<char>   msg(cfg.messageSize);
+        LONGLONG            now;
+
+        if (interval == 0) {
+            for (int i = 0 ; i < cfg.connections * cfg.pipeline ; i++) {
+                Stamp(msg, Benchmark::Clock::Now());
+                client.SendPooled(msg);
+            }
+            while (Benchmark::Clock::Now() < endTime)
+                Sleep(1);
+            return;
+        }
+        while ((now = Benchmark::Clock::Now()) < endTime) {
+            if (next > now) {
+                if (next - now > Benchmark::Clock::FromSeconds(0.002))
+                    Sleep(1);
+                continue;
+            }
+            Stamp(msg, next);                                   // late sends keep their intended time
+            client.SendPooled(msg);
+            next += interval;
+        }
+    }
+
+    template<typename Server>
+    class TopicPublisher {                              // PubSub : what GenerateBroadcastLoad sends with, Publish returns the subscriber count (drops are in GetPubSubStats)
+    private:
+        Server         &server;
+    public:
+        explicit        TopicPublisher  (Server &s) : server(s) {}
+
+        int             SendDataToAll   (const char *data, u_long length) { return server.Publish("bench", data, length); }
+    };
+
+    /************* DnsStub ***********/
+    class DnsStub {                                     // Minimal DNS server : every A query gets 127.0.0.1, every AAAA query no record
+    private:
+        SOCKET                  s               = INVALID_SOCKET;
+        HANDLE                  thread          = nullptr;
+        DWORD                   ttl             = 0;    // Seconds
+
+        static DWORD WINAPI     Run             (LPVOID lpParam) {
+            auto           *stub = static_cast<DnsStub*>(lpParam);
+            char            query[512];
+            char            answer[512 + 16];
+            SOCKADDR_IN     from;
+            int             fromLength;
+            int             length;
+
+            while (true) {
+                fromLength = sizeof(from);
+                if ((length = recvfrom(stub->s, query, sizeof(query), 0, (SOCKADDR*)&from, &fromLength)) == SOCKET_ERROR) {
+                    if (WSAGetLastError() == WSAECONNRESET)     // ICMP port unreachable of an earlier answer
+                        continue;
+                    break;                                      // closed by Stop
+                }
+                // ----------------------------- header, then the question : name labels, type and class
+                int end = 12;
+                while (end < length && query[end] != 0)
+                    end += static_cast<unsigned char>(query[end]) + 1;
+                end += 5;
+                if (length < 12 || end > length)
+                    continue;
+                WORD type = static_cast<WORD>((static_cast<unsigned char>(query[end - 4]) << 8) | static_cast<unsigned char>(query[end - 3]));
+                memcpy(answer, query, end);                     // id and question as asked, additional records dropped
+                answer[2] = static_cast<char>(0x80 | (query[2] & 0x01));    // response, recursion desired as asked
+                answer[3] = static_cast<char>(0x80);            // recursion available, no error
+                answer[4] = 0; answer[5] = 1;                   // question count
+                answer[6] = 0; answer[7] = type == DNS_TYPE_A ? 1 : 0;      // answer count
+                memset(answer + 8, 0, 4);                       // authority and additional counts
+                if (type == DNS_TYPE_A) {
+                    const unsigned char record[] = {0xC0, 0x0C,                     // name : pointer to the question
+                                                    0x00, 0x01, 0x00, 0x01,         // type A, class IN
+                                                    static_cast<unsigned char>(stub->ttl >> 24), static_cast<unsigned char>(stub->ttl >> 16),
+                                                    static_cast<unsigned char>(stub->ttl >> 8), static_cast<unsigned char>(stub->ttl),
+                                                    0x00, 0x04, 127, 0, 0, 1};      // 127.0.0.1
+                    memcpy(answer + end, record, sizeof(record));
+                    end += sizeof(record);
+                }
+                sendto(stub->s, answer, end, 0, (SOCKADDR*)&from, fromLength);
+                InterlockedIncrement64(&stub->queries);
+            }
+            return NO_ERROR;
+        }
+    public:
+        volatile LONG64         queries         = 0;
+
+        bool                    Start           (const char *address, DWORD ttlSeconds) {
+            SOCKADDR_IN addr{};
+            ttl = ttlSeconds;
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(53);
+            if (inet_pton(AF_INET, address, &addr.sin_addr) != 1 || (s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+                return false;
+            if (bind(s, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+                fprintf(stderr, "dns stub bind failed / error %d\n", WSAGetLastError());
+                return false;
+            }
+            thread = CreateThread(nullptr, 0, Run, this, 0, nullptr);
+            return thread != nullptr;
+        }
+                                ~DnsStub        () {
+            if (s != INVALID_SOCKET)
+                closesocket(s);
+            if (thread != nullptr) {
+                WaitForSingleObject(thread, INFINITE);
+                CloseHandle(thread);
+            }
+        }
+    };
+    ////////////// DnsStub ////////////
+
+    /************* SelfSignedCertificate ***********/
+    class SelfSignedCertificate {                       // CN=localhost certificate with a new RSA key, the key container is deleted with it
+    private:
+        static constexpr const char *CONTAINER  = "SocketManagerLoadGenerator";
+        HCRYPTPROV              provider        = 0;
+    public:
+        PCCERT_CONTEXT          certificate     = nullptr;
+
+        bool                    Create          () {
+            HCRYPTKEY                   key         = 0;
+            BYTE                        name[256];
+            DWORD                       nameLength  = sizeof(name);
+            CERT_NAME_BLOB              subject{};
+            CRYPT_KEY_PROV_INFO         keyInfo{};
+            CRYPT_ALGORITHM_IDENTIFIER  algorithm{};
+            wchar_t                     container[64];
+
+            CryptAcquireContextA(&provider, CONTAINER, nullptr, PROV_RSA_AES, CRYPT_DELETEKEYSET);     // leftover of a killed run
+            if (!CryptAcquireContextA(&provider, CONTAINER, nullptr, PROV_RSA_AES, CRYPT_NEWKEYSET) ||
+                !CryptGenKey(provider, AT_KEYEXCHANGE, (2048 << 16) | CRYPT_EXPORTABLE, &key)) {
+                fprintf(stderr, "key generation failed / error %lu\n", GetLastError());
+                return false;
+            }
+            CryptDestroyKey(key);
+            if (!CertStrToNameA(X509_ASN_ENCODING, "CN=localhost", CERT_X500_NAME_STR, nullptr, name, &nameLength, nullptr)) {
+                fprintf(stderr, "certificate name failed / error %lu\n", GetLastError());
+                return false;
+            }
+            subject.cbData = nameLength;
+            subject.pbData = name;
+            MultiByteToWideChar(CP_ACP, 0, CONTAINER, -1, container, 64);
+            keyInfo.pwszContainerName = container;
+            keyInfo.dwProvType = PROV_RSA_AES;
+            keyInfo.dwKeySpec = AT_KEYEXCHANGE;
+            algorithm.pszObjId = const_cast<LPSTR>(szOID_RSA_SHA256RSA);
+            certificate = CertCreateSelfSignCertificate(provider, &subject, 0, &keyInfo, &algorithm, nullptr, nullptr, nullptr);
+            if (certificate == nullptr)
+                fprintf(stderr, "self-signed certificate failed / error %lu\n", GetLastError());
+            return certificate != nullptr;
+        }
+                                ~SelfSignedCertificate () {
+            if (certificate != nullptr)
+                CertFreeCertificateContext(certificate);
+            if (provider != 0) {
+                CryptReleaseContext(provider, 0);
+                CryptAcquireContextA(&provider, CONTAINER, nullptr, PROV_RSA_AES, CRYPT_DELETEKEYSET);
+            }
+        }
+    };
+    ////////////// SelfSignedCertificate ////////////
+
+    struct Starter {                                    // Flips recording on after warmup, while the generator runs
+        Context                 *ctx;
+        LONGLONG                 at;
+        Benchmark::ProcessUsage *cpuStart;
+    };
+
+    DWORD WINAPI StartRecording(LPVOID lpParam) {
+        auto *s = static_cast<Starter*>(lpParam);
+        while (Benchmark::Clock::Now() < s->at)
+            Sleep(1);
+        *s->cpuStart = Benchmark::ProcessUsage::Sample();
+        s->ctx->latencies.Start();
+        return NO_ERROR;
+    }
+
+    bool ParseConfig(const Benchmark::Arguments &args, Config &cfg) {
+        const char *scenario = args.Get("scenario", "echo");
+        if (strcmp(scenario, "echo") == 0)              cfg.scenario = Scenario::Echo;
+        else if (strcmp(scenario, "pingpong") == 0)     cfg.scenario = Scenario::PingPong;
+        else if (strcmp(scenario, "stream") == 0)       cfg.scenario = Scenario::Stream;
+        else if (strcmp(scenario, "broadcast") == 0)    cfg.scenario = Scenario::Broadcast;
+        else if (strcmp(scenario, "accept") == 0)       cfg.scenario = Scenario::Accept;
+        else if (strcmp(scenario, "file") == 0)         cfg.scenario = Scenario::File;
+        else if (strcmp(scenario, "relay") == 0)        cfg.scenario = Scenario::Relay;
+        else if (strcmp(scenario, "priority") == 0)     cfg.scenario = Scenario::Priority;
+        else if (strcmp(scenario, "datagram") == 0)     cfg.scenario = Scenario::Datagram;
+        else if (strcmp(scenario, "http") == 0)         cfg.scenario = Scenario::Http;
+        else if (strcmp(scenario, "websocket") == 0)    cfg.scenario = Scenario::WebSocket;
+        else if (strcmp(scenario, "wsbroadcast") == 0)  cfg.scenario = Scenario::WsBroadcast;
+        else if (strcmp(scenario, "pubsub") == 0)       cfg.scenario = Scenario::PubSub;
+        else if (strcmp(scenario, "pool") == 0)         cfg.scenario = Scenario::Pool;
+        else if (strcmp(scenario, "rpc") == 0)          cfg.scenario = Scenario::Rpc;
+        else {
+            fprintf(stderr, "unknown scenario %s\n", scenario);
+            return false;
+        }
+        cfg.address     = args.Get("address", cfg.address);
+        cfg.listenAddress = args.Get("listen-address", cfg.listenAddress);
+        cfg.connectDelay = args.GetInt("connect-delay", cfg.connectDelay);
+        cfg.dnsStub     = args.Get("dns-stub", cfg.dnsStub);
+        cfg.dnsTtl      = args.GetInt("dns-ttl", cfg.dnsTtl);
+        cfg.ring        = static_cast<DWORD>(args.GetInt("ring", cfg.ring));
+        cfg.tls         = args.GetInt("tls", cfg.tls) != 0;
+        const char *compress = args.Get("compress", "none");
+        if (strcmp(compress, "none") == 0)              cfg.compression = SocketManager::Compression::NO_COMPRESSION;
+        else if (strcmp(compress, "fast") == 0)         cfg.compression = SocketManager::Compression::FAST_COMPRESSION;
+        else if (strcmp(compress, "strong") == 0)       cfg.compression = SocketManager::Compression::STRONG_COMPRESSION;
+        else {
+            fprintf(stderr, "unknown compression %s\n", compress);
+            return false;
+        }
+        const char *payload = args.Get("payload", "zeros");
+        if (strcmp(payload, "zeros") == 0)              cfg.payload = Payload::Zeros;
+        else if (strcmp(payload, "text") == 0)          cfg.payload = Payload::Text;
+        else if (strcmp(payload, "random") == 0)        cfg.payload = Payload::Random;
+        else {
+            fprintf(stderr, "unknown payload %s\n", payload);
+            return false;
+        }
+        cfg.port        = static_cast<u_short>(args.GetInt("port", cfg.port));
+        cfg.connections = static_cast<int>(args.GetInt("connections", cfg.connections));
+        cfg.messageSize = static_cast<u_long>(args.GetInt("size", cfg.messageSize));
+        cfg.rate        = args.GetDouble("rate", cfg.rate);
+        cfg.duration    = args.GetDouble("duration", cfg.duration);
+        cfg.warmup      = args.GetDouble("warmup", cfg.warmup);
+        cfg.pipeline    = static_cast<int>(args.GetInt("pipeline", cfg.pipeline));
+        cfg.shards      = static_cast<int>(args.GetInt("shards", cfg.shards));
+        cfg.pin         = args.GetInt("pin", cfg.pin) != 0;
+        cfg.zeroCopy    = static_cast<u_long>(args.GetInt("zerocopy", cfg.zeroCopy));
+        cfg.sendFile    = args.GetInt("sendfile", cfg.sendFile) != 0;
+        cfg.relay       = args.GetInt("relay", cfg.relay) != 0;
+        cfg.isbFactor   = static_cast<int>(args.GetInt("isb", cfg.isbFactor));
+        cfg.shape       = args.GetDouble("shape", cfg.shape);
+        cfg.bulkSize    = static_cast<u_long>(args.GetInt("bulk-size", cfg.bulkSize));
+        cfg.schedule    = args.GetInt("schedule", cfg.schedule) != 0;
+        cfg.memoryBudget = static_cast<ULONG64>(args.GetInt("memory-budget", 0));
+        cfg.drain       = args.GetInt("drain", cfg.drain);
+        cfg.listeners   = static_cast<int>(args.GetInt("listeners", cfg.listeners));
+        cfg.listenerManagers = args.GetInt("listener-managers", cfg.listenerManagers) != 0;
+        const char *isbSource = args.Get("isb-source", "notify");
+        if (strcmp(isbSource, "notify") == 0)           cfg.isbSource = SocketManager::ISBSource::IDEAL_SEND_BACKLOG;
+        else if (strcmp(isbSource, "tcpinfo") == 0)     cfg.isbSource = SocketManager::ISBSource::TCP_INFO;
+        else {
+            fprintf(stderr, "unknown isb source %s\n", isbSource);
+            return false;
+        }
+        cfg.slow        = static_cast<DWORD>(args.GetInt("slow", cfg.slow));
+        const char *balance = args.Get("balance", "least");
+        if (strcmp(balance, "least") == 0)              cfg.balancing = ConnectionPool::Balancing::LEAST_LOADED;
+        else if (strcmp(balance, "roundrobin") == 0)    cfg.balancing = ConnectionPool::Balancing::ROUND_ROBIN;
+        else {
+            fprintf(stderr, "unknown balance %s\n", balance);
+            return false;
+        }
+        if (cfg.scenario == Scenario::Pool)
+            cfg.listenerManagers = true;                // every backend is a server of its own, so the slow one doesn't hold the others' threads
+        const char *backpressure = args.Get("backpressure", "newest");
+        if (strcmp(backpressure, "newest") == 0)        cfg.backpressure = SocketManager::Backpressure::DROP_NEWEST;
+        else if (strcmp(backpressure, "oldest") == 0)   cfg.backpressure = SocketManager::Backpressure::DROP_OLDEST;
+        else if (strcmp(backpressure, "disconnect") == 0) cfg.backpressure = SocketManager::Backpressure::DISCONNECT;
+        else {
+            fprintf(stderr, "unknown backpressure %s\n", backpressure);
+            return false;
+        }
+        cfg.output      = args.Get("output");
+
+        if (cfg.connections <= 0 || cfg.pipeline <= 0 || cfg.duration <= 0 || cfg.shards < 0 || cfg.isbFactor < 0 || cfg.shape < 0 || cfg.messageSize < STAMP_SIZE) {
+            fprintf(stderr, "invalid configuration (connections, pipeline and duration must be > 0, shards, isb and shape >= 0, size >= %lu)\n", STAMP_SIZE);
+            return false;
+        }
+        if (cfg.dnsTtl < 0) {
+            fprintf(stderr, "dns-ttl must be >= 0\n");
+            return false;
+        }
+        if (cfg.listeners <= 0 || cfg.port + cfg.listeners > 65536) {
+            fprintf(stderr, "listeners must be > 0 and all their ports <= 65535\n");
+            return false;
+        }
+        bool unixClient = strncmp(cfg.address, SocketManager::UNIX_ADDRESS_PREFIX, strlen(SocketManager::UNIX_ADDRESS_PREFIX)) == 0;
+        bool unixServer = strncmp(cfg.listenAddress, SocketManager::UNIX_ADDRESS_PREFIX, strlen(SocketManager::UNIX_ADDRESS_PREFIX)) == 0;
+        if (unixClient != unixServer || (unixClient && cfg.listeners > 1)) {    // each listener would need a path of its own
+            fprintf(stderr, "unix addresses go with a unix listen address and a single listener\n");
+            return false;
+        }
+        if (cfg.ring > 0 && (!unixClient || cfg.scenario == Scenario::File || cfg.scenario == Scenario::Relay || cfg.scenario == Scenario::Datagram)) {
+            fprintf(stderr, "ring needs unix addresses and doesn't work with file, relay and datagram\n");
+            return false;
+        }
+        if (cfg.tls && (cfg.ring > 0 || cfg.scenario == Scenario::Relay || cfg.scenario == Scenario::Datagram)) {  // RelayData can't reseal records
+            fprintf(stderr, "tls doesn't work with ring, relay and datagram\n");
+            return false;
+        }
+        if (cfg.compression != SocketManager::Compression::NO_COMPRESSION && (cfg.tls || cfg.ring > 0 || (cfg.scenario != Scenario::Echo && cfg.scenario != Scenario::Stream))) {
+            fprintf(stderr, "compress only works with echo and stream, without tls and ring\n");
+            return false;
+        }
+        if ((cfg.scenario == Scenario::Http || cfg.scenario == Scenario::WebSocket || cfg.scenario == Scenario::WsBroadcast) && (cfg.ring > 0 || cfg.zeroCopy > 0)) {    // messages go with a head, in one gather write
+            fprintf(stderr, "http and websocket scenarios don't work with ring and zerocopy\n");
+            return false;
+        }
+        if (cfg.listenerManagers && cfg.listeners > 1 && (cfg.scenario == Scenario::Broadcast || cfg.scenario == Scenario::PubSub || cfg.scenario == Scenario::Relay)) {  // they need every connection on the same server
+            fprintf(stderr, "listener-managers doesn't work with broadcast, pubsub and relay\n");
+            return false;
+        }
+        if (cfg.scenario == Scenario::Accept && cfg.messageSize > 1024) {   // the server echoes and closes on its first read
+            fprintf(stderr, "accept scenario needs size <= 1024 so the message arrives in a single read\n");
+            return false;
+        }
+        if (cfg.scenario == Scenario::File && cfg.messageSize == STAMP_SIZE) {
+            fprintf(stderr, "file scenario needs size > %lu\n", STAMP_SIZE);
+            return false;
+        }
+        if (cfg.scenario == Scenario::Priority && (cfg.rate <= 0 || cfg.bulkSize > 32768 || (cfg.bulkSize > 0 && cfg.bulkSize < STAMP_SIZE))) {
+            fprintf(stderr, "priority scenario needs rate > 0 and %lu <= bulk-size <= 32768 (or 0)\n", STAMP_SIZE);
+            return false;
+        }
+        if (cfg.scenario == Scenario::Datagram && cfg.messageSize > SocketManager::MAX_DATAGRAM_SIZE) {
+            fprintf(stderr, "datagram scenario needs size <= %lu\n", SocketManager::MAX_DATAGRAM_SIZE);
+            return false;
+        }
+        u_long frameSize = cfg.messageSize + (cfg.scenario == Scenario::Rpc ? RpcFrame::HEADER_SIZE : 0);
+        if (cfg.scenario != Scenario::File && static_cast<LONG64>(frameSize) * cfg.pipeline > 65536) {  // the echo (or copying relay) would otherwise be refused by the server backpressure
+            fprintf(stderr, "size * pipeline must stay under the 64kB default max pending send (rpc : size + %lu)\n", RpcFrame::HEADER_SIZE);
+            return false;
+        }
+        return true;
+    }
+
+    void WriteReport(const Context &ctx, const Benchmark::LatencyHistogram &latency, double measuredSeconds,
+                     const Benchmark::ProcessUsage &cpuStart, const Benchmark::ProcessUsage &cpuEnd,
+                     const Benchmark::ProcessUsage &baseline, const Benchmark::ProcessUsage &memBefore, const Benchmark::ProcessUsage &memAfter) {
+        const Config   &cfg         = ctx.config;
+        FILE           *out         = cfg.output ? fopen(cfg.output, "w") : stdout;
+        if (out == nullptr) {
+            fprintf(stderr, "cannot open %s\n", cfg.output);
+            out = stdout;
+        }
+        double          messages    = static_cast<double>(latency.Count());
+        double          cpuUs       = static_cast<double>(cpuEnd.cpuTime100ns - cpuStart.cpuTime100ns) / 10.0;
+        double          memDelta    = memAfter.privateBytes > memBefore.privateBytes ? static_cast<double>(memAfter.privateBytes - memBefore.privateBytes) : 0;
+        double          setupDelta  = memBefore.privateBytes > baseline.privateBytes ? static_cast<double>(memBefore.privateBytes - baseline.privateBytes) : 0;
+
+        Benchmark::JsonWriter json(out);
+        json.BeginObject();
+        json.Value("benchmark", "loadgenerator");
+        json.Value("scenario", ScenarioName(cfg.scenario));
+        json.BeginObject("config");
+        json.Value("connections", cfg.connections);
+        json.Value("message_size", static_cast<uint64_t>(cfg.messageSize));
+        json.Value("rate", cfg.rate);
+        json.Value("open_loop", cfg.rate > 0 && cfg.scenario != Scenario::PingPong && cfg.scenario != Scenario::Http && cfg.scenario != Scenario::WebSocket && cfg.scenario != Scenario::Rpc);
+        json.Value("duration_s", cfg.duration);
+        json.Value("warmup_s", cfg.warmup);
+        json.Value("pipeline", cfg.pipeline);
+        json.Value("shards", cfg.shards);
+        json.Value("pinned", cfg.shards > 0 && cfg.pin);
+        json.Value("zero_copy_threshold", static_cast<uint64_t>(cfg.zeroCopy));
+        json.Value("send_file", cfg.scenario == Scenario::File && cfg.sendFile);
+        json.Value("relay_data", cfg.scenario == Scenario::Relay && cfg.relay);
+        json.Value("isb_factor", cfg.isbFactor);
+        json.Value("isb_source", cfg.isbSource == SocketManager::ISBSource::TCP_INFO ? "tcpinfo" : "notify");
+        json.Value("shape_bytes_per_s", cfg.shape);
+        json.Value("bulk_size", static_cast<uint64_t>(cfg.scenario == Scenario::Priority ? cfg.bulkSize : 0));
+        json.Value("send_scheduling", cfg.scenario == Scenario::Priority && cfg.schedule);
+        json.Value("memory_budget_bytes", static_cast<uint64_t>(cfg.memoryBudget));
+        json.Value("drain_timeout_ms", static_cast<double>(cfg.drain));
+        json.Value("listeners", cfg.listeners);
+        json.Value("address", cfg.address);
+        json.Value("listen_address", cfg.listenAddress);
+        json.Value("dns_stub", cfg.dnsStub != nullptr ? cfg.dnsStub : "");
+        json.Value("dns_ttl_s", static_cast<double>(cfg.dnsTtl));
+        json.Value("ring_bytes", static_cast<uint64_t>(cfg.ring));
+        json.Value("tls", cfg.tls);
+        json.Value("compression", cfg.compression == SocketManager::Compression::FAST_COMPRESSION ? "fast" :
+                                  cfg.compression == SocketManager::Compression::STRONG_COMPRESSION ? "strong" : "none");
+        json.Value("payload", cfg.payload == Payload::Text ? "text" : cfg.payload == Payload::Random ? "random" : "zeros");
+        json.Value("slow_backend_ms", static_cast<uint64_t>(cfg.scenario == Scenario::Pool ? cfg.slow : 0));
+        json.Value("balance", cfg.scenario != Scenario::Pool ? "" : cfg.balancing == ConnectionPool::Balancing::ROUND_ROBIN ? "roundrobin" : "least");
+        json.Value("backpressure", cfg.scenario != Scenario::PubSub ? "" :
+                                   cfg.backpressure == SocketManager::Backpressure::DROP_OLDEST ? "oldest" :
+                                   cfg.backpressure == SocketManager::Backpressure::DISCONNECT ? "disconnect" : "newest");
+        json.Value("listener_managers", cfg.listenerManagers && cfg.listeners > 1);
+        json.EndObject();
+        json.BeginObject("results");
+        json.Value("measured_s", measuredSeconds);
+        json.Value("messages", latency.Count());
+        json.Value("throughput_msg_per_s", messages / measuredSeconds);
+        json.Value("throughput_mb_per_s", messages * cfg.messageSize / measuredSeconds / (1024.0 * 1024.0));
+        json.Latency("latency_us", latency);
+        json.Value("cpu_us_per_msg", messages > 0 ? cpuUs / messages : 0.0);   // client and server side together
+        json.Value("cpu_utilisation", cpuUs / 1e6 / measuredSeconds);          // in number of cores
+        json.Value("memory_bytes_per_connection", memDelta / cfg.connections); // both ends of each connection
+        json.Value("setup_memory_bytes", setupDelta);                           // managers and listeners, client included, before any connection
+        json.Value("threads", memAfter.threads);                                // whole process, client included
+        json.Value("send_failures", static_cast<uint64_t>(ctx.sendFailures));
+        json.Value("echo_failures", static_cast<uint64_t>(ctx.echoFailures));
+        json.Value("max_pending_send_bytes", ctx.maxPendingSend);             // client side, mean over connections
+        json.Value("server_memory_bytes", static_cast<uint64_t>(ctx.serverMemory.usedBytes));     // buffers and sockets, as checked against the budget
+        json.Value("server_memory_peak_bytes", static_cast<uint64_t>(ctx.serverMemory.peakBytes));
+        json.Value("accept_pauses", static_cast<uint64_t>(ctx.serverMemory.acceptPauses));
+        json.Value("rejected_sends", static_cast<uint64_t>(ctx.serverMemory.rejectedSends));
+        json.Value("read_probes", static_cast<uint64_t>(ctx.serverMemory.readProbes));
+        json.BeginObject("dns");                                                // connects to a host name, client side
+        json.Value("cache_hits", static_cast<uint64_t>(ctx.dns.cacheHits));
+        json.Value("negative_hits", static_cast<uint64_t>(ctx.dns.negativeHits));
+        json.Value("resolutions", static_cast<uint64_t>(ctx.dns.resolutions));
+        json.Value("failures", static_cast<uint64_t>(ctx.dns.failures));
+        json.Value("stub_queries", static_cast<uint64_t>(ctx.dnsQueries));  // A and AAAA, 2 per resolution
+        json.EndObject();
+        if (cfg.scenario == Scenario::Datagram) {
+            const SocketManager::DatagramStats &received = ctx.serverDatagrams;
+            const SocketManager::DatagramStats &sent = ctx.clientDatagrams;
+            json.BeginObject("datagram");                                       // whole run, warmup included
+            json.Value("sent", static_cast<uint64_t>(sent.sent));
+            json.Value("received", static_cast<uint64_t>(received.received));
+            json.Value("loss", sent.sent > 0 ? 1.0 - static_cast<double>(received.received) / static_cast<double>(sent.sent) : 0.0);
+            json.Value("dropped", static_cast<uint64_t>(received.dropped + sent.dropped));     // truncated or failed right away
+            json.Value("datagrams_per_read", received.reads > 0 ? static_cast<double>(received.received) / static_cast<double>(received.reads) : 0.0);
+            json.Value("datagrams_per_send", sent.sends > 0 ? static_cast<double>(sent.sent) / static_cast<double>(sent.sends) : 0.0);
+            json.EndObject();
+        }
+        if (cfg.tls) {
+            json.BeginObject("tls");                                            // server side, whole run, warmup included
+            json.Value("handshakes", static_cast<uint64_t>(ctx.serverTls.handshakes));
+            json.Value("failures", static_cast<uint64_t>(ctx.serverTls.failures));
+            json.EndObject();
+        }
+        if (cfg.compression != SocketManager::Compression::NO_COMPRESSION) {
+            const SocketManager::CompressionStats &client = ctx.clientCompression;
+            const SocketManager::CompressionStats &server = ctx.serverCompression;
+            auto raw = static_cast<uint64_t>(client.rawBytesSent + server.rawBytesSent);
+            auto packed = static_cast<uint64_t>(client.packedBytesSent + server.packedBytesSent);
+            double share = raw > 0 ? static_cast<double>(packed) / static_cast<double>(raw) : 0.0;
+            json.BeginObject("compression");                                    // both ends, whole run, warmup included
+            json.Value("negotiated", static_cast<uint64_t>(client.negotiated));
+            json.Value("refused", static_cast<uint64_t>(client.refused));
+            json.Value("raw_bytes", raw);
+            json.Value("packed_bytes", packed);
+            json.Value("ratio", packed > 0 ? static_cast<double>(raw) / static_cast<double>(packed) : 0.0);
+            json.Value("batches", static_cast<uint64_t>(client.batches + server.batches));
+            json.Value("blocks", static_cast<uint64_t>(client.blocks + server.blocks));
+            json.Value("stored_blocks", static_cast<uint64_t>(client.storedBlocks + server.storedBlocks));
+            json.Value("contexts_created", static_cast<uint64_t>(client.contextsCreated + server.contextsCreated));
+            json.Value("contexts_reused", static_cast<uint64_t>(client.contextsReused + server.contextsReused));
+            json.Value("wire_mb_per_s", messages * cfg.messageSize * share / measuredSeconds / (1024.0 * 1024.0));  // what the link carried
+            json.EndObject();
+        }
+        if (cfg.scenario == Scenario::PubSub) {
+            json.BeginObject("pubsub");                                         // server side, whole run, warmup included
+            json.Value("published", static_cast<uint64_t>(ctx.serverPubSub.published));
+            json.Value("delivered", static_cast<uint64_t>(ctx.serverPubSub.delivered));
+            json.Value("dropped", static_cast<uint64_t>(ctx.serverPubSub.dropped));
+            json.Value("disconnected", static_cast<uint64_t>(ctx.serverPubSub.disconnected));
+            json.EndObject();
+        }
+        if (cfg.scenario == Scenario::Pool) {
+            json.BeginObject("pool");                                           // client side, whole run, warmup included
+            json.Value("routed", static_cast<uint64_t>(ctx.pool.routed));
+            json.Value("refused", static_cast<uint64_t>(ctx.pool.refused));
+            json.Value("ejections", static_cast<uint64_t>(ctx.pool.ejections));
+            json.Value("connects", static_cast<uint64_t>(ctx.pool.connects));
+            json.BeginArray("backends");                                        // backend 0 is the slow one
+            for (const ConnectionPool::BackendStats &backend : ctx.poolBackends) {
+                json.BeginObject();
+                json.Value("routed", static_cast<uint64_t>(backend.routed));
+                json.Value("share", ctx.pool.routed > 0 ? static_cast<double>(backend.routed) / static_cast<double>(ctx.pool.routed) : 0.0);
+                json.Value("healthy", backend.healthy);
+                json.Value("ejections", static_cast<uint64_t>(backend.ejections));
+                json.EndObject();
+            }
+            json.EndArray();
+            json.EndObject();
+        }
+        if (cfg.scenario == Scenario::Rpc) {
+            json.BeginObject("rpc");                                            // client side, whole run, warmup included
+            json.Value("calls", static_cast<uint64_t>(ctx.rpc.calls));
+            json.Value("completed", static_cast<uint64_t>(ctx.rpc.completed));
+            json.Value("timeouts", static_cast<uint64_t>(ctx.rpc.timeouts));
+            json.Value("refused", static_cast<uint64_t>(ctx.rpc.refused));
+            json.Value("late", static_cast<uint64_t>(ctx.rpc.late));
+            json.EndObject();
+        }
+        if (cfg.drain >= 0) {
+            json.Value("shutdown_ms", ctx.shutdownMs);                         // server Drain with every connection open
+            json.Value("shutdown_flushed", ctx.shutdownFlushed);
+        }
+        json.EndObject();
+        json.EndObject();
+        if (out != stdout)
+            fclose(out);
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    Benchmark::Arguments    args(argc, argv);
+    Context                 ctx;
+    RPC_STATUS              status;
+
+    if (!ParseConfig(args, ctx.config))
+        return 1;
+    const Config &cfg = ctx.config;
+    Benchmark::ProcessUsage baseline = Benchmark::ProcessUsage::Sample();
+
+    if (cfg.scenario == Scenario::Http) {
+        ctx.httpHead = "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: " + std::to_string(cfg.messageSize) + "\r\n\r\n";
+        ctx.httpResponseHead = static_cast<u_long>(strlen("HTTP/1.1 200 OK\r\nContent-Length: \r\n\r\n") + std::to_string(cfg.messageSize).size());
+    }
+    if (cfg.scenario == Scenario::WebSocket || cfg.scenario == Scenario::WsBroadcast) {    // key and accept of the RFC 6455 example
+        char frameHead[WebSocketParser::MAX_HEADER_SIZE];
+        ctx.wsUpgrade = "GET /echo HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        ctx.wsResponseHead = static_cast<u_long>(strlen("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n"));
+        ctx.wsFrameHead = WebSocketParser::EncodeHeader(WebSocketParser::BINARY, true, cfg.messageSize, frameHead);
+    }
+
+    typedef ShardedServer<BenchServer> Server;
+    Server::Factory factory = [&ctx](DWORD threadCount, const SocketManager::Placement &placement) { return new BenchServer(ctx, threadCount, placement); };
+    EchoHttpHandler httpHandler;                                // outlives the listeners
+    EchoWebSocketHandler webSocketHandler(ctx);
+    EchoRpcHandler rpcHandler(ctx);
+    std::vector<std::unique_ptr<Server>> servers;               // --listener-managers : one per listener, else only the first one
+    std::vector<std::unique_ptr<BenchServer::Handler>> handlers;
+    for (int i = 0 ; i < (cfg.listenerManagers ? cfg.listeners : 1) ; i++)
+        servers.emplace_back(new Server(factory, cfg.shards > 0 ? static_cast<DWORD>(cfg.shards) : 1, cfg.shards > 0 ? 1 : 0, cfg.shards > 0 && cfg.pin));
+    Server &server = *servers[0];
+    for (size_t i = 0 ; cfg.scenario == Scenario::Pool && i < server.ShardCount() ; i++)
+        server.Shard(i).holdMs = cfg.slow;
+    DnsStub dnsStub;                                            // outlives the client, which waits for its resolutions in flight
+    SelfSignedCertificate certificate;                          // outlives the managers, their credentials hold it
+    BenchClient client(ctx);
+    if (cfg.tls) {
+        SocketManager::TlsOptions serverTls;
+        SocketManager::TlsOptions clientTls;
+        if (!certificate.Create()) {
+            fprintf(stderr, "tls initialisation failed\n");
+            return 1;
+        }
+        serverTls.certificate = certificate.certificate;
+        clientTls.serverName = "localhost";
+        clientTls.verifyPeer = false;                           // self-signed
+        if (!client.SetTls(clientTls)) {
+            fprintf(stderr, "tls initialisation failed\n");
+            return 1;
+        }
+        for (auto &listenerServer : servers) {
+            if (!listenerServer->SetTls(serverTls)) {
+                fprintf(stderr, "tls initialisation failed\n");
+                return 1;
+            }
+        }
+    }
+    for (auto &listenerServer : servers) {
+        if (cfg.scenario == Scenario::Priority)
+            listenerServer->SetDefaultFraming(MessageFramer::LengthPrefixed());
+        if (cfg.scenario == Scenario::Rpc)
+            listenerServer->SetDefaultFraming(RpcFrame::Framing());
+        listenerServer->SetSharedMemoryRing(cfg.ring);
+        listenerServer->SetCompression(cfg.compression);
+        if (cfg.memoryBudget > 0) {
+            SocketManager::MemoryBudget budget;
+            budget.soft = cfg.memoryBudget / servers.size() / 4 * 3;
+            budget.hard = cfg.memoryBudget / servers.size();
+            listenerServer->SetMemoryBudget(budget);
+        }
+        if (!listenerServer->isReady() || !client.isReady()) {
+            fprintf(stderr, "manager initialisation failed\n");
+            return 1;
+        }
+    }
+
+    if (cfg.dnsStub != nullptr && (!dnsStub.Start(cfg.dnsStub, static_cast<DWORD>(cfg.dnsTtl)) || !client.SetDnsServer(cfg.dnsStub))) {
+        fprintf(stderr, "dns stub failed on %s\n", cfg.dnsStub);
+        return 1;
+    }
+
+    // ----------------------------- wait for the server to listen before any connect
+    SOCKADDR_STORAGE datagramServer{};
+    if (cfg.scenario == Scenario::Datagram) {
+        int length;
+        UUID datagramId = server.Shard(0).OpenDatagramSocket(cfg.listenAddress, cfg.port);
+        if (UuidIsNil(&datagramId, &status) || !SocketManager::ParseAddress(cfg.address, cfg.port, datagramServer, length)) {
+            fprintf(stderr, "datagram socket failed (numeric addresses only)\n");
+            return 1;
+        }
+    }
+    for (int i = 0 ; cfg.scenario != Scenario::Datagram && i < cfg.listeners ; i++) {
+        Server &owner = *servers[cfg.listenerManagers ? i : 0];
+        SocketHandler *handler = nullptr;
+        if (cfg.scenario == Scenario::Http)
+            handler = &httpHandler;
+        else if (cfg.scenario == Scenario::WebSocket || cfg.scenario == Scenario::WsBroadcast)
+            handler = &webSocketHandler;
+        else if (cfg.scenario == Scenario::Rpc)
+            handler = &rpcHandler;
+        else if (cfg.listeners > 1) {
+            handlers.emplace_back(new BenchServer::Handler());
+            handler = handlers.back().get();
+        }
+        UUID listenId = owner.ListenToNewSocket(SocketManager::Listener(static_cast<u_short>(cfg.port + i), cfg.listenAddress, handler));
+        if (UuidIsNil(&listenId, &status)) {
+            fprintf(stderr, "listen failed\n");
+            return 1;
+        }
+        while (!owner.isServerSocketReady(listenId)) {
+            if (!owner.Shard(0).isSocketInitialising(listenId)) {
+                fprintf(stderr, "listen socket failed\n");
+                return 1;
+            }
+            Sleep(10);
+        }
+    }
+
+    // ----------------------------- open every connection and wait for all of them
+    Benchmark::ProcessUsage memBefore = Benchmark::ProcessUsage::Sample();
+    if (cfg.scenario == Scenario::Datagram && !client.OpenDatagrams()) {
+        fprintf(stderr, "could not open %d datagram sockets\n", cfg.connections);
+        return 1;
+    }
+    if (cfg.scenario == Scenario::Pool && !client.OpenPool(30000)) {
+        fprintf(stderr, "could not establish the %d connections of the pool\n", cfg.connections);
+        return 1;
+    }
+    if (cfg.scenario != Scenario::Accept && cfg.scenario != Scenario::Datagram && cfg.scenario != Scenario::Pool && (!client.Connect() || !client.WaitConnected(30000))) {
+        fprintf(stderr, "could not establish %d connections\n", cfg.connections);
+        return 1;
+    }
+    if ((cfg.scenario == Scenario::WebSocket || cfg.scenario == Scenario::WsBroadcast) && !client.Upgrade(30000)) {
+        fprintf(stderr, "could not upgrade %d connections to websocket\n", cfg.connections);
+        return 1;
+    }
+    if (cfg.scenario == Scenario::Broadcast || cfg.scenario == Scenario::PubSub) {     // server only knows a client once its accept completed (and subscribed it)
+        std::vector<char> hello(cfg.messageSize);
+        for (auto &conn : client.connections)
+            client.Send(*conn, hello, 0);
+        DWORD start = GetTickCount();
+        while (ctx.helloBytes < static_cast<LONG64>(cfg.messageSize) * cfg.connections && GetTickCount() - start < 30000)
+            Sleep(10);
+    }
+    if (cfg.scenario == Scenario::Relay) {              // server pairs each source with its sink from their hello
+        std::vector<char> hello(STAMP_SIZE);
+        LONGLONG pair = 0;
+        for (auto &conn : client.connections) {
+            Stamp(hello, pair * 2);
+            client.SendData(hello.data(), STAMP_SIZE, conn->id);
+            Stamp(hello, pair * 2 + 1);
+            client.SendData(hello.data(), STAMP_SIZE, conn->sinkId);
+            pair++;
+        }
+        DWORD start = GetTickCount();
+        while (ctx.helloBytes < static_cast<LONG64>(STAMP_SIZE) * 2 * cfg.connections && GetTickCount() - start < 30000)
+            Sleep(10);
+    }
+    Benchmark::ProcessUsage memAfter = Benchmark::ProcessUsage::Sample();
+    HANDLE file = INVALID_HANDLE_VALUE;
+    if (cfg.scenario == Scenario::File && (file = CreateBenchFile(cfg.messageSize - STAMP_SIZE)) == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "could not create the %lu bytes file\n", cfg.messageSize - STAMP_SIZE);
+        return 1;
+    }
+
+    // ----------------------------- run
+    LONGLONG                start       = Benchmark::Clock::Now();
+    LONGLONG                measureFrom = start + Benchmark::Clock::FromSeconds(cfg.warmup);
+    LONGLONG                end         = measureFrom + Benchmark::Clock::FromSeconds(cfg.duration);
+    Benchmark::ProcessUsage cpuStart{};
+    HANDLE                  starter;
+
+    Starter                 starterArgs{&ctx, measureFrom, &cpuStart};
+    starter = CreateThread(nullptr, 0, StartRecording, &starterArgs, 0, nullptr);
+
+    switch (cfg.scenario) {
+        case Scenario::PingPong :
+            /** NOBREAK **/
+        case Scenario::Http :
+            /** NOBREAK **/
+        case Scenario::WebSocket :{
+            std::vector<char> msg(cfg.messageSize);
+            for (auto &conn : client.connections)
+                for (int i = 0 ; i < cfg.pipeline ; i++)
+                    client.Send(*conn, msg, Benchmark::Clock::Now());
+            while (Benchmark::Clock::Now() < end)
+                Sleep(1);
+            break;
+        }
+        case Scenario::Broadcast :{
+            GenerateBroadcastLoad(ctx, server, end);
+            break;
+        }
+        case Scenario::WsBroadcast :{
+            GenerateBroadcastLoad(ctx, webSocketHandler, end);
+            break;
+        }
+        case Scenario::PubSub :{
+            TopicPublisher<Server> publisher(server);
+            GenerateBroadcastLoad(ctx, publisher, end);
+            break;
+        }
+        case Scenario::Accept :{
+            GenerateConnectionLoad(ctx, client, end);
+            break;
+        }
+        case Scenario::File :{
+            GenerateFileLoad(ctx, client, file, end);
+            break;
+        }
+        case Scenario::Priority :{
+            GeneratePriorityLoad(ctx, client, end);
+            break;
+        }
+        case Scenario::Datagram :{
+            GenerateDatagramLoad(ctx, client, datagramServer, end);
+            break;
+        }
+        case Scenario::Pool :{
+            GeneratePoolLoad(ctx, client, end);
+            break;
+        }
+        case Scenario::Rpc :{
+            std::vector<char> msg(cfg.messageSize);
+            for (auto &conn : client.connections)
+                for (int i = 0 ; i < cfg.pipeline ; i++)
+                    client.SendCall(*conn, msg, Benchmark::Clock::Now());
+            while (Benchmark::Clock::Now() < end)
+                Sleep(1);
+            break;
+        }
+        default:
+            GenerateClientLoad(ctx, client, end);
+    }
+    ctx.latencies.Stop();
+    Benchmark::ProcessUsage cpuEnd = Benchmark::ProcessUsage::Sample();
+    for (auto &conn : client.connections)
+        ctx.maxPendingSend += static_cast<double>(client.MaxPendingByteSent(conn->id)) / static_cast<double>(client.connections.size());
+    for (auto &listenerServer : servers) {
+        SocketManager::MemoryStats stats = listenerServer->GetMemoryStats();
+        ctx.serverMemory.usedBytes += stats.usedBytes;
+        ctx.serverMemory.peakBytes += stats.peakBytes;
+        ctx.serverMemory.acceptPauses += stats.acceptPauses;
+        ctx.serverMemory.rejectedSends += stats.rejectedSends;
+        ctx.serverMemory.readProbes += stats.readProbes;
+    }
+    ctx.dns = client.GetDnsStats();
+    ctx.dnsQueries = dnsStub.queries;
+    for (auto &listenerServer : servers) {
+        SocketManager::TlsStats stats = listenerServer->GetTlsStats();
+        ctx.serverTls.handshakes += stats.handshakes;
+        ctx.serverTls.failures += stats.failures;
+    }
+    for (auto &listenerServer : servers) {
+        SocketManager::CompressionStats stats = listenerServer->GetCompressionStats();
+        ctx.serverCompression.contextsCreated += stats.contextsCreated;
+        ctx.serverCompression.contextsReused += stats.contextsReused;
+        ctx.serverCompression.batches += stats.batches;
+        ctx.serverCompression.blocks += stats.blocks;
+        ctx.serverCompression.storedBlocks += stats.storedBlocks;
+        ctx.serverCompression.rawBytesSent += stats.rawBytesSent;
+        ctx.serverCompression.packedBytesSent += stats.packedBytesSent;
+    }
+    ctx.clientCompression = client.GetCompressionStats();
+    if (cfg.scenario == Scenario::PubSub)
+        ctx.serverPubSub = server.GetPubSubStats();
+    if (cfg.scenario == Scenario::Pool) {
+        ctx.pool = client.pool->GetPoolStats();
+        for (int i = 0 ; i < cfg.listeners ; i++)
+            ctx.poolBackends.push_back(client.pool->GetBackendStats(i));
+    }
+    if (cfg.scenario == Scenario::Rpc)
+        ctx.rpc = client.rpc->GetStats();
+    if (cfg.scenario == Scenario::Datagram) {
+        Sleep(100);                                     // datagrams still in flight, a lost one never comes
+        ctx.serverDatagrams = server.Shard(0).GetDatagramStats();
+        ctx.clientDatagrams = client.GetDatagramStats();
+    }
+    InterlockedExchange(&ctx.running, 0);
+    WaitForSingleObject(starter, INFINITE);
+    CloseHandle(starter);
+
+    // ----------------------------- let in flight messages drain before reading histograms
+    DWORD drainStart = GetTickCount();
+    for (auto &conn : client.connections) {
+        while (conn->outstanding > 0 && cfg.scenario != Scenario::Stream && cfg.scenario != Scenario::Accept && GetTickCount() - drainStart < 2000)
+            Sleep(1);
+    }
+
+    // ----------------------------- shutdown of the server with every connection still open
+    if (cfg.drain >= 0) {
+        LONGLONG drainFrom = Benchmark::Clock::Now();
+        ctx.shutdownFlushed = true;
+        for (auto &listenerServer : servers)
+            ctx.shutdownFlushed = listenerServer->Drain(static_cast<DWORD>(cfg.drain)) && ctx.shutdownFlushed;
+        ctx.shutdownMs = Benchmark::Clock::ToSeconds(Benchmark::Clock::Now() - drainFrom) * 1000.0;
+    }
+
+    WriteReport(ctx, ctx.latencies.Collect(), Benchmark::Clock::ToSeconds(end - measureFrom), cpuStart, cpuEnd, baseline, memBefore, memAfter);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);                              // after the drain, so no SendFile is still reading it
+    return 0;
+}
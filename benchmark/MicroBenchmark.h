@@ -0,0 +1,228 @@
+#ifndef SOCKETMANAGER_MICROBENCHMARK_H
+#define SOCKETMANAGER_MICROBENCHMARK_H
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include "BenchmarkUtils.h"
+
+namespace Benchmark {
+
+    template<typename T>
+    inline void DoNotOptimize(T const &value) { asm volatile("" : : "r,m"(value) : "memory"); }     // Keep the compiler from discarding a computed value
+
+/************* MicroCase ***********/
+    struct MicroCase {                                  // One benchmark, run once per thread count
+        std::string                                 name;
+        std::vector<int>                            threadCounts;
+        std::function<void(int threads)>            setup;          // Called before each measured run, out of timing
+        std::function<void(uint64_t iterations, int threadIndex)>   run;
+        std::function<void()>                       teardown;       // Called after each measured run, out of timing
+    };
+
+    struct MicroResult {
+        std::string         name;
+        int                 threads;
+        uint64_t            iterations;                 // Per thread
+        double              nsPerOp;                    // Median over repetitions of (slowest thread time / iterations)
+        double              opsPerSecond;               // All threads together
+        double              baselineNsPerOp;            // 0 if not in baseline
+    };
+////////////// MicroCase ////////////
+
+/************* MicroRunner ***********/
+    class MicroRunner {                                 // Run registered cases, print JSON and optionally compare with a previous JSON output
+    private:
+        struct ThreadArgs {
+            MicroCase          *mcase;
+            uint64_t            iterations;
+            int                 index;
+            volatile LONG      *ready;
+            HANDLE              startEvent;
+            LONGLONG            elapsed;
+        };
+
+        std::vector<MicroCase>      cases;
+        double                      minTime         = 0.2;          // Seconds, each measured run lasts at least that long
+        int                         repetitions     = 5;
+        std::string                 filter;
+        double                      tolerance       = 10.0;         // Percent of slowdown flagged as regression
+
+        static DWORD WINAPI     ThreadMain      (LPVOID lpParam) {
+            auto *args = static_cast<ThreadArgs*>(lpParam);
+            InterlockedIncrement(args->ready);
+            WaitForSingleObject(args->startEvent, INFINITE);
+            LONGLONG start = Clock::Now();
+            args->mcase->run(args->iterations, args->index);
+            args->elapsed = Clock::Now() - start;
+            return NO_ERROR;
+        }
+
+        static LONGLONG         Measure         (MicroCase &mcase, int threads, uint64_t iterations) {  // Returns slowest thread time
+            mcase.setup(threads);
+            if (threads == 1) {
+                LONGLONG start = Clock::Now();
+                mcase.run(iterations, 0);
+                LONGLONG elapsed = Clock::Now() - start;
+                mcase.teardown();
+                return elapsed;
+            }
+            volatile LONG               ready       = 0;
+            HANDLE                      startEvent  = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+            std::vector<ThreadArgs>     args(threads);
+            std::vector<HANDLE>         handles;
+            for (int i = 0 ; i < threads ; i++) {
+                args[i] = ThreadArgs{&mcase, iterations, i, &ready, startEvent, 0};
+                handles.push_back(CreateThread(nullptr, 0, ThreadMain, &args[i], 0, nullptr));
+            }
+            while (ready < threads)                     // start every thread at once to measure actual contention
+                Sleep(0);
+            SetEvent(startEvent);
+            WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), TRUE, INFINITE);
+            LONGLONG slowest = 0;
+            for (int i = 0 ; i < threads ; i++) {
+                CloseHandle(handles[i]);
+                slowest = std::max(slowest, args[i].elapsed);
+            }
+            CloseHandle(startEvent);
+            mcase.teardown();
+            return slowest;
+        }
+
+        MicroResult             RunCase         (MicroCase &mcase, int threads) {
+            uint64_t iterations = 1;
+            LONGLONG target     = Clock::FromSeconds(minTime);
+            LONGLONG elapsed;
+            while ((elapsed = Measure(mcase, threads, iterations)) < target / 2) {     // calibrate
+                double scale = elapsed > 0 ? static_cast<double>(target) / static_cast<double>(elapsed) : 10.0;
+                iterations = static_cast<uint64_t>(static_cast<double>(iterations) * std::min(std::max(scale, 2.0), 100.0));
+            }
+            std::vector<double> samples;
+            for (int r = 0 ; r < repetitions ; r++)
+                samples.push_back(static_cast<double>(Clock::ToNanoseconds(Measure(mcase, threads, iterations))) / static_cast<double>(iterations));
+            std::sort(samples.begin(), samples.end());
+            double median = samples[samples.size() / 2];
+            return MicroResult{mcase.name, threads, iterations, median, median > 0 ? 1e9 / median * threads : 0, 0};
+        }
+
+        static bool             LoadBaseline    (const char *path, std::vector<MicroResult> &baseline) {    // Parse a file written by WriteJson
+            FILE *f = fopen(path, "r");
+            if (f == nullptr)
+                return false;
+            std::string content;
+            char chunk[4096];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+                content.append(chunk, n);
+            fclose(f);
+
+            size_t pos = 0;
+            while ((pos = content.find("\"name\":\"", pos)) != std::string::npos) {
+                pos += 8;
+                size_t nameEnd = content.find('"', pos);
+                size_t objEnd = content.find('}', pos);
+                if (nameEnd == std::string::npos || objEnd == std::string::npos)
+                    break;
+                MicroResult r{content.substr(pos, nameEnd - pos), 0, 0, 0, 0, 0};
+                std::string obj = content.substr(nameEnd, objEnd - nameEnd);
+                size_t t = obj.find("\"threads\":"), ns = obj.find("\"ns_per_op\":");
+                if (t != std::string::npos && ns != std::string::npos) {
+                    r.threads = atoi(obj.c_str() + t + 10);
+                    r.nsPerOp = atof(obj.c_str() + ns + 12);
+                    baseline.push_back(r);
+                }
+                pos = objEnd;
+            }
+            return true;
+        }
+
+        void                    WriteJson       (FILE *out, const std::vector<MicroResult> &results, bool withBaseline) {
+            JsonWriter json(out);
+            json.BeginObject();
+            json.Value("benchmark", "micro");
+            json.Value("tolerance_pct", tolerance);
+            json.BeginArray("results");
+            for (const MicroResult &r : results) {
+                json.BeginObject();
+                json.Value("name", r.name.c_str());
+                json.Value("threads", r.threads);
+                json.Value("iterations", r.iterations);
+                json.Value("ns_per_op", r.nsPerOp);
+                json.Value("ops_per_s", r.opsPerSecond);
+                if (withBaseline && r.baselineNsPerOp > 0) {
+                    double change = (r.nsPerOp - r.baselineNsPerOp) / r.baselineNsPerOp * 100.0;
+                    json.Value("baseline_ns_per_op", r.baselineNsPerOp);
+                    json.Value("change_pct", change);
+                    json.Value("regression", change > tolerance);
+                }
+                json.EndObject();
+            }
+            json.EndArray();
+            json.EndObject();
+        }
+
+    public:
+        void                    Add             (MicroCase mcase)   { cases.push_back(std::move(mcase)); }
+
+        template<typename Fixture>                      // Fixture : Setup(int threads), Run(uint64_t iterations, int threadIndex), Teardown()
+        void                    Add             (const std::string &name, std::vector<int> threadCounts, Fixture *fixture) {
+            std::shared_ptr<Fixture> owned(fixture);
+            Add(MicroCase{name, std::move(threadCounts),
+                          [owned](int threads) { owned->Setup(threads); },
+                          [owned](uint64_t iterations, int index) { owned->Run(iterations, index); },
+                          [owned]() { owned->Teardown(); }});
+        }
+
+        // --filter=<substring> --min-time=<s> --repetitions=<n> --output=<file> --baseline=<file> --tolerance=<percent>
+        // Returns 2 when a case is slower than its baseline by more than the tolerance, 1 on error, 0 otherwise.
+        int                     Main            (int argc, char *argv[]) {
+            Arguments   args(argc, argv);
+            const char *output      = args.Get("output");
+            const char *baselinePath= args.Get("baseline");
+            std::vector<MicroResult> baseline, results;
+
+            filter      = args.Get("filter", "");
+            minTime     = args.GetDouble("min-time", minTime);
+            repetitions = std::max(1, static_cast<int>(args.GetInt("repetitions", repetitions)));
+            tolerance   = args.GetDouble("tolerance", tolerance);
+            if (baselinePath && !LoadBaseline(baselinePath, baseline)) {
+                fprintf(stderr, "cannot read baseline %s\n", baselinePath);
+                return 1;
+            }
+
+            bool regression = false;
+            for (MicroCase &mcase : cases) {
+                if (!filter.empty() && mcase.name.find(filter) == std::string::npos)
+                    continue;
+                for (int threads : mcase.threadCounts) {
+                    MicroResult r = RunCase(mcase, threads);
+                    for (const MicroResult &b : baseline)
+                        if (b.name == r.name && b.threads == r.threads)
+                            r.baselineNsPerOp = b.nsPerOp;
+                    bool slower = r.baselineNsPerOp > 0 && (r.nsPerOp - r.baselineNsPerOp) / r.baselineNsPerOp * 100.0 > tolerance;
+                    regression |= slower;
+                    fprintf(stderr, "%-48s threads=%-3d %12.2f ns/op", r.name.c_str(), r.threads, r.nsPerOp);
+                    if (r.baselineNsPerOp > 0)
+                        fprintf(stderr, "  baseline %12.2f ns/op %+7.1f%%%s", r.baselineNsPerOp,
+                                (r.nsPerOp - r.baselineNsPerOp) / r.baselineNsPerOp * 100.0, slower ? "  REGRESSION" : "");
+                    fprintf(stderr, "\n");
+                    results.push_back(r);
+                }
+            }
+
+            FILE *out = output ? fopen(output, "w") : stdout;
+            if (out == nullptr) {
+                fprintf(stderr, "cannot open %s\n", output);
+                return 1;
+            }
+            WriteJson(out, results, !baseline.empty());
+            if (out != stdout)
+                fclose(out);
+            return regression ? 2 : 0;
+        }
+    };
+////////////// MicroRunner ////////////
+
+}
+
+#endif //SOCKETMANAGER_MICROBENCHMARK_H
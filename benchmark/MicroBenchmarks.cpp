@@ -0,0 +1,317 @@
+#include <cstring>
+#include <random>
+#include "SocketManager.h"
+#include "WebSocketParser.h"
+#include "MicroBenchmark.h"
+
+/*
+ * Micro benchmarks of the helper containers and hot path primitives, single threaded and under contention.
+ *
+ * Usage : SocketManagerMicroBenchmark [--filter=CriticalMap] [--min-time=0.2] [--repetitions=5] [--output=current.json]
+ *                                     [--baseline=previous.json --tolerance=10]
+ * With --baseline, every case is compared with the same case/thread count of a previous run, slowdowns above
+ * --tolerance percent are flagged in the output and the process returns 2.
+ */
+
+namespace {
+
+    const std::vector<int>  SINGLE_THREAD   = {1};
+    const std::vector<int>  CONTENTION      = {1, 2, 4, 8};
+    const int               LIVE_ELEMENTS   = 16;       // Elements each thread keeps alive, like a few in flight operations per socket
+    const int               MAP_SIZE        = 1024;
+
+    std::vector<UUID> GenerateIds(int n) {
+        std::vector<UUID> ids(n);
+        for (UUID &id : ids)
+            UuidCreate(&id);
+        return ids;
+    }
+
+    /************* RecyclableListFixture ***********/
+    class RecyclableListFixture {                       // Raw CriticalRecyclableList create/erase cost, without any element construction cost
+    private:
+        typedef CriticalRecyclableList<uint64_t>    List;
+        std::unique_ptr<List>                       list;
+        std::vector<std::vector<List::iterator>> live;
+    public:
+        void Setup(int threads) {
+            list.reset(new List());
+            live.assign(threads, std::vector<List::iterator>());
+        }
+        void Run(uint64_t iterations, int index) {
+            std::vector<List::iterator> &mine = live[index];
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                if (mine.size() == LIVE_ELEMENTS) {
+                    list->erase(mine[i % LIVE_ELEMENTS]);
+                    mine[i % LIVE_ELEMENTS] = list->create(i);
+                } else
+                    mine.push_back(list->create(i));
+            }
+        }
+        void Teardown() {
+            for (auto &mine : live)
+                for (auto it : mine)
+                    list->erase(it);
+            live.clear();
+        }
+    };
+    ////////////// RecyclableListFixture ////////////
+
+    /************* ListEltFixture ***********/
+    template<typename T>
+    class ListEltFixture {                              // ListElt<T>::Create/Delete, as done for every Buffer of every operation and every Socket
+    private:
+        std::unique_ptr<CriticalRecyclableList<T>>  list;
+        std::vector<std::vector<T*>>                live;
+        std::function<T*(CriticalRecyclableList<T>&)> create;
+    public:
+        explicit ListEltFixture(std::function<T*(CriticalRecyclableList<T>&)> c) : create(std::move(c)) {}
+
+        void Setup(int threads) {
+            list.reset(new CriticalRecyclableList<T>());
+            live.assign(threads, std::vector<T*>());
+        }
+        void Run(uint64_t iterations, int index) {
+            std::vector<T*> &mine = live[index];
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                if (mine.size() == LIVE_ELEMENTS) {
+                    ListElt<T>::Delete(mine[i % LIVE_ELEMENTS]);
+                    mine[i % LIVE_ELEMENTS] = create(*list);
+                } else
+                    mine.push_back(create(*list));
+            }
+        }
+        void Teardown() {
+            for (auto &mine : live)
+                for (T *elt : mine)
+                    ListElt<T>::Delete(elt);
+            live.clear();
+        }
+    };
+    ////////////// ListEltFixture ////////////
+
+    /************* CriticalMapFixture ***********/
+    class CriticalMapFixture {                          // CriticalMap::Get, the lookup done by every public call taking a socket id
+    private:
+        CriticalMap<UUID, Socket*>  map;
+        std::vector<UUID>           present;
+        std::vector<UUID>           missing;
+        bool                        hit;
+    public:
+        explicit CriticalMapFixture(bool h) : hit(h) {
+            present = GenerateIds(MAP_SIZE);
+            missing = GenerateIds(MAP_SIZE);
+            for (int i = 0 ; i < MAP_SIZE ; i++)
+                map.map[present[i]] = reinterpret_cast<Socket*>(static_cast<uintptr_t>(i + 1));
+        }
+        void Setup(int) {}
+        void Run(uint64_t iterations, int index) {
+            const std::vector<UUID> &keys = hit ? present : missing;
+            for (uint64_t i = 0 ; i < iterations ; i++)
+                Benchmark::DoNotOptimize(map.Get(keys[(i + index * 97) % MAP_SIZE]));
+        }
+        void Teardown() {}
+    };
+    ////////////// CriticalMapFixture ////////////
+
+    /************* UuidHashFixture ***********/
+    class UuidHashFixture {                             // std::hash<UUID> specialization of Misc.h
+    private:
+        std::vector<UUID>           ids;
+        std::hash<UUID>             hasher;
+    public:
+        UuidHashFixture() : ids(GenerateIds(MAP_SIZE)) {}
+        void Setup(int) {}
+        void Run(uint64_t iterations, int) {
+            for (uint64_t i = 0 ; i < iterations ; i++)
+                Benchmark::DoNotOptimize(hasher(ids[i % MAP_SIZE]));
+        }
+        void Teardown() {}
+    };
+    ////////////// UuidHashFixture ////////////
+
+    /************* AssignFixture ***********/
+    template<typename T>
+    class AssignFixture {                               // Copy assignment, done by CriticalRecyclableList::create each time an element is recycled
+    private:
+        CriticalRecyclableList<T>                       list;
+        std::vector<std::pair<T*, T*>>                  pairs;
+        std::function<T*(CriticalRecyclableList<T>&)>   create;
+    public:
+        explicit AssignFixture(std::function<T*(CriticalRecyclableList<T>&)> c) : create(std::move(c)) {}
+
+        void Setup(int threads) {
+            for (int i = 0 ; i < threads ; i++)
+                pairs.emplace_back(create(list), create(list));
+        }
+        void Run(uint64_t iterations, int index) {
+            T *dst = pairs[index].first, *src = pairs[index].second;
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                *dst = *src;
+                Benchmark::DoNotOptimize(dst);
+            }
+        }
+        void Teardown() {
+            for (auto &p : pairs) {
+                ListElt<T>::Delete(p.first);
+                ListElt<T>::Delete(p.second);
+            }
+            pairs.clear();
+        }
+    };
+    ////////////// AssignFixture ////////////
+
+    /************* DelimiterScannerFixture ***********/
+    class DelimiterScannerFixture {                     // Boundaries of one 4KiB read of delimited messages, as searched by MessageFramer
+    private:
+        static const size_t         READ_SIZE       = 4096;
+        std::string                 data;
+        std::string                 delimiter;
+        DelimiterScanner::Level     level;
+        bool                        bytewise;           // Naive byte by byte loop, the reference the vectorized versions are compared with
+        DelimiterScanner::Level     previous;
+    public:
+        DelimiterScannerFixture(const std::string &d, size_t averageSize, DelimiterScanner::Level l, bool b = false)
+                : delimiter(d), level(l), bytewise(b) {
+            std::mt19937 random(42);
+            std::uniform_int_distribution<size_t> sizes(averageSize / 2, averageSize + averageSize / 2);
+            while (data.size() < READ_SIZE) {
+                data.append(sizes(random), 'a');
+                data.append(delimiter);
+            }
+            data.resize(READ_SIZE);
+        }
+        void Setup(int) {
+            previous = DelimiterScanner::GetLevel();
+            DelimiterScanner::SetLevel(level);
+        }
+        void Run(uint64_t iterations, int) {
+            std::vector<u_long> positions;
+            positions.reserve(READ_SIZE);
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                positions.clear();
+                if (bytewise) {
+                    for (size_t pos = 0 ; pos + delimiter.size() <= data.size() ; pos++) {
+                        if (memcmp(data.data() + pos, delimiter.data(), delimiter.size()) == 0) {
+                            positions.push_back(static_cast<u_long>(pos));
+                            pos += delimiter.size() - 1;
+                        }
+                    }
+                } else
+                    DelimiterScanner::FindAll(data.data(), data.size(), delimiter.data(), delimiter.size(), positions);
+                Benchmark::DoNotOptimize(positions.data());
+            }
+        }
+        void Teardown() { DelimiterScanner::SetLevel(previous); }
+    };
+    ////////////// DelimiterScannerFixture ////////////
+
+    /************* WebSocketMaskFixture ***********/
+    class WebSocketMaskFixture {                        // Unmasking of one 4KiB read of client frames, in place, as done by WebSocketParser
+    private:
+        static const size_t         READ_SIZE       = 4096;
+        std::vector<char>           data;
+        DelimiterScanner::Level     level;
+        DelimiterScanner::Level     previous;
+    public:
+        explicit WebSocketMaskFixture(DelimiterScanner::Level l) : data(READ_SIZE, 'a'), level(l) {}
+        void Setup(int) {
+            previous = WebSocketParser::GetLevel();
+            WebSocketParser::SetLevel(level);
+        }
+        void Run(uint64_t iterations, int) {
+            const u_char key[4] = {0x12, 0x34, 0x56, 0x78};
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                WebSocketParser::Mask(data.data() + 1, READ_SIZE - 1, key, i);   // payloads start anywhere in a read
+                Benchmark::DoNotOptimize(data.data());
+            }
+        }
+        void Teardown() { WebSocketParser::SetLevel(previous); }
+    };
+    ////////////// WebSocketMaskFixture ////////////
+
+    /************* NumaPoolFixture ***********/
+    class NumaPoolFixture {                             // Random reads of buffer sized elements of a pool placed on node 0, by threads pinned on the same node or on another one
+    private:
+        static const size_t             BLOCK_SIZE      = 4096;             // Like a Buffer
+        static const size_t             BLOCK_COUNT     = 16384;            // 64MB, far above any last level cache
+        struct Block {
+            char                        data[BLOCK_SIZE];
+        };
+        typedef CriticalRecyclableList<Block>   Pool;
+
+        std::unique_ptr<Pool>           pool;
+        std::vector<Block*>             blocks;
+        DWORD                           poolNode;
+        DWORD                           readerNode;
+    public:
+        NumaPoolFixture(DWORD pn, DWORD rn) : poolNode(pn), readerNode(rn) {}
+
+        void Setup(int) {
+            pool.reset(new Pool(Pool::DEFAULT_MAX_RECYCLED_SIZE, poolNode));
+            for (size_t i = 0 ; i < BLOCK_COUNT ; i++) {
+                Block &block = *pool->create();
+                memset(block.data, static_cast<int>(i), BLOCK_SIZE);        // commit the pages
+                blocks.push_back(&block);
+            }
+        }
+        void Run(uint64_t iterations, int index) {
+            Numa::PinThread(GetCurrentThread(), readerNode, index);
+            uint64_t sum = 0;
+            uint64_t at = static_cast<uint64_t>(index) * 7919;
+            for (uint64_t i = 0 ; i < iterations ; i++) {
+                at = at * 6364136223846793005ull + 1442695040888963407ull;  // random block and cache line, defeats the prefetcher
+                sum += static_cast<unsigned char>(blocks[(at >> 33) % BLOCK_COUNT]->data[((at >> 20) % (BLOCK_SIZE / 64)) * 64]);
+            }
+            Benchmark::DoNotOptimize(sum);
+            Numa::PinThread(GetCurrentThread(), Numa::ANY_NODE, -1);
+        }
+        void Teardown() {
+            blocks.clear();
+            pool.reset();
+        }
+    };
+    ////////////// NumaPoolFixture ////////////
+
+    Buffer *CreateBuffer(CriticalRecyclableList<Buffer> &l) { return Buffer::Create(l); }
+    Socket *CreateSocket(CriticalRecyclableList<Socket> &l) { return Socket::Create(l, static_cast<SocketManager*>(nullptr), static_cast<SOCKET>(INVALID_SOCKET), AF_INET); }
+
+}
+
+int main(int argc, char *argv[]) {
+    Benchmark::MicroRunner runner;
+
+    runner.Add("CriticalRecyclableList/create_erase",   CONTENTION,     new RecyclableListFixture());
+    runner.Add("ListElt<Buffer>/Create_Delete",         CONTENTION,     new ListEltFixture<Buffer>(CreateBuffer));
+    runner.Add("ListElt<Socket>/Create_Delete",         CONTENTION,     new ListEltFixture<Socket>(CreateSocket));
+    runner.Add("CriticalMap<UUID,Socket*>/Get_hit",     CONTENTION,     new CriticalMapFixture(true));
+    runner.Add("CriticalMap<UUID,Socket*>/Get_miss",    CONTENTION,     new CriticalMapFixture(false));
+    runner.Add("std::hash<UUID>",                       SINGLE_THREAD,  new UuidHashFixture());
+    runner.Add("Buffer/operator=",                      SINGLE_THREAD,  new AssignFixture<Buffer>(CreateBuffer));
+    runner.Add("Socket/operator=",                      SINGLE_THREAD,  new AssignFixture<Socket>(CreateSocket));
+
+    const DelimiterScanner::Level best = DelimiterScanner::GetLevel();
+    const std::pair<const char*, size_t> messageSizes[] = {{"16B", 16}, {"128B", 128}, {"1KiB", 1024}};
+    for (auto &size : messageSizes) {
+        runner.Add(std::string("DelimiterScanner/bytewise/LF/") + size.first, SINGLE_THREAD,
+                   new DelimiterScannerFixture("\n", size.second, DelimiterScanner::SCALAR, true));
+        for (int l = DelimiterScanner::SCALAR ; l <= best ; l++) {
+            auto level = static_cast<DelimiterScanner::Level>(l);
+            runner.Add(std::string("DelimiterScanner/") + DelimiterScanner::LevelName(level) + "/LF/" + size.first, SINGLE_THREAD,
+                       new DelimiterScannerFixture("\n", size.second, level));
+            runner.Add(std::string("DelimiterScanner/") + DelimiterScanner::LevelName(level) + "/CRLF/" + size.first, SINGLE_THREAD,
+                       new DelimiterScannerFixture("\r\n", size.second, level));
+        }
+    }
+
+    for (int l = DelimiterScanner::SCALAR ; l <= WebSocketParser::GetLevel() ; l++) {
+        auto level = static_cast<DelimiterScanner::Level>(l);
+        runner.Add(std::string("WebSocketParser/Mask/") + DelimiterScanner::LevelName(level) + "/4KiB", SINGLE_THREAD, new WebSocketMaskFixture(level));
+    }
+
+    runner.Add("NumaPool/read/local_node",              CONTENTION,     new NumaPoolFixture(0, 0));
+    if (Numa::NodeCount() > 1)
+        runner.Add("NumaPool/read/remote_node",         CONTENTION,     new NumaPoolFixture(0, 1));
+
+    return runner.Main(argc, argv);
+}
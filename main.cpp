@@ -35,17 +35,7 @@ int pingpongStressTest(){
             return 1;
     } else
         return 1;
-    if(clientManager.isReady()) {
-        for(int i = 0 ; i < N ; i++) {
-            socketId[i] = clientManager.ConnectToNewSocket(address, port);
-            if (UuidIsNil(socketId+i, &status)) {
-                return 1;
-            }
-        }
-    } else
-        return 1;
-
-    for (;;) {
+    for (;;) { // wait for the listen socket before connecting to it
         if (!serverManager.isServerSocketReady(serverSocketId)) {
             if (serverManager.isSocketInitialising(serverSocketId))
                 Sleep(100);
@@ -55,6 +45,15 @@ int pingpongStressTest(){
             break;
         }
     }
+    if(clientManager.isReady()) {
+        for(int i = 0 ; i < N ; i++) {
+            socketId[i] = clientManager.ConnectToNewSocket(address, port);
+            if (UuidIsNil(socketId+i, &status)) {
+                return 1;
+            }
+        }
+    } else
+        return 1;
 
     for (int i = 0 ; N2 == 0 || i < N2 ; i++) {
         int n = serverManager.SendDataToAll("ping\n", 5);
@@ -5,6 +5,24 @@
 #include <mswsock.h>
 #include <windows.h>
 #include <conio.h>
+#include <mstcpip.h>
+#include <windns.h>
+#include <wincrypt.h>
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+#include <compressapi.h>
+
+#if defined(__has_include) && __has_include(<afunix.h>)
+#include <afunix.h>
+#else //because older mingw64 has no afunix.h
+#define UNIX_PATH_MAX 108
+
+typedef struct sockaddr_un {
+    ADDRESS_FAMILY  sun_family;
+    char            sun_path[UNIX_PATH_MAX];
+} SOCKADDR_UN, *PSOCKADDR_UN;
+#endif //afunix.h
 
 #ifndef SO_REUSE_UNICASTPORT //because ws2def.h of mingw64 is incomplete
 #define SO_REUSE_UNICASTPORT 0x3007
@@ -14,6 +32,7 @@
 #include <ws2tcpip.h>
 #else //HAVE_DECL_IDEAL_SEND_BACKLOG_IOCTLS
 #include <ws2ipdef.h>
+#include <ws2tcpip.h>
 
 #define SIO_IDEAL_SEND_BACKLOG_QUERY   _IOR('t', 123, ULONG)
 #define SIO_IDEAL_SEND_BACKLOG_CHANGE   _IO('t', 122)
@@ -54,4 +73,55 @@ idealsendbacklognotify(
 
 #endif //HAVE_DECL_IDEAL_SEND_BACKLOG_IOCTLS
 
+#ifndef UDP_SEND_MSG_SIZE //because ws2ipdef.h of mingw64 is incomplete
+#define UDP_SEND_MSG_SIZE           2
+#define UDP_RECV_MAX_COALESCED_SIZE 3
+#define UDP_COALESCED_INFO          3
+#endif //UDP_SEND_MSG_SIZE
+
+#ifndef SIO_UDP_CONNRESET //because mstcpip.h of older mingw64 is incomplete
+#define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR, 12)
+#endif //SIO_UDP_CONNRESET
+
+#ifndef SIO_TCP_INFO //because mstcpip.h of older mingw64 is incomplete
+#define SIO_TCP_INFO _WSAIORW(IOC_VENDOR, 39)
+
+typedef enum {
+    TCPSTATE_CLOSED,
+    TCPSTATE_LISTEN,
+    TCPSTATE_SYN_SENT,
+    TCPSTATE_SYN_RCVD,
+    TCPSTATE_ESTABLISHED,
+    TCPSTATE_FIN_WAIT_1,
+    TCPSTATE_FIN_WAIT_2,
+    TCPSTATE_CLOSE_WAIT,
+    TCPSTATE_CLOSING,
+    TCPSTATE_LAST_ACK,
+    TCPSTATE_TIME_WAIT,
+    TCPSTATE_MAX
+} TCPSTATE;
+
+typedef struct _TCP_INFO_v0 {
+    TCPSTATE    State;
+    ULONG       Mss;
+    ULONG64     ConnectionTimeMs;
+    BOOLEAN     TimestampsEnabled;
+    ULONG       RttUs;
+    ULONG       MinRttUs;
+    ULONG       BytesInFlight;
+    ULONG       Cwnd;
+    ULONG       SndWnd;
+    ULONG       RcvWnd;
+    ULONG       RcvBuf;
+    ULONG64     BytesOut;
+    ULONG64     BytesIn;
+    ULONG       BytesReordered;
+    ULONG       BytesRetrans;
+    ULONG       FastRetrans;
+    ULONG       DupAcksIn;
+    ULONG       TimeoutEpisodes;
+    UCHAR       SynRetrans;
+} TCP_INFO_v0, *PTCP_INFO_v0;
+#endif //SIO_TCP_INFO
+
 #endif //SOCKETMANAGER_SOCKET_HEADERS_H
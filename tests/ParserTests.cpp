@@ -0,0 +1,387 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MessageFramer.h"
+#include "HttpParser.h"
+#include "WebSocketParser.h"
+#include "RpcFrame.h"
+#include "DelimiterScanner.h"
+
+/*
+ * Unit tests of the parsers that don't need a socket : message framing, HTTP/1.1 requests, WebSocket frames, RPC headers and the delimiter scanner.
+ *
+ * Usage : SocketManagerTests
+ * Every failed check is printed with its line, the process returns 1 if there was any (run by ctest).
+ */
+
+namespace {
+
+    int failures = 0;
+
+#define CHECK(condition) do { if (!(condition)) { fprintf(stderr, "%s:%d : %s failed\n", __FILE__, __LINE__, #condition); failures++; } } while (false)
+
+    /************* MessageFramer ***********/
+    struct FramedReads {                                // Messages a framer delivers from a list of reads, as the socket would feed them
+        std::vector<std::string>    messages;
+        bool                        valid       = true;
+    };
+
+    FramedReads Frame(const MessageFramer::Options &options, const std::vector<std::string> &reads) {
+        MessageFramer   framer;
+        FramedReads     result;
+
+        framer.Configure(options);
+        for (const std::string &read : reads) {
+            const char *data = read.data();
+            auto length = static_cast<u_long>(read.size());
+            if (!framer.Feed(data, length, [&](const char *message, u_long messageLength) {
+                    result.messages.emplace_back(message, messageLength);
+                    return true;
+                })) {
+                result.valid = false;
+                break;
+            }
+        }
+        return result;
+    }
+
+    std::vector<std::string> Bytewise(const std::string &stream) {      // One read per byte, every header and delimiter straddles reads
+        std::vector<std::string> reads;
+        for (char c : stream)
+            reads.emplace_back(1, c);
+        return reads;
+    }
+
+    std::string Prefixed(const MessageFramer::Options &options, const std::string &message) {
+        MessageFramer   framer;
+        char            header[MessageFramer::MAX_HEADER_SIZE];
+
+        framer.Configure(options);
+        u_long size = framer.EncodeHeader(static_cast<u_long>(message.size()), header);
+        return std::string(header, size) + message;
+    }
+
+    void TestVarintPrefix() {
+        MessageFramer::Options  options     = MessageFramer::VarintPrefixed();
+        std::string             big(300, 'x');
+        std::string             stream      = Prefixed(options, "a") + Prefixed(options, big) + Prefixed(options, "");
+
+        CHECK(Prefixed(options, big).compare(0, 2, "\xAC\x02") == 0);           // 300 on two bytes, low 7 bits first
+        FramedReads whole = Frame(options, {stream});
+        CHECK(whole.valid && whole.messages.size() == 3);
+        CHECK(whole.messages.size() == 3 && whole.messages[0] == "a" && whole.messages[1] == big && whole.messages[2].empty());
+        FramedReads split = Frame(options, Bytewise(stream));
+        CHECK(split.valid && split.messages == whole.messages);
+    }
+
+    void TestVarintOverflow() {
+        MessageFramer::Options options = MessageFramer::VarintPrefixed();
+
+        CHECK(!Frame(options, {std::string("\x80\x80\x80\x80\x80\x01", 6)}).valid);        // a sixth byte
+        CHECK(!Frame(options, {std::string("\xFF\xFF\xFF\xFF\x7F", 5)}).valid);            // more than 32 bits in the fifth one
+        CHECK(!Frame(options, Bytewise(std::string("\x80\x80\x80\x80\x80", 5))).valid);    // caught before the end of the header
+        CHECK(!Frame(MessageFramer::VarintPrefixed(100), {std::string("\x65", 1)}).valid); // 101 over maxMessageSize
+        CHECK(Frame(MessageFramer::VarintPrefixed(100), {std::string("\x64", 1) + std::string(100, 'x')}).messages.size() == 1);
+    }
+
+    void TestFixedPrefix() {
+        MessageFramer::Options  options     = MessageFramer::LengthPrefixed(2);
+        std::string             stream      = Prefixed(options, "hello") + Prefixed(options, "world");
+
+        CHECK(stream.compare(0, 2, std::string("\x00\x05", 2)) == 0);           // big endian
+        FramedReads split = Frame(options, {stream.substr(0, 1), stream.substr(1, 5), stream.substr(6)});
+        CHECK(split.valid && split.messages == std::vector<std::string>({"hello", "world"}));
+        CHECK(!Frame(MessageFramer::LengthPrefixed(2, 4), {stream}).valid);
+    }
+
+    void TestDelimiter() {
+        MessageFramer::Options  options     = MessageFramer::Delimited("\r\n", 2);
+        std::vector<std::string> expected   = {"abc", "", "def"};
+
+        FramedReads straddling = Frame(options, {"abc\r", "\n\r\nd", "ef\r", "\n"});    // CR and LF in different reads
+        CHECK(straddling.valid && straddling.messages == expected);
+        FramedReads bytewise = Frame(options, Bytewise("abc\r\n\r\ndef\r\n"));
+        CHECK(bytewise.valid && bytewise.messages == expected);
+        FramedReads lone = Frame(options, {"a\rb\r", "c\r\n"});                      // CR not followed by LF is data
+        CHECK(lone.valid && lone.messages == std::vector<std::string>({"a\rb\rc"}));
+        CHECK(!Frame(MessageFramer::Delimited("\r\n", 2, 4), {"abcde\r\n"}).valid);
+        CHECK(!Frame(MessageFramer::Delimited("\r\n", 2, 4), {"abc", "defg"}).valid); // too big before the delimiter is even seen
+    }
+
+    void TestStop() {
+        MessageFramer   framer;
+        std::string     read        = "one\ntwo\nthree\n";
+        const char     *data        = read.data();
+        auto            length      = static_cast<u_long>(read.size());
+        int             delivered   = 0;
+
+        framer.Configure(MessageFramer::Delimited("\n", 1));
+        CHECK(framer.Feed(data, length, [&](const char *message, u_long messageLength) { return ++delivered < 2; }));
+        CHECK(delivered == 2 && std::string(data, length) == "three\n");         // left on the first unread byte
+    }
+    ////////////// MessageFramer ////////////
+
+    /************* HttpParser ***********/
+    struct ParsedRequest {                              // Copy of a request, its views die with the callback
+        std::string                 method;
+        std::string                 target;
+        std::string                 body;
+        bool                        keepAlive;
+    };
+
+    struct ParsedReads {
+        std::vector<ParsedRequest>  requests;
+        bool                        valid       = true;
+        u_short                     error       = 0;
+    };
+
+    ParsedReads Parse(const std::vector<std::string> &reads, const HttpParser::Limits &limits = HttpParser::Limits()) {
+        HttpParser  parser(limits);
+        ParsedReads result;
+
+        for (const std::string &read : reads) {
+            const char *data = read.data();
+            auto length = static_cast<u_long>(read.size());
+            if (!parser.Feed(data, length, [&](const HttpRequest &request) {
+                    result.requests.push_back({std::string(request.method), std::string(request.target), std::string(request.body), request.keepAlive});
+                    return true;
+                })) {
+                result.valid = false;
+                result.error = parser.GetError();
+                break;
+            }
+        }
+        return result;
+    }
+
+    u_short ErrorOf(const std::string &stream, const HttpParser::Limits &limits = HttpParser::Limits()) {
+        ParsedReads parsed = Parse({stream}, limits);
+        return parsed.valid ? 0 : parsed.error;
+    }
+
+    void TestHttpPipelined() {
+        std::string stream = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+                             "POST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+                             "GET /c HTTP/1.0\r\n\r\n";
+
+        ParsedReads whole = Parse({stream});
+        CHECK(whole.valid && whole.requests.size() == 3);
+        if (whole.requests.size() == 3) {
+            CHECK(whole.requests[0].method == "GET" && whole.requests[0].target == "/a" && whole.requests[0].keepAlive);
+            CHECK(whole.requests[1].method == "POST" && whole.requests[1].body == "hello");
+            CHECK(!whole.requests[2].keepAlive);                                // HTTP/1.0 without keep-alive
+        }
+        for (size_t cut = 1 ; cut < stream.size() ; cut++) {                    // every split point of the stream in two reads
+            ParsedReads split = Parse({stream.substr(0, cut), stream.substr(cut)});
+            CHECK(split.valid && split.requests.size() == 3);
+            if (split.requests.size() == 3)
+                CHECK(split.requests[1].body == "hello" && split.requests[2].target == "/c");
+        }
+        ParsedReads bytewise = Parse(Bytewise(stream));
+        CHECK(bytewise.valid && bytewise.requests.size() == 3);
+        CHECK(Parse({"GET / HTTP/1.1\r\nConnection: close\r\n\r\n"}).requests.at(0).keepAlive == false);
+    }
+
+    void TestHttpHeaderLimits() {
+        HttpParser::Limits  limits;
+        std::string         many        = "GET / HTTP/1.1\r\n";
+
+        limits.maxHeaderSize = 64;
+        CHECK(ErrorOf("GET / HTTP/1.1\r\nX: " + std::string(64, 'a') + "\r\n\r\n", limits) == 431);
+        ParsedReads straddling = Parse({"GET / HTTP/1.1\r\nX: ", std::string(64, 'a'), "\r\n\r\n"}, limits);   // caught in the spill, before the end of the head
+        CHECK(!straddling.valid && straddling.error == 431);
+        CHECK(ErrorOf("GET / HTTP/1.1\r\nX: a\r\n\r\n", limits) == 0);
+        for (u_long i = 0 ; i <= HttpRequest::MAX_HEADERS ; i++)
+            many += "X-" + std::to_string(i) + ": v\r\n";
+        CHECK(ErrorOf(many + "\r\n") == 431);
+        limits = HttpParser::Limits();
+        limits.maxBodySize = 4;
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", limits) == 413);
+    }
+
+    void TestHttpSmuggling() {
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n") == 501);
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\nhello") == 501);
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!") == 400);
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\nhello") == 0);  // same value repeated
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length: +5\r\n\r\nhello") == 400);
+        CHECK(ErrorOf("POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\nhello") == 400);        // whitespace before the colon
+        CHECK(ErrorOf("GET / HTTP/1.1\r\nX: a\r\n b\r\n\r\n") == 400);                      // obsolete line folding
+        CHECK(ErrorOf("GET  / HTTP/1.1\r\n\r\n") == 400);
+        CHECK(ErrorOf("GET / HTTP/2.0\r\n\r\n") == 505);
+    }
+    ////////////// HttpParser ////////////
+
+    /************* WebSocketParser ***********/
+    const u_char KEY[4] = {0x12, 0x34, 0x56, 0x78};
+
+    std::string ClientFrame(WebSocketParser::Opcode opcode, bool fin, const std::string &payload, bool masked = true) {
+        char header[WebSocketParser::MAX_HEADER_SIZE];
+        std::string body = payload;
+
+        u_long size = WebSocketParser::EncodeHeader(opcode, fin, body.size(), header, masked ? KEY : nullptr);
+        if (masked)
+            WebSocketParser::Mask(&body[0], body.size(), KEY);
+        return std::string(header, size) + body;
+    }
+
+    struct WsMessage {
+        WebSocketParser::Opcode     opcode;
+        std::string                 payload;
+
+        bool operator==(const WsMessage &other) const { return opcode == other.opcode && payload == other.payload; }
+    };
+
+    struct WsReads {
+        std::vector<WsMessage>      messages;
+        bool                        valid       = true;
+        u_short                     error       = 0;
+    };
+
+    WsReads ParseFrames(std::vector<std::string> reads, const WebSocketParser::Limits &limits = WebSocketParser::Limits()) {
+        WebSocketParser parser(limits);
+        WsReads         result;
+
+        for (std::string &read : reads) {                // unmasked in place
+            char *data = &read[0];
+            auto length = static_cast<u_long>(read.size());
+            if (!parser.Feed(data, length, [&](WebSocketParser::Opcode opcode, const char *payload, u_long payloadLength) {
+                    result.messages.push_back({opcode, std::string(payload, payloadLength)});
+                    return true;
+                })) {
+                result.valid = false;
+                result.error = parser.GetError();
+                break;
+            }
+        }
+        return result;
+    }
+
+    void TestWebSocketMasked() {
+        std::string             big(70000, 'b');        // 8 bytes extended length
+        std::string             medium(300, 'm');       // 2 bytes extended length
+        std::string             stream  = ClientFrame(WebSocketParser::TEXT, true, "hello") + ClientFrame(WebSocketParser::BINARY, true, medium) +
+                                          ClientFrame(WebSocketParser::BINARY, true, big);
+        std::vector<WsMessage>  expected = {{WebSocketParser::TEXT, "hello"}, {WebSocketParser::BINARY, medium}, {WebSocketParser::BINARY, big}};
+
+        WsReads whole = ParseFrames({stream});
+        CHECK(whole.valid && whole.messages == expected);
+        WsReads split = ParseFrames({stream.substr(0, 1), stream.substr(1, 8), stream.substr(9, 400), stream.substr(409)});
+        CHECK(split.valid && split.messages == expected);
+        WsReads unmasked = ParseFrames({ClientFrame(WebSocketParser::TEXT, true, "hello", false)});
+        CHECK(!unmasked.valid && unmasked.error == 1002);      // clients must mask
+    }
+
+    void TestWebSocketFragmented() {
+        std::string stream = ClientFrame(WebSocketParser::TEXT, false, "Hel") + ClientFrame(WebSocketParser::PING, true, "p") +
+                             ClientFrame(WebSocketParser::CONTINUATION, false, "lo ") + ClientFrame(WebSocketParser::CONTINUATION, true, "world");
+        std::vector<WsMessage> expected = {{WebSocketParser::PING, "p"}, {WebSocketParser::TEXT, "Hello world"}};   // control frame delivered between fragments
+
+        WsReads whole = ParseFrames({stream});
+        CHECK(whole.valid && whole.messages == expected);
+        WsReads bytewise = ParseFrames(Bytewise(stream));
+        CHECK(bytewise.valid && bytewise.messages == expected);
+    }
+
+    void TestWebSocketErrors() {
+        WebSocketParser::Limits limits;
+
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::CONTINUATION, true, "x")}).error == 1002);                // nothing to continue
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::TEXT, false, "a") + ClientFrame(WebSocketParser::TEXT, true, "b")}).error == 1002);
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::PING, false, "x")}).error == 1002);                       // fragmented control frame
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::PING, true, std::string(126, 'x'))}).error == 1002);
+        CHECK(ParseFrames({ClientFrame(static_cast<WebSocketParser::Opcode>(0x3), true, "x")}).error == 1002);   // reserved opcode
+        limits.maxMessageSize = 8;
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::BINARY, true, std::string(9, 'x'))}, limits).error == 1009);
+        CHECK(ParseFrames({ClientFrame(WebSocketParser::TEXT, false, "1234") + ClientFrame(WebSocketParser::CONTINUATION, true, "56789")}, limits).error == 1009);
+    }
+    ////////////// WebSocketParser ////////////
+
+    /************* RpcFrame ***********/
+    void TestRpcFrame() {
+        RpcFrame::Header    header      = {RpcFrame::RESPONSE, RpcFrame::FAILED, 0xBEEF, 0x0102030405060708ULL};
+        RpcFrame::Header    decoded     = {};
+        char                encoded[RpcFrame::HEADER_SIZE];
+        std::string         payload     = "payload";
+
+        RpcFrame::Encode(header, static_cast<u_long>(payload.size()), encoded);
+        FramedReads framed = Frame(RpcFrame::Framing(), Bytewise(std::string(encoded, RpcFrame::HEADER_SIZE) + payload));
+        CHECK(framed.valid && framed.messages.size() == 1);
+        if (framed.messages.size() == 1) {
+            const std::string &message = framed.messages[0];
+            CHECK(RpcFrame::Decode(message.data(), static_cast<u_long>(message.size()), decoded));
+            CHECK(decoded.kind == header.kind && decoded.status == header.status && decoded.method == header.method && decoded.id == header.id);
+            CHECK(message.substr(RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE) == payload);
+        }
+        CHECK(!RpcFrame::Decode(encoded + RpcFrame::PREFIX_SIZE, RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE - 1, decoded));   // too short
+        encoded[RpcFrame::PREFIX_SIZE] = 2;
+        CHECK(!RpcFrame::Decode(encoded + RpcFrame::PREFIX_SIZE, RpcFrame::HEADER_SIZE - RpcFrame::PREFIX_SIZE, decoded));       // unknown kind
+    }
+    ////////////// RpcFrame ////////////
+
+    /************* DelimiterScanner ***********/
+    std::vector<u_long> Occurrences(const std::string &data, const std::string &delimiter) {     // Reference : non overlapping occurrences, one byte at a time
+        std::vector<u_long> positions;
+        for (size_t i = 0 ; i + delimiter.size() <= data.size() ; ) {
+            if (data.compare(i, delimiter.size(), delimiter) == 0) {
+                positions.push_back(static_cast<u_long>(i));
+                i += delimiter.size();
+            } else
+                i++;
+        }
+        return positions;
+    }
+
+    void TestDelimiterScanner() {
+        const DelimiterScanner::Level   best        = DelimiterScanner::GetLevel();
+        const std::string               delimiters[] = {"\n", "\r\n", "aa", "--boundary"};
+        std::string                     data;
+
+        for (size_t i = 0 ; i < 200 ; i++)                          // delimiters on and across every 16 and 32 bytes block boundary
+            data += (i % 7 == 0) ? "\r\n" : (i % 5 == 0) ? "aaa" : (i % 11 == 0) ? "--boundary" : "x";
+        for (int l = DelimiterScanner::SCALAR ; l <= best ; l++) {
+            auto level = static_cast<DelimiterScanner::Level>(l);
+            CHECK(DelimiterScanner::SetLevel(level));
+            for (const std::string &delimiter : delimiters) {
+                for (size_t start = 0 ; start < 33 ; start++) {
+                    std::vector<u_long> positions;
+                    std::string slice = data.substr(start);
+                    DelimiterScanner::FindAll(slice.data(), slice.size(), delimiter.data(), delimiter.size(), positions);
+                    CHECK(positions == Occurrences(slice, delimiter));
+                }
+            }
+            std::vector<u_long> overlapping;
+            DelimiterScanner::FindAll("aaaa", 4, "aa", 2, overlapping);
+            CHECK(overlapping == std::vector<u_long>({0, 2}));
+        }
+        DelimiterScanner::SetLevel(best);
+    }
+    ////////////// DelimiterScanner ////////////
+
+#undef CHECK
+
+}
+
+int main() {
+    TestVarintPrefix();
+    TestVarintOverflow();
+    TestFixedPrefix();
+    TestDelimiter();
+    TestStop();
+    TestHttpPipelined();
+    TestHttpHeaderLimits();
+    TestHttpSmuggling();
+    TestWebSocketMasked();
+    TestWebSocketFragmented();
+    TestWebSocketErrors();
+    TestRpcFrame();
+    TestDelimiterScanner();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}